@@ -0,0 +1,149 @@
+// Disassembler for MCS-48 ROM images. Writes a listing that asm assembles
+// back into the same bytes, and checks that it does. The work is done by
+// simulator/mcs48_disasm.c.
+//
+// Usage: disasm [rom.bin [out.asm]] [-e addr]...
+//
+// Code is found by following it from the reset and interrupt vectors. Each
+// -e adds an entry point, as a number like 0x800 or $800, for code that is
+// only reached in ways that can't be followed. Everything else is listed as
+// .db.
+//
+// The round trip check assembles the listing in memory and compares the
+// result with the ROM. It is timed over many runs, each from scratch.
+
+#if _MSC_VER
+#pragma warning(disable: 4996)
+#endif
+
+#include "mcs48_asm.h"
+#include "mcs48_disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+enum { MAX_ENTRY_POINTS = 64, NUM_TIMING_RUNS = 200 };
+
+static unsigned s_entry_points[MAX_ENTRY_POINTS];
+static unsigned s_num_entry_points;
+
+static mcs48_disasm_t s_disasm;
+static mcs48_asm_t s_asm;
+
+
+static bool parse_addr(char const *s, unsigned *addr) {
+    char *end;
+    unsigned long val = (s[0] == '$') ? strtoul(s + 1, &end, 16) : strtoul(s, &end, 0);
+    if (end == s || *end || val >= MCS48_DISASM_IMAGE_SIZE)
+        return false;
+    *addr = (unsigned)val;
+    return true;
+}
+
+static void disassemble(u8 const *rom, unsigned rom_size) {
+    mcs48_disasm_init(&s_disasm, rom, rom_size);
+    mcs48_disasm_trace_vectors(&s_disasm);
+    for (unsigned i = 0; i < s_num_entry_points; i++)
+        mcs48_disasm_trace(&s_disasm, s_entry_points[i], false);
+}
+
+// Disassembles the ROM, reassembles the listing and compares. Returns the
+// address of the first byte that differs, or -1 if none do.
+static int round_trip(u8 const *rom, unsigned rom_size, char *listing, size_t listing_size) {
+    disassemble(rom, rom_size);
+    size_t len = mcs48_disasm_listing(&s_disasm, listing, listing_size);
+
+    mcs48_asm_init(&s_asm);
+    bool ok = mcs48_asm_assemble(&s_asm, listing, len);
+    int first_diff = -1;
+    for (unsigned i = 0; i < MCS48_DISASM_IMAGE_SIZE && first_diff < 0; i++) {
+        if (!ok || s_asm.image[i] != s_disasm.rom[i])
+            first_diff = i;
+    }
+    mcs48_asm_free(&s_asm);
+    return first_diff;
+}
+
+
+int main(int argc, char *argv[]) {
+    char const *rom_path = "rom.bin";
+    char const *out_path = "out.asm";
+    unsigned num_paths = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0) {
+            unsigned addr;
+            if (i + 1 >= argc || !parse_addr(argv[i + 1], &addr)) {
+                printf("-e needs an address below 0x1000\n");
+                return 1;
+            }
+            if (s_num_entry_points < MAX_ENTRY_POINTS)
+                s_entry_points[s_num_entry_points++] = addr;
+            i++;
+        }
+        else if (num_paths == 0) {
+            rom_path = argv[i];
+            num_paths++;
+        }
+        else if (num_paths == 1) {
+            out_path = argv[i];
+            num_paths++;
+        }
+    }
+
+    FILE *rom_file = fopen(rom_path, "rb");
+    if (!rom_file) {
+        printf("Couldn't open input file\n");
+        return 1;
+    }
+    static u8 rom[MCS48_DISASM_IMAGE_SIZE];
+    unsigned rom_size = (unsigned)fread(rom, 1, sizeof(rom), rom_file);
+    fclose(rom_file);
+
+    disassemble(rom, rom_size);
+    size_t listing_size = mcs48_disasm_listing(&s_disasm, NULL, 0) + 1;
+    char *listing = (char *)malloc(listing_size);
+    mcs48_disasm_listing(&s_disasm, listing, listing_size);
+
+    unsigned num_code_bytes = 0;
+    for (unsigned i = 0; i < MCS48_DISASM_IMAGE_SIZE; i++)
+        num_code_bytes += (s_disasm.flags[i] & MCS48_DISASM_CODE) ? 1 : 0;
+    unsigned num_tables_found = 0;
+    for (unsigned i = 0; i < s_disasm.num_tables; i++) {
+        mcs48_jump_table_t const *table = &s_disasm.tables[i];
+        if (table->num_entries)
+            num_tables_found++;
+        else
+            printf("Couldn't find the table of the jmpp @a at $%04X\n", table->jmpp_addr);
+    }
+    printf("Found %u instructions, %u bytes of code and %u of %u jump tables\n",
+        s_disasm.num_insns, num_code_bytes, num_tables_found, s_disasm.num_tables);
+    if (s_disasm.num_illegal)
+        printf("%u traces ran into unused opcodes\n", s_disasm.num_illegal);
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        printf("Couldn't open output file\n");
+        return 1;
+    }
+    fprintf(out, "// Disassembled from %s\n\n", rom_path);
+    fwrite(listing, 1, listing_size - 1, out);
+    fclose(out);
+
+    // The listing is made again in each run, into the same buffer
+    clock_t start = clock();
+    int first_diff = -1;
+    for (int i = 0; i < NUM_TIMING_RUNS; i++)
+        first_diff = round_trip(rom, rom_size, listing, listing_size);
+    double ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC / NUM_TIMING_RUNS;
+
+    free(listing);
+    if (first_diff >= 0) {
+        printf("Round trip failed. The listing reassembles differently at $%04X.\n", first_diff);
+        return 1;
+    }
+    printf("Round trip OK in %.3f ms\n", ms);
+    return 0;
+}
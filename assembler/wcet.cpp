@@ -0,0 +1,247 @@
+// Worst case execution time analyser for MCS-48 ROM images. Builds the
+// control flow graph of the code that the disassembler finds, weighs each
+// basic block with the cycles that cpu.c burns for it, and works out how
+// long the timer interrupt, the external interrupt and the code from reset
+// can take. The work is done by simulator/mcs48_cfg.c.
+//
+// Usage: wcet [rom.bin [out.txt]] [-e addr]... [-j from=to]... [-b addr=count]...
+//             [-t reload]
+//
+// -e adds an entry point, as for disasm. -j says that the instruction at
+// from, a ret to an address pushed by hand, goes to to. -b gives the bound of
+// the loop that starts at addr, for loops that aren't counted by a djnz. -t
+// is the value that the timer interrupt reloads the timer with. With it, the
+// interrupt's share of the CPU is shown, and the time from reset includes the
+// timer interrupts that can come in it, and one external interrupt.
+//
+// out.txt lists every block, and the worst path through each handler.
+//
+// The stock ROM needs: -e 0x800 -j 0x2b0=0x800 -t 0xfe
+
+#if _MSC_VER
+#pragma warning(disable: 4996)
+#endif
+
+#include "cpu.h"
+#include "mcs48_cfg.h"
+#include "mcs48_disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Taking an interrupt costs two cycles, for the call to the vector
+enum { INTERRUPT_ENTRY_CYCLES = 2, TIMER_PRESCALE = 32, MAX_ENTRY_POINTS = 64 };
+
+static unsigned s_entry_points[MAX_ENTRY_POINTS];
+static unsigned s_num_entry_points;
+
+static mcs48_disasm_t s_disasm;
+static mcs48_cfg_t s_cfg;
+
+
+static bool parse_addr(char const *s, char const *end_char, unsigned *addr) {
+    char *end;
+    unsigned long val = (s[0] == '$') ? strtoul(s + 1, &end, 16) : strtoul(s, &end, 0);
+    if (end == s || (end_char ? *end != *end_char : *end != '\0') || val >= MCS48_DISASM_IMAGE_SIZE)
+        return false;
+    *addr = (unsigned)val;
+    return true;
+}
+
+// Parses "a=b", as two addresses, or an address and a count
+static bool parse_pair(char const *s, unsigned *a, unsigned *b, bool b_is_addr) {
+    char const *equals = strchr(s, '=');
+    if (!equals || !parse_addr(s, "=", a))
+        return false;
+    if (b_is_addr)
+        return parse_addr(equals + 1, NULL, b);
+    char *end;
+    unsigned long val = strtoul(equals + 1, &end, 0);
+    if (end == equals + 1 || *end || val < 1 || val > 0xffff)
+        return false;
+    *b = (unsigned)val;
+    return true;
+}
+
+static double cycles_to_us(unsigned cycles) {
+    return cycles * 1e6 / CPU_CLOCK_RATE_HZ;
+}
+
+static void write_block(FILE *out, mcs48_block_t const *b) {
+    fprintf(out, "$%04X-$%04X %3u cycles", b->start, b->last, b->cycles);
+    if (b->callee != MCS48_CFG_NO_BLOCK) {
+        fprintf(out, "  call $%04X (%u)", s_cfg.blocks[b->callee].start,
+            s_cfg.wcet[b->callee].cycles);
+    }
+    if (b->returns)
+        fprintf(out, "  ret");
+    if (b->unknown_end)
+        fprintf(out, "  unknown end");
+    for (unsigned i = 0; i < b->num_succs; i++)
+        fprintf(out, "%s$%04X", i ? ", " : "  -> ", s_cfg.blocks[s_cfg.succs[b->first_succ + i]].start);
+    fprintf(out, "\n");
+}
+
+// Works out the WCET of the code at addr, and writes it, its loops and its
+// worst path to out
+static mcs48_wcet_t report(FILE *out, char const *what, unsigned addr) {
+    mcs48_wcet_t w = mcs48_cfg_wcet(&s_cfg, addr);
+    fprintf(out, "// %s at $%04X: %u cycles\n", what, addr, w.cycles);
+    for (unsigned i = 0; i < s_cfg.num_loops; i++) {
+        mcs48_loop_t const *loop = &s_cfg.loops[i];
+        fprintf(out, "//   Loop at $%04X, back from $%04X, %u cycles per pass, ", loop->header,
+            loop->latch, loop->iteration_cycles);
+        if (loop->endless)
+            fprintf(out, "endless\n");
+        else if (loop->count)
+            fprintf(out, "%u passes%s\n", loop->count, loop->inferred ? " from the djnz" : "");
+        else
+            fprintf(out, "no bound, so counted once\n");
+    }
+    if (w.recursive)
+        fprintf(out, "//   Recursive\n");
+    if (w.unknown_end)
+        fprintf(out, "//   Reaches code that can't be followed\n");
+    for (unsigned i = 0; i < s_cfg.num_blocks; i++) {
+        if (s_cfg.on_worst_path[i])
+            write_block(out, &s_cfg.blocks[i]);
+    }
+    fprintf(out, "\n");
+
+    // The loops that need a bound are listed on the console too
+    for (unsigned i = 0; i < s_cfg.num_loops; i++) {
+        mcs48_loop_t const *loop = &s_cfg.loops[i];
+        if (!loop->endless && !loop->count) {
+            printf("The loop at $%04X in the %s has no bound. It takes %u cycles per pass.\n",
+                loop->header, what, loop->iteration_cycles);
+        }
+    }
+    return w;
+}
+
+static void print_wcet(char const *what, unsigned addr, mcs48_wcet_t const *w, unsigned cycles) {
+    printf("%-20s $%04X %6u cycles %9.1f us%s%s\n", what, addr, cycles, cycles_to_us(cycles),
+        w->num_unbounded ? "  (has unbounded loops)" : "",
+        w->unknown_end ? "  (incomplete)" : "");
+}
+
+
+int main(int argc, char *argv[]) {
+    char const *rom_path = "rom.bin";
+    char const *out_path = "wcet.txt";
+    unsigned num_paths = 0;
+    int timer_reload = -1;
+    mcs48_cfg_init(&s_cfg);
+    for (int i = 1; i < argc; i++) {
+        bool has_arg = i + 1 < argc;
+        unsigned a, b;
+        if (strcmp(argv[i], "-e") == 0) {
+            if (!has_arg || !parse_addr(argv[i + 1], NULL, &a)) {
+                printf("-e needs an address below 0x1000\n");
+                return 1;
+            }
+            if (s_num_entry_points < MAX_ENTRY_POINTS)
+                s_entry_points[s_num_entry_points++] = a;
+            i++;
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            if (!has_arg || !parse_pair(argv[i + 1], &a, &b, true) || !mcs48_cfg_add_edge(&s_cfg, a, b)) {
+                printf("-j needs two addresses below 0x1000, like 0x2b0=0x800\n");
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "-b") == 0) {
+            if (!has_arg || !parse_pair(argv[i + 1], &a, &b, false) || !mcs48_cfg_set_loop_bound(&s_cfg, a, b)) {
+                printf("-b needs an address and a count, like 0x023=8\n");
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "-t") == 0) {
+            char *end;
+            unsigned long val = has_arg ? strtoul(argv[i + 1], &end, 0) : 256;
+            if (!has_arg || *end || val > 0xff) {
+                printf("-t needs the timer reload value, like 0xfe\n");
+                return 1;
+            }
+            timer_reload = (int)val;
+            i++;
+        }
+        else if (num_paths == 0) {
+            rom_path = argv[i];
+            num_paths++;
+        }
+        else if (num_paths == 1) {
+            out_path = argv[i];
+            num_paths++;
+        }
+    }
+
+    FILE *rom_file = fopen(rom_path, "rb");
+    if (!rom_file) {
+        printf("Couldn't open input file\n");
+        return 1;
+    }
+    static u8 rom[MCS48_DISASM_IMAGE_SIZE];
+    unsigned rom_size = (unsigned)fread(rom, 1, sizeof(rom), rom_file);
+    fclose(rom_file);
+
+    mcs48_disasm_init(&s_disasm, rom, rom_size);
+    mcs48_disasm_trace_vectors(&s_disasm);
+    for (unsigned i = 0; i < s_num_entry_points; i++)
+        mcs48_disasm_trace(&s_disasm, s_entry_points[i], false);
+    for (unsigned i = 0; i < s_cfg.num_extra_edges; i++)
+        mcs48_disasm_trace(&s_disasm, s_cfg.extra_edges[i].to, false);
+    mcs48_cfg_build(&s_cfg, &s_disasm);
+    printf("Found %u blocks in %u instructions\n", s_cfg.num_blocks, s_disasm.num_insns);
+
+    FILE *out = fopen(out_path, "wb");
+    if (!out) {
+        printf("Couldn't open output file\n");
+        return 1;
+    }
+    fprintf(out, "// Worst cases of %s, in cycles of %u Hz. Taking an interrupt costs %u more.\n\n",
+        rom_path, (unsigned)CPU_CLOCK_RATE_HZ, (unsigned)INTERRUPT_ENTRY_CYCLES);
+    mcs48_wcet_t timer = report(out, "timer interrupt", 0x007);
+    mcs48_wcet_t ext = report(out, "external interrupt", 0x003);
+    mcs48_wcet_t reset = report(out, "code from reset", 0x000);
+    for (unsigned i = 0; i < s_num_entry_points; i++)
+        report(out, "entry point", s_entry_points[i]);
+
+    // Every block, with the WCETs of the calls that the reports above needed
+    fprintf(out, "// Blocks\n");
+    for (unsigned i = 0; i < s_cfg.num_blocks; i++)
+        write_block(out, &s_cfg.blocks[i]);
+    fclose(out);
+
+    unsigned timer_cycles = timer.cycles + INTERRUPT_ENTRY_CYCLES;
+    unsigned ext_cycles = ext.cycles + INTERRUPT_ENTRY_CYCLES;
+    print_wcet("Timer interrupt", 0x007, &timer, timer_cycles);
+    print_wcet("External interrupt", 0x003, &ext, ext_cycles);
+    print_wcet("From reset", 0x000, &reset, reset.cycles);
+    if (timer_reload < 0)
+        return 0;
+
+    unsigned period = (256 - timer_reload) * TIMER_PRESCALE;
+    printf("The timer interrupts every %u cycles (%.1f us). Its handler takes up to %.0f%% of the CPU.\n",
+        period, cycles_to_us(period), timer_cycles * 100.0 / period);
+    if (timer_cycles >= period) {
+        printf("The timer interrupt can take longer than its period, so the time from reset has no bound.\n");
+        return 0;
+    }
+
+    // The time from reset grows by a timer interrupt for each period it spans
+    unsigned total = reset.cycles + ext_cycles;
+    while (true) {
+        unsigned next = reset.cycles + ext_cycles + (total + period - 1) / period * timer_cycles;
+        if (next == total)
+            break;
+        total = next;
+    }
+    printf("With the interrupts, the code from reset takes up to %u cycles (%.3f ms).\n",
+        total, cycles_to_us(total) / 1000.0);
+    return 0;
+}
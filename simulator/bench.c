@@ -0,0 +1,359 @@
+// Benchmarks for the CPU core. Runs the virtual car with the stock ROM, once
+// for each configuration of the core, and reports the speed of each, then
+// checks that each configuration runs the illegal opcodes the same way. Then
+// times vc_snapshot() and vc_restore(), and takes views from a sim thread the
+// way the UI does. Finally times adding points to, and seeking in, a signal
+// capture store, and getting the columns to draw a graph with at a range of
+// zooms.
+//
+// Usage: bench <rom.bin> [sim_seconds]
+
+// This project's headers
+#include "capture.h"
+#include "cpu.h"
+#include "graph.h"
+#include "sim_thread.h"
+#include "virtual_car.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static u8 g_rom[4096];
+static unsigned g_rom_size;
+
+
+typedef struct {
+    char const *name;
+    cpu_dispatch_t dispatch;
+} bench_config_t;
+
+static bench_config_t const g_configs[] = {
+    { "per-instruction dispatch", CPU_DISPATCH_PER_INSN },
+    { "decode cache", CPU_DISPATCH_BLOCKS },
+#if CPU_THREADED_DISPATCH
+    { "threaded dispatch", CPU_DISPATCH_THREADED }
+#endif
+};
+
+
+static bool load_rom(char const *path) {
+    FILE *rom_file = fopen(path, "rb");
+    if (!rom_file) return false;
+    g_rom_size = fread(g_rom, 1, sizeof(g_rom), rom_file);
+    fclose(rom_file);
+    return g_rom_size > 0;
+}
+
+static bool same_state(cpu_t const *a, cpu_t const *b) {
+    return a->master_clk == b->master_clk && a->pc == b->pc &&
+           memcmp(a->ram, b->ram, sizeof(a->ram)) == 0;
+}
+
+static void run_car(VirtualCar *car, double sim_seconds) {
+    double const step_period = 1e-3;
+    for (double t = 0.0; t < sim_seconds; t += step_period)
+        vc_advance(car, step_period);
+}
+
+// Runs one configuration and copies the final CPU state into final_state, so
+// that the configurations can be checked against each other.
+static void run_config(bench_config_t const *config, double sim_seconds, cpu_t *final_state) {
+    VirtualCar car;
+    vc_init(&car);
+    car.throttle_pos = 0.5;
+    car.cpu->dispatch = config->dispatch;
+    cpu_load_rom(car.cpu, g_rom, g_rom_size);
+    cpu_reset(car.cpu);
+
+    double start_time = GetRealTime();
+    run_car(&car, sim_seconds);
+    double wall_seconds = GetRealTime() - start_time;
+
+    double mips = car.cpu->num_insns / wall_seconds / 1e6;
+    printf("%-28s %8.2f MIPS  %7.1fx real time\n", config->name, mips, sim_seconds / wall_seconds);
+
+    *final_state = *car.cpu;
+    vc_destroy(&car);
+}
+
+// Runs a few illegal opcodes in each configuration, and checks that each
+// takes its length and cycles from MCS48_ISA_TABLE. The stock ROM doesn't use
+// any, so running it doesn't check this.
+static void check_illegal_opcodes(void) {
+    static u8 const rom[] = {
+        0x88, 0x55,     // orl bus,#55h. If the operand weren't skipped, 55h is strt t.
+        0x98, 0xaa,     // anl bus,#0aah
+        0x02,           // outl bus,a
+        0x08,           // ins a,bus
+        0x00,           // nop
+        0x04, 0x07      // jmp 7
+    };
+
+    // 2 cycles for each illegal opcode, then 1 for the nop
+    unsigned const end_clk = 2 * 4 + 1;
+    u16 const end_pc = 7;
+
+    int num_configs = sizeof(g_configs) / sizeof(g_configs[0]);
+    for (int i = 0; i < num_configs; i++) {
+        VirtualCar car;
+        vc_init(&car);
+        car.cpu->dispatch = g_configs[i].dispatch;
+        cpu_load_rom(car.cpu, rom, sizeof(rom));
+        cpu_reset(car.cpu);
+        cpu_run_until(car.cpu, end_clk);
+        if (car.cpu->pc != end_pc || car.cpu->master_clk != end_clk) {
+            printf("  ERROR: illegal opcodes in '%s' ended at pc %03X, clk %u, not %03X, %u\n",
+                g_configs[i].name, car.cpu->pc, car.cpu->master_clk, end_pc, end_clk);
+        }
+        vc_destroy(&car);
+    }
+}
+
+// Times vc_snapshot() and vc_restore() on a warmed-up car, and checks that
+// running on from a restored snapshot repeats the original run exactly.
+static void bench_snapshots(void) {
+    VirtualCar car;
+    vc_init(&car);
+    car.throttle_pos = 0.5;
+    cpu_load_rom(car.cpu, g_rom, g_rom_size);
+    cpu_reset(car.cpu);
+    run_car(&car, 2.0);
+
+    static vc_snapshot_t snapshot;
+    vc_snapshot(&car, &snapshot);
+    run_car(&car, 0.5);
+    cpu_t first_run = *car.cpu;
+    vc_restore(&car, &snapshot);
+    run_car(&car, 0.5);
+    if (!same_state(car.cpu, &first_run))
+        puts("  ERROR: run from restored snapshot differs");
+
+    int const num_repeats = 100000;
+    double start_time = GetRealTime();
+    for (int i = 0; i < num_repeats; i++)
+        vc_snapshot(&car, &snapshot);
+    double snapshot_ns = (GetRealTime() - start_time) * 1e9 / num_repeats;
+
+    start_time = GetRealTime();
+    for (int i = 0; i < num_repeats; i++)
+        vc_restore(&car, &snapshot);
+    double restore_ns = (GetRealTime() - start_time) * 1e9 / num_repeats;
+
+    printf("%-28s %8.1f ns snapshot  %6.1f ns restore  (%u bytes)\n", "vc_snapshot",
+        snapshot_ns, restore_ns, (unsigned)(sizeof(snapshot) - sizeof(snapshot.graphs)));
+    vc_destroy(&car);
+}
+
+// Runs the car on a sim thread, once at real time and once as fast as
+// possible, and takes a view from it about every 7 ms, as the UI does. Checks
+// that the views come in order, that each was made with the controls that it
+// was asked for, and that none changes while it is held. Reports the speed
+// that the sim thread kept, and the interval between views.
+static void bench_sim_thread(void) {
+    static char const *const names[] = { "sim thread, real time", "sim thread, flat out" };
+    double const speeds[] = { 1.0, 0.0 };
+    double const run_seconds = 2.0;
+    int const frame_ms = 7;
+    static sim_view_t held;
+
+    for (int i = 0; i < 2; i++) {
+        VirtualCar car;
+        vc_init(&car);
+        car.record_graphs = true;
+        cpu_load_rom(car.cpu, g_rom, g_rom_size);
+        cpu_reset(car.cpu);
+
+        sim_controls_t controls;
+        memset(&controls, 0, sizeof(controls));
+        controls.throttle_pos = 0.5;
+        controls.sim_speed = speeds[i];
+        controls.graph_columns = MAX_GRAPH_COLUMNS;
+        for (int j = 0; j < NUM_GRAPHS; j++)
+            controls.graph_time_ranges[j] = CPU_CLOCK_RATE_HZ / 10;
+
+        sim_thread_t sim;
+        if (!sim_thread_start(&sim, &car, &controls)) {
+            puts("  ERROR: couldn't start the sim thread");
+            vc_destroy(&car);
+            return;
+        }
+
+        // The throttle position asked for with each of the last two requests.
+        // It changes every frame, so a view made with the wrong controls shows.
+        double requested_throttle[2] = { 0.0, controls.throttle_pos };
+
+        unsigned num_views = 0;
+        unsigned num_bad_views = 0;
+        bool is_bad = false;    // Whether the view being held has failed a check
+        unsigned first_clk = 0;
+        unsigned last_serial = 0;
+        unsigned last_clk = 0;
+        double first_time = 0.0;
+        double last_time = 0.0;
+        double max_interval = 0.0;
+        double start_time = GetRealTime();
+        while (GetRealTime() - start_time < run_seconds) {
+            controls.throttle_pos = (sim.request % 8) / 8.0;
+            unsigned request = sim.request;
+            sim_view_t const *view = sim_thread_get_view(&sim, &controls);
+            if (sim.request != request)
+                requested_throttle[sim.request & 1] = controls.throttle_pos;
+            if (!view) {
+                SleepMillisec(frame_ms);
+                continue;
+            }
+
+            double now = GetRealTime();
+            if (num_views == 0 || view->serial != last_serial) {
+                num_bad_views += is_bad;
+                is_bad = false;
+                if (num_views == 0) {
+                    first_clk = view->master_clk;
+                    first_time = now;
+                }
+                else {
+                    if (view->serial != last_serial + 1 || (int)(view->master_clk - last_clk) < 0)
+                        is_bad = true;
+                    if (now - last_time > max_interval)
+                        max_interval = now - last_time;
+                }
+                if (view->controls.throttle_pos != requested_throttle[view->serial & 1] ||
+                        view->throttle_pos != view->controls.throttle_pos)
+                    is_bad = true;
+                num_views++;
+                last_serial = view->serial;
+                last_clk = view->master_clk;
+                last_time = now;
+            }
+
+            // Drawing the view
+            memcpy(&held, view, sizeof(held));
+            SleepMillisec(frame_ms);
+            if (memcmp(&held, view, sizeof(held)) != 0)
+                is_bad = true;
+        }
+        num_bad_views += is_bad;
+        sim_thread_stop(&sim);
+
+        if (num_bad_views)
+            printf("  ERROR: %u views from the sim thread failed a check\n", num_bad_views);
+        double speed = (last_clk - first_clk) * CPU_CLOCK_PERIOD / (last_time - first_time);
+        printf("%-28s %8.3fx real time  %5.1f views/s  %5.1f ms max interval\n", names[i],
+            speed, num_views / (last_time - first_time), max_interval * 1e3);
+        vc_destroy(&car);
+    }
+}
+
+// Fills a capture with a PWM-like square wave whose period drifts, checks
+// that it reads back the same, and times capture_add() and capture_seek().
+static void bench_capture(void) {
+    enum { NUM_POINTS = 4000000 };
+    capture_t capture;
+    capture_init(&capture, 64 * 1024 * 1024);
+
+    unsigned time = 0;
+    double start_time = GetRealTime();
+    for (int i = 0; i < NUM_POINTS; i++) {
+        time += 300 + (i * 7) % 400;
+        capture_add(&capture, time, (i & 1) ? 255 : 0);
+    }
+    double add_ns = (GetRealTime() - start_time) * 1e9 / NUM_POINTS;
+
+    capture_cursor_t cursor;
+    time = 0;
+    bool ok = capture.num_points == NUM_POINTS && capture_seek(&capture, 0, &cursor);
+    for (int i = 0; ok && i < NUM_POINTS; i++) {
+        time += 300 + (i * 7) % 400;
+        ok = cursor.time == time && cursor.val == ((i & 1) ? 255 : 0);
+        if (i + 1 < NUM_POINTS)
+            ok = ok && capture_next(&cursor);
+    }
+    if (!ok)
+        puts("  ERROR: capture reads back differently");
+
+    int const num_seeks = 1000000;
+    uint64_t seek_time = 0;
+    start_time = GetRealTime();
+    for (int i = 0; i < num_seeks; i++) {
+        seek_time = (seek_time + 2654435761u) % capture.last_time;
+        capture_seek(&capture, seek_time, &cursor);
+    }
+    double seek_ns = (GetRealTime() - start_time) * 1e9 / num_seeks;
+
+    double bytes_per_point = (double)(capture.next_serial * sizeof(capture_chunk_t)) / NUM_POINTS;
+    printf("%-28s %8.1f ns add  %6.1f ns seek  (%.2f bytes per point)\n", "capture",
+        add_ns, seek_ns, bytes_per_point);
+    capture_free(&capture);
+}
+
+// Fills a graph with ten minutes of a PWM-like signal, then times getting the
+// columns to draw it, at ranges from 50 us to the full ten minutes.
+static void bench_graph_zoom(void) {
+    graph_id_t const id = FROM_KLR_CYCLING_VALVE_PWM;
+    unsigned const end_time = (unsigned)(CPU_CLOCK_RATE_HZ * 600.0);
+    unsigned time = 0;
+    for (int i = 0; time < end_time; i++) {
+        time += 300 + (i * 7) % 400;
+        u8 val = (i & 1) ? 255 : 0;
+        graph_add_point(id, time, 255 - val);
+        graph_add_point(id, time, val);
+    }
+
+    static double const ranges[] = { 50e-6, 1e-3, 50e-3, 1.0, 60.0, 600.0 };
+    static char const *range_names[] = { "50 us", "1 ms", "50 ms", "1 s", "1 min", "10 min" };
+    enum { NUM_COLUMNS = 560 };
+    static u8 mins[NUM_COLUMNS];
+    static u8 maxs[NUM_COLUMNS];
+    for (int i = 0; i < (int)(sizeof(ranges) / sizeof(ranges[0])); i++) {
+        unsigned range = (unsigned)(CPU_CLOCK_RATE_HZ * ranges[i]);
+        int const num_repeats = 1000;
+        double start_time = GetRealTime();
+        for (int j = 0; j < num_repeats; j++)
+            graph_get_columns(id, time, range, NUM_COLUMNS, mins, maxs);
+        double us = (GetRealTime() - start_time) * 1e6 / num_repeats;
+
+        char name[64];
+        snprintf(name, sizeof(name), "graph columns, %s range", range_names[i]);
+        printf("%-28s %8.1f us per %d columns\n", name, us, NUM_COLUMNS);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        puts("Usage: bench <rom.bin> [sim_seconds]");
+        return 1;
+    }
+
+    if (!load_rom(argv[1])) {
+        printf("Couldn't read ROM file '%s'\n", argv[1]);
+        return 1;
+    }
+
+    double sim_seconds = argc > 2 ? atof(argv[2]) : 20.0;
+    int num_configs = sizeof(g_configs) / sizeof(g_configs[0]);
+    cpu_t reference;
+    for (int i = 0; i < num_configs; i++) {
+        cpu_t final_state;
+        run_config(&g_configs[i], sim_seconds, &final_state);
+        if (i == 0) {
+            reference = final_state;
+        }
+        else if (!same_state(&final_state, &reference)) {
+            printf("  ERROR: final state differs from '%s'\n", g_configs[0].name);
+        }
+    }
+
+    check_illegal_opcodes();
+    bench_snapshots();
+    bench_sim_thread();
+    bench_capture();
+    bench_graph_zoom();
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Own header
+#include "capture.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+// Longest encoding of one point: a 5 byte varint of a delta below 2^31,
+// shifted left one bit, and the value
+enum { MAX_POINT_BYTES = 6 };
+
+
+static capture_chunk_t *get_chunk(capture_t const *c, unsigned serial) {
+    return c->chunks[serial % c->max_chunks];
+}
+
+static unsigned get_num_chunks(capture_t const *c) {
+    return c->next_serial - c->first_serial;
+}
+
+static void start_chunk(capture_t *c, uint64_t time, u8 val) {
+    // If the ring is full, drop the oldest chunk
+    if (get_num_chunks(c) == (unsigned)c->max_chunks) {
+        c->num_points -= get_chunk(c, c->first_serial)->num_points;
+        c->first_serial++;
+    }
+
+    capture_chunk_t **slot = &c->chunks[c->next_serial % c->max_chunks];
+    if (!*slot)
+        *slot = (capture_chunk_t *)malloc(sizeof(capture_chunk_t));
+    capture_chunk_t *chunk = *slot;
+    chunk->start_time = time;
+    chunk->start_val = val;
+    chunk->num_bytes = 0;
+    chunk->num_points = 1;
+    c->last_chunk = chunk;
+    c->next_serial++;
+}
+
+static void decode_point(u8 const *data, int *byte_idx, uint64_t *time, u8 *val) {
+    int i = *byte_idx;
+    uint64_t v = 0;
+    int shift = 0;
+    u8 b;
+    do {
+        b = data[i++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    *time += v >> 1;
+    if (v & 1)
+        *val = data[i++];
+    *byte_idx = i;
+}
+
+static void set_cursor_to_chunk_start(capture_cursor_t *cursor, unsigned serial) {
+    capture_chunk_t const *chunk = get_chunk(cursor->capture, serial);
+    cursor->serial = serial;
+    cursor->next_byte = 0;
+    cursor->time = chunk->start_time;
+    cursor->val = chunk->start_val;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void capture_init(capture_t *c, unsigned max_bytes) {
+    memset(c, 0, sizeof(*c));
+    c->max_chunks = max_bytes / sizeof(capture_chunk_t);
+    if (c->max_chunks < 2)
+        c->max_chunks = 2;
+    c->chunks = (capture_chunk_t **)calloc(c->max_chunks, sizeof(capture_chunk_t *));
+}
+
+void capture_free(capture_t *c) {
+    for (int i = 0; i < c->max_chunks; i++)
+        free(c->chunks[i]);
+    free(c->chunks);
+    memset(c, 0, sizeof(*c));
+}
+
+void capture_clear(capture_t *c) {
+    c->first_serial = c->next_serial;
+    c->num_points = 0;
+}
+
+void capture_add(capture_t *c, unsigned time, u8 val) {
+    uint64_t t = capture_expand_time(c, time);
+    if (t < c->last_time)
+        t = c->last_time;
+
+    if (c->num_points == 0) {
+        start_chunk(c, t, val);
+    }
+    else {
+        capture_chunk_t *chunk = c->last_chunk;
+        if (chunk->num_bytes > CAPTURE_CHUNK_BYTES - MAX_POINT_BYTES) {
+            start_chunk(c, t, val);
+        }
+        else {
+            bool val_changed = val != c->last_val;
+            uint64_t v = ((t - c->last_time) << 1) | val_changed;
+            u8 *p = chunk->data + chunk->num_bytes;
+            while (v >= 0x80) {
+                *p++ = (u8)v | 0x80;
+                v >>= 7;
+            }
+            *p++ = (u8)v;
+            if (val_changed)
+                *p++ = val;
+            chunk->num_bytes = (int)(p - chunk->data);
+            chunk->num_points++;
+        }
+    }
+
+    c->num_points++;
+    c->last_time = t;
+    c->last_val = val;
+}
+
+uint64_t capture_expand_time(capture_t const *c, unsigned time) {
+    if (c->next_serial == 0)
+        return time;    // Nothing has ever been added
+
+    int delta = (int)(time - (unsigned)c->last_time);
+    if (delta < 0 && (uint64_t)-(int64_t)delta > c->last_time)
+        return 0;
+    return c->last_time + (int64_t)delta;
+}
+
+bool capture_seek(capture_t const *c, uint64_t time, capture_cursor_t *cursor) {
+    if (c->num_points == 0)
+        return false;
+
+    // Find the last chunk that starts at or before time, or the first chunk
+    unsigned lo = c->first_serial;
+    unsigned hi = c->next_serial - 1;
+    while (lo != hi) {
+        unsigned mid = lo + (hi - lo + 1) / 2;
+        if (get_chunk(c, mid)->start_time <= time)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    // Then the last point in it that is at or before time
+    cursor->capture = c;
+    set_cursor_to_chunk_start(cursor, lo);
+    capture_chunk_t const *chunk = get_chunk(c, lo);
+    while (cursor->next_byte < chunk->num_bytes) {
+        int next_byte = cursor->next_byte;
+        uint64_t next_time = cursor->time;
+        u8 next_val = cursor->val;
+        decode_point(chunk->data, &next_byte, &next_time, &next_val);
+        if (next_time > time)
+            break;
+        cursor->next_byte = next_byte;
+        cursor->time = next_time;
+        cursor->val = next_val;
+    }
+
+    return true;
+}
+
+bool capture_next(capture_cursor_t *cursor) {
+    capture_t const *c = cursor->capture;
+    capture_chunk_t const *chunk = get_chunk(c, cursor->serial);
+    if (cursor->next_byte < chunk->num_bytes) {
+        decode_point(chunk->data, &cursor->next_byte, &cursor->time, &cursor->val);
+        return true;
+    }
+
+    if (cursor->serial + 1 == c->next_serial)
+        return false;
+    set_cursor_to_chunk_start(cursor, cursor->serial + 1);
+    return true;
+}
+
+void capture_mark(capture_t const *c, capture_mark_t *mark) {
+    mark->serial = c->next_serial - 1;
+    mark->num_bytes = 0;
+    mark->chunk_num_points = 0;
+    if (c->num_points > 0) {
+        capture_chunk_t const *chunk = get_chunk(c, mark->serial);
+        mark->num_bytes = chunk->num_bytes;
+        mark->chunk_num_points = chunk->num_points;
+    }
+    mark->num_points = c->num_points;
+    mark->last_time = c->last_time;
+    mark->last_val = c->last_val;
+    mark->epoch = c->epoch;
+}
+
+bool capture_rewind(capture_t *c, capture_mark_t const *mark) {
+    bool is_same_history = mark->epoch == c->epoch ||
+        (mark->epoch == c->base_epoch && mark->num_points <= c->base_points);
+    bool is_chunk_held = mark->serial - c->first_serial < get_num_chunks(c);
+    if (mark->num_points > 0 && (!is_same_history || !is_chunk_held)) {
+        capture_clear(c);
+        return false;
+    }
+
+    if (mark->num_points == 0) {
+        capture_clear(c);
+    }
+    else {
+        c->next_serial = mark->serial + 1;
+        capture_chunk_t *chunk = get_chunk(c, mark->serial);
+        c->last_chunk = chunk;
+        chunk->num_bytes = mark->num_bytes;
+        chunk->num_points = mark->chunk_num_points;
+
+        // Older chunks may have been dropped since the mark was taken
+        c->num_points = 0;
+        for (unsigned serial = c->first_serial; serial != c->next_serial; serial++)
+            c->num_points += get_chunk(c, serial)->num_points;
+    }
+
+    c->last_time = mark->last_time;
+    c->last_val = mark->last_val;
+    c->base_epoch = mark->epoch;
+    c->base_points = mark->num_points;
+    c->epoch = ++c->num_rewinds;
+    return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdint.h>
+
+
+// An append-only store of the (time, value) points of one signal, for keeping
+// a long history in bounded memory.
+//
+// Points are packed into fixed-size chunks. The first point of each chunk is
+// held in full in its header. Each later point is a varint of the time since
+// the previous point, shifted left one bit, with the bottom bit set if the
+// value changed. Only then is the new value stored, in the byte after. A
+// typical edge takes 3 bytes.
+//
+// Times are extended to 64 bits internally, so the capture can span more than
+// the 2^32 cycles that the 32-bit master_clk wraps in.
+//
+// When the memory limit is reached, the oldest chunk is dropped to make room.
+
+enum { CAPTURE_CHUNK_BYTES = 512 };
+
+typedef struct {
+    uint64_t start_time;    // Time of the first point, which isn't in data
+    u8 start_val;
+    int num_bytes;          // Number of bytes of data that are used
+    unsigned num_points;    // Including the first
+    u8 data[CAPTURE_CHUNK_BYTES];
+} capture_chunk_t;
+
+typedef struct {
+    capture_chunk_t **chunks;   // Ring of max_chunks. Each is allocated when first needed.
+    int max_chunks;
+    unsigned first_serial;      // Serial number of the oldest chunk held. Chunk n is at chunks[n % max_chunks].
+    unsigned next_serial;       // Serial number the next chunk started will get
+    capture_chunk_t *last_chunk;    // The chunk with serial next_serial - 1. Valid while num_points > 0.
+    unsigned num_points;        // Number of points held
+    uint64_t last_time;
+    u8 last_val;
+
+    // For checking that a mark is still valid. Each rewind starts a new
+    // epoch. The first base_points points are the same as they were in
+    // base_epoch.
+    unsigned epoch;
+    unsigned num_rewinds;
+    unsigned base_epoch;
+    unsigned base_points;
+} capture_t;
+
+// For reading the points in time order
+typedef struct {
+    capture_t const *capture;
+    unsigned serial;        // Chunk the point is in
+    int next_byte;          // Index in the chunk's data of the next point
+    uint64_t time;          // The point the cursor is on
+    u8 val;
+} capture_cursor_t;
+
+// The end of a capture at some moment. See capture_rewind().
+typedef struct {
+    unsigned serial;        // Chunk the last point was in
+    int num_bytes;          // Bytes used in that chunk
+    unsigned chunk_num_points;
+    unsigned num_points;
+    uint64_t last_time;
+    u8 last_val;
+    unsigned epoch;
+} capture_mark_t;
+
+
+// max_bytes is rounded down to whole chunks, with a minimum of two.
+void capture_init(capture_t *c, unsigned max_bytes);
+void capture_free(capture_t *c);
+void capture_clear(capture_t *c);
+
+// Appends a point. A time before the last point's is treated as equal to it.
+void capture_add(capture_t *c, unsigned time, u8 val);
+
+// Converts a 32-bit time to the capture's 64-bit clock, taking it to be within
+// 2^31 cycles of the last point.
+uint64_t capture_expand_time(capture_t const *c, unsigned time);
+
+// Moves the cursor to the last point at or before time, or to the first point
+// if they are all after it. Binary searches the chunks, so takes O(log n).
+// Returns false if the capture is empty.
+bool capture_seek(capture_t const *c, uint64_t time, capture_cursor_t *cursor);
+
+// Moves the cursor to the next point. Returns false, leaving the cursor where
+// it was, if there isn't one. Adding points can drop the chunk the cursor is
+// in, so don't hold on to a cursor across calls to capture_add().
+bool capture_next(capture_cursor_t *cursor);
+
+// Records the current end of the capture, so that points added after it can
+// be discarded by capture_rewind(). This is how snapshots of the graphs are
+// taken, without copying any chunks.
+void capture_mark(capture_t const *c, capture_mark_t *mark);
+
+// Discards the points added since mark was taken. The same mark can be
+// rewound to any number of times. If the chunk the mark ends in has since been
+// dropped to make room, or the points before the mark have changed because the
+// capture was rewound to an earlier mark and then added to, the whole capture
+// is cleared instead and false is returned.
+bool capture_rewind(capture_t *c, capture_mark_t const *mark);
@@ -38,19 +38,18 @@
 //   mov a,t
 // 
 // - IRQ timing is hacked due to WY-100 needing to take JNI branch before
-//   servicing interrupt (see m.irq_polled), probably related to note above?
+//   servicing interrupt (see m->irq_polled), probably related to note above?
 
 // Own header
 #include "cpu.h"
 
-// Deadfrog headers
-#include "df_bitmap.h"
-#include "df_font.h"
-#include "df_window.h"
+// This project's headers
+#include "mcs48_isa.h"
 
 // Standard headers
-#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 // ****************************************************************************
@@ -69,622 +68,1017 @@ enum flag_bits {
     B_FLAG = 0x10
 };
 
-// r0-r7 map to memory via reg_ptr
-#define R0 m.reg_ptr[0]
-#define R1 m.reg_ptr[1]
-#define R2 m.reg_ptr[2]
-#define R3 m.reg_ptr[3]
-#define R4 m.reg_ptr[4]
-#define R5 m.reg_ptr[5]
-#define R6 m.reg_ptr[6]
-#define R7 m.reg_ptr[7]
-
+// Opcode properties used by the decode cache
+enum opcode_flags {
+    END = 0x01,         // Ends a block. Always changes control flow, or can make an interrupt pending.
+    SLOW = 0x02,        // Can't be in a block. Reads or reconfigures the timer, or is illegal.
+    DECODED = 0x04,     // Set on decoded_insn_t entries that are valid
+    HAS_BLOCK = 0x08    // Set on decoded_insn_t entries whose block_* fields are valid
+};
 
-// ****************************************************************************
-// Global variables
-// ****************************************************************************
+// Longest run of instructions that is executed in one dispatch
+enum { MAX_BLOCK_INSNS = 16 };
 
-static cpu_t m;
+// r0-r7 map to memory via reg_base
+#define R0 m->ram[m->reg_base + 0]
+#define R1 m->ram[m->reg_base + 1]
+#define R2 m->ram[m->reg_base + 2]
+#define R3 m->ram[m->reg_base + 3]
+#define R4 m->ram[m->reg_base + 4]
+#define R5 m->ram[m->reg_base + 5]
+#define R6 m->ram[m->reg_base + 6]
+#define R7 m->ram[m->reg_base + 7]
 
 
 // ****************************************************************************
 // Static functions
 // ****************************************************************************
 
-static u8 rom_read(u16 a) { return m.rom[a]; }
-static u8 ram_read(u16 a) { return m.ram[a]; }
-static void ram_write(u16 a, u8 v) { m.ram[a] = v; }
-static u8 ext_mem_read(u8 a) { return cpu_external_mem_read(&m, a); }
-static void ext_mem_write(u16 a, u8 v) { assert(0); }
-static void port1_write(u8 v) { cpu_port1_write(&m, v); m.p1 = v; }
-static void port2_write(u8 v) { cpu_port2_write(&m, v); m.p2 = v; }
-static int t0_read(void) { return cpu_t0_read(); }
-static int t1_read(void) { return cpu_t1_read(); }
+static u8 rom_read(cpu_t *m, u16 a) { return m->rom[a]; }
+static u8 ram_read(cpu_t *m, u16 a) { return m->ram[a]; }
+static void ram_write(cpu_t *m, u16 a, u8 v) { m->ram[a] = v; }
+static u8 ext_mem_read(cpu_t *m, u8 a) { return m->callbacks->external_mem_read(m, a); }
+static void ext_mem_write(cpu_t *m, u8 a, u8 v) { m->callbacks->external_mem_write(m, a, v); }
+static void port1_write(cpu_t *m, u8 v) { m->callbacks->port1_write(m, v); m->p1 = v; }
+static void port2_write(cpu_t *m, u8 v) { m->callbacks->port2_write(m, v); m->p2 = v; }
+static int t0_read(cpu_t *m) { return m->callbacks->t0_read(m); }
+static int t1_read(cpu_t *m) { return m->callbacks->t1_read(m); }
 
 // fetch an opcode byte
-static u8 opcode_fetch(void) {
-    u16 address = m.pc;
-    m.pc = ((m.pc + 1) & 0x7ff) | (m.pc & 0x800);
-    return m.rom[address];
+static u8 opcode_fetch(cpu_t *m) {
+    u16 address = m->pc;
+    m->pc = ((m->pc + 1) & 0x7ff) | (m->pc & 0x800);
+    return m->rom[address];
 }
 
 // fetch an opcode argument byte
-static u8 argument_fetch(void) {
-    u16 address = m.pc;
-    m.pc = ((m.pc + 1) & 0x7ff) | (m.pc & 0x800);
-    return m.rom[address];
+static u8 argument_fetch(cpu_t *m) {
+    u16 address = m->pc;
+    m->pc = ((m->pc + 1) & 0x7ff) | (m->pc & 0x800);
+    return m->rom[address];
 }
 
-// update reg_ptr to point to the appropriate register bank
-static void update_reg_ptr(void) {
-    m.reg_ptr = &m.ram[(m.psw & B_FLAG) ? 24 : 0];
+// update reg_base to index the appropriate register bank
+static void update_reg_base(cpu_t *m) {
+    m->reg_base = (m->psw & B_FLAG) ? 24 : 0;
 }
 
 // push the PC and PSW values onto the stack
-static void push_pc_psw(void) {
-    u8 sp = m.psw & 0x07;
-    ram_write(8 + 2*sp, m.pc);
-    ram_write(9 + 2*sp, ((m.pc >> 8) & 0x0f) | (m.psw & 0xf0));
-    m.psw = (m.psw & 0xf0) | ((sp + 1) & 0x07);
+static void push_pc_psw(cpu_t *m) {
+    u8 sp = m->psw & 0x07;
+    ram_write(m, 8 + 2*sp, m->pc);
+    ram_write(m, 9 + 2*sp, ((m->pc >> 8) & 0x0f) | (m->psw & 0xf0));
+    m->psw = (m->psw & 0xf0) | ((sp + 1) & 0x07);
 }
 
 // pull the PC and PSW values from the stack
-static void pull_pc_psw(void) {
-    u8 sp = (m.psw - 1) & 0x07;
-    m.pc = ram_read(8 + 2*sp);
-    m.pc |= ram_read(9 + 2*sp) << 8;
-    m.psw = ((m.pc >> 8) & 0xf0) | sp;
-    m.pc &= (m.irq_in_progress) ? 0x7ff : 0xfff;
-    update_reg_ptr();
+static void pull_pc_psw(cpu_t *m) {
+    u8 sp = (m->psw - 1) & 0x07;
+    m->pc = ram_read(m, 8 + 2*sp);
+    m->pc |= ram_read(m, 9 + 2*sp) << 8;
+    m->psw = ((m->pc >> 8) & 0xf0) | sp;
+    m->pc &= (m->irq_in_progress) ? 0x7ff : 0xfff;
+    update_reg_base(m);
 }
 
 // pull the PC value from the stack, leaving the upper part of PSW intact
-static void pull_pc(void) {
-    u8 sp = (m.psw - 1) & 0x07;
-    m.pc = ram_read(8 + 2*sp);
-    m.pc |= ram_read(9 + 2*sp) << 8;
-    m.pc &= (m.irq_in_progress) ? 0x7ff : 0xfff;
-    m.psw = (m.psw & 0xf0) | sp;
+static void pull_pc(cpu_t *m) {
+    u8 sp = (m->psw - 1) & 0x07;
+    m->pc = ram_read(m, 8 + 2*sp);
+    m->pc |= ram_read(m, 9 + 2*sp) << 8;
+    m->pc &= (m->irq_in_progress) ? 0x7ff : 0xfff;
+    m->psw = (m->psw & 0xf0) | sp;
 }
 
-static void execute_add(u8 dat) {
-    u16 temp = m.acc + dat;
-    u16 temp4 = (m.acc & 0x0f) + (dat & 0x0f);
+static void execute_add(cpu_t *m, u8 dat) {
+    u16 temp = m->acc + dat;
+    u16 temp4 = (m->acc & 0x0f) + (dat & 0x0f);
 
-    m.psw &= ~(C_FLAG | A_FLAG);
-    m.psw |= (temp4 << 2) & A_FLAG;
-    m.psw |= (temp >> 1) & C_FLAG;
-    m.acc = temp;
+    m->psw &= ~(C_FLAG | A_FLAG);
+    m->psw |= (temp4 << 2) & A_FLAG;
+    m->psw |= (temp >> 1) & C_FLAG;
+    m->acc = temp;
 }
 
-static void execute_addc(u8 dat) {
-    u8 carryin = (m.psw & C_FLAG) >> 7;
-    u16 temp = m.acc + dat + carryin;
-    u16 temp4 = (m.acc & 0x0f) + (dat & 0x0f) + carryin;
+static void execute_addc(cpu_t *m, u8 dat) {
+    u8 carryin = (m->psw & C_FLAG) >> 7;
+    u16 temp = m->acc + dat + carryin;
+    u16 temp4 = (m->acc & 0x0f) + (dat & 0x0f) + carryin;
 
-    m.psw &= ~(C_FLAG | A_FLAG);
-    m.psw |= (temp4 << 2) & A_FLAG;
-    m.psw |= (temp >> 1) & C_FLAG;
-    m.acc = temp;
+    m->psw &= ~(C_FLAG | A_FLAG);
+    m->psw |= (temp4 << 2) & A_FLAG;
+    m->psw |= (temp >> 1) & C_FLAG;
+    m->acc = temp;
 }
 
-static void execute_jmp(u16 address) {
-    u16 a11 = (m.irq_in_progress) ? 0 : m.a11;
-    m.pc = address | a11;
+static void execute_jmp(cpu_t *m, u16 address) {
+    u16 a11 = (m->irq_in_progress) ? 0 : m->a11;
+    m->pc = address | a11;
 }
 
-static void execute_call(u16 address) {
-    push_pc_psw();
-    execute_jmp(address);
+static void execute_call(cpu_t *m, u16 address) {
+    push_pc_psw(m);
+    execute_jmp(m, address);
 }
 
 // perform the logic of a conditional jump instruction
-static void execute_jcc(bool result) {
-    u16 pch = m.pc & 0xf00;
-    u8 offset = argument_fetch();
+static void execute_jcc(cpu_t *m, bool result) {
+    u16 pch = m->pc & 0xf00;
+    u8 offset = argument_fetch(m);
     if (result)
-        m.pc = pch | offset;
+        m->pc = pch | offset;
 }
 
 // processing timers and counters
-static void burn_cycles(int count) {
-    if (m.timecount_enabled) {
+static void burn_cycles(cpu_t *m, int count) {
+    if (m->timecount_enabled) {
         bool timer_over = false;
+        unsigned overflow_clk = 0;
 
         // if the timer is enabled, accumulate prescaler cycles
-        if (m.timecount_enabled & TIMER_ENABLED) {
-            u8 old_timer = m.timer_counter;
-            m.prescaler += count;
-            m.timer_counter += m.prescaler >> 5;
-            m.prescaler &= 0x1f;
-            timer_over = m.timer_counter < old_timer;
+        if (m->timecount_enabled & TIMER_ENABLED) {
+            u8 old_timer = m->timer_counter;
+            m->prescaler += count;
+            m->timer_counter += m->prescaler >> 5;
+            m->prescaler &= 0x1f;
+            timer_over = m->timer_counter < old_timer;
+
+            // the counter and prescaler now hold the cycles since it wrapped
+            overflow_clk = m->master_clk + count - ((m->timer_counter << 5) | m->prescaler);
         }
 
         // if the counter is enabled, poll the T1 test input once for each cycle
-        else if (m.timecount_enabled & COUNTER_ENABLED) {
-            for (; count > 0; count--, m.icount--, m.master_clk++) {
-                m.t1_history = (m.t1_history << 1) | (t1_read() & 1);
-                if ((m.t1_history & 3) == 2) {
-                    if (++m.timer_counter == 0)
+        else if (m->timecount_enabled & COUNTER_ENABLED) {
+            for (; count > 0; count--, m->icount--, m->master_clk++) {
+                m->t1_history = (m->t1_history << 1) | (t1_read(m) & 1);
+                if ((m->t1_history & 3) == 2) {
+                    if (++m->timer_counter == 0) {
                         timer_over = true;
+                        overflow_clk = m->master_clk + 1;
+                    }
                 }
             }
         }
 
         // if either source caused a timer overflow, set the flags
         if (timer_over) {
-            m.timer_flag = true;
+            m->timer_flag = true;
 
             // according to the docs, if an overflow occurs with interrupts disabled, the overflow is not stored
-            if (m.tirq_enabled)
-                m.timer_overflow = true;
+            if (m->tirq_enabled && !m->timer_overflow) {
+                m->timer_overflow = true;
+                m->timer_overflow_clk = overflow_clk;
+            }
         }
     }
 
     // (note: if timer counter is enabled, count was already reduced to 0)
-    m.icount -= count;
-    m.master_clk += count;
+    m->icount -= count;
+    m->master_clk += count;
+}
+
+static unsigned get_irq_histogram_index(unsigned num_cycles) {
+    if (num_cycles < (1u << IRQ_HISTOGRAM_LINEAR_BITS))
+        return num_cycles;
+
+    unsigned octave = IRQ_HISTOGRAM_LINEAR_BITS;
+    while (octave < 31 && (num_cycles >> (octave + 1)))
+        octave++;
+    unsigned sub = (num_cycles >> (octave - IRQ_HISTOGRAM_SUB_BITS)) & ((1 << IRQ_HISTOGRAM_SUB_BITS) - 1);
+    return (1 << IRQ_HISTOGRAM_LINEAR_BITS) + ((octave - IRQ_HISTOGRAM_LINEAR_BITS) << IRQ_HISTOGRAM_SUB_BITS) + sub;
+}
+
+// the longest length that goes in the given histogram entry
+static unsigned get_irq_histogram_top(unsigned index) {
+    if (index < (1u << IRQ_HISTOGRAM_LINEAR_BITS))
+        return index;
+
+    index -= 1 << IRQ_HISTOGRAM_LINEAR_BITS;
+    unsigned octave = IRQ_HISTOGRAM_LINEAR_BITS + (index >> IRQ_HISTOGRAM_SUB_BITS);
+    unsigned sub = index & ((1 << IRQ_HISTOGRAM_SUB_BITS) - 1);
+    unsigned shift = octave - IRQ_HISTOGRAM_SUB_BITS;
+    return (((1u << IRQ_HISTOGRAM_SUB_BITS) + sub) << shift) + ((1u << shift) - 1);
+}
+
+static void add_irq_sample(irq_histogram_t *h, unsigned num_cycles) {
+    h->counts[get_irq_histogram_index(num_cycles)]++;
+    h->num_samples++;
+    if (num_cycles > h->max)
+        h->max = num_cycles;
+}
+
+// note when an interrupt routine starts, and how long it took to get there
+// from when it was both raised and enabled
+static void enter_irq(cpu_t *m, int source, unsigned raised_clk, unsigned enabled_clk, bool was_raised) {
+    m->irq_source = source;
+    m->irq_entry_clk = m->master_clk;
+    if (m->irq_stats && was_raised) {
+        unsigned since_raised = m->master_clk - raised_clk;
+        unsigned since_enabled = m->master_clk - enabled_clk;
+        add_irq_sample(&m->irq_stats->latency[source], since_raised < since_enabled ? since_raised : since_enabled);
+    }
+    if (m->callbacks->irq_entered)
+        m->callbacks->irq_entered(m, source);
 }
 
 // check for and process IRQs
-static void check_irqs() {
+static void check_irqs(cpu_t *m) {
     // if something is in progress, we do nothing
-    if (m.irq_in_progress)
+    if (m->irq_in_progress)
         return;
 
     // external interrupts take priority
-    else if (m.irq_state && m.xirq_enabled) {
+    else if (m->irq_state && m->xirq_enabled) {
         // indicate we took the external IRQ
-        //        standard_irq_callback(0, m.pc);
+        //        standard_irq_callback(0, m->pc);
 
-        burn_cycles(2);
-        m.irq_in_progress = true;
+        burn_cycles(m, 2);
+        m->irq_in_progress = true;
 
         // force JNI to be taken (hack)
-        if (m.irq_polled) {
-            m.pc = ((m.prev_pc + 1) & 0x7ff) | (m.prev_pc & 0x800);
-            execute_jcc(true);
+        if (m->irq_polled) {
+            m->pc = ((m->prev_pc + 1) & 0x7ff) | (m->prev_pc & 0x800);
+            execute_jcc(m, true);
         }
 
         // transfer to location 0x03
-        execute_call(0x03);
+        execute_call(m, 0x03);
+        enter_irq(m, IRQ_EXTERNAL, m->irq_raised_clk, m->xirq_enabled_clk, m->irq_raised);
+        m->irq_raised = false;
     }
 
     // timer overflow interrupts follow
-    else if (m.timer_overflow && m.tirq_enabled) {
-        //        standard_irq_callback(1, m.pc);
+    else if (m->timer_overflow && m->tirq_enabled) {
+        //        standard_irq_callback(1, m->pc);
 
-        burn_cycles(2);
-        m.irq_in_progress = true;
+        burn_cycles(m, 2);
+        m->irq_in_progress = true;
 
         // transfer to location 0x07
-        execute_call(0x07);
+        execute_call(m, 0x07);
+        enter_irq(m, IRQ_TIMER, m->timer_overflow_clk, m->tirq_enabled_clk, true);
 
         // timer overflow flip-flop is reset once taken
-        m.timer_overflow = false;
+        m->timer_overflow = false;
     }
 }
 
 // The mask of bits that the code can directly affect
 enum { P2_MASK = 0xff };
 
-#define OPHANDLER(_name) static void _name(void)
+#define OPHANDLER(_name) static void _name(cpu_t *m)
 
 OPHANDLER( illegal ) {
-    burn_cycles(1);
-    printf("Illegal opcode = %02x @ %04X\n", rom_read(m.prev_pc), m.prev_pc);
-}
-
-OPHANDLER( add_a_r0 )       { burn_cycles(1); execute_add(R0); }
-OPHANDLER( add_a_r1 )       { burn_cycles(1); execute_add(R1); }
-OPHANDLER( add_a_r2 )       { burn_cycles(1); execute_add(R2); }
-OPHANDLER( add_a_r3 )       { burn_cycles(1); execute_add(R3); }
-OPHANDLER( add_a_r4 )       { burn_cycles(1); execute_add(R4); }
-OPHANDLER( add_a_r5 )       { burn_cycles(1); execute_add(R5); }
-OPHANDLER( add_a_r6 )       { burn_cycles(1); execute_add(R6); }
-OPHANDLER( add_a_r7 )       { burn_cycles(1); execute_add(R7); }
-OPHANDLER( add_a_xr0 )      { burn_cycles(1); execute_add(ram_read(R0)); }
-OPHANDLER( add_a_xr1 )      { burn_cycles(1); execute_add(ram_read(R1)); }
-OPHANDLER( add_a_n )        { burn_cycles(2); execute_add(argument_fetch()); }
-
-OPHANDLER( adc_a_r0 )       { burn_cycles(1); execute_addc(R0); }
-OPHANDLER( adc_a_r1 )       { burn_cycles(1); execute_addc(R1); }
-OPHANDLER( adc_a_r2 )       { burn_cycles(1); execute_addc(R2); }
-OPHANDLER( adc_a_r3 )       { burn_cycles(1); execute_addc(R3); }
-OPHANDLER( adc_a_r4 )       { burn_cycles(1); execute_addc(R4); }
-OPHANDLER( adc_a_r5 )       { burn_cycles(1); execute_addc(R5); }
-OPHANDLER( adc_a_r6 )       { burn_cycles(1); execute_addc(R6); }
-OPHANDLER( adc_a_r7 )       { burn_cycles(1); execute_addc(R7); }
-OPHANDLER( adc_a_xr0 )      { burn_cycles(1); execute_addc(ram_read(R0)); }
-OPHANDLER( adc_a_xr1 )      { burn_cycles(1); execute_addc(ram_read(R1)); }
-OPHANDLER( adc_a_n )        { burn_cycles(2); execute_addc(argument_fetch()); }
-
-OPHANDLER( anl_a_r0 )       { burn_cycles(1); m.acc &= R0; }
-OPHANDLER( anl_a_r1 )       { burn_cycles(1); m.acc &= R1; }
-OPHANDLER( anl_a_r2 )       { burn_cycles(1); m.acc &= R2; }
-OPHANDLER( anl_a_r3 )       { burn_cycles(1); m.acc &= R3; }
-OPHANDLER( anl_a_r4 )       { burn_cycles(1); m.acc &= R4; }
-OPHANDLER( anl_a_r5 )       { burn_cycles(1); m.acc &= R5; }
-OPHANDLER( anl_a_r6 )       { burn_cycles(1); m.acc &= R6; }
-OPHANDLER( anl_a_r7 )       { burn_cycles(1); m.acc &= R7; }
-OPHANDLER( anl_a_xr0 )      { burn_cycles(1); m.acc &= ram_read(R0); }
-OPHANDLER( anl_a_xr1 )      { burn_cycles(1); m.acc &= ram_read(R1); }
-OPHANDLER( anl_a_n )        { burn_cycles(2); m.acc &= argument_fetch(); }
-
-OPHANDLER( anl_p1_n )       { burn_cycles(2); port1_write(m.p1 & argument_fetch()); }
-OPHANDLER( anl_p2_n )       { burn_cycles(2); port2_write((m.p2 & argument_fetch()) | ~P2_MASK); }
-
-OPHANDLER( call_0 )         { burn_cycles(2); execute_call(argument_fetch() | 0x000); }
-OPHANDLER( call_1 )         { burn_cycles(2); execute_call(argument_fetch() | 0x100); }
-OPHANDLER( call_2 )         { burn_cycles(2); execute_call(argument_fetch() | 0x200); }
-OPHANDLER( call_3 )         { burn_cycles(2); execute_call(argument_fetch() | 0x300); }
-OPHANDLER( call_4 )         { burn_cycles(2); execute_call(argument_fetch() | 0x400); }
-OPHANDLER( call_5 )         { burn_cycles(2); execute_call(argument_fetch() | 0x500); }
-OPHANDLER( call_6 )         { burn_cycles(2); execute_call(argument_fetch() | 0x600); }
-OPHANDLER( call_7 )         { burn_cycles(2); execute_call(argument_fetch() | 0x700); }
-
-OPHANDLER( clr_a )          { burn_cycles(1); m.acc = 0; }
-OPHANDLER( clr_c )          { burn_cycles(1); m.psw &= ~C_FLAG; }
-OPHANDLER( clr_f0 )         { burn_cycles(1); m.psw &= ~F_FLAG; }
-OPHANDLER( clr_f1 )         { burn_cycles(1); m.f1 = false; }
-
-OPHANDLER( cpl_a )          { burn_cycles(1); m.acc ^= 0xff; }
-OPHANDLER( cpl_c )          { burn_cycles(1); m.psw ^= C_FLAG; }
-OPHANDLER( cpl_f0 )         { burn_cycles(1); m.psw ^= F_FLAG; }
-OPHANDLER( cpl_f1 )         { burn_cycles(1); m.f1 = !m.f1; }
+    u8 opcode = rom_read(m, m->prev_pc);
+    printf("Illegal opcode = %02x @ %04X\n", opcode, m->prev_pc);
 
-OPHANDLER( da_a ) {
-    burn_cycles(1);
+    // orl bus,#n and anl bus,#n are two bytes long in s_mcs48_lengths
+    if (opcode == 0x88 || opcode == 0x98)
+        argument_fetch(m);
+}
+
+OPHANDLER( add_a_r0 )       { execute_add(m, R0); }
+OPHANDLER( add_a_r1 )       { execute_add(m, R1); }
+OPHANDLER( add_a_r2 )       { execute_add(m, R2); }
+OPHANDLER( add_a_r3 )       { execute_add(m, R3); }
+OPHANDLER( add_a_r4 )       { execute_add(m, R4); }
+OPHANDLER( add_a_r5 )       { execute_add(m, R5); }
+OPHANDLER( add_a_r6 )       { execute_add(m, R6); }
+OPHANDLER( add_a_r7 )       { execute_add(m, R7); }
+OPHANDLER( add_a_xr0 )      { execute_add(m, ram_read(m, R0)); }
+OPHANDLER( add_a_xr1 )      { execute_add(m, ram_read(m, R1)); }
+OPHANDLER( add_a_n )        { execute_add(m, argument_fetch(m)); }
+
+OPHANDLER( adc_a_r0 )       { execute_addc(m, R0); }
+OPHANDLER( adc_a_r1 )       { execute_addc(m, R1); }
+OPHANDLER( adc_a_r2 )       { execute_addc(m, R2); }
+OPHANDLER( adc_a_r3 )       { execute_addc(m, R3); }
+OPHANDLER( adc_a_r4 )       { execute_addc(m, R4); }
+OPHANDLER( adc_a_r5 )       { execute_addc(m, R5); }
+OPHANDLER( adc_a_r6 )       { execute_addc(m, R6); }
+OPHANDLER( adc_a_r7 )       { execute_addc(m, R7); }
+OPHANDLER( adc_a_xr0 )      { execute_addc(m, ram_read(m, R0)); }
+OPHANDLER( adc_a_xr1 )      { execute_addc(m, ram_read(m, R1)); }
+OPHANDLER( adc_a_n )        { execute_addc(m, argument_fetch(m)); }
+
+OPHANDLER( anl_a_r0 )       { m->acc &= R0; }
+OPHANDLER( anl_a_r1 )       { m->acc &= R1; }
+OPHANDLER( anl_a_r2 )       { m->acc &= R2; }
+OPHANDLER( anl_a_r3 )       { m->acc &= R3; }
+OPHANDLER( anl_a_r4 )       { m->acc &= R4; }
+OPHANDLER( anl_a_r5 )       { m->acc &= R5; }
+OPHANDLER( anl_a_r6 )       { m->acc &= R6; }
+OPHANDLER( anl_a_r7 )       { m->acc &= R7; }
+OPHANDLER( anl_a_xr0 )      { m->acc &= ram_read(m, R0); }
+OPHANDLER( anl_a_xr1 )      { m->acc &= ram_read(m, R1); }
+OPHANDLER( anl_a_n )        { m->acc &= argument_fetch(m); }
+
+OPHANDLER( anl_p1_n )       { port1_write(m, m->p1 & argument_fetch(m)); }
+OPHANDLER( anl_p2_n )       { port2_write(m, (m->p2 & argument_fetch(m)) | ~P2_MASK); }
+
+OPHANDLER( call_0 )         { execute_call(m, argument_fetch(m) | 0x000); }
+OPHANDLER( call_1 )         { execute_call(m, argument_fetch(m) | 0x100); }
+OPHANDLER( call_2 )         { execute_call(m, argument_fetch(m) | 0x200); }
+OPHANDLER( call_3 )         { execute_call(m, argument_fetch(m) | 0x300); }
+OPHANDLER( call_4 )         { execute_call(m, argument_fetch(m) | 0x400); }
+OPHANDLER( call_5 )         { execute_call(m, argument_fetch(m) | 0x500); }
+OPHANDLER( call_6 )         { execute_call(m, argument_fetch(m) | 0x600); }
+OPHANDLER( call_7 )         { execute_call(m, argument_fetch(m) | 0x700); }
+
+OPHANDLER( clr_a )          { m->acc = 0; }
+OPHANDLER( clr_c )          { m->psw &= ~C_FLAG; }
+OPHANDLER( clr_f0 )         { m->psw &= ~F_FLAG; }
+OPHANDLER( clr_f1 )         { m->f1 = false; }
+
+OPHANDLER( cpl_a )          { m->acc ^= 0xff; }
+OPHANDLER( cpl_c )          { m->psw ^= C_FLAG; }
+OPHANDLER( cpl_f0 )         { m->psw ^= F_FLAG; }
+OPHANDLER( cpl_f1 )         { m->f1 = !m->f1; }
 
-    if ((m.acc & 0x0f) > 0x09 || (m.psw & A_FLAG)) {
-        if (m.acc > 0xf9)
-            m.psw |= C_FLAG;
-        m.acc += 0x06;
+OPHANDLER( da_a ) {
+    if ((m->acc & 0x0f) > 0x09 || (m->psw & A_FLAG)) {
+        if (m->acc > 0xf9)
+            m->psw |= C_FLAG;
+        m->acc += 0x06;
     }
-    if ((m.acc & 0xf0) > 0x90 || (m.psw & C_FLAG)) {
-        m.acc += 0x60;
-        m.psw |= C_FLAG;
+    if ((m->acc & 0xf0) > 0x90 || (m->psw & C_FLAG)) {
+        m->acc += 0x60;
+        m->psw |= C_FLAG;
     }
 }
 
-OPHANDLER( dec_a )          { burn_cycles(1); m.acc--; }
-OPHANDLER( dec_r0 )         { burn_cycles(1); R0--; }
-OPHANDLER( dec_r1 )         { burn_cycles(1); R1--; }
-OPHANDLER( dec_r2 )         { burn_cycles(1); R2--; }
-OPHANDLER( dec_r3 )         { burn_cycles(1); R3--; }
-OPHANDLER( dec_r4 )         { burn_cycles(1); R4--; }
-OPHANDLER( dec_r5 )         { burn_cycles(1); R5--; }
-OPHANDLER( dec_r6 )         { burn_cycles(1); R6--; }
-OPHANDLER( dec_r7 )         { burn_cycles(1); R7--; }
-
-OPHANDLER( dis_i )          { burn_cycles(1); m.xirq_enabled = false; }
-OPHANDLER( dis_tcnti )      { burn_cycles(1); m.tirq_enabled = false; m.timer_overflow = false; }
-
-OPHANDLER( djnz_r0 )        { burn_cycles(2); execute_jcc(--R0 != 0); }
-OPHANDLER( djnz_r1 )        { burn_cycles(2); execute_jcc(--R1 != 0); }
-OPHANDLER( djnz_r2 )        { burn_cycles(2); execute_jcc(--R2 != 0); }
-OPHANDLER( djnz_r3 )        { burn_cycles(2); execute_jcc(--R3 != 0); }
-OPHANDLER( djnz_r4 )        { burn_cycles(2); execute_jcc(--R4 != 0); }
-OPHANDLER( djnz_r5 )        { burn_cycles(2); execute_jcc(--R5 != 0); }
-OPHANDLER( djnz_r6 )        { burn_cycles(2); execute_jcc(--R6 != 0); }
-OPHANDLER( djnz_r7 )        { burn_cycles(2); execute_jcc(--R7 != 0); }
-
-OPHANDLER( en_i )           { burn_cycles(1); m.xirq_enabled = true; }
-OPHANDLER( en_tcnti )       { burn_cycles(1); m.tirq_enabled = true; }
-
-OPHANDLER( inc_a )          { burn_cycles(1); m.acc++; }
-OPHANDLER( inc_r0 )         { burn_cycles(1); R0++; }
-OPHANDLER( inc_r1 )         { burn_cycles(1); R1++; }
-OPHANDLER( inc_r2 )         { burn_cycles(1); R2++; }
-OPHANDLER( inc_r3 )         { burn_cycles(1); R3++; }
-OPHANDLER( inc_r4 )         { burn_cycles(1); R4++; }
-OPHANDLER( inc_r5 )         { burn_cycles(1); R5++; }
-OPHANDLER( inc_r6 )         { burn_cycles(1); R6++; }
-OPHANDLER( inc_r7 )         { burn_cycles(1); R7++; }
-OPHANDLER( inc_xr0 )        { burn_cycles(1); ram_write(R0, ram_read(R0) + 1); }
-OPHANDLER( inc_xr1 )        { burn_cycles(1); ram_write(R1, ram_read(R1) + 1); }
-
-OPHANDLER( jb_0 )           { burn_cycles(2); execute_jcc((m.acc & 0x01) != 0); }
-OPHANDLER( jb_1 )           { burn_cycles(2); execute_jcc((m.acc & 0x02) != 0); }
-OPHANDLER( jb_2 )           { burn_cycles(2); execute_jcc((m.acc & 0x04) != 0); }
-OPHANDLER( jb_3 )           { burn_cycles(2); execute_jcc((m.acc & 0x08) != 0); }
-OPHANDLER( jb_4 )           { burn_cycles(2); execute_jcc((m.acc & 0x10) != 0); }
-OPHANDLER( jb_5 )           { burn_cycles(2); execute_jcc((m.acc & 0x20) != 0); }
-OPHANDLER( jb_6 )           { burn_cycles(2); execute_jcc((m.acc & 0x40) != 0); }
-OPHANDLER( jb_7 )           { burn_cycles(2); execute_jcc((m.acc & 0x80) != 0); }
-OPHANDLER( jc )             { burn_cycles(2); execute_jcc((m.psw & C_FLAG) != 0); }
-OPHANDLER( jf0 )            { burn_cycles(2); execute_jcc((m.psw & F_FLAG) != 0); }
-OPHANDLER( jf1 )            { burn_cycles(2); execute_jcc(m.f1); }
-OPHANDLER( jnc )            { burn_cycles(2); execute_jcc((m.psw & C_FLAG) == 0); }
-OPHANDLER( jni )            { burn_cycles(2); m.irq_polled = (m.irq_state == 0); execute_jcc(m.irq_state != 0); }
-OPHANDLER( jnt_0 )          { burn_cycles(2); execute_jcc(t0_read() == 0); }
-OPHANDLER( jnt_1 )          { burn_cycles(2); execute_jcc(t1_read() == 0); }
-OPHANDLER( jnz )            { burn_cycles(2); execute_jcc(m.acc != 0); }
-OPHANDLER( jtf )            { burn_cycles(2); execute_jcc(m.timer_flag); m.timer_flag = false; }
-OPHANDLER( jt_0 )           { burn_cycles(2); execute_jcc(t0_read() != 0); }
-OPHANDLER( jt_1 )           { burn_cycles(2); execute_jcc(t1_read() != 0); }
-OPHANDLER( jz )             { burn_cycles(2); execute_jcc(m.acc == 0); }
-
-OPHANDLER( jmp_0 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x000); }
-OPHANDLER( jmp_1 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x100); }
-OPHANDLER( jmp_2 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x200); }
-OPHANDLER( jmp_3 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x300); }
-OPHANDLER( jmp_4 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x400); }
-OPHANDLER( jmp_5 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x500); }
-OPHANDLER( jmp_6 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x600); }
-OPHANDLER( jmp_7 )          { burn_cycles(2); execute_jmp(argument_fetch() | 0x700); }
-OPHANDLER( jmpp_xa )        { burn_cycles(2); m.pc &= 0xf00; m.pc |= rom_read(m.pc | m.acc); }
-
-OPHANDLER( mov_a_n )        { burn_cycles(2); m.acc = argument_fetch(); }
-OPHANDLER( mov_a_psw )      { burn_cycles(1); m.acc = m.psw | 0x08; }
-OPHANDLER( mov_a_r0 )       { burn_cycles(1); m.acc = R0; }
-OPHANDLER( mov_a_r1 )       { burn_cycles(1); m.acc = R1; }
-OPHANDLER( mov_a_r2 )       { burn_cycles(1); m.acc = R2; }
-OPHANDLER( mov_a_r3 )       { burn_cycles(1); m.acc = R3; }
-OPHANDLER( mov_a_r4 )       { burn_cycles(1); m.acc = R4; }
-OPHANDLER( mov_a_r5 )       { burn_cycles(1); m.acc = R5; }
-OPHANDLER( mov_a_r6 )       { burn_cycles(1); m.acc = R6; }
-OPHANDLER( mov_a_r7 )       { burn_cycles(1); m.acc = R7; }
-OPHANDLER( mov_a_xr0 )      { burn_cycles(1); m.acc = ram_read(R0); }
-OPHANDLER( mov_a_xr1 )      { burn_cycles(1); m.acc = ram_read(R1); }
-OPHANDLER( mov_a_t )        { burn_cycles(1); m.acc = m.timer_counter; }
-
-OPHANDLER( mov_psw_a )      { burn_cycles(1); m.psw = m.acc & ~0x08; update_reg_ptr(); }
-OPHANDLER( mov_r0_a )       { burn_cycles(1); R0 = m.acc; }
-OPHANDLER( mov_r1_a )       { burn_cycles(1); R1 = m.acc; }
-OPHANDLER( mov_r2_a )       { burn_cycles(1); R2 = m.acc; }
-OPHANDLER( mov_r3_a )       { burn_cycles(1); R3 = m.acc; }
-OPHANDLER( mov_r4_a )       { burn_cycles(1); R4 = m.acc; }
-OPHANDLER( mov_r5_a )       { burn_cycles(1); R5 = m.acc; }
-OPHANDLER( mov_r6_a )       { burn_cycles(1); R6 = m.acc; }
-OPHANDLER( mov_r7_a )       { burn_cycles(1); R7 = m.acc; }
-OPHANDLER( mov_r0_n )       { burn_cycles(2); R0 = argument_fetch(); }
-OPHANDLER( mov_r1_n )       { burn_cycles(2); R1 = argument_fetch(); }
-OPHANDLER( mov_r2_n )       { burn_cycles(2); R2 = argument_fetch(); }
-OPHANDLER( mov_r3_n )       { burn_cycles(2); R3 = argument_fetch(); }
-OPHANDLER( mov_r4_n )       { burn_cycles(2); R4 = argument_fetch(); }
-OPHANDLER( mov_r5_n )       { burn_cycles(2); R5 = argument_fetch(); }
-OPHANDLER( mov_r6_n )       { burn_cycles(2); R6 = argument_fetch(); }
-OPHANDLER( mov_r7_n )       { burn_cycles(2); R7 = argument_fetch(); }
-OPHANDLER( mov_t_a )        { burn_cycles(1); m.timer_counter = m.acc; }
-OPHANDLER( mov_xr0_a )      { burn_cycles(1); ram_write(R0, m.acc); }
-OPHANDLER( mov_xr1_a )      { burn_cycles(1); ram_write(R1, m.acc); }
-OPHANDLER( mov_xr0_n )      { burn_cycles(2); ram_write(R0, argument_fetch()); }
-OPHANDLER( mov_xr1_n )      { burn_cycles(2); ram_write(R1, argument_fetch()); }
-
-OPHANDLER( movp_a_xa )      { burn_cycles(2); m.acc = rom_read((m.pc & 0xf00) | m.acc); }
-OPHANDLER( movp3_a_xa )     { burn_cycles(2); m.acc = rom_read(0x300 | m.acc); }
-
-OPHANDLER( movx_a_xr0 )     { burn_cycles(2); m.acc = ext_mem_read(R0); }
-OPHANDLER( movx_a_xr1 )     { burn_cycles(2); m.acc = ext_mem_read(R1); }
-OPHANDLER( movx_xr0_a )     { burn_cycles(2); ext_mem_write(R0, m.acc); }
-OPHANDLER( movx_xr1_a )     { burn_cycles(2); ext_mem_write(R1, m.acc); }
-
-OPHANDLER( nop )            { burn_cycles(1); }
-
-OPHANDLER( orl_a_r0 )       { burn_cycles(1); m.acc |= R0; }
-OPHANDLER( orl_a_r1 )       { burn_cycles(1); m.acc |= R1; }
-OPHANDLER( orl_a_r2 )       { burn_cycles(1); m.acc |= R2; }
-OPHANDLER( orl_a_r3 )       { burn_cycles(1); m.acc |= R3; }
-OPHANDLER( orl_a_r4 )       { burn_cycles(1); m.acc |= R4; }
-OPHANDLER( orl_a_r5 )       { burn_cycles(1); m.acc |= R5; }
-OPHANDLER( orl_a_r6 )       { burn_cycles(1); m.acc |= R6; }
-OPHANDLER( orl_a_r7 )       { burn_cycles(1); m.acc |= R7; }
-OPHANDLER( orl_a_xr0 )      { burn_cycles(1); m.acc |= ram_read(R0); }
-OPHANDLER( orl_a_xr1 )      { burn_cycles(1); m.acc |= ram_read(R1); }
-OPHANDLER( orl_a_n )        { burn_cycles(2); m.acc |= argument_fetch(); }
-
-OPHANDLER( orl_p1_n )       { burn_cycles(2); port1_write(m.p1 | argument_fetch()); }
-OPHANDLER( orl_p2_n )       { burn_cycles(2); port2_write((m.p2 | argument_fetch()) & P2_MASK); }
-
-OPHANDLER( ret )            { burn_cycles(2); pull_pc(); }
-OPHANDLER( retr ) {
-    burn_cycles(2);
+OPHANDLER( dec_a )          { m->acc--; }
+OPHANDLER( dec_r0 )         { R0--; }
+OPHANDLER( dec_r1 )         { R1--; }
+OPHANDLER( dec_r2 )         { R2--; }
+OPHANDLER( dec_r3 )         { R3--; }
+OPHANDLER( dec_r4 )         { R4--; }
+OPHANDLER( dec_r5 )         { R5--; }
+OPHANDLER( dec_r6 )         { R6--; }
+OPHANDLER( dec_r7 )         { R7--; }
+
+OPHANDLER( dis_i )          { m->xirq_enabled = false; }
+OPHANDLER( dis_tcnti )      { m->tirq_enabled = false; m->timer_overflow = false; }
+
+OPHANDLER( djnz_r0 )        { execute_jcc(m, --R0 != 0); }
+OPHANDLER( djnz_r1 )        { execute_jcc(m, --R1 != 0); }
+OPHANDLER( djnz_r2 )        { execute_jcc(m, --R2 != 0); }
+OPHANDLER( djnz_r3 )        { execute_jcc(m, --R3 != 0); }
+OPHANDLER( djnz_r4 )        { execute_jcc(m, --R4 != 0); }
+OPHANDLER( djnz_r5 )        { execute_jcc(m, --R5 != 0); }
+OPHANDLER( djnz_r6 )        { execute_jcc(m, --R6 != 0); }
+OPHANDLER( djnz_r7 )        { execute_jcc(m, --R7 != 0); }
+
+OPHANDLER( en_i ) {
+    if (!m->xirq_enabled)
+        m->xirq_enabled_clk = m->master_clk;
+    m->xirq_enabled = true;
+}
 
+OPHANDLER( en_tcnti ) {
+    if (!m->tirq_enabled)
+        m->tirq_enabled_clk = m->master_clk;
+    m->tirq_enabled = true;
+}
+
+OPHANDLER( inc_a )          { m->acc++; }
+OPHANDLER( inc_r0 )         { R0++; }
+OPHANDLER( inc_r1 )         { R1++; }
+OPHANDLER( inc_r2 )         { R2++; }
+OPHANDLER( inc_r3 )         { R3++; }
+OPHANDLER( inc_r4 )         { R4++; }
+OPHANDLER( inc_r5 )         { R5++; }
+OPHANDLER( inc_r6 )         { R6++; }
+OPHANDLER( inc_r7 )         { R7++; }
+OPHANDLER( inc_xr0 )        { ram_write(m, R0, ram_read(m, R0) + 1); }
+OPHANDLER( inc_xr1 )        { ram_write(m, R1, ram_read(m, R1) + 1); }
+
+OPHANDLER( jb_0 )           { execute_jcc(m, (m->acc & 0x01) != 0); }
+OPHANDLER( jb_1 )           { execute_jcc(m, (m->acc & 0x02) != 0); }
+OPHANDLER( jb_2 )           { execute_jcc(m, (m->acc & 0x04) != 0); }
+OPHANDLER( jb_3 )           { execute_jcc(m, (m->acc & 0x08) != 0); }
+OPHANDLER( jb_4 )           { execute_jcc(m, (m->acc & 0x10) != 0); }
+OPHANDLER( jb_5 )           { execute_jcc(m, (m->acc & 0x20) != 0); }
+OPHANDLER( jb_6 )           { execute_jcc(m, (m->acc & 0x40) != 0); }
+OPHANDLER( jb_7 )           { execute_jcc(m, (m->acc & 0x80) != 0); }
+OPHANDLER( jc )             { execute_jcc(m, (m->psw & C_FLAG) != 0); }
+OPHANDLER( jf0 )            { execute_jcc(m, (m->psw & F_FLAG) != 0); }
+OPHANDLER( jf1 )            { execute_jcc(m, m->f1); }
+OPHANDLER( jnc )            { execute_jcc(m, (m->psw & C_FLAG) == 0); }
+OPHANDLER( jni )            { m->irq_polled = (m->irq_state == 0); execute_jcc(m, m->irq_state != 0); }
+OPHANDLER( jnt_0 )          { execute_jcc(m, t0_read(m) == 0); }
+OPHANDLER( jnt_1 )          { execute_jcc(m, t1_read(m) == 0); }
+OPHANDLER( jnz )            { execute_jcc(m, m->acc != 0); }
+OPHANDLER( jtf )            { execute_jcc(m, m->timer_flag); m->timer_flag = false; }
+OPHANDLER( jt_0 )           { execute_jcc(m, t0_read(m) != 0); }
+OPHANDLER( jt_1 )           { execute_jcc(m, t1_read(m) != 0); }
+OPHANDLER( jz )             { execute_jcc(m, m->acc == 0); }
+
+OPHANDLER( jmp_0 )          { execute_jmp(m, argument_fetch(m) | 0x000); }
+OPHANDLER( jmp_1 )          { execute_jmp(m, argument_fetch(m) | 0x100); }
+OPHANDLER( jmp_2 )          { execute_jmp(m, argument_fetch(m) | 0x200); }
+OPHANDLER( jmp_3 )          { execute_jmp(m, argument_fetch(m) | 0x300); }
+OPHANDLER( jmp_4 )          { execute_jmp(m, argument_fetch(m) | 0x400); }
+OPHANDLER( jmp_5 )          { execute_jmp(m, argument_fetch(m) | 0x500); }
+OPHANDLER( jmp_6 )          { execute_jmp(m, argument_fetch(m) | 0x600); }
+OPHANDLER( jmp_7 )          { execute_jmp(m, argument_fetch(m) | 0x700); }
+OPHANDLER( jmpp_xa )        { m->pc &= 0xf00; m->pc |= rom_read(m, m->pc | m->acc); }
+
+OPHANDLER( mov_a_n )        { m->acc = argument_fetch(m); }
+OPHANDLER( mov_a_psw )      { m->acc = m->psw | 0x08; }
+OPHANDLER( mov_a_r0 )       { m->acc = R0; }
+OPHANDLER( mov_a_r1 )       { m->acc = R1; }
+OPHANDLER( mov_a_r2 )       { m->acc = R2; }
+OPHANDLER( mov_a_r3 )       { m->acc = R3; }
+OPHANDLER( mov_a_r4 )       { m->acc = R4; }
+OPHANDLER( mov_a_r5 )       { m->acc = R5; }
+OPHANDLER( mov_a_r6 )       { m->acc = R6; }
+OPHANDLER( mov_a_r7 )       { m->acc = R7; }
+OPHANDLER( mov_a_xr0 )      { m->acc = ram_read(m, R0); }
+OPHANDLER( mov_a_xr1 )      { m->acc = ram_read(m, R1); }
+OPHANDLER( mov_a_t )        { m->acc = m->timer_counter; }
+
+OPHANDLER( mov_psw_a )      { m->psw = m->acc & ~0x08; update_reg_base(m); }
+OPHANDLER( mov_r0_a )       { R0 = m->acc; }
+OPHANDLER( mov_r1_a )       { R1 = m->acc; }
+OPHANDLER( mov_r2_a )       { R2 = m->acc; }
+OPHANDLER( mov_r3_a )       { R3 = m->acc; }
+OPHANDLER( mov_r4_a )       { R4 = m->acc; }
+OPHANDLER( mov_r5_a )       { R5 = m->acc; }
+OPHANDLER( mov_r6_a )       { R6 = m->acc; }
+OPHANDLER( mov_r7_a )       { R7 = m->acc; }
+OPHANDLER( mov_r0_n )       { R0 = argument_fetch(m); }
+OPHANDLER( mov_r1_n )       { R1 = argument_fetch(m); }
+OPHANDLER( mov_r2_n )       { R2 = argument_fetch(m); }
+OPHANDLER( mov_r3_n )       { R3 = argument_fetch(m); }
+OPHANDLER( mov_r4_n )       { R4 = argument_fetch(m); }
+OPHANDLER( mov_r5_n )       { R5 = argument_fetch(m); }
+OPHANDLER( mov_r6_n )       { R6 = argument_fetch(m); }
+OPHANDLER( mov_r7_n )       { R7 = argument_fetch(m); }
+OPHANDLER( mov_t_a )        { m->timer_counter = m->acc; }
+OPHANDLER( mov_xr0_a )      { ram_write(m, R0, m->acc); }
+OPHANDLER( mov_xr1_a )      { ram_write(m, R1, m->acc); }
+OPHANDLER( mov_xr0_n )      { ram_write(m, R0, argument_fetch(m)); }
+OPHANDLER( mov_xr1_n )      { ram_write(m, R1, argument_fetch(m)); }
+
+OPHANDLER( movp_a_xa )      { m->acc = rom_read(m, (m->pc & 0xf00) | m->acc); }
+OPHANDLER( movp3_a_xa )     { m->acc = rom_read(m, 0x300 | m->acc); }
+
+OPHANDLER( movx_a_xr0 )     { m->acc = ext_mem_read(m, R0); }
+OPHANDLER( movx_a_xr1 )     { m->acc = ext_mem_read(m, R1); }
+OPHANDLER( movx_xr0_a )     { ext_mem_write(m, R0, m->acc); }
+OPHANDLER( movx_xr1_a )     { ext_mem_write(m, R1, m->acc); }
+
+OPHANDLER( nop )            { }
+
+OPHANDLER( orl_a_r0 )       { m->acc |= R0; }
+OPHANDLER( orl_a_r1 )       { m->acc |= R1; }
+OPHANDLER( orl_a_r2 )       { m->acc |= R2; }
+OPHANDLER( orl_a_r3 )       { m->acc |= R3; }
+OPHANDLER( orl_a_r4 )       { m->acc |= R4; }
+OPHANDLER( orl_a_r5 )       { m->acc |= R5; }
+OPHANDLER( orl_a_r6 )       { m->acc |= R6; }
+OPHANDLER( orl_a_r7 )       { m->acc |= R7; }
+OPHANDLER( orl_a_xr0 )      { m->acc |= ram_read(m, R0); }
+OPHANDLER( orl_a_xr1 )      { m->acc |= ram_read(m, R1); }
+OPHANDLER( orl_a_n )        { m->acc |= argument_fetch(m); }
+
+OPHANDLER( orl_p1_n )       { port1_write(m, m->p1 | argument_fetch(m)); }
+OPHANDLER( orl_p2_n )       { port2_write(m, (m->p2 | argument_fetch(m)) & P2_MASK); }
+
+OPHANDLER( ret )            { pull_pc(m); }
+OPHANDLER( retr ) {
     // implicitly clear the IRQ in progress flip flop
-    m.irq_in_progress = false;
-    pull_pc_psw();
+    if (m->irq_stats && m->irq_in_progress)
+        add_irq_sample(&m->irq_stats->duration[m->irq_source], m->master_clk - m->irq_entry_clk);
+    m->irq_in_progress = false;
+    pull_pc_psw(m);
 }
 
-OPHANDLER( rl_a )           { burn_cycles(1); m.acc = (m.acc << 1) | (m.acc >> 7); }
-OPHANDLER( rlc_a )          { burn_cycles(1); u8 newc = m.acc & C_FLAG; m.acc = (m.acc << 1) | (m.psw >> 7); m.psw = (m.psw & ~C_FLAG) | newc; }
+OPHANDLER( rl_a )           { m->acc = (m->acc << 1) | (m->acc >> 7); }
+OPHANDLER( rlc_a )          { u8 newc = m->acc & C_FLAG; m->acc = (m->acc << 1) | (m->psw >> 7); m->psw = (m->psw & ~C_FLAG) | newc; }
 
-OPHANDLER( rr_a )           { burn_cycles(1); m.acc = (m.acc >> 1) | (m.acc << 7); }
-OPHANDLER( rrc_a )          { burn_cycles(1); u8 newc = (m.acc << 7) & C_FLAG; m.acc = (m.acc >> 1) | (m.psw & C_FLAG); m.psw = (m.psw & ~C_FLAG) | newc; }
+OPHANDLER( rr_a )           { m->acc = (m->acc >> 1) | (m->acc << 7); }
+OPHANDLER( rrc_a )          { u8 newc = (m->acc << 7) & C_FLAG; m->acc = (m->acc >> 1) | (m->psw & C_FLAG); m->psw = (m->psw & ~C_FLAG) | newc; }
 
-OPHANDLER( sel_mb0 )        { burn_cycles(1); m.a11 = 0x000; }
-OPHANDLER( sel_mb1 )        { burn_cycles(1); m.a11 = 0x800; }
+OPHANDLER( sel_mb0 )        { m->a11 = 0x000; }
+OPHANDLER( sel_mb1 )        { m->a11 = 0x800; }
 
-OPHANDLER( sel_rb0 )        { burn_cycles(1); m.psw &= ~B_FLAG; update_reg_ptr(); }
-OPHANDLER( sel_rb1 )        { burn_cycles(1); m.psw |=  B_FLAG; update_reg_ptr(); }
+OPHANDLER( sel_rb0 )        { m->psw &= ~B_FLAG; update_reg_base(m); }
+OPHANDLER( sel_rb1 )        { m->psw |=  B_FLAG; update_reg_base(m); }
 
-OPHANDLER( stop_tcnt )      { burn_cycles(1); m.timecount_enabled = 0; }
-OPHANDLER( strt_t )         { burn_cycles(1); m.timecount_enabled = TIMER_ENABLED; m.prescaler = 0; }
+OPHANDLER( stop_tcnt )      { m->timecount_enabled = 0; }
+OPHANDLER( strt_t )         { m->timecount_enabled = TIMER_ENABLED; m->prescaler = 0; }
 OPHANDLER( strt_cnt ) {
-    burn_cycles(1);
-    if (!(m.timecount_enabled & COUNTER_ENABLED))
-        m.t1_history = t1_read();
+    if (!(m->timecount_enabled & COUNTER_ENABLED))
+        m->t1_history = t1_read(m);
 
-    m.timecount_enabled = COUNTER_ENABLED;
+    m->timecount_enabled = COUNTER_ENABLED;
 }
 
-OPHANDLER( swap_a )         { burn_cycles(1); m.acc = (m.acc << 4) | (m.acc >> 4); }
+OPHANDLER( swap_a )         { m->acc = (m->acc << 4) | (m->acc >> 4); }
+
+OPHANDLER( xch_a_r0 )       { u8 tmp = m->acc; m->acc = R0; R0 = tmp; }
+OPHANDLER( xch_a_r1 )       { u8 tmp = m->acc; m->acc = R1; R1 = tmp; }
+OPHANDLER( xch_a_r2 )       { u8 tmp = m->acc; m->acc = R2; R2 = tmp; }
+OPHANDLER( xch_a_r3 )       { u8 tmp = m->acc; m->acc = R3; R3 = tmp; }
+OPHANDLER( xch_a_r4 )       { u8 tmp = m->acc; m->acc = R4; R4 = tmp; }
+OPHANDLER( xch_a_r5 )       { u8 tmp = m->acc; m->acc = R5; R5 = tmp; }
+OPHANDLER( xch_a_r6 )       { u8 tmp = m->acc; m->acc = R6; R6 = tmp; }
+OPHANDLER( xch_a_r7 )       { u8 tmp = m->acc; m->acc = R7; R7 = tmp; }
+OPHANDLER( xch_a_xr0 )      { u8 tmp = m->acc; m->acc = ram_read(m, R0); ram_write(m, R0, tmp); }
+OPHANDLER( xch_a_xr1 )      { u8 tmp = m->acc; m->acc = ram_read(m, R1); ram_write(m, R1, tmp); }
+
+OPHANDLER( xchd_a_xr0 )     { u8 oldram = ram_read(m, R0); ram_write(m, R0, (oldram & 0xf0) | (m->acc & 0x0f)); m->acc = (m->acc & 0xf0) | (oldram & 0x0f); }
+OPHANDLER( xchd_a_xr1 )     { u8 oldram = ram_read(m, R1); ram_write(m, R1, (oldram & 0xf0) | (m->acc & 0x0f)); m->acc = (m->acc & 0xf0) | (oldram & 0x0f); }
+
+OPHANDLER( xrl_a_r0 )       { m->acc ^= R0; }
+OPHANDLER( xrl_a_r1 )       { m->acc ^= R1; }
+OPHANDLER( xrl_a_r2 )       { m->acc ^= R2; }
+OPHANDLER( xrl_a_r3 )       { m->acc ^= R3; }
+OPHANDLER( xrl_a_r4 )       { m->acc ^= R4; }
+OPHANDLER( xrl_a_r5 )       { m->acc ^= R5; }
+OPHANDLER( xrl_a_r6 )       { m->acc ^= R6; }
+OPHANDLER( xrl_a_r7 )       { m->acc ^= R7; }
+OPHANDLER( xrl_a_xr0 )      { m->acc ^= ram_read(m, R0); }
+OPHANDLER( xrl_a_xr1 )      { m->acc ^= ram_read(m, R1); }
+OPHANDLER( xrl_a_n )        { m->acc ^= argument_fetch(m); }
+
+
+// The handler, length and cycles of each opcode come from MCS48_ISA_TABLE, as
+// the assembler's do. The handlers are used to build both the call table and,
+// when CPU_THREADED_DISPATCH is on, the computed-goto label table.
+#define OP(_n, _len, _cycles, _kind, _mnemonic, _operands, _a) &_a,
+#define OP_CYCLES(_n, _len, _cycles, _kind, _mnemonic, _operands, _a) _cycles,
+#define OP_LENGTH(_n, _len, _cycles, _kind, _mnemonic, _operands, _a) _len,
+
+typedef void (*mcs48_ophandler)(cpu_t *m);
 
-OPHANDLER( xch_a_r0 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R0; R0 = tmp; }
-OPHANDLER( xch_a_r1 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R1; R1 = tmp; }
-OPHANDLER( xch_a_r2 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R2; R2 = tmp; }
-OPHANDLER( xch_a_r3 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R3; R3 = tmp; }
-OPHANDLER( xch_a_r4 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R4; R4 = tmp; }
-OPHANDLER( xch_a_r5 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R5; R5 = tmp; }
-OPHANDLER( xch_a_r6 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R6; R6 = tmp; }
-OPHANDLER( xch_a_r7 )       { burn_cycles(1); u8 tmp = m.acc; m.acc = R7; R7 = tmp; }
-OPHANDLER( xch_a_xr0 )      { burn_cycles(1); u8 tmp = m.acc; m.acc = ram_read(R0); ram_write(R0, tmp); }
-OPHANDLER( xch_a_xr1 )      { burn_cycles(1); u8 tmp = m.acc; m.acc = ram_read(R1); ram_write(R1, tmp); }
-
-OPHANDLER( xchd_a_xr0 )     { burn_cycles(1); u8 oldram = ram_read(R0); ram_write(R0, (oldram & 0xf0) | (m.acc & 0x0f)); m.acc = (m.acc & 0xf0) | (oldram & 0x0f); }
-OPHANDLER( xchd_a_xr1 )     { burn_cycles(1); u8 oldram = ram_read(R1); ram_write(R1, (oldram & 0xf0) | (m.acc & 0x0f)); m.acc = (m.acc & 0xf0) | (oldram & 0x0f); }
+static const mcs48_ophandler s_mcs48_opcodes[256] = {
+    MCS48_ISA_TABLE(OP)
+};
 
-OPHANDLER( xrl_a_r0 )       { burn_cycles(1); m.acc ^= R0; }
-OPHANDLER( xrl_a_r1 )       { burn_cycles(1); m.acc ^= R1; }
-OPHANDLER( xrl_a_r2 )       { burn_cycles(1); m.acc ^= R2; }
-OPHANDLER( xrl_a_r3 )       { burn_cycles(1); m.acc ^= R3; }
-OPHANDLER( xrl_a_r4 )       { burn_cycles(1); m.acc ^= R4; }
-OPHANDLER( xrl_a_r5 )       { burn_cycles(1); m.acc ^= R5; }
-OPHANDLER( xrl_a_r6 )       { burn_cycles(1); m.acc ^= R6; }
-OPHANDLER( xrl_a_r7 )       { burn_cycles(1); m.acc ^= R7; }
-OPHANDLER( xrl_a_xr0 )      { burn_cycles(1); m.acc ^= ram_read(R0); }
-OPHANDLER( xrl_a_xr1 )      { burn_cycles(1); m.acc ^= ram_read(R1); }
-OPHANDLER( xrl_a_n )        { burn_cycles(2); m.acc ^= argument_fetch(); }
+// Number of cycles taken by each opcode
+static const u8 s_mcs48_cycles[256] = {
+    MCS48_ISA_TABLE(OP_CYCLES)
+};
 
+// Number of bytes in each instruction, including the opcode
+static const u8 s_mcs48_lengths[256] = {
+    MCS48_ISA_TABLE(OP_LENGTH)
+};
 
-#define OP(_a) &_a
+// Properties used by the decode cache. See decoded_insn_t.
+static const u8 s_mcs48_flags[256] = {
+    0,    SLOW, SLOW, 0,    END,  END,  SLOW, 0,      // 00
+    SLOW, SLOW, SLOW, SLOW, SLOW, SLOW, SLOW, SLOW,
+    0,    0,    0,    0,    END,  0,    0,    0,      // 10
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    SLOW, 0,    END,  END,  0,    0,      // 20
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    SLOW, END,  0,    0,    0,      // 30
+    SLOW, SLOW, SLOW, SLOW, SLOW, SLOW, SLOW, SLOW,
+    0,    0,    SLOW, 0,    END,  SLOW, 0,    0,      // 40
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    0,    END,  SLOW, 0,    0,      // 50
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    SLOW, SLOW, END,  SLOW, SLOW, 0,      // 60
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    SLOW, END,  SLOW, 0,    0,      // 70
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    SLOW, END,  END,  0,    END,  SLOW,   // 80
+    SLOW, 0,    0,    SLOW, SLOW, SLOW, SLOW, SLOW,
+    0,    0,    0,    END,  END,  0,    0,    0,      // 90
+    SLOW, 0,    0,    SLOW, SLOW, SLOW, SLOW, SLOW,
+    0,    0,    SLOW, 0,    END,  0,    SLOW, 0,      // A0
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    END,  END,  0,    0,    SLOW,   // B0
+    0,    0,    0,    0,    0,    0,    0,    0,
+    SLOW, SLOW, SLOW, SLOW, END,  0,    0,    0,      // C0
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    0,    END,  0,    SLOW, 0,      // D0
+    0,    0,    0,    0,    0,    0,    0,    0,
+    SLOW, SLOW, SLOW, 0,    END,  0,    0,    0,      // E0
+    0,    0,    0,    0,    0,    0,    0,    0,
+    0,    0,    0,    SLOW, END,  0,    0,    0,      // F0
+    0,    0,    0,    0,    0,    0,    0,    0
+};
 
-typedef void (*mcs48_ophandler)(void);
 
-static const mcs48_ophandler s_mcs48_opcodes[256] = {
-    OP(nop),        OP(illegal),    OP(illegal),   OP(add_a_n),   OP(jmp_0),     OP(en_i),       OP(illegal),   OP(dec_a),      // 00
-    OP(illegal),    OP(illegal),    OP(illegal),   OP(illegal),   OP(illegal),   OP(illegal),    OP(illegal),   OP(illegal),
-    OP(inc_xr0),    OP(inc_xr1),    OP(jb_0),      OP(adc_a_n),   OP(call_0),    OP(dis_i),      OP(jtf),       OP(inc_a),      // 10
-    OP(inc_r0),     OP(inc_r1),     OP(inc_r2),    OP(inc_r3),    OP(inc_r4),    OP(inc_r5),     OP(inc_r6),    OP(inc_r7),
-    OP(xch_a_xr0),  OP(xch_a_xr1),  OP(illegal),   OP(mov_a_n),   OP(jmp_1),     OP(en_tcnti),   OP(jnt_0),     OP(clr_a),      // 20
-    OP(xch_a_r0),   OP(xch_a_r1),   OP(xch_a_r2),  OP(xch_a_r3),  OP(xch_a_r4),  OP(xch_a_r5),   OP(xch_a_r6),  OP(xch_a_r7),
-    OP(xchd_a_xr0), OP(xchd_a_xr1), OP(jb_1),      OP(illegal),   OP(call_1),    OP(dis_tcnti),  OP(jt_0),      OP(cpl_a),      // 30
-    OP(illegal),    OP(illegal),    OP(illegal),   OP(illegal),   OP(illegal),   OP(illegal),    OP(illegal),   OP(illegal),
-    OP(orl_a_xr0),  OP(orl_a_xr1),  OP(mov_a_t),   OP(orl_a_n),   OP(jmp_2),     OP(strt_cnt),   OP(jnt_1),     OP(swap_a),     // 40
-    OP(orl_a_r0),   OP(orl_a_r1),   OP(orl_a_r2),  OP(orl_a_r3),  OP(orl_a_r4),  OP(orl_a_r5),   OP(orl_a_r6),  OP(orl_a_r7),
-    OP(anl_a_xr0),  OP(anl_a_xr1),  OP(jb_2),      OP(anl_a_n),   OP(call_2),    OP(strt_t),     OP(jt_1),      OP(da_a),       // 50
-    OP(anl_a_r0),   OP(anl_a_r1),   OP(anl_a_r2),  OP(anl_a_r3),  OP(anl_a_r4),  OP(anl_a_r5),   OP(anl_a_r6),  OP(anl_a_r7),
-    OP(add_a_xr0),  OP(add_a_xr1),  OP(mov_t_a),   OP(illegal),   OP(jmp_3),     OP(stop_tcnt),  OP(illegal),   OP(rrc_a),      // 60
-    OP(add_a_r0),   OP(add_a_r1),   OP(add_a_r2),  OP(add_a_r3),  OP(add_a_r4),  OP(add_a_r5),   OP(add_a_r6),  OP(add_a_r7),
-    OP(adc_a_xr0),  OP(adc_a_xr1),  OP(jb_3),      OP(illegal),   OP(call_3),    OP(illegal),    OP(jf1),       OP(rr_a),       // 70
-    OP(adc_a_r0),   OP(adc_a_r1),   OP(adc_a_r2),  OP(adc_a_r3),  OP(adc_a_r4),  OP(adc_a_r5),   OP(adc_a_r6),  OP(adc_a_r7),
-    OP(movx_a_xr0), OP(movx_a_xr1), OP(illegal),   OP(ret),       OP(jmp_4),     OP(clr_f0),     OP(jni),       OP(illegal),    // 80
-    OP(illegal),    OP(orl_p1_n),   OP(orl_p2_n),  OP(illegal),   OP(illegal),   OP(illegal),    OP(illegal),   OP(illegal),
-    OP(movx_xr0_a), OP(movx_xr1_a), OP(jb_4),      OP(retr),      OP(call_4),    OP(cpl_f0),     OP(jnz),       OP(clr_c),      // 90
-    OP(illegal),    OP(anl_p1_n),   OP(anl_p2_n),  OP(illegal),   OP(illegal),   OP(illegal),    OP(illegal),   OP(illegal),
-    OP(mov_xr0_a),  OP(mov_xr1_a),  OP(illegal),   OP(movp_a_xa), OP(jmp_5),     OP(clr_f1),     OP(illegal),   OP(cpl_c),      // A0
-    OP(mov_r0_a),   OP(mov_r1_a),   OP(mov_r2_a),  OP(mov_r3_a),  OP(mov_r4_a),  OP(mov_r5_a),   OP(mov_r6_a),  OP(mov_r7_a),
-    OP(mov_xr0_n),  OP(mov_xr1_n),  OP(jb_5),      OP(jmpp_xa),   OP(call_5),    OP(cpl_f1),     OP(jf0),       OP(illegal),    // B0
-    OP(mov_r0_n),   OP(mov_r1_n),   OP(mov_r2_n),  OP(mov_r3_n),  OP(mov_r4_n),  OP(mov_r5_n),   OP(mov_r6_n),  OP(mov_r7_n),
-    OP(illegal),    OP(illegal),    OP(illegal),   OP(illegal),   OP(jmp_6),     OP(sel_rb0),    OP(jz),        OP(mov_a_psw),  // C0
-    OP(dec_r0),     OP(dec_r1),     OP(dec_r2),    OP(dec_r3),    OP(dec_r4),    OP(dec_r5),     OP(dec_r6),    OP(dec_r7),
-    OP(xrl_a_xr0),  OP(xrl_a_xr1),  OP(jb_6),      OP(xrl_a_n),   OP(call_6),    OP(sel_rb1),    OP(illegal),   OP(mov_psw_a),  // D0
-    OP(xrl_a_r0),   OP(xrl_a_r1),   OP(xrl_a_r2),  OP(xrl_a_r3),  OP(xrl_a_r4),  OP(xrl_a_r5),   OP(xrl_a_r6),  OP(xrl_a_r7),
-    OP(illegal),    OP(illegal),    OP(illegal),   OP(movp3_a_xa),OP(jmp_7),     OP(sel_mb0),    OP(jnc),       OP(rl_a),       // E0
-    OP(djnz_r0),    OP(djnz_r1),    OP(djnz_r2),   OP(djnz_r3),   OP(djnz_r4),   OP(djnz_r5),    OP(djnz_r6),   OP(djnz_r7),
-    OP(mov_a_xr0),  OP(mov_a_xr1),  OP(jb_7),      OP(illegal),   OP(call_7),    OP(sel_mb1),    OP(jc),        OP(rlc_a),      // F0
-    OP(mov_a_r0),   OP(mov_a_r1),   OP(mov_a_r2),  OP(mov_a_r3),  OP(mov_a_r4),  OP(mov_a_r5),   OP(mov_a_r6),  OP(mov_a_r7)
+// One entry per ROM address. A block is the straight-line run of instructions
+// starting at an entry, up to and including the first END instruction, and
+// stopping before any SLOW instruction. Execution leaves a block early if a
+// conditional branch is taken. Blocks are run without checking for interrupts
+// or the end of the time slice between instructions, and with the timer
+// updated once at the end. That is only exact if the timer can't overflow
+// within the block, so cpu_execute() checks that first.
+struct decoded_insn_t {
+    mcs48_ophandler handler;
+    u16 next_pc;        // PC after the opcode byte, as the handler expects to find it
+    u16 following_pc;   // PC of the next instruction in the straight-line run
+    u8 cycles;
+    u8 flags;
+    u8 block_insns;     // Number of instructions in the block starting here. 0 if the first is SLOW.
+    u8 block_cycles;    // Total cycles of the block
 };
 
+static void decode_insn(cpu_t *m, u16 pc) {
+    decoded_insn_t *d = &m->decode_cache[pc];
+    u8 opcode = m->rom[pc];
+    d->handler = s_mcs48_opcodes[opcode];
+    d->next_pc = ((pc + 1) & 0x7ff) | (pc & 0x800);
+    d->following_pc = ((pc + s_mcs48_lengths[opcode]) & 0x7ff) | (pc & 0x800);
+    d->cycles = s_mcs48_cycles[opcode];
+    d->flags = s_mcs48_flags[opcode] | DECODED;
+}
+
+static void decode_block(cpu_t *m, u16 pc) {
+    decoded_insn_t *start = &m->decode_cache[pc];
+    int num_insns = 0;
+    int num_cycles = 0;
+    while (num_insns < MAX_BLOCK_INSNS) {
+        decoded_insn_t *d = &m->decode_cache[pc];
+        if (!(d->flags & DECODED))
+            decode_insn(m, pc);
+        if (d->flags & SLOW)
+            break;
+
+        num_insns++;
+        num_cycles += d->cycles;
+        if (d->flags & END)
+            break;
+        pc = d->following_pc;
+    }
+
+    start->block_insns = num_insns;
+    start->block_cycles = num_cycles;
+    start->flags |= HAS_BLOCK;
+}
+
+static inline decoded_insn_t const *get_block(cpu_t *m, u16 pc) {
+    decoded_insn_t const *block = &m->decode_cache[pc];
+    if (!(block->flags & HAS_BLOCK))
+        decode_block(m, pc);
+    return block;
+}
+
+// Returns true if running the whole block gives the same result as stepping
+// through it one instruction at a time.
+static inline bool can_run_block(cpu_t *m, decoded_insn_t const *block) {
+    if (block->block_insns == 0 || m->icount < block->block_cycles)
+        return false;
+
+    // The counter polls T1 every cycle
+    if (m->timecount_enabled & COUNTER_ENABLED)
+        return false;
+
+    if (m->timecount_enabled & TIMER_ENABLED) {
+        unsigned prescaler_ticks = (m->timer_counter << 5) + m->prescaler + block->block_cycles;
+        if (prescaler_ticks >= 0x2000)
+            return false;   // The timer would overflow within the block
+    }
+
+    return true;
+}
+
+// Accounts for a block in one go. Only valid if can_run_block() said so.
+static void finish_block(cpu_t *m, int num_cycles, int num_insns) {
+    m->icount -= num_cycles;
+    if (m->timecount_enabled & TIMER_ENABLED) {
+        m->prescaler += num_cycles;
+        m->timer_counter += m->prescaler >> 5;
+        m->prescaler &= 0x1f;
+    }
+
+    m->num_insns += num_insns;
+}
+
+static void execute_block(cpu_t *m, decoded_insn_t const *block) {
+    unsigned start_clk = m->master_clk;
+    int num_insns = block->block_insns;
+    int i = 0;
+    while (i < num_insns) {
+        decoded_insn_t const *d = &m->decode_cache[m->pc];
+        m->prev_pc = m->pc;
+        m->pc = d->next_pc;
+        m->master_clk += d->cycles;
+        d->handler(m);
+        i++;
+
+        if (m->pc != d->following_pc)
+            break;  // Branch taken
+    }
+
+    finish_block(m, m->master_clk - start_clk, i);
+}
+
+static void execute_one(cpu_t *m) {
+    m->prev_pc = m->pc;
+
+    // fetch and process opcode
+    unsigned opcode = opcode_fetch(m);
+    burn_cycles(m, s_mcs48_cycles[opcode]);
+    (*s_mcs48_opcodes[opcode])(m);
+    m->num_insns++;
+}
+
+// Profiling. Only runs per instruction, so that every instruction is seen.
+
+static void profile_push(cpu_profile_t *p, u16 site, unsigned clk) {
+    if (p->stack_depth == PROFILE_STACK_DEPTH) {
+        // The CPU's stack has wrapped. Forget the oldest entry, like it does.
+        memmove(&p->stack_sites[0], &p->stack_sites[1], sizeof(p->stack_sites[0]) * (PROFILE_STACK_DEPTH - 1));
+        memmove(&p->stack_start_clks[0], &p->stack_start_clks[1], sizeof(p->stack_start_clks[0]) * (PROFILE_STACK_DEPTH - 1));
+        p->stack_depth--;
+    }
+
+    p->stack_sites[p->stack_depth] = site;
+    p->stack_start_clks[p->stack_depth] = clk;
+    p->stack_depth++;
+}
+
+static void profile_pop(cpu_profile_t *p, unsigned clk) {
+    if (p->stack_depth == 0)
+        return; // A return from a call that we didn't see
+
+    p->stack_depth--;
+    u16 site = p->stack_sites[p->stack_depth];
+    unsigned num_cycles = clk - p->stack_start_clks[p->stack_depth];
+    if (site >= PROFILE_IRQ_SITE)
+        p->irq_cycles[site - PROFILE_IRQ_SITE] += num_cycles;
+    else
+        p->call_cycles[site] += num_cycles;
+}
+
+static void execute_profiled(cpu_t *m) {
+    cpu_profile_t *p = m->profile;
+    do {
+        unsigned start_clk = m->master_clk;
+        check_irqs(m);
+        m->irq_polled = false;
+        if (m->master_clk != start_clk) {
+            int irq = (m->pc == 0x03) ? 0 : 1;
+            p->irqs[irq]++;
+            profile_push(p, PROFILE_IRQ_SITE + irq, start_clk);
+        }
+
+        u16 pc = m->pc;
+        u8 opcode = m->rom[pc];
+        start_clk = m->master_clk;
+        execute_one(m);
+        p->insns[pc]++;
+        p->cycles[pc] += m->master_clk - start_clk;
+
+        if ((opcode & 0x1f) == 0x14) {
+            p->calls[pc]++;
+            p->call_targets[pc] = m->pc;
+            profile_push(p, pc, start_clk);
+        }
+        else if (opcode == 0x83 || opcode == 0x93) {
+            profile_pop(p, m->master_clk);   // ret or retr
+        }
+    } while (m->icount > 0);
+}
+
+#if CPU_THREADED_DISPATCH
+
+// Starts the instruction described by d and jumps to its opcode's label
+#define THREADED_BEGIN_INSN() \
+    m->prev_pc = m->pc; \
+    m->pc = d->next_pc; \
+    m->master_clk += d->cycles; \
+    goto *s_labels[m->rom[m->prev_pc]]
+
+// One label per opcode. Each runs its handler and then either leaves the block
+// or dispatches the next instruction itself, so that the host branch
+// predictor sees a separate indirect jump after each opcode.
+#define THREADED_LABEL_ADDR(_n, _len, _cycles, _kind, _mnemonic, _operands, _a) &&op_##_n,
+#define THREADED_OP(_n, _len, _cycles, _kind, _mnemonic, _operands, _a) \
+    op_##_n: \
+        _a(m); \
+        insns_left--; \
+        if (insns_left == 0 || m->pc != d->following_pc) goto block_done; \
+        d = &m->decode_cache[m->pc]; \
+        THREADED_BEGIN_INSN();
+
+// The same as the CPU_DISPATCH_BLOCKS loop in cpu_execute(), with the handlers
+// inlined into one function. Interrupts are still only checked between blocks.
+static void execute_threaded(cpu_t *m) {
+    static void *const s_labels[256] = {
+        MCS48_ISA_TABLE(THREADED_LABEL_ADDR)
+    };
+
+    do {
+        check_irqs(m);
+        m->irq_polled = false;
+
+        decoded_insn_t const *block = get_block(m, m->pc);
+        if (!can_run_block(m, block)) {
+            execute_one(m);
+            continue;
+        }
+
+        unsigned start_clk = m->master_clk;
+        int insns_left = block->block_insns;
+        decoded_insn_t const *d = block;
+        THREADED_BEGIN_INSN();
+
+        MCS48_ISA_TABLE(THREADED_OP)
+
+    block_done:
+        finish_block(m, m->master_clk - start_clk, block->block_insns - insns_left);
+    } while (m->icount > 0);
+}
+
+#endif
+
 
 // *****************************************************************************
 // Public functions
 // *****************************************************************************
 
-cpu_t *cpu_get(void) {
-    return &m;
+cpu_t *cpu_create(cpu_callbacks_t const *callbacks, void *user_data) {
+    cpu_t *m = (cpu_t *)calloc(1, sizeof(cpu_t));
+    m->callbacks = callbacks;
+    m->user_data = user_data;
+    m->decode_cache = (decoded_insn_t *)calloc(sizeof(m->rom), sizeof(decoded_insn_t));
+    m->dispatch = CPU_DISPATCH_PER_INSN;
+    update_reg_base(m);
+    return m;
+}
+
+void cpu_destroy(cpu_t *m) {
+    free(m->decode_cache);
+    free(m);
+}
+
+void cpu_load_rom(cpu_t *m, u8 const *data, unsigned num_bytes) {
+    if (num_bytes > sizeof(m->rom))
+        num_bytes = sizeof(m->rom);
+    memcpy(m->rom, data, num_bytes);
+    cpu_invalidate_decode_cache(m);
+}
+
+void cpu_invalidate_decode_cache(cpu_t *m) {
+    memset(m->decode_cache, 0, sizeof(m->rom) * sizeof(decoded_insn_t));
+}
+
+void cpu_patch_rom(cpu_t *m, unsigned addr, u8 const *data, unsigned num_bytes) {
+    if (addr >= sizeof(m->rom))
+        return;
+    if (num_bytes > sizeof(m->rom) - addr)
+        num_bytes = sizeof(m->rom) - addr;
+    unsigned end = addr + num_bytes;
+
+    // A block depends on the opcodes in it, and on the one that stopped it.
+    // Walk each block as it was decoded, before the ROM changes.
+    for (unsigned pc = 0; pc < sizeof(m->rom); pc++) {
+        decoded_insn_t *block = &m->decode_cache[pc];
+        if (!(block->flags & HAS_BLOCK))
+            continue;
+
+        u16 insn_pc = pc;
+        for (int i = 0; i <= block->block_insns; i++) {
+            if (insn_pc >= addr && insn_pc < end) {
+                block->flags &= ~HAS_BLOCK;
+                break;
+            }
+            insn_pc = m->decode_cache[insn_pc].following_pc;
+        }
+    }
+
+    memcpy(m->rom + addr, data, num_bytes);
+    memset(m->decode_cache + addr, 0, num_bytes * sizeof(decoded_insn_t));
+}
+
+void cpu_snapshot(cpu_t const *m, cpu_snapshot_t *snapshot) {
+    memcpy(snapshot->data, m, sizeof(snapshot->data));
+}
+
+void cpu_restore(cpu_t *m, cpu_snapshot_t const *snapshot) {
+    memcpy(m, snapshot->data, sizeof(snapshot->data));
 }
 
 // void cpu_power_on() {
-//     m.prev_pc = 0;
-//     m.pc = 0;
+//     m->prev_pc = 0;
+//     m->pc = 0;
 // 
-//     m.acc = 0;
-//     m.psw = 0;
-//     m.f1 = false;
-//     m.a11 = 0;
-//     m.p1 = 0;
-//     m.p2 = 0;
-//     m.timer = 0;
-//     m.prescaler = 0;
-//     m.t1_history = 0;
+//     m->acc = 0;
+//     m->psw = 0;
+//     m->f1 = false;
+//     m->a11 = 0;
+//     m->p1 = 0;
+//     m->p2 = 0;
+//     m->timer = 0;
+//     m->prescaler = 0;
+//     m->t1_history = 0;
 // 
-//     m.irq_state = false;
-//     m.irq_polled = false;
-//     m.irq_in_progress = false;
-//     m.timer_overflow = false;
-//     m.timer_flag = false;
-//     m.tirq_enabled = false;
-//     m.xirq_enabled = false;
-//     m.timecount_enabled = 0;
+//     m->irq_state = false;
+//     m->irq_polled = false;
+//     m->irq_in_progress = false;
+//     m->timer_overflow = false;
+//     m->timer_flag = false;
+//     m->tirq_enabled = false;
+//     m->xirq_enabled = false;
+//     m->timecount_enabled = 0;
 // 
-//     // ensure that reg_ptr is valid before get_info gets called
-//     update_reg_ptr();
+//     // ensure that reg_base is valid before get_info gets called
+//     update_reg_base(m);
 // }
 
-void cpu_reset(void) {
+void cpu_reset(cpu_t *m) {
     // confirmed from reset description
-    m.pc = 0;
-    m.psw = m.psw & (C_FLAG | A_FLAG);
-    update_reg_ptr();
-    m.f1 = false;
-    m.a11 = 0;
+    m->pc = 0;
+    m->psw = m->psw & (C_FLAG | A_FLAG);
+    update_reg_base(m);
+    m->f1 = false;
+    m->a11 = 0;
 
-    m.tirq_enabled = false;
-    m.xirq_enabled = false;
-    m.timecount_enabled = 0;
-    m.timer_flag = false;
+    m->tirq_enabled = false;
+    m->xirq_enabled = false;
+    m->timecount_enabled = 0;
+    m->timer_flag = false;
 
     // confirmed from interrupt logic description
-    m.irq_in_progress = false;
-    m.timer_overflow = false;
+    m->irq_in_progress = false;
+    m->timer_overflow = false;
 
-    m.irq_polled = false;
+    m->irq_polled = false;
+
+    // the stack pointer is reset
+    if (m->profile)
+        m->profile->stack_depth = 0;
 
     // port 1 and port 2 are set to input mode
-    port1_write(0xff);
-    port2_write(0xff);
+    port1_write(m, 0xff);
+    port2_write(m, 0xff);
 }
 
-void cpu_execute(int num_cycles) {
-    m.icount += num_cycles;
-    update_reg_ptr();
+void cpu_execute(cpu_t *m, int num_cycles) {
+    m->icount += num_cycles;
+    update_reg_base(m);
+
+    if (m->profile) {
+        execute_profiled(m);
+        return;
+    }
+
+#if CPU_THREADED_DISPATCH
+    if (m->dispatch == CPU_DISPATCH_THREADED) {
+        execute_threaded(m);
+        return;
+    }
+#endif
 
     // iterate over remaining cycles, guaranteeing at least one instruction
     do {
         // check interrupts
-        check_irqs();
-        m.irq_polled = false;
-
-        m.prev_pc = m.pc;
-
-        // fetch and process opcode
-        unsigned opcode = opcode_fetch();
-        (*s_mcs48_opcodes[opcode])();
-    } while (m.icount > 0);
-}
-
-#define DRAW_TEXT(x, y, msg, ...) \
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, msg, ##__VA_ARGS__)
-
-void cpu_draw_state(int _x, int _y) {
-    cpu_t *cpu = cpu_get();
-    int x = _x + g_defaultFont->maxCharWidth;
-    int y = _y + g_defaultFont->charHeight;
-    DRAW_TEXT(x, y, "KLR Microcontroller state");
-    DRAW_TEXT(x + 1, y, "KLR Microcontroller state");
-    x += g_defaultFont->maxCharWidth;
-    y += g_defaultFont->charHeight * 1.2;
-    x += DRAW_TEXT(x, y, "PC:%03x  ", cpu->pc);
-    x += DRAW_TEXT(x, y, "MasterClk:%d  ", cpu->master_clk);
-    x += DRAW_TEXT(x, y, "T:%d  ", cpu->timer_counter);
-    x += DRAW_TEXT(x, y, "MemBank:%d  ", !!cpu->a11);
-
-    x = g_defaultFont->maxCharWidth * 2;
-    y += g_defaultFont->charHeight * 2;
-    x += DRAW_TEXT(x, y, "RAM:    ");
-    for (unsigned a = 0; a < 16; a++) {
-        x += DRAW_TEXT(x, y, " %x ", a);
-    }
-    for (unsigned a = 0; a < 128; a++) {
-        if ((a & 0xf) == 0) {
-            x = g_defaultFont->maxCharWidth * 2;
-            y += g_defaultFont->charHeight;
-            x += DRAW_TEXT(x, y, "     %x0 ", a >> 4);
+        check_irqs(m);
+        m->irq_polled = false;
+
+        if (m->dispatch != CPU_DISPATCH_PER_INSN) {
+            decoded_insn_t const *block = get_block(m, m->pc);
+            if (can_run_block(m, block)) {
+                execute_block(m, block);
+                continue;
+            }
+        }
+
+        execute_one(m);
+    } while (m->icount > 0);
+}
+
+void cpu_run_until(cpu_t *m, unsigned end_clk) {
+    int num_cycles = (int)(end_clk - m->master_clk);
+    if (num_cycles <= 0)
+        return;
+
+    m->icount = 0;
+    cpu_execute(m, num_cycles);
+}
+
+void cpu_end_slice(cpu_t *m) {
+    m->icount = 0;
+}
+
+void cpu_raise_irq(cpu_t *m) {
+    // if it was already raised, the latency counts from the first time
+    if (!m->irq_raised)
+        m->irq_raised_clk = m->master_clk;
+    m->irq_state = true;
+    m->irq_raised = true;
+}
+
+unsigned irq_histogram_percentile(irq_histogram_t const *h, double fraction) {
+    double wanted = fraction * h->num_samples;
+    unsigned num_seen = 0;
+    for (int i = 0; i < IRQ_HISTOGRAM_SIZE; i++) {
+        num_seen += h->counts[i];
+        if (num_seen > 0 && num_seen >= wanted) {
+            unsigned top = get_irq_histogram_top(i);
+            return top < h->max ? top : h->max;
         }
-        x += DRAW_TEXT(x, y, "%02x ", cpu->ram[a]);
     }
 
-    y += g_defaultFont->charHeight * 1.7;
-    HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
+    return h->max;
 }
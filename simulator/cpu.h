@@ -10,17 +10,112 @@
 
 #include "types.h"
 
+#include <stddef.h>
+
 
 enum { CPU_CLOCK_RATE_HZ = 733333 };
 #define CPU_CLOCK_PERIOD (1.0 / CPU_CLOCK_RATE_HZ)
 
+// Threaded dispatch uses the GCC "labels as values" extension, which MSVC
+// doesn't have. Define CPU_THREADED_DISPATCH to 0 to leave it out.
+#ifndef CPU_THREADED_DISPATCH
+#if defined(__GNUC__)
+#define CPU_THREADED_DISPATCH 1
+#else
+#define CPU_THREADED_DISPATCH 0
+#endif
+#endif
+
+
+typedef struct cpu_t cpu_t;
+typedef struct decoded_insn_t decoded_insn_t;
+
+// Call-back functions that handle access by the CPU core into the rest of the
+// simulated system. Each CPU instance has its own table.
+typedef struct {
+    u8 (*t0_read)(cpu_t *cpu);
+    u8 (*t1_read)(cpu_t *cpu);
+    void (*port1_write)(cpu_t *cpu, u8 val);
+    void (*port2_write)(cpu_t *cpu, u8 val);
+    u8 (*external_mem_read)(cpu_t *cpu, u8 addr);
+    void (*external_mem_write)(cpu_t *cpu, u8 addr, u8 val);
+    void (*irq_entered)(cpu_t *cpu, int source);    // Optional. source is IRQ_EXTERNAL or IRQ_TIMER.
+} cpu_callbacks_t;
+
+// How cpu_execute() gets from one instruction to the next. The results are
+// identical in every mode. bench.c compares their speed.
+typedef enum {
+    CPU_DISPATCH_PER_INSN,  // One call through the opcode table per instruction
+    CPU_DISPATCH_BLOCKS,    // Runs blocks of pre-decoded instructions from the decode cache
+    CPU_DISPATCH_THREADED   // Like CPU_DISPATCH_BLOCKS, but each handler jumps straight
+                            // to the next. Falls back to CPU_DISPATCH_BLOCKS if
+                            // CPU_THREADED_DISPATCH is 0.
+} cpu_dispatch_t;
+
+// Where the cycles went. Collected by cpu_execute() while cpu_t::profile is
+// set. The arrays are indexed by 12-bit address. See profile_report.h.
+enum { PROFILE_STACK_DEPTH = 8 };
+
+typedef struct {
+    unsigned insns[4096];           // Times the instruction at each address was executed
+    unsigned cycles[4096];          // Cycles spent in the instruction at each address
+    unsigned calls[4096];           // Times the call at each address was executed
+    unsigned call_cycles[4096];     // Cycles from the call at each address to the matching ret, including callees
+    u16 call_targets[4096];         // Where the call at each address went
+    unsigned irqs[2];               // Number of external and timer interrupts taken
+    unsigned irq_cycles[2];         // Cycles from each interrupt to its retr, including callees
+
+    // Shadow of the CPU's stack, to match returns to calls. Sites are
+    // addresses, or PROFILE_IRQ_SITE + 0 or 1 for interrupts.
+    u16 stack_sites[PROFILE_STACK_DEPTH];
+    unsigned stack_start_clks[PROFILE_STACK_DEPTH];
+    int stack_depth;
+} cpu_profile_t;
+
+enum { PROFILE_IRQ_SITE = 0x1000 };
+
+// Interrupt timing. Collected by the CPU while cpu_t::irq_stats is set.
+enum { IRQ_EXTERNAL, IRQ_TIMER, NUM_IRQ_SOURCES };
+
+// Lengths below 2^IRQ_HISTOGRAM_LINEAR_BITS cycles each have their own entry.
+// Above that, each power of two is split into 2^IRQ_HISTOGRAM_SUB_BITS
+// entries, so an entry is never wider than 1/8 of the lengths it holds.
+enum {
+    IRQ_HISTOGRAM_LINEAR_BITS = 6,
+    IRQ_HISTOGRAM_SUB_BITS = 3,
+    IRQ_HISTOGRAM_SIZE = (1 << IRQ_HISTOGRAM_LINEAR_BITS) + (32 - IRQ_HISTOGRAM_LINEAR_BITS) * (1 << IRQ_HISTOGRAM_SUB_BITS)
+};
+
+typedef struct {
+    unsigned counts[IRQ_HISTOGRAM_SIZE];    // Samples in each range of lengths. See irq_histogram_percentile().
+    unsigned num_samples;
+    unsigned max;
+} irq_histogram_t;
 
 typedef struct {
+    // From the interrupt becoming pending and enabled to the first
+    // instruction of the interrupt routine. That is, from the IRQ line being
+    // raised or the timer overflowing, or from the en i or en tcnti that
+    // unmasked it, whichever is later. Time spent waiting for another
+    // interrupt routine to finish is included. Includes the 2 cycles of the
+    // implicit call. An external interrupt that is taken without the line
+    // having been raised again since the last one isn't counted.
+    irq_histogram_t latency[NUM_IRQ_SOURCES];
+
+    // From the first instruction of the interrupt routine to the end of its
+    // retr.
+    irq_histogram_t duration[NUM_IRQ_SOURCES];
+} cpu_irq_stats_t;
+
+// The fields from the start of cpu_t up to, but not including, rom are the
+// machine state. They are plain data, with no pointers, so that they can be
+// saved and restored with a memcpy. See cpu_snapshot().
+struct cpu_t {
     u16 prev_pc;
     u16 pc;               // Program Counter
 
     u8 acc;               // Accumulator
-    u8 *reg_ptr;          // Pointer to r0-r7
+    u8 reg_base;          // Index in ram of r0 of the selected register bank
     u8 psw;               // Program Status Word
     bool f1;              // F1 flag (F0 is in PSW)
     u16 a11;              // 11th address bit, either 0x000 or 0x800
@@ -34,28 +129,80 @@ typedef struct {
     bool irq_polled;      // true if last instruction was JNI (and not taken)
     bool irq_in_progress; // true if an IRQ is in progress
     bool timer_overflow;  // true on a timer overflow; cleared by taking interrupt
+    bool irq_raised;      // true if cpu_raise_irq() was called since the last external interrupt
+    u8 irq_source;        // IRQ_EXTERNAL or IRQ_TIMER, if an IRQ is in progress
     bool timer_flag;      // true on a timer overflow; cleared on JTF
     bool tirq_enabled;    // true if the timer IRQ is enabled
     bool xirq_enabled;    // true if the external IRQ is enabled
     u8 timecount_enabled; // bitmask of timer/counter enabled
 
     int icount;           // Number of cycles to execute. Can be -1 when cpu_execute() returns.
-    int master_clk;       // Total number of cycles executed.
+    unsigned master_clk;  // Total number of cycles executed. Wraps after 2^32.
+    unsigned num_insns;   // Total number of instructions executed.
+    unsigned irq_raised_clk; // master_clk when cpu_raise_irq() was last called
+    unsigned timer_overflow_clk; // master_clk when timer_overflow was set
+    unsigned irq_entry_clk; // master_clk at the start of the interrupt routine in progress
+    unsigned xirq_enabled_clk; // master_clk when en i last enabled the external IRQ
+    unsigned tirq_enabled_clk; // master_clk when en tcnti last enabled the timer IRQ
 
-    u8 rom[4096];
     u8 ram[128];
-} cpu_t;
+    u8 rom[4096];
+
+    cpu_callbacks_t const *callbacks;
+    void *user_data;      // Passed through untouched. For use by the call-backs.
+
+    decoded_insn_t *decode_cache;   // One entry per ROM address. Filled in lazily.
+    cpu_dispatch_t dispatch;        // Defaults to CPU_DISPATCH_PER_INSN
+    cpu_profile_t *profile;         // NULL unless profiling. Owned by the caller. Forces CPU_DISPATCH_PER_INSN.
+    cpu_irq_stats_t *irq_stats;     // NULL unless measuring interrupt timing. Owned by the caller.
+};
+
+
+// The callbacks table must outlive the CPU instance. The instance has no
+// global state, so separate instances can be run on separate threads.
+cpu_t *cpu_create(cpu_callbacks_t const *callbacks, void *user_data);
+void cpu_destroy(cpu_t *cpu);
+
+// Use cpu_load_rom() rather than writing to cpu->rom directly, so that the
+// decode cache is invalidated. cpu_reset() leaves the cache intact because it
+// doesn't change the ROM.
+void cpu_load_rom(cpu_t *cpu, u8 const *data, unsigned num_bytes);
+void cpu_invalidate_decode_cache(cpu_t *cpu);
+
+// Writes num_bytes of data into the ROM at addr, for hot-reloading a patch
+// into a running CPU. Only the decode cache entries that the new bytes affect
+// are invalidated. See mcs48_asm.h.
+void cpu_patch_rom(cpu_t *cpu, unsigned addr, u8 const *data, unsigned num_bytes);
+
+// A saved copy of a CPU's machine state. It can be restored into the same
+// instance, or into any other instance with the same ROM.
+typedef struct {
+    u8 data[offsetof(cpu_t, rom)];
+} cpu_snapshot_t;
+
+void cpu_snapshot(cpu_t const *cpu, cpu_snapshot_t *snapshot);
+void cpu_restore(cpu_t *cpu, cpu_snapshot_t const *snapshot);
+
+void cpu_reset(cpu_t *cpu);
+void cpu_execute(cpu_t *cpu, int num_cycles);
+
+// Raises the external IRQ line, at the current master_clk. The line stays
+// raised. The ROM stops it re-triggering by disabling the interrupt.
+void cpu_raise_irq(cpu_t *cpu);
 
+// Runs until master_clk reaches end_clk, stopping at the first instruction
+// boundary at or after it. Unlike cpu_execute(), doesn't carry over any
+// overshoot from the previous call, and does nothing if end_clk has already
+// passed.
+void cpu_run_until(cpu_t *cpu, unsigned end_clk);
 
-// Implement these call-back functions to handle access by the CPU core into the
-// rest of the simulated system.
-u8 cpu_t0_read(void);
-u8 cpu_t1_read(void);
-void cpu_port1_write(cpu_t *cpu, u8 val);
-void cpu_port2_write(cpu_t *cpu, u8 val);
-u8 cpu_external_mem_read(cpu_t *cpu, u8 addr);
+// Makes cpu_execute() return early, at the end of the current instruction
+// or block. For use by call-backs that schedule an event within the current
+// time slice.
+void cpu_end_slice(cpu_t *cpu);
 
-cpu_t *cpu_get(void);
-void cpu_reset();
-void cpu_execute(int num_cycles);
-void cpu_draw_state(int x, int y);
+// Returns the length in cycles that the given fraction of the samples are no
+// longer than. For example, 0.99 gives the 99th percentile. Samples of 64
+// cycles or more are grouped into ranges, so the result is the top of the
+// range the percentile falls in, or max if that is smaller.
+unsigned irq_histogram_percentile(irq_histogram_t const *h, double fraction);
@@ -19,6 +19,224 @@ static inline void __movsb(unsigned char *dst, unsigned char *src, size_t n) {
 #endif
 
 
+// Span kernels. These fill or blend a run of pixels in a row. Every version
+// writes exactly the same pixels as PutPixUnclipped() would, including
+// leaving alpha at zero after a blend. The fastest version that the CPU
+// supports is picked the first time one is needed.
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define DF_SIMD_SPANS 1
+#include <immintrin.h>
+#endif
+
+#if DF_SIMD_SPANS && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+typedef void SpanFunc(DfColour * __restrict row, int len, DfColour c);
+
+static SpanFunc *g_fillSpan = NULL;
+static SpanFunc *g_blendSpan = NULL;
+static int g_simdLevel = -1;
+
+
+static inline void BlendPixel(DfColour *pixel, unsigned invA, unsigned crb, unsigned cg) {
+    unsigned rb = (pixel->c & 0xff00ff) * invA + crb;
+    unsigned g = pixel->g * invA + cg;
+    pixel->c = rb >> 8;
+    pixel->g = g >> 8;
+}
+
+
+static void FillSpanScalar(DfColour * __restrict row, int len, DfColour c) {
+#ifdef _MSC_VER
+    __stosd((unsigned long*)row, c.c, len);
+#else
+    for (int i = 0; i < len; i++)
+        row[i] = c;
+#endif
+}
+
+
+static void BlendSpanScalar(DfColour * __restrict row, int len, DfColour c) {
+    unsigned crb = (c.c & 0xff00ff) * c.a;
+    unsigned cg = c.g * c.a;
+    unsigned invA = 255 - c.a;
+    for (int i = 0; i < len; i++)
+        BlendPixel(row + i, invA, crb, cg);
+}
+
+
+#if DF_SIMD_SPANS
+
+// The blends work on each channel in a 16-bit lane. Channel * invA + colour *
+// a is at most 255 * 255, so it can't overflow, and >> 8 of it is what the
+// scalar version gets for that channel. Alpha is masked off at the end.
+//
+// Loads and stores are unaligned. Aligning first costs more than it saves on
+// the short spans that most of the UI's fills are.
+
+struct BlendConsts {
+    unsigned invA, crb, cg;     // For the scalar tail
+    __m128i invAs, cols;        // invA and colour * a, in the lanes of two pixels
+};
+
+
+static inline void InitBlendConsts(BlendConsts *k, DfColour c) {
+    k->invA = 255 - c.a;
+    k->crb = (c.c & 0xff00ff) * c.a;
+    k->cg = c.g * c.a;
+    short cb = (short)(c.b * c.a), cg = (short)k->cg, cr = (short)(c.r * c.a);
+    k->invAs = _mm_set1_epi16((short)k->invA);
+    k->cols = _mm_set_epi16(0, cr, cg, cb, 0, cr, cg, cb);
+}
+
+
+static inline __m128i Blend4Sse2(__m128i p, BlendConsts const *k) {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, k->invAs), k->cols), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, k->invAs), k->cols), 8);
+    return _mm_and_si128(_mm_packus_epi16(lo, hi), _mm_set1_epi32(0xffffff));
+}
+
+
+static void FillSpanSse2(DfColour * __restrict row, int len, DfColour c) {
+    __m128i v = _mm_set1_epi32((int)c.c);
+    int i = 0;
+    for (; i + 4 <= len; i += 4)
+        _mm_storeu_si128((__m128i *)(row + i), v);
+    for (; i < len; i++)
+        row[i] = c;
+}
+
+
+static void BlendSpanSse2(DfColour * __restrict row, int len, DfColour c) {
+    BlendConsts k;
+    InitBlendConsts(&k, c);
+    int i = 0;
+    for (; i + 4 <= len; i += 4) {
+        __m128i p = _mm_loadu_si128((__m128i *)(row + i));
+        _mm_storeu_si128((__m128i *)(row + i), Blend4Sse2(p, &k));
+    }
+    for (; i < len; i++)
+        BlendPixel(row + i, k.invA, k.crb, k.cg);
+}
+
+
+TARGET_AVX2 static void FillSpanAvx2(DfColour * __restrict row, int len, DfColour c) {
+    __m256i v = _mm256_set1_epi32((int)c.c);
+    int i = 0;
+    for (; i + 8 <= len; i += 8)
+        _mm256_storeu_si256((__m256i *)(row + i), v);
+    if (i + 4 <= len) {
+        _mm_storeu_si128((__m128i *)(row + i), _mm256_castsi256_si128(v));
+        i += 4;
+    }
+    for (; i < len; i++)
+        row[i] = c;
+}
+
+
+TARGET_AVX2 static void BlendSpanAvx2(DfColour * __restrict row, int len, DfColour c) {
+    BlendConsts k;
+    InitBlendConsts(&k, c);
+
+    // Unpack and pack both work within each 128-bit half, so the pixels come
+    // back out in the order they went in
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const rgbMask = _mm256_set1_epi32(0xffffff);
+    __m256i const invAs = _mm256_broadcastsi128_si256(k.invAs);
+    __m256i const cols = _mm256_broadcastsi128_si256(k.cols);
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256i p = _mm256_loadu_si256((__m256i *)(row + i));
+        __m256i lo = _mm256_unpacklo_epi8(p, zero);
+        __m256i hi = _mm256_unpackhi_epi8(p, zero);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(lo, invAs), cols), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(hi, invAs), cols), 8);
+        p = _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgbMask);
+        _mm256_storeu_si256((__m256i *)(row + i), p);
+    }
+    if (i + 4 <= len) {
+        __m128i p = _mm_loadu_si128((__m128i *)(row + i));
+        _mm_storeu_si128((__m128i *)(row + i), Blend4Sse2(p, &k));
+        i += 4;
+    }
+    for (; i < len; i++)
+        BlendPixel(row + i, k.invA, k.crb, k.cg);
+}
+
+
+static bool CpuHasAvx2() {
+#ifdef _MSC_VER
+    // The OS must save the YMM registers too, not just the CPU have them
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // DF_SIMD_SPANS
+
+
+static int GetCpuSimdLevel() {
+#if DF_SIMD_SPANS
+    return CpuHasAvx2() ? DF_SIMD_AVX2 : DF_SIMD_SSE2;
+#else
+    return DF_SIMD_NONE;
+#endif
+}
+
+
+static inline void InitSpanKernels() {
+    if (g_simdLevel < 0)
+        BitmapSetSimdLevel(DF_SIMD_AVX2);
+}
+
+
+int BitmapGetSimdLevel() {
+    InitSpanKernels();
+    return g_simdLevel;
+}
+
+
+int BitmapSetSimdLevel(int level) {
+    int maxLevel = GetCpuSimdLevel();
+    if (level > maxLevel)
+        level = maxLevel;
+    if (level < DF_SIMD_NONE)
+        level = DF_SIMD_NONE;
+
+    g_fillSpan = FillSpanScalar;
+    g_blendSpan = BlendSpanScalar;
+#if DF_SIMD_SPANS
+    if (level == DF_SIMD_SSE2) {
+        g_fillSpan = FillSpanSse2;
+        g_blendSpan = BlendSpanSse2;
+    }
+    else if (level == DF_SIMD_AVX2) {
+        g_fillSpan = FillSpanAvx2;
+        g_blendSpan = BlendSpanAvx2;
+    }
+#endif
+    g_simdLevel = level;
+    return level;
+}
+
+
 DfBitmap *BitmapCreate(int width, int height) {
 	DfBitmap *bmp = new DfBitmap;
 	bmp->width = width;
@@ -97,28 +315,11 @@ DfColour GetPix(DfBitmap *bmp, int x, int y) {
 
 void HLineUnclipped(DfBitmap *bmp, int x, int y, int len, DfColour c) {
     DfColour * __restrict row = GetLine(bmp, y) + x;
-    if (c.a == 255) {
-#ifdef _MSC_VER
-        __stosd((unsigned long*)row, c.c, len);
-#else
-        for (int i = 0; i < len; i++)
-            row[i] = c;
-#endif
-    }
-    else {
-        unsigned crb = (c.c & 0xff00ff) * c.a;
-        unsigned cg = c.g * c.a;
-
-        unsigned char invA = 255 - c.a;
-        for (int i = 0; i < len; i++) {
-            DfColour *pixel = row + i;
-            unsigned rb = (pixel->c & 0xff00ff) * invA + crb;
-            unsigned g = pixel->g * invA + cg;
-
-            pixel->c = rb >> 8;
-            pixel->g = g >> 8;
-        }
-    }
+    InitSpanKernels();
+    if (c.a == 255)
+        g_fillSpan(row, len, c);
+    else
+        g_blendSpan(row, len, c);
 }
 
 
@@ -536,21 +737,11 @@ void RectFill(DfBitmap *bmp, int x1, int y1, int w, int h, DfColour c) {
     if (w <= 0) return;
 
     DfColour * __restrict line = GetLine(bmp, y1) + x1;
-    if (c.a == 255) {
-        for (int a = y1; a < y2; a++) {
-#ifdef _MSC_VER
-            __stosd((unsigned long*)line, c.c, w);
-#else
-            for (int b = 0; b < w; b++)
-                line[b].c = c.c;
-#endif
-            line += bmp->width;
-        }
-    }
-    else
-    {
-        for (int a = y1; a < y2; a++)
-            HLineUnclipped(bmp, x1, a, w, c);
+    InitSpanKernels();
+    SpanFunc *span = c.a == 255 ? g_fillSpan : g_blendSpan;
+    for (int a = y1; a < y2; a++) {
+        span(line, w, c);
+        line += bmp->width;
     }
 }
 
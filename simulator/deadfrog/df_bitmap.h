@@ -93,6 +93,13 @@ DLL_API void        ScaleUpBlit     (DfBitmap *destBmp, int x, int y, int scale,
 // output should be. Does box sampling downscale and bilinear upscale.
 DLL_API void        StretchBlit     (DfBitmap *dst_bmp, int dstX, int dstY, int dstWidth, int dstHeight, DfBitmap *src_bmp);
 
+// The instruction sets that the line and rectangle fills can use. The best
+// one the CPU has is picked at run time. Every level draws exactly the same
+// pixels, so choosing a lower one is only useful for comparing speeds.
+enum { DF_SIMD_NONE, DF_SIMD_SSE2, DF_SIMD_AVX2 };
+DLL_API int         BitmapGetSimdLevel();
+DLL_API int         BitmapSetSimdLevel(int level);  // Clamped to what the CPU has. Returns the level set.
+
 
 inline void PutPixUnclipped(DfBitmap *bmp, int x, int y, DfColour c)
 {
@@ -43,14 +43,16 @@ void SleepMillisec(int milliseconds) {
 
 // POSIX headers
 #include <stdint.h>
-#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 
+// CLOCK_MONOTONIC rather than gettimeofday(), so that changes to the time of
+// day don't make time jump.
 static double GetLowLevelTime() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-	return tv.tv_usec / 1e6 + tv.tv_sec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_nsec / 1e9 + ts.tv_sec;
 }
 
 
@@ -220,7 +220,7 @@ static void InputPollInternal(DfWindow *win) {
 }
 
 
-void UpdateWin(DfWindow *win) {
+static void AdvanceFrameCounters(DfWindow *win) {
     // *** FPS Meter ***
 
     win->_private->framesThisSecond++;
@@ -244,11 +244,25 @@ void UpdateWin(DfWindow *win) {
 
     win->advanceTime = currentTime - win->_private->lastUpdateTime;
     win->_private->lastUpdateTime = currentTime;
+}
+
 
+void UpdateWin(DfWindow *win) {
+    AdvanceFrameCounters(win);
+    BlitBitmapToWindow(win, 0, win->bmp->height);
+}
 
-    // *** Swap buffers ***
 
-    BlitBitmapToWindow(win);
+void UpdateWinRows(DfWindow *win, int numBands, int const *firstRows, int const *numRows) {
+    AdvanceFrameCounters(win);
+    for (int i = 0; i < numBands; i++) {
+        int first = firstRows[i];
+        int end = first + numRows[i];
+        if (first < 0) first = 0;
+        if (end > win->bmp->height) end = win->bmp->height;
+        if (end > first)
+            BlitBitmapToWindow(win, first, end - first);
+    }
 }
 
 
@@ -133,6 +133,10 @@ DLL_API void SetWindowRect(DfWindow *win, int x, int y, int width, int height);
 // Blit back buffer to screen and update FPS counter.
 DLL_API void UpdateWin(DfWindow *win);
 
+// Like UpdateWin(), but only blits the given bands of rows. For apps that know
+// that the rest of the back buffer hasn't changed since it was last blitted.
+DLL_API void UpdateWinRows(DfWindow *win, int numBands, int const *firstRows, int const *numRows);
+
 // Windows only. Returns the Window handle because lots of things on Windows
 // need this. Cast the return value to HWND.
 DLL_API void *GetWindowHandle(DfWindow *win);
@@ -547,25 +547,27 @@ void SetWindowRect(DfWindow *win, int x, int y, int width, int height) {
 }
 
 
-// This function copies a DfBitmap to the window, so you can actually see it.
+// This function copies rows of a DfBitmap to the window, so you can actually see them.
 // SetBIBitsToDevice seems to be the fastest way to achieve this on most hardware.
-static void BlitBitmapToWindow(DfWindow *win) {
+// The rows are passed as a top-down DIB of their own, because the meaning of
+// the start scan line of a top-down DIB varies between drivers.
+static void BlitBitmapToWindow(DfWindow *win, int firstRow, int numRows) {
     DfBitmap *bmp = win->bmp;
     BITMAPINFO binfo = {};
     binfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
     binfo.bmiHeader.biWidth = bmp->width;
-    binfo.bmiHeader.biHeight = -(int)bmp->height;
+    binfo.bmiHeader.biHeight = -numRows;
     binfo.bmiHeader.biPlanes = 1;
     binfo.bmiHeader.biBitCount = 32;
     binfo.bmiHeader.biCompression = BI_RGB;
-    binfo.bmiHeader.biSizeImage = bmp->height * bmp->width * 4;
+    binfo.bmiHeader.biSizeImage = numRows * bmp->width * 4;
 
     HDC dc = GetDC(win->_private->platSpec->hWnd);
 
     SetDIBitsToDevice(dc,
-        0, 0, bmp->width, bmp->height,
-        0, 0, 0, bmp->height,
-        bmp->pixels, &binfo, DIB_RGB_COLORS
+        0, firstRow, bmp->width, numRows,
+        0, 0, 0, numRows,
+        bmp->pixels + firstRow * bmp->width, &binfo, DIB_RGB_COLORS
     );
 
     ReleaseDC(win->_private->platSpec->hWnd, dc);
@@ -1,5 +1,7 @@
 // Platform includes
 #include <linux/limits.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -30,6 +32,15 @@
 // You will also see other X11 applications' traffic if they are launched with
 // the same DISPLAY string.
 
+// If the Xserver has the MIT-SHM extension, the back buffer is put in a shared
+// memory segment and frames are sent with ShmPutImage, so the pixels aren't
+// copied through the socket. If anything about that fails, frames are sent
+// with PutImage as before. To compare the two:
+//    DF_X11_NO_SHM=1 disables MIT-SHM.
+//    DF_X11_BLIT_STATS=1 prints the mean time per frame upload, up to when the
+//    Xserver has read the pixels. While MIT-SHM works, uploads alternate
+//    between ShmPutImage and PutImage, so that both are timed in one run.
+
 
 
 //
@@ -40,9 +51,17 @@ enum {
     X11_OPCODE_MAP_WINDOW = 8,
     X11_OPCODE_CHANGE_PROPERTY = 18,
     X11_OPCODE_SET_SELECTION_OWNER = 22,
+    X11_OPCODE_GET_INPUT_FOCUS = 43,
     X11_OPCODE_QUERY_KEYMAP = 44,
     X11_OPCODE_CREATE_GC = 55,
     X11_OPCODE_PUT_IMAGE = 72,
+    X11_OPCODE_QUERY_EXTENSION = 98,
+
+    // Minor opcodes of the MIT-SHM extension. Its major opcode is given by
+    // QueryExtension.
+    X11_SHM_ATTACH = 1,
+    X11_SHM_DETACH = 2,
+    X11_SHM_PUT_IMAGE = 3,
 
     X11_EVENT_CODE_SELECTION_NOTIFY = 31,
 
@@ -183,6 +202,24 @@ struct WindowPlatformSpecific {
     char *clipboardRxData;  // NULL except between calls of X11InternalClipboardRequestData() and ClipboardReleaseReceivedData()
     char *clipboardTxData;
     unsigned clipboardTxDataNumChars;
+
+    // MIT-SHM. While shmSegId is non-zero, the window's bitmap's pixels are
+    // in the shared memory segment at shmAddr.
+    uint8_t shmMajorOpcode; // 0 if the Xserver doesn't have MIT-SHM.
+    uint8_t shmCompletionEvent;
+    bool shmFailed;         // Set when the Xserver rejects a MIT-SHM request.
+    uint32_t shmSegId;
+    void *shmAddr;
+    int numShmPutsPending;
+
+    // Size from the last ConfigureNotify event, or 0. The bitmap is resized
+    // in InputPoll(), not while handling the event, because resizing it may
+    // need a round trip to the Xserver.
+    int newWidth, newHeight;
+
+    bool printBlitStats;
+    int numBlits[2];        // Indexed by whether ShmPutImage was used.
+    double blitSeconds[2];
 };
 
 
@@ -489,6 +526,15 @@ static void FatalRead(WindowPlatformSpecific *platSpec, void *buf, size_t count)
 }
 
 
+// Blocks until the Xserver has sent something, so that callers waiting for
+// a reply or event on the non-blocking socket don't have to spin.
+static void WaitForXServerData(WindowPlatformSpecific *platSpec) {
+    struct pollfd pollFd = { platSpec->socketFd, POLLIN };
+    if (poll(&pollFd, 1, -1) == -1 && errno != EINTR)
+        FATAL_ERROR("Poll gave an error");
+}
+
+
 // static void HandleErrorMessage(WindowPlatformSpecific *platSpec) {
 //     // See https://www.x.org/releases/X11R7.7/doc/xproto/x11protocol.html#Encoding::Errors
 //     printf("Error message from X11 server - ");
@@ -534,20 +580,38 @@ static void HandleEvent(DfWindow *win) {
 
     platSpec->recvBuf[0] &= 0x7f; // Clear the seemingly useless "Generated" flag.
 
+    if (platSpec->shmCompletionEvent && platSpec->recvBuf[0] == platSpec->shmCompletionEvent) {
+        platSpec->numShmPutsPending--;
+        ConsumeMessage(platSpec, 32);
+        return;
+    }
+
     switch (platSpec->recvBuf[0]) {
+    case 0: // Error.
+        if (platSpec->shmMajorOpcode && platSpec->recvBuf[10] == platSpec->shmMajorOpcode) {
+            // Caused by one of our MIT-SHM requests. Stop using it.
+            platSpec->shmFailed = true;
+            platSpec->numShmPutsPending = 0;
+        }
+        else {
+            printf("Error message from X11 server. Code %i. Opcode %i.\n",
+                platSpec->recvBuf[1], platSpec->recvBuf[10]);
+        }
+        break;
+
     case 2: // KeyPress event.
         {
             unsigned char x11_keycode = platSpec->recvBuf[1];
             unsigned char df_keycode = x11KeycodeToDfKeycode(x11_keycode);
-            win->_private->newKeyDowns[df_keycode] = 1;
+            win->input.keyDowns[df_keycode] = 1;
             win->input.keys[df_keycode] = 1;
             int modifiers = platSpec->recvBuf[28];
             char ascii = dfKeycodeToAscii(df_keycode, modifiers);
     //printf("Key down. x11_keycode:%i. df_keycode:%i. Ascii:%c. Modifiers: 0x%x\n", x11_keycode, df_keycode, ascii, modifiers);
 
-            if (ascii) {
-                win->_private->newKeysTyped[win->_private->newNumKeysTyped] = ascii;
-                win->_private->newNumKeysTyped++;
+            if (ascii && win->input.numKeysTyped < MAX_KEYS_TYPED_PER_FRAME) {
+                win->input.keysTyped[win->input.numKeysTyped] = ascii;
+                win->input.numKeysTyped++;
             }
             break;
         }
@@ -556,7 +620,7 @@ static void HandleEvent(DfWindow *win) {
         {
             unsigned char x11_keycode = platSpec->recvBuf[1];
             unsigned char df_keycode = x11KeycodeToDfKeycode(x11_keycode);
-            win->_private->newKeyUps[df_keycode] = 1;
+            win->input.keyUps[df_keycode] = 1;
             win->input.keys[df_keycode] = 0;
     //printf("Key up. x11_keycode:%i. df_keycode:%i.\n", x11_keycode, df_keycode);
             break;
@@ -566,10 +630,16 @@ static void HandleEvent(DfWindow *win) {
         switch (platSpec->recvBuf[1]) {
             case 1:
                 win->input.lmb = 1;
-                win->_private->lmbPrivate = true;
+                win->input.lmbClicked = true;
+                break;
+            case 2:
+                win->input.mmb = 1;
+                win->input.mmbClicked = true;
+                break;
+            case 3:
+                win->input.rmb = 1;
+                win->input.rmbClicked = true;
                 break;
-            case 2: win->input.mmb = 1; break;
-            case 3: win->input.rmb = 1; break;
             case 4: win->input.mouseZ++; break;
             case 5: win->input.mouseZ--; break;
         }
@@ -580,10 +650,16 @@ static void HandleEvent(DfWindow *win) {
         switch (platSpec->recvBuf[1]) {
             case 1:
                 win->input.lmb = 0;
-                win->_private->lmbPrivate = false;
+                win->input.lmbUnClicked = true;
+                break;
+            case 2:
+                win->input.mmb = 0;
+                win->input.mmbUnClicked = true;
+                break;
+            case 3:
+                win->input.rmb = 0;
+                win->input.rmbUnClicked = true;
                 break;
-            case 2: win->input.mmb = 0; break;
-            case 3: win->input.rmb = 0; break;
         }
         //printf("up:%i\n", platSpec->recvBuf[1]);
         break;
@@ -608,10 +684,8 @@ static void HandleEvent(DfWindow *win) {
 
     case 22: // Configure notify event.
         {
-            int w = platSpec->recvBuf[20] + (platSpec->recvBuf[21] << 8);
-            int h = platSpec->recvBuf[22] + (platSpec->recvBuf[23] << 8);
-            BitmapDelete(win->bmp);
-            win->bmp = BitmapCreate(w, h);
+            platSpec->newWidth = platSpec->recvBuf[20] + (platSpec->recvBuf[21] << 8);
+            platSpec->newHeight = platSpec->recvBuf[22] + (platSpec->recvBuf[23] << 8);
 //             if (win->redrawCallback) {
 //                 win->redrawCallback();
 //             }
@@ -736,6 +810,47 @@ static uint32_t generateId(DfWindow *win) {
 }
 
 
+// Sends a request that has a reply, and waits for the reply. The Xserver
+// handles requests in order, so any errors caused by earlier requests have
+// been received and handled by the time this returns.
+static void SyncWithXServer(DfWindow *win) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    uint32_t packet[1];
+    packet[0] = X11_OPCODE_GET_INPUT_FOCUS | (1<<16);
+    SendBuf(platSpec, packet, sizeof(packet));
+
+    while (!GetReply(win, 32))
+        WaitForXServerData(platSpec);
+
+    ConsumeMessage(platSpec, 32);
+}
+
+
+static void QueryShmExtension(DfWindow *win) {
+    char const name[] = "MIT-SHM";
+    int nameLen = sizeof(name) - 1;
+    int requestLenWords = 2 + (nameLen + 3) / 4;
+    uint8_t packet[16] = { 0 };
+    packet[0] = X11_OPCODE_QUERY_EXTENSION;
+    packet[2] = requestLenWords;
+    packet[4] = nameLen;
+    memcpy(packet + 8, name, nameLen);
+
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    SendBuf(platSpec, packet, requestLenWords * 4);
+
+    while (!GetReply(win, 32))
+        WaitForXServerData(platSpec);
+
+    if (platSpec->recvBuf[8]) { // Present.
+        platSpec->shmMajorOpcode = platSpec->recvBuf[9];
+        platSpec->shmCompletionEvent = platSpec->recvBuf[10]; // ShmCompletion is the first event.
+    }
+
+    ConsumeMessage(platSpec, 32);
+}
+
+
 // Initialize the connection to the Xserver if we haven't already.
 static void ConnectToXserver(DfWindow *win) {
     WindowPlatformSpecific *platSpec = win->_private->platSpec;
@@ -828,6 +943,95 @@ static void ConnectToXserver(DfWindow *win) {
         platSpec->wmDeleteWindowId, platSpec->wmProtocolsId);
 
     platSpec->windowId = generateId(win);
+
+    char const *noShm = getenv("DF_X11_NO_SHM");
+    if (!noShm || noShm[0] == '0')
+        QueryShmExtension(win);
+    platSpec->printBlitStats = getenv("DF_X11_BLIT_STATS") != NULL;
+}
+
+
+// Moves the window's bitmap's pixels into a shared memory segment, and has
+// the Xserver attach it. Leaves them where they are if any of that fails.
+static void CreateShmBackBuffer(DfWindow *win) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    if (!platSpec->shmMajorOpcode || platSpec->shmFailed || platSpec->shmSegId) return;
+
+    size_t numBytes = win->bmp->width * win->bmp->height * sizeof(DfColour);
+    int shmId = shmget(IPC_PRIVATE, numBytes, IPC_CREAT | 0600);
+    if (shmId < 0) return;
+    void *shmAddr = shmat(shmId, NULL, 0);
+    if (shmAddr == (void *)-1) {
+        shmctl(shmId, IPC_RMID, NULL);
+        return;
+    }
+
+    uint32_t segId = generateId(win);
+    int const len = 4;
+    uint32_t packet[len];
+    packet[0] = platSpec->shmMajorOpcode | (X11_SHM_ATTACH << 8) | (len<<16);
+    packet[1] = segId;
+    packet[2] = shmId;
+    packet[3] = 1; // Read only.
+    SendBuf(platSpec, packet, sizeof(packet));
+    SyncWithXServer(win);
+
+    // Now that the Xserver has attached it (or failed to), mark the segment
+    // to be freed when the last process detaches, so that it isn't leaked
+    // if we crash.
+    shmctl(shmId, IPC_RMID, NULL);
+
+    if (platSpec->shmFailed) {
+        printf("Xserver couldn't attach shared memory. Using PutImage instead.\n");
+        shmdt(shmAddr);
+        return;
+    }
+
+    memcpy(shmAddr, win->bmp->pixels, numBytes);
+    delete [] win->bmp->pixels;
+    win->bmp->pixels = (DfColour *)shmAddr;
+    platSpec->shmSegId = segId;
+    platSpec->shmAddr = shmAddr;
+}
+
+
+// Moves the window's bitmap's pixels out of shared memory, back to the heap.
+static void DestroyShmBackBuffer(DfWindow *win) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    if (!platSpec->shmSegId) return;
+
+    int numPixels = win->bmp->width * win->bmp->height;
+    DfColour *pixels = new DfColour[numPixels];
+    memcpy(pixels, win->bmp->pixels, numPixels * sizeof(DfColour));
+    win->bmp->pixels = pixels;
+
+    if (!platSpec->shmFailed) {
+        int const len = 2;
+        uint32_t packet[len];
+        packet[0] = platSpec->shmMajorOpcode | (X11_SHM_DETACH << 8) | (len<<16);
+        packet[1] = platSpec->shmSegId;
+        SendBuf(platSpec, packet, sizeof(packet));
+    }
+
+    shmdt(platSpec->shmAddr);
+    platSpec->shmSegId = 0;
+    platSpec->shmAddr = NULL;
+}
+
+
+static void ApplyPendingResize(DfWindow *win) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    int w = platSpec->newWidth;
+    int h = platSpec->newHeight;
+    platSpec->newWidth = platSpec->newHeight = 0;
+
+    // ConfigureNotify is also sent when the window is only moved.
+    if (w == 0 || (w == win->bmp->width && h == win->bmp->height)) return;
+
+    DestroyShmBackBuffer(win);
+    BitmapDelete(win->bmp);
+    win->bmp = BitmapCreate(w, h);
+    CreateShmBackBuffer(win);
 }
 
 
@@ -913,6 +1117,7 @@ DfWindow *CreateWinPos(int x, int y, int width, int height, WindowType windowed,
     SendBuf(platSpec, packet, sizeof(packet));
 
     CreateGc(win);
+    CreateShmBackBuffer(win);
     MapWindow(win);
     SetWindowTitle(win, winName);
     EnableDeleteWindowEvent(win);
@@ -932,6 +1137,7 @@ void DestroyWin(DfWindow *win) {
     packet[1] = platSpec->windowId;
     SendBuf(platSpec, packet, sizeof(packet));
 
+    DestroyShmBackBuffer(win);
     BitmapDelete(win->bmp);
     delete[] platSpec->connectionReplySuccessBody;
     delete win->_private->platSpec;
@@ -940,18 +1146,18 @@ void DestroyWin(DfWindow *win) {
 }
 
 
-static void BlitBitmapToWindow(DfWindow *win) {
+static void PutImageRows(DfWindow *win, int firstRow, int numRows) {
     WindowPlatformSpecific *platSpec = win->_private->platSpec;
 
-    // *** Send back-buffer to Xserver.
+    // *** Send rows of the back-buffer to Xserver.
     int W = win->bmp->width;
-    int H = win->bmp->height;
+    int endRow = firstRow + numRows;
     enum { MAX_BYTES_PER_REQUEST = 65535 }; // Len field is 16-bits
     int num_rows_in_chunk = (MAX_BYTES_PER_REQUEST - 6) / W; // -6 because of packet header
-    DfColour *row = win->bmp->pixels;
-    for (int y = 0; y < H; y += num_rows_in_chunk) {
-        if (y + num_rows_in_chunk > H) {
-            num_rows_in_chunk = H - y;
+    DfColour *row = win->bmp->pixels + firstRow * W;
+    for (int y = firstRow; y < endRow; y += num_rows_in_chunk) {
+        if (y + num_rows_in_chunk > endRow) {
+            num_rows_in_chunk = endRow - y;
         }
 
         uint32_t packet[6];
@@ -971,6 +1177,74 @@ static void BlitBitmapToWindow(DfWindow *win) {
 }
 
 
+// Only the request goes through the socket. The Xserver reads the pixels
+// from the shared segment. Returns false if the Xserver rejected the request.
+static bool ShmPutImageRows(DfWindow *win, int firstRow, int numRows) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    int const len = 10;
+    uint32_t packet[len];
+    packet[0] = platSpec->shmMajorOpcode | (X11_SHM_PUT_IMAGE << 8) | (len<<16);
+    packet[1] = platSpec->windowId;
+    packet[2] = platSpec->graphicsContextId;
+    packet[3] = win->bmp->width | (win->bmp->height << 16); // Total width and height.
+    packet[4] = 0 | (firstRow << 16); // Src X and Y.
+    packet[5] = win->bmp->width | (numRows << 16); // Src width and height.
+    packet[6] = 0 | (firstRow << 16); // Dst X and Y.
+    packet[7] = 24 | (2 << 8) | (1 << 16); // Bit depth, ZPixmap format, send ShmCompletion.
+    packet[8] = platSpec->shmSegId;
+    packet[9] = 0; // Offset.
+    SendBuf(platSpec, packet, sizeof(packet));
+    platSpec->numShmPutsPending++;
+
+    // Wait until the Xserver has read the pixels, so that the caller can't
+    // draw the next frame over them first.
+    while (platSpec->numShmPutsPending > 0 && !platSpec->shmFailed) {
+        WaitForXServerData(platSpec);
+        HandleEvents(win);
+    }
+
+    return !platSpec->shmFailed;
+}
+
+
+static void BlitBitmapToWindow(DfWindow *win, int firstRow, int numRows) {
+    WindowPlatformSpecific *platSpec = win->_private->platSpec;
+    double startTime = GetRealTime();
+
+    bool useShm = platSpec->shmSegId != 0;
+    if (useShm && platSpec->printBlitStats)
+        useShm = (platSpec->numBlits[0] + platSpec->numBlits[1]) % 2 == 0;
+
+    if (useShm && !ShmPutImageRows(win, firstRow, numRows)) {
+        printf("Xserver rejected ShmPutImage. Using PutImage instead.\n");
+        DestroyShmBackBuffer(win);
+        useShm = false;
+    }
+    if (!useShm) {
+        PutImageRows(win, firstRow, numRows);
+
+        // ShmPutImageRows() waits for the Xserver to read the pixels. Do the
+        // same here, so that the times compare like for like.
+        if (platSpec->printBlitStats)
+            SyncWithXServer(win);
+    }
+
+    if (platSpec->printBlitStats) {
+        platSpec->blitSeconds[useShm] += GetRealTime() - startTime;
+        platSpec->numBlits[useShm]++;
+        if (platSpec->numBlits[0] + platSpec->numBlits[1] == 200) {
+            if (platSpec->numBlits[1])
+                printf("ShmPutImage: %.3f ms per upload. ", platSpec->blitSeconds[1] * 1e3 / platSpec->numBlits[1]);
+            if (platSpec->numBlits[0])
+                printf("PutImage: %.3f ms per upload.", platSpec->blitSeconds[0] * 1e3 / platSpec->numBlits[0]);
+            printf("\n");
+            memset(platSpec->numBlits, 0, sizeof(platSpec->numBlits));
+            memset(platSpec->blitSeconds, 0, sizeof(platSpec->blitSeconds));
+        }
+    }
+}
+
+
 static void CreateFakeWindowIfNeeded() {
     if (g_fakeWindow._private) return;
 
@@ -1015,7 +1289,18 @@ bool WaitVsync() {
 
 
 bool InputPoll(DfWindow *win) {
+    win->input.lmbClicked = false;
+    win->input.mmbClicked = false;
+    win->input.rmbClicked = false;
+    win->input.lmbUnClicked = false;
+    win->input.mmbUnClicked = false;
+    win->input.rmbUnClicked = false;
+    memset(win->input.keyDowns, 0, KEY_MAX);
+    memset(win->input.keyUps, 0, KEY_MAX);
+    win->input.numKeysTyped = 0;
+
     bool rv = HandleEvents(win);
+    ApplyPendingResize(win);
     InputPollInternal(win);
     return rv;
 }
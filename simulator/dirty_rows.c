@@ -0,0 +1,65 @@
+// Own header
+#include "dirty_rows.h"
+
+
+static int get_end(dirty_rows_t const *d, int band) {
+    return d->first_rows[band] + d->num_rows[band];
+}
+
+static void remove_band(dirty_rows_t *d, int band) {
+    for (int i = band; i + 1 < d->num_bands; i++) {
+        d->first_rows[i] = d->first_rows[i + 1];
+        d->num_rows[i] = d->num_rows[i + 1];
+    }
+    d->num_bands--;
+}
+
+// Extends the band to cover the one after it, then removes that one
+static void merge_with_next(dirty_rows_t *d, int band) {
+    int end = get_end(d, band + 1);
+    if (end > get_end(d, band))
+        d->num_rows[band] = end - d->first_rows[band];
+    remove_band(d, band + 1);
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void dirty_rows_clear(dirty_rows_t *d) {
+    d->num_bands = 0;
+}
+
+void dirty_rows_add(dirty_rows_t *d, int y, int h) {
+    if (h <= 0) return;
+
+    // Make room by merging the two closest bands
+    if (d->num_bands == MAX_DIRTY_BANDS) {
+        int closest = 0;
+        for (int i = 1; i + 1 < d->num_bands; i++) {
+            if (d->first_rows[i + 1] - get_end(d, i) < d->first_rows[closest + 1] - get_end(d, closest))
+                closest = i;
+        }
+        merge_with_next(d, closest);
+    }
+
+    // Insert in order of first row
+    int band = d->num_bands;
+    while (band > 0 && d->first_rows[band - 1] > y) {
+        d->first_rows[band] = d->first_rows[band - 1];
+        d->num_rows[band] = d->num_rows[band - 1];
+        band--;
+    }
+    d->first_rows[band] = y;
+    d->num_rows[band] = h;
+    d->num_bands++;
+
+    // Merge with the neighbours it overlaps or touches
+    if (band > 0 && get_end(d, band - 1) >= y) {
+        band--;
+        merge_with_next(d, band);
+    }
+    while (band + 1 < d->num_bands && get_end(d, band) >= d->first_rows[band + 1])
+        merge_with_next(d, band);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+
+
+// The bands of rows of the window that have been redrawn since they were last
+// sent to the screen. Bands are kept sorted and don't overlap or touch. When
+// there are too many, the two closest are merged.
+
+enum { MAX_DIRTY_BANDS = 16 };
+
+typedef struct {
+    int first_rows[MAX_DIRTY_BANDS];
+    int num_rows[MAX_DIRTY_BANDS];
+    int num_bands;
+} dirty_rows_t;
+
+
+void dirty_rows_clear(dirty_rows_t *d);
+
+// Adds the rows from y to y + h - 1
+void dirty_rows_add(dirty_rows_t *d, int y, int h);
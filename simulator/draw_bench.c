@@ -0,0 +1,223 @@
+// Benchmarks for Deadfrog's drawing primitives, the ones that the simulator's
+// UI spends its frames in. First checks that the line fills write exactly the
+// same pixels as PutPixUnclipped() at every SIMD level the CPU has. Then times
+// each primitive at each level, and reports the speed in millions of pixels
+// drawn per second.
+//
+// Usage: draw_bench [seconds_per_test]
+
+// Deadfrog headers
+#include "df_bitmap.h"
+#include "df_font.h"
+#include "df_time.h"
+#include "fonts/df_mono.h"
+
+// Standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// The size of the simulator's window
+enum { BMP_WIDTH = 700, BMP_HEIGHT = 800 };
+
+static char const *const LEVEL_NAMES[] = { "scalar", "SSE2", "AVX2" };
+
+static DfBitmap *g_bmp;
+static DfBitmap *g_src_bmp;
+static DfFont *g_font;
+static double g_seconds_per_test;
+
+
+static unsigned g_rand_state = 1;
+
+static unsigned next_rand(void) {
+    g_rand_state = g_rand_state * 1103515245 + 12345;
+    return g_rand_state >> 8;
+}
+
+static DfColour rand_colour(unsigned alpha) {
+    DfColour c;
+    c.c = next_rand();
+    c.a = (unsigned char)alpha;
+    return c;
+}
+
+static void fill_with_noise(DfBitmap *bmp) {
+    for (int i = 0; i < bmp->width * bmp->height; i++)
+        bmp->pixels[i].c = next_rand() ^ (next_rand() << 16);
+}
+
+
+// Draws runs of every length up to a few vector widths, from every alignment,
+// with every alpha, and compares them with PutPixUnclipped().
+static bool check_exactness(void) {
+    enum { WIDTH = 128, MAX_LEN = 80 };
+    DfBitmap *expected = BitmapCreate(WIDTH, 1);
+    DfBitmap *actual = BitmapCreate(WIDTH, 1);
+    bool ok = true;
+
+    for (unsigned alpha = 0; alpha < 256 && ok; alpha++) {
+        for (int x = 0; x < 16 && ok; x++) {
+            int len = (int)(next_rand() % MAX_LEN);
+            DfColour c = rand_colour(alpha);
+            fill_with_noise(expected);
+            memcpy(actual->pixels, expected->pixels, WIDTH * sizeof(DfColour));
+
+            for (int i = 0; i < len; i++)
+                PutPixUnclipped(expected, x + i, 0, c);
+            HLineUnclipped(actual, x, 0, len, c);
+
+            if (memcmp(actual->pixels, expected->pixels, WIDTH * sizeof(DfColour)) != 0) {
+                printf("  ERROR: %s HLine differs from PutPixUnclipped(), x=%d len=%d colour=%08x\n",
+                    LEVEL_NAMES[BitmapGetSimdLevel()], x, len, c.c);
+                ok = false;
+            }
+        }
+    }
+
+    BitmapDelete(expected);
+    BitmapDelete(actual);
+    return ok;
+}
+
+
+// Each test draws one batch of the primitive and returns how many pixels it
+// drew
+typedef double test_func_t(void);
+
+static double test_clear(void) {
+    BitmapClear(g_bmp, Colour(200, 200, 200, 255));
+    return (double)BMP_WIDTH * BMP_HEIGHT;
+}
+
+static double test_rect_fill(void) {
+    // Like a RAM cell's background
+    for (int y = 0; y < 600; y += 20)
+        for (int x = 0; x < 600; x += 100)
+            RectFill(g_bmp, x, y, 96, 17, Colour(255, 255, 255, 255));
+    return 30.0 * 6 * 96 * 17;
+}
+
+static double test_rect_blend(void) {
+    for (int y = 0; y < 600; y += 20)
+        for (int x = 0; x < 600; x += 100)
+            RectFill(g_bmp, x, y, 96, 17, Colour(255, 0, 0, 96));
+    return 30.0 * 6 * 96 * 17;
+}
+
+static double test_hline_fill(void) {
+    // Like a graph's grid lines
+    for (int y = 0; y < BMP_HEIGHT; y++)
+        HLine(g_bmp, 0, y, BMP_WIDTH, Colour(0, 0, 0, 255));
+    return (double)BMP_WIDTH * BMP_HEIGHT;
+}
+
+static double test_hline_blend(void) {
+    for (int y = 0; y < BMP_HEIGHT; y++)
+        HLine(g_bmp, 0, y, BMP_WIDTH, Colour(0, 0, 255, 128));
+    return (double)BMP_WIDTH * BMP_HEIGHT;
+}
+
+static double test_short_hline_blend(void) {
+    for (int y = 0; y < BMP_HEIGHT; y++)
+        for (int x = 0; x < BMP_WIDTH; x += 16)
+            HLine(g_bmp, x, y, 10, Colour(0, 0, 255, 128));
+    return BMP_HEIGHT * (BMP_WIDTH / 16) * 10.0;
+}
+
+static double test_text(void) {
+    // Counts the pixels of the character cells drawn
+    static char const line[] = "0x3f 0x00 0x7c 0xff 0x12 0x80 0x01 0x55 0xaa 0x40";
+    int num_lines = BMP_HEIGHT / g_font->charHeight;
+    double pixels = 0.0;
+    for (int i = 0; i < num_lines; i++) {
+        int w = DrawTextSimple(g_font, Colour(0, 0, 0, 255), g_bmp, 0, i * g_font->charHeight, line);
+        pixels += (double)w * g_font->charHeight;
+    }
+    return pixels;
+}
+
+static double test_blit(void) {
+    Blit(g_bmp, 0, 0, g_src_bmp);
+    return (double)BMP_WIDTH * BMP_HEIGHT;
+}
+
+
+typedef struct {
+    char const *name;
+    test_func_t *func;
+} test_t;
+
+static test_t const g_tests[] = {
+    { "BitmapClear", test_clear },
+    { "RectFill, opaque", test_rect_fill },
+    { "RectFill, blended", test_rect_blend },
+    { "HLine 700, opaque", test_hline_fill },
+    { "HLine 700, blended", test_hline_blend },
+    { "HLine 10, blended", test_short_hline_blend },
+    { "DrawTextSimple 8x15", test_text },
+    { "Blit", test_blit },
+};
+
+// Returns millions of pixels per second
+static double run_test(test_t const *test) {
+    // Warm up the caches and the branch predictors
+    test->func();
+
+    double pixels = 0.0;
+    double start_time = GetRealTime();
+    double elapsed;
+    do {
+        pixels += test->func();
+        elapsed = GetRealTime() - start_time;
+    } while (elapsed < g_seconds_per_test);
+
+    return pixels / elapsed / 1e6;
+}
+
+
+int main(int argc, char *argv[]) {
+    g_seconds_per_test = argc > 1 ? atof(argv[1]) : 0.5;
+    if (g_seconds_per_test <= 0.0) {
+        puts("Usage: draw_bench [seconds_per_test]");
+        return 1;
+    }
+
+    g_bmp = BitmapCreate(BMP_WIDTH, BMP_HEIGHT);
+    g_src_bmp = BitmapCreate(BMP_WIDTH, BMP_HEIGHT);
+    fill_with_noise(g_src_bmp);
+    g_font = LoadFontFromMemory(df_mono_8x15, sizeof(df_mono_8x15));
+
+    int max_level = BitmapGetSimdLevel();
+    printf("CPU supports %s\n", LEVEL_NAMES[max_level]);
+
+    bool ok = true;
+    for (int level = DF_SIMD_NONE; level <= max_level; level++) {
+        BitmapSetSimdLevel(level);
+        ok = check_exactness() && ok;
+    }
+    if (ok)
+        puts("All levels match PutPixUnclipped()");
+
+    printf("%-28s", "Mpixels/s");
+    for (int level = DF_SIMD_NONE; level <= max_level; level++)
+        printf(" %9s", LEVEL_NAMES[level]);
+    printf("\n");
+
+    int num_tests = sizeof(g_tests) / sizeof(g_tests[0]);
+    for (int i = 0; i < num_tests; i++) {
+        printf("%-28s", g_tests[i].name);
+        for (int level = DF_SIMD_NONE; level <= max_level; level++) {
+            BitmapSetSimdLevel(level);
+            printf(" %9.1f", run_test(&g_tests[i]));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    FontDelete(g_font);
+    BitmapDelete(g_src_bmp);
+    BitmapDelete(g_bmp);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+// Own header
+#include "event_queue.h"
+
+// Standard headers
+#include <assert.h>
+#include <stddef.h>
+
+
+static void swap_events(event_t *a, event_t *b) {
+    event_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+void event_queue_init(event_queue_t *q) {
+    q->num_events = 0;
+}
+
+void event_queue_push(event_queue_t *q, unsigned time, int type) {
+    assert(q->num_events < MAX_EVENTS);
+    if (q->num_events == MAX_EVENTS) return;
+
+    // Add at the bottom of the heap, then sift up
+    int i = q->num_events++;
+    q->events[i].time = time;
+    q->events[i].type = type;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_time_before(q->events[i].time, q->events[parent].time))
+            break;
+        swap_events(&q->events[i], &q->events[parent]);
+        i = parent;
+    }
+}
+
+event_t const *event_queue_peek(event_queue_t const *q) {
+    if (q->num_events == 0) return NULL;
+    return &q->events[0];
+}
+
+event_t event_queue_pop(event_queue_t *q) {
+    assert(q->num_events > 0);
+    event_t earliest = q->events[0];
+
+    // Move the last event to the top, then sift down
+    q->num_events--;
+    q->events[0] = q->events[q->num_events];
+    int i = 0;
+    while (1) {
+        int smallest = i;
+        int left = i * 2 + 1;
+        int right = left + 1;
+        if (left < q->num_events && event_time_before(q->events[left].time, q->events[smallest].time))
+            smallest = left;
+        if (right < q->num_events && event_time_before(q->events[right].time, q->events[smallest].time))
+            smallest = right;
+        if (smallest == i)
+            break;
+        swap_events(&q->events[i], &q->events[smallest]);
+        i = smallest;
+    }
+
+    return earliest;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+
+// Times are in CPU cycles, on the same clock as cpu_t::master_clk. They are
+// compared modulo 2^32, so the clock can wrap as long as no event is
+// scheduled more than 2^31 cycles ahead.
+typedef struct {
+    unsigned time;
+    int type;           // Meaning is up to the owner of the queue
+} event_t;
+
+
+enum { MAX_EVENTS = 32 };
+
+typedef struct {
+    event_t events[MAX_EVENTS]; // Binary min-heap, ordered by time
+    int num_events;
+} event_queue_t;
+
+
+// Returns true if time a is before time b
+static inline bool event_time_before(unsigned a, unsigned b) {
+    return (int)(a - b) < 0;
+}
+
+void event_queue_init(event_queue_t *q);
+void event_queue_push(event_queue_t *q, unsigned time, int type);
+
+// Returns the earliest event, or NULL if the queue is empty.
+event_t const *event_queue_peek(event_queue_t const *q);
+
+// Removes and returns the earliest event. The queue must not be empty.
+event_t event_queue_pop(event_queue_t *q);
@@ -1,88 +1,171 @@
 // Own header
 #include "graph.h"
 
-// Deadfrog headers
-#include "df_bitmap.h"
-#include "df_window.h"
+// Standard headers
+#include <string.h>
 
 
-typedef struct {
-    unsigned time;
-    uint8_t val;
-} graph_point_t;
-
-
-enum { MAX_POINTS = 64 };
-
-typedef struct {
-    graph_point_t points[MAX_POINTS]; // In time order. Oldest first.
-    int first_idx;
-    int next_idx;   // if first_idx == next_idx, there are no points.
-} graph_t;
+static graph_t g_graphs[NUM_GRAPHS];
+static FILE *g_trace_file;
 
+static char const *g_graph_names[NUM_GRAPHS] = {
+    "to_klr_reset",
+    "to_klr_ignition",
+    "from_klr_ignition",
+    "from_klr_cycling_valve_pwm",
+    "from_klr_full_load_signal",
+    "from_klr_blink_code"
+};
 
-static graph_t g_graphs[NUM_GRAPHS];
 
 void graph_add_point(graph_id_t id, unsigned time, uint8_t val) {
     if (id >= NUM_GRAPHS) return;
     graph_t *g = &g_graphs[id];
+    capture_t *c = &g->capture;
+    if (!c->chunks) {
+        capture_init(c, GRAPH_CAPTURE_BYTES);
+        lod_init(&g->lod);
+    }
 
     // TODO: check that time is greater than last point.
 
-    int num_points = (g->next_idx - g->first_idx + MAX_POINTS) % MAX_POINTS;
-    if (num_points == (MAX_POINTS - 1)) {
-        // Already full. Remove oldest point.
-        g->first_idx++;
-        g->first_idx %= MAX_POINTS;
+    if (c->num_points > 0) {
+        if (c->last_val)
+            g->high_time += time - (unsigned)c->last_time;
+        if (c->last_val != val)
+            g->num_transitions++;
     }
 
-    g->points[g->next_idx].time = time;
-    g->points[g->next_idx].val = val;
-    g->next_idx++;
-    g->next_idx %= MAX_POINTS;
-}
+    capture_add(c, time, val);
+    lod_add(&g->lod, c->last_time, val);
 
-void graph_draw(graph_id_t id, unsigned time_now, unsigned time_range_to_display,
-        int x, int y, int w, int h) {
-    if (id >= NUM_GRAPHS) return;
-    graph_t *g = &g_graphs[id];
+    if (g_trace_file)
+        fprintf(g_trace_file, "%u,%s,%u\n", time, g_graph_names[id], val);
+}
 
-    DfColour gray = Colour(220, 220, 220, 255);
-    RectFill(g_window->bmp, x, y, w, h, gray);
+graph_t const *graph_get(graph_id_t id) {
+    if (id >= NUM_GRAPHS) return NULL;
+    return &g_graphs[id];
+}
 
-    if (g->first_idx == g->next_idx)
-        return; // No data to plot
+char const *graph_get_name(graph_id_t id) {
+    if (id >= NUM_GRAPHS) return "";
+    return g_graph_names[id];
+}
 
-    double start_time = (double)time_now - (double)time_range_to_display;
-    double scale_x = (double)w / (double)time_range_to_display;
-    double scale_y = -(double)(h - 1) / 255.0;
-    y += h - 1;
+static void mark_columns_empty(int num_columns, uint8_t *mins, uint8_t *maxs) {
+    memset(mins, 255, num_columns);
+    memset(maxs, 0, num_columns);
+}
 
-    double x2;
-    double y2;
-    int last_idx = (g->next_idx - 1 + MAX_POINTS) % MAX_POINTS;
-    if (g->points[last_idx].time < start_time) {
-        HLine(g_window->bmp, x, y + g->points[last_idx].val * scale_y, w, g_colourBlack);
+// For when the columns are short. There are few points in each.
+static void get_columns_from_points(capture_t const *c, uint64_t start_time, double cycles_per_column,
+        int num_columns, uint8_t *mins, uint8_t *maxs) {
+    capture_cursor_t cursor;
+    if (!capture_seek(c, start_time, &cursor)) {
+        mark_columns_empty(num_columns, mins, maxs);
         return;
     }
 
-    for (int i = g->first_idx; i != last_idx; i = (i + 1) % MAX_POINTS) {
-        graph_point_t *p1 = &g->points[i];
-        graph_point_t *p2 = &g->points[(i + 1) % MAX_POINTS];
-        if (p2->time < start_time)
+    // The cursor is on the last point before the column, whose value is held
+    // into it, or on the first point, which may be after it
+    for (int i = 0; i < num_columns; i++) {
+        uint64_t end_time = start_time + (uint64_t)((i + 1) * cycles_per_column);
+        if (cursor.time >= end_time) {
+            mins[i] = 255;
+            maxs[i] = 0;
             continue;
-        double x1 = x + (p1->time - start_time) * scale_x;
-        double y1 = y + p1->val * scale_y;
-        x2 = x + (p2->time - start_time) * scale_x;
-        y2 = y + p2->val * scale_y;
-        if (x1 < x) x1 = x;
-        DrawLine(g_window->bmp, x1, y1, x2, y2, g_colourBlack);
+        }
+
+        uint8_t min = cursor.val;
+        uint8_t max = cursor.val;
+        capture_cursor_t next = cursor;
+        while (capture_next(&next) && next.time < end_time) {
+            cursor = next;
+            if (cursor.val < min) min = cursor.val;
+            if (cursor.val > max) max = cursor.val;
+        }
+        mins[i] = min;
+        maxs[i] = max;
+    }
+}
+
+static void get_columns_from_lod(lod_t const *lod, int level, uint64_t start_time, double cycles_per_column,
+        int num_columns, uint8_t *mins, uint8_t *maxs) {
+    for (int i = 0; i < num_columns; i++) {
+        uint64_t column_start = start_time + (uint64_t)(i * cycles_per_column);
+        uint64_t column_end = start_time + (uint64_t)((i + 1) * cycles_per_column);
+        if (!lod_get_range(lod, level, column_start, column_end, &mins[i], &maxs[i])) {
+            mins[i] = 255;
+            maxs[i] = 0;
+        }
+    }
+}
+
+void graph_get_columns(graph_id_t id, unsigned time_now, unsigned time_range, int num_columns,
+        uint8_t *mins, uint8_t *maxs) {
+    if (num_columns > MAX_GRAPH_COLUMNS)
+        num_columns = MAX_GRAPH_COLUMNS;
+    if (id >= NUM_GRAPHS || num_columns <= 0) return;
+    graph_t const *g = &g_graphs[id];
+    capture_t const *c = &g->capture;
+    if (c->num_points == 0) {
+        mark_columns_empty(num_columns, mins, maxs);
+        return;
     }
 
-    int len = (w + x);
-    len -= x2;
-    HLine(g_window->bmp, x2, y2, len, g_colourBlack);
+    uint64_t end_time = capture_expand_time(c, time_now);
+    uint64_t start_time = end_time > time_range ? end_time - time_range : 0;
+    double cycles_per_column = (double)time_range / num_columns;
+    int level = lod_choose_level(&g->lod, start_time, cycles_per_column);
+    if (level < 0)
+        get_columns_from_points(c, start_time, cycles_per_column, num_columns, mins, maxs);
+    else
+        get_columns_from_lod(&g->lod, level, start_time, cycles_per_column, num_columns, mins, maxs);
+}
+
+// The LOD buckets that the restored end of the capture falls in also hold
+// the points that were discarded. Rebuild them from the capture.
+static void rebuild_lod(graph_t *g) {
+    capture_t const *c = &g->capture;
+    if (c->num_points == 0) {
+        lod_clear(&g->lod);
+        return;
+    }
+
+    uint64_t rewind_time = lod_get_rewind_time(c->last_time);
+    capture_cursor_t cursor;
+    capture_seek(c, rewind_time > 0 ? rewind_time - 1 : 0, &cursor);
+    if (cursor.time < rewind_time) {
+        lod_rewind(&g->lod, rewind_time, cursor.val);
+    }
+    else {
+        // Nothing held from before then. Rebuild from the first point.
+        lod_clear(&g->lod);
+        lod_add(&g->lod, cursor.time, cursor.val);
+    }
+
+    while (capture_next(&cursor))
+        lod_add(&g->lod, cursor.time, cursor.val);
+}
+
+void graph_snapshot(graph_snapshot_t *snapshot) {
+    for (int i = 0; i < NUM_GRAPHS; i++) {
+        capture_mark(&g_graphs[i].capture, &snapshot->marks[i]);
+        snapshot->num_transitions[i] = g_graphs[i].num_transitions;
+        snapshot->high_time[i] = g_graphs[i].high_time;
+    }
+}
+
+void graph_restore(graph_snapshot_t const *snapshot) {
+    for (int i = 0; i < NUM_GRAPHS; i++) {
+        capture_rewind(&g_graphs[i].capture, &snapshot->marks[i]);
+        rebuild_lod(&g_graphs[i]);
+        g_graphs[i].num_transitions = snapshot->num_transitions[i];
+        g_graphs[i].high_time = snapshot->high_time[i];
+    }
 }
 
-void graph_draw_y_axis(unsigned time_now, unsigned time_range_to_display) {
+void graph_set_trace_file(FILE *trace_file) {
+    g_trace_file = trace_file;
 }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "capture.h"
+#include "lod.h"
+
 #include <stdint.h>
+#include <stdio.h>
 
 
 // Signals to graph are:
@@ -15,9 +19,58 @@ typedef enum {
 } graph_id_t;
 
 
+// Memory limit for the points of each graph. At the rate the KLR toggles its
+// outputs, this holds over an hour.
+enum { GRAPH_CAPTURE_BYTES = 4 * 1024 * 1024 };
+
+typedef struct {
+    capture_t capture;  // Every point added, back as far as GRAPH_CAPTURE_BYTES allows
+    lod_t lod;          // Min/max summary of the points, for drawing long time ranges
+
+    // Summary of every point ever added, not just the ones still in the capture.
+    unsigned num_transitions;   // Number of times val changed.
+    unsigned high_time;         // Total time spent with val != 0.
+} graph_t;
+
+
+// The state of every graph at some moment. Restoring discards the points
+// added since. See vc_snapshot() and capture_rewind().
+typedef struct {
+    capture_mark_t marks[NUM_GRAPHS];
+    unsigned num_transitions[NUM_GRAPHS];
+    unsigned high_time[NUM_GRAPHS];
+} graph_snapshot_t;
+
+
 void graph_add_point(graph_id_t id, unsigned time, uint8_t val);
+graph_t const *graph_get(graph_id_t id);
+char const *graph_get_name(graph_id_t id);
+
+void graph_snapshot(graph_snapshot_t *snapshot);
+void graph_restore(graph_snapshot_t const *snapshot);
+
+// Widest graph that graph_get_columns() and graph_draw() can produce
+enum { MAX_GRAPH_COLUMNS = 4096 };
+
+// Splits the time range from time_now - time_range to time_now into
+// num_columns equal slices, and gets the lowest and highest value that the
+// signal held in each. A slice with no data gets a min greater than its max.
+// Uses the graph's LOD summary when the slices are long enough, and the points
+// themselves otherwise, so the time taken is proportional to num_columns
+// however long the range is.
+void graph_get_columns(graph_id_t id, unsigned time_now, unsigned time_range, int num_columns,
+    uint8_t *mins, uint8_t *maxs);
+
+// If trace_file is not NULL, every point added is also written to it as a
+// line of CSV: time,signal_name,val.
+void graph_set_trace_file(FILE *trace_file);
 
 // Draws a chart for the specified graph. The displayed range is from
-// time_now - time_range_to_display, to time_now.
+// time_now - time_range_to_display, to time_now. Implemented in graph_draw.c
+// so that the headless build doesn't need Deadfrog.
 void graph_draw(graph_id_t id, unsigned time_now, unsigned time_range_to_display,
     int x, int y, int w, int h);
+
+// Draws a chart of columns that graph_get_columns() got earlier, one per
+// pixel, up to w of them.
+void graph_draw_columns(uint8_t const *mins, uint8_t const *maxs, int x, int y, int w, int h);
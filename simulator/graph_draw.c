@@ -0,0 +1,41 @@
+// Own header
+#include "graph.h"
+
+// Deadfrog headers
+#include "df_bitmap.h"
+#include "df_window.h"
+
+
+void graph_draw(graph_id_t id, unsigned time_now, unsigned time_range_to_display,
+        int x, int y, int w, int h) {
+    if (!graph_get(id)) return;
+
+    static uint8_t mins[MAX_GRAPH_COLUMNS];
+    static uint8_t maxs[MAX_GRAPH_COLUMNS];
+    if (w > MAX_GRAPH_COLUMNS)
+        w = MAX_GRAPH_COLUMNS;
+    graph_get_columns(id, time_now, time_range_to_display, w, mins, maxs);
+    graph_draw_columns(mins, maxs, x, y, w, h);
+}
+
+void graph_draw_columns(uint8_t const *mins, uint8_t const *maxs, int x, int y, int w, int h) {
+    DfColour gray = Colour(220, 220, 220, 255);
+    RectFill(g_window->bmp, x, y, w, h, gray);
+
+    // One vertical line per column, from the lowest value held to the highest.
+    // Where the signal is steady, that is a single pixel.
+    if (w > MAX_GRAPH_COLUMNS)
+        w = MAX_GRAPH_COLUMNS;
+    double scale_y = -(double)(h - 1) / 255.0;
+    y += h - 1;
+    for (int i = 0; i < w; i++) {
+        if (mins[i] > maxs[i])
+            continue;   // No data
+        int top = y + maxs[i] * scale_y;
+        int bottom = y + mins[i] * scale_y;
+        VLine(g_window->bmp, x + i, top, bottom - top + 1, g_colourBlack);
+    }
+}
+
+void graph_draw_y_axis(unsigned time_now, unsigned time_range_to_display) {
+}
@@ -0,0 +1,387 @@
+// Headless batch-mode front end. Runs the KLR ROM as fast as the host allows,
+// with no window, driven by a scenario file. Writes the signal traces and a
+// summary of the run to files.
+//
+// Usage: headless [--vcd] [--trace] [--record] [--realtime <ratio>] <rom.bin>
+//                 <scenario.txt> <duration_seconds> [output_prefix] [annotated_asm]
+//        headless [--vcd] [--trace] [--realtime <ratio>] --replay <rom.bin>
+//                 <journal> <duration_seconds> [output_prefix] [annotated_asm]
+//
+// The scenario file contains lines of the form "time_in_seconds throttle_pos",
+// in time order, with throttle_pos in the range 0 to 1. Each throttle position
+// is held until the time of the next line. Lines starting with '#' are
+// ignored.
+//
+// Outputs are <output_prefix>_trace.csv, <output_prefix>_stats.txt and
+// <output_prefix>_irq.csv. The last has the interrupt latency and duration
+// figures for each band of engine RPM. The default output_prefix is
+// "headless". If annotated_asm is given, the CPU is
+// profiled and <output_prefix>_profile.txt is written too, with each address
+// keyed back to its line in the annotated_asm file. With --vcd, every change
+// on the KLR's pins is written to <output_prefix>.vcd, for viewing in GTKWave.
+// With --trace, the CPU's I/O is logged to <output_prefix>.trace, in the
+// binary format described in trace.h. trace_tool reads it.
+//
+// With --record, every input to the KLR is saved to <output_prefix>.journal.
+// With --replay, the inputs come from a journal file instead of the physics
+// sim and a scenario. Replaying into the same ROM reproduces the recorded run
+// exactly, so replaying into a patched ROM shows only what the patch changed.
+// The engine RPM that the interrupt figures are banded by is then worked out
+// from the times of the sparks in the journal, and the physics sim's figures
+// are left out of <output_prefix>_stats.txt.
+//
+// With --realtime, the run is paced to wall-clock time instead of running
+// as fast as possible, with ratio simulated seconds per real second. See
+// pacer.h. The timing jitter figures are added to <output_prefix>_stats.txt.
+
+// This project's headers
+#include "cpu.h"
+#include "graph.h"
+#include "journal.h"
+#include "pacer.h"
+#include "profile_report.h"
+#include "trace.h"
+#include "vcd.h"
+#include "virtual_car.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// The simulation is advanced in steps of this many seconds. The scenario is
+// only sampled at step boundaries.
+static double const STEP_PERIOD = 1e-3;
+
+// With --realtime, a run that falls further behind the wall clock than this
+// drops the time it missed. See pacer.h.
+static double const MAX_BEHIND_SECONDS = 0.03;
+
+enum { MAX_SCENARIO_POINTS = 1024 };
+
+typedef struct {
+    double time;
+    double throttle_pos;
+} scenario_point_t;
+
+static scenario_point_t g_scenario[MAX_SCENARIO_POINTS];
+static int g_num_scenario_points;
+
+// Interrupt timing is collected separately for each band of engine RPM
+static double const IRQ_RPM_BAND_WIDTH = 500.0;
+enum { NUM_IRQ_RPM_BANDS = 14 };
+
+static cpu_irq_stats_t g_irq_stats[NUM_IRQ_RPM_BANDS];
+static cpu_irq_stats_t g_total_irq_stats;
+
+static char const *g_irq_names[NUM_IRQ_SOURCES] = { "ext", "timer" };
+
+
+static void usage(void) {
+    puts("Usage: headless [--vcd] [--trace] [--record] [--realtime <ratio>] <rom.bin> <scenario.txt> <duration_seconds> [output_prefix] [annotated_asm]");
+    puts("       headless [--vcd] [--trace] [--realtime <ratio>] --replay <rom.bin> <journal> <duration_seconds> [output_prefix] [annotated_asm]");
+    exit(1);
+}
+
+static bool load_rom(char const *path) {
+    FILE *rom_file = fopen(path, "rb");
+    if (!rom_file) return false;
+    u8 rom[4096];
+    unsigned num_bytes = fread(rom, 1, sizeof(rom), rom_file);
+    fclose(rom_file);
+    cpu_load_rom(g_virtual_car.cpu, rom, num_bytes);
+    return num_bytes > 0;
+}
+
+static bool load_scenario(char const *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) return false;
+
+    char line[128];
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') continue;
+
+        scenario_point_t p;
+        if (sscanf(line, "%lf %lf", &p.time, &p.throttle_pos) != 2) continue;
+        if (g_num_scenario_points == MAX_SCENARIO_POINTS) {
+            printf("Too many points in scenario. Max is %d\n", MAX_SCENARIO_POINTS);
+            break;
+        }
+
+        g_scenario[g_num_scenario_points] = p;
+        g_num_scenario_points++;
+    }
+
+    fclose(in);
+    return true;
+}
+
+static double get_scenario_throttle_pos(double time) {
+    double throttle_pos = 0.0;
+    for (int i = 0; i < g_num_scenario_points; i++) {
+        if (g_scenario[i].time > time) break;
+        throttle_pos = g_scenario[i].throttle_pos;
+    }
+
+    return throttle_pos;
+}
+
+static FILE *open_output_file(char const *prefix, char const *suffix) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s%s", prefix, suffix);
+    FILE *f = fopen(path, "w");
+    if (!f)
+        printf("Couldn't open output file '%s'\n", path);
+    return f;
+}
+
+static cpu_irq_stats_t *get_irq_stats(double engine_rpm) {
+    int band = (int)(engine_rpm / IRQ_RPM_BAND_WIDTH);
+    if (band < 0) band = 0;
+    if (band >= NUM_IRQ_RPM_BANDS) band = NUM_IRQ_RPM_BANDS - 1;
+    return &g_irq_stats[band];
+}
+
+static void add_histogram(irq_histogram_t *total, irq_histogram_t const *h) {
+    for (int i = 0; i < IRQ_HISTOGRAM_SIZE; i++)
+        total->counts[i] += h->counts[i];
+    total->num_samples += h->num_samples;
+    if (h->max > total->max)
+        total->max = h->max;
+}
+
+static void write_histogram_figures(FILE *out, irq_histogram_t const *h) {
+    fprintf(out, ",%u,%u,%u,%u", h->num_samples, irq_histogram_percentile(h, 0.5), irq_histogram_percentile(h, 0.99), h->max);
+}
+
+static void write_irq_csv(FILE *out) {
+    fputs("rpm_band,irq,latency_count,latency_p50,latency_p99,latency_max,duration_count,duration_p50,duration_p99,duration_max\n", out);
+    for (int band = 0; band < NUM_IRQ_RPM_BANDS; band++) {
+        cpu_irq_stats_t const *stats = &g_irq_stats[band];
+        for (int irq = 0; irq < NUM_IRQ_SOURCES; irq++) {
+            if (stats->latency[irq].num_samples == 0 && stats->duration[irq].num_samples == 0) continue;
+            fprintf(out, "%.0f,%s", band * IRQ_RPM_BAND_WIDTH, g_irq_names[irq]);
+            write_histogram_figures(out, &stats->latency[irq]);
+            write_histogram_figures(out, &stats->duration[irq]);
+            fputs("\n", out);
+        }
+    }
+}
+
+// The physics sim doesn't run while replaying, so its figures are left out
+static void write_stats(FILE *out, double sim_duration, double wall_duration, bool replay) {
+    cpu_t *cpu = g_virtual_car.cpu;
+    fprintf(out, "sim_seconds %.6f\n", sim_duration);
+    fprintf(out, "wall_seconds %.6f\n", wall_duration);
+    fprintf(out, "sim_seconds_per_wall_second %.3f\n", sim_duration / wall_duration);
+    fprintf(out, "cpu_cycles %u\n", cpu->master_clk);
+    fprintf(out, "early_adc_reads %u\n", g_virtual_car.num_early_adc_reads);
+    fprintf(out, "ext_mem_writes %u\n", g_virtual_car.num_ext_mem_writes);
+    if (!replay) {
+        fprintf(out, "final_engine_rpm %.1f\n", g_virtual_car.engine_rpm);
+        fprintf(out, "final_turbo_rpm %.1f\n", g_virtual_car.turbo_rpm);
+        fprintf(out, "final_manifold_pressure %.3f\n", g_virtual_car.manifold_pressure);
+    }
+
+    for (int i = 0; i < NUM_GRAPHS; i++) {
+        graph_t const *g = graph_get((graph_id_t)i);
+        double duty = (double)g->high_time / (double)cpu->master_clk;
+        fprintf(out, "%s_transitions %u\n", graph_get_name((graph_id_t)i), g->num_transitions);
+        fprintf(out, "%s_duty %.4f\n", graph_get_name((graph_id_t)i), duty);
+    }
+
+    for (int band = 0; band < NUM_IRQ_RPM_BANDS; band++) {
+        for (int irq = 0; irq < NUM_IRQ_SOURCES; irq++) {
+            add_histogram(&g_total_irq_stats.latency[irq], &g_irq_stats[band].latency[irq]);
+            add_histogram(&g_total_irq_stats.duration[irq], &g_irq_stats[band].duration[irq]);
+        }
+    }
+    for (int irq = 0; irq < NUM_IRQ_SOURCES; irq++) {
+        irq_histogram_t const *latency = &g_total_irq_stats.latency[irq];
+        irq_histogram_t const *duration = &g_total_irq_stats.duration[irq];
+        fprintf(out, "%s_irq_latency_count %u\n", g_irq_names[irq], latency->num_samples);
+        fprintf(out, "%s_irq_latency_p99 %u\n", g_irq_names[irq], irq_histogram_percentile(latency, 0.99));
+        fprintf(out, "%s_irq_latency_max %u\n", g_irq_names[irq], latency->max);
+        fprintf(out, "%s_irq_duration_count %u\n", g_irq_names[irq], duration->num_samples);
+        fprintf(out, "%s_irq_duration_p99 %u\n", g_irq_names[irq], irq_histogram_percentile(duration, 0.99));
+        fprintf(out, "%s_irq_duration_max %u\n", g_irq_names[irq], duration->max);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool write_vcd = false;
+    bool write_trace = false;
+    bool record = false;
+    bool replay = false;
+    double realtime_ratio = 0.0;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--vcd") == 0)
+            write_vcd = true;
+        else if (strcmp(argv[1], "--trace") == 0)
+            write_trace = true;
+        else if (strcmp(argv[1], "--record") == 0)
+            record = true;
+        else if (strcmp(argv[1], "--replay") == 0)
+            replay = true;
+        else if (strcmp(argv[1], "--realtime") == 0 && argc > 2) {
+            realtime_ratio = atof(argv[2]);
+            if (realtime_ratio <= 0.0) usage();
+            argc--;
+            argv++;
+        }
+        else
+            usage();
+        argc--;
+        argv++;
+    }
+
+    if (argc < 4 || (record && replay)) usage();
+    char const *rom_path = argv[1];
+    char const *scenario_path = argv[2];
+    double sim_duration = atof(argv[3]);
+    char const *output_prefix = argc > 4 ? argv[4] : "headless";
+    char const *asm_path = argc > 5 ? argv[5] : NULL;
+
+    vc_init(&g_virtual_car);
+    g_virtual_car.record_graphs = true;
+    if (!load_rom(rom_path)) {
+        printf("Couldn't read ROM file '%s'\n", rom_path);
+        return 1;
+    }
+    journal_t journal;
+    journal_init(&journal);
+    if (replay) {
+        if (!journal_load(&journal, scenario_path)) {
+            printf("Couldn't read journal file '%s'\n", scenario_path);
+            return 1;
+        }
+    }
+    else if (!load_scenario(scenario_path)) {
+        printf("Couldn't read scenario file '%s'\n", scenario_path);
+        return 1;
+    }
+
+    FILE *trace_file = open_output_file(output_prefix, "_trace.csv");
+    FILE *stats_file = open_output_file(output_prefix, "_stats.txt");
+    FILE *irq_file = open_output_file(output_prefix, "_irq.csv");
+    if (!trace_file || !stats_file || !irq_file) return 1;
+    fputs("time,signal,val\n", trace_file);
+    graph_set_trace_file(trace_file);
+
+    cpu_profile_t *profile = NULL;
+    if (asm_path) {
+        profile = (cpu_profile_t *)calloc(1, sizeof(cpu_profile_t));
+        g_virtual_car.cpu->profile = profile;
+    }
+
+    cpu_reset(g_virtual_car.cpu);
+
+    FILE *vcd_file = NULL;
+    vcd_t vcd;
+    if (write_vcd) {
+        vcd_file = open_output_file(output_prefix, ".vcd");
+        if (!vcd_file) return 1;
+        if (!vcd_init(&vcd, vcd_file, CPU_CLOCK_RATE_HZ)) {
+            printf("Couldn't start the VCD writer\n");
+            return 1;
+        }
+        vc_start_vcd(&g_virtual_car, &vcd);
+    }
+
+    trace_writer_t trace;
+    if (write_trace) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s.trace", output_prefix);
+        if (!trace_writer_open(&trace, path, CPU_CLOCK_RATE_HZ)) {
+            printf("Couldn't open output file '%s'\n", path);
+            return 1;
+        }
+        g_virtual_car.trace = &trace;
+    }
+
+    if (record)
+        vc_start_recording(&g_virtual_car, &journal);
+    if (replay)
+        vc_start_replay(&g_virtual_car, &journal);
+
+    // One step per tick, so each tick is STEP_PERIOD of simulated time
+    pacer_t pacer;
+    if (realtime_ratio > 0.0)
+        pacer_init(&pacer, realtime_ratio, STEP_PERIOD / realtime_ratio, MAX_BEHIND_SECONDS);
+
+    // sim_time is what the car has actually been advanced by. In real time
+    // that is what the pacer issued, which isn't always STEP_PERIOD.
+    double start_time = GetRealTime();
+    double sim_time = 0.0;
+    while (sim_time < sim_duration) {
+        if (!replay)
+            g_virtual_car.throttle_pos = get_scenario_throttle_pos(sim_time);
+        g_virtual_car.cpu->irq_stats = get_irq_stats(g_virtual_car.engine_rpm);
+        double step = STEP_PERIOD;
+        if (realtime_ratio > 0.0)
+            step = pacer_wait(&pacer) * CPU_CLOCK_PERIOD;
+        if (step > sim_duration - sim_time)
+            step = sim_duration - sim_time;
+        vc_advance(&g_virtual_car, step);
+        sim_time += step;
+    }
+    double wall_duration = GetRealTime() - start_time;
+
+    graph_set_trace_file(NULL);
+    fclose(trace_file);
+    if (vcd_file) {
+        g_virtual_car.vcd = NULL;
+        if (vcd.num_stalls)
+            printf("The VCD writer stalled %u times\n", vcd.num_stalls);
+        vcd_free(&vcd);
+        fclose(vcd_file);
+    }
+    if (write_trace) {
+        g_virtual_car.trace = NULL;
+        if (trace.num_stalls)
+            printf("The trace writer stalled %u times\n", trace.num_stalls);
+        trace_writer_close(&trace);
+    }
+
+    if (record) {
+        g_virtual_car.journal = NULL;
+        char path[512];
+        snprintf(path, sizeof(path), "%s.journal", output_prefix);
+        if (!journal_save(&journal, path))
+            printf("Couldn't write journal file '%s'\n", path);
+    }
+    g_virtual_car.replay = NULL;
+    journal_free(&journal);
+
+    write_stats(stats_file, sim_time, wall_duration, replay);
+    if (realtime_ratio > 0.0)
+        pacer_write_stats(&pacer, stats_file);
+    fclose(stats_file);
+    write_irq_csv(irq_file);
+    fclose(irq_file);
+
+    if (profile) {
+        FILE *profile_file = open_output_file(output_prefix, "_profile.txt");
+        if (profile_file) {
+            profile_write_report(profile, asm_path, profile_file);
+            fclose(profile_file);
+        }
+        g_virtual_car.cpu->profile = NULL;
+        free(profile);
+    }
+
+    vc_destroy(&g_virtual_car);
+
+    printf("Simulated %.3f s in %.3f s (%.1fx real time)\n",
+        sim_time, wall_duration, sim_time / wall_duration);
+    if (realtime_ratio > 0.0) {
+        printf("Tick lateness p99 %.0f us, max %.0f us. %llu slips.\n",
+            pacer_lateness_percentile(&pacer.stats, 0.99) * 1e-3, pacer.stats.max_lateness_ns * 1e-3,
+            (unsigned long long)pacer.stats.num_slips);
+    }
+    return 0;
+}
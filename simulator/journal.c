@@ -0,0 +1,86 @@
+// Own header
+#include "journal.h"
+
+// Standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static char const JOURNAL_MAGIC[8] = { 'K', 'L', 'R', 'J', 'R', 'N', 'L', '\0' };
+enum { JOURNAL_VERSION = 1 };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+} journal_header_t;
+
+
+static void reserve(journal_t *j, unsigned num_entries) {
+    if (num_entries <= j->max_entries) return;
+    unsigned max_entries = j->max_entries ? j->max_entries * 2 : 4096;
+    while (max_entries < num_entries)
+        max_entries *= 2;
+    j->entries = (journal_entry_t *)realloc(j->entries, max_entries * sizeof(journal_entry_t));
+    j->max_entries = max_entries;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void journal_init(journal_t *j) {
+    memset(j, 0, sizeof(*j));
+}
+
+void journal_free(journal_t *j) {
+    free(j->entries);
+    memset(j, 0, sizeof(*j));
+}
+
+void journal_add(journal_t *j, unsigned clk, journal_type_t type, u8 arg, uint16_t val) {
+    reserve(j, j->num_entries + 1);
+    journal_entry_t *e = &j->entries[j->num_entries++];
+    e->clk = clk;
+    e->type = (u8)type;
+    e->arg = arg;
+    e->val = val;
+}
+
+bool journal_save(journal_t const *j, char const *path) {
+    FILE *out = fopen(path, "wb");
+    if (!out) return false;
+
+    journal_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.num_entries = j->num_entries;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+        fwrite(j->entries, sizeof(journal_entry_t), j->num_entries, out) == j->num_entries;
+
+    return fclose(out) == 0 && ok;
+}
+
+bool journal_load(journal_t *j, char const *path) {
+    journal_init(j);
+    FILE *in = fopen(path, "rb");
+    if (!in) return false;
+
+    journal_header_t header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == JOURNAL_VERSION;
+    if (ok) {
+        reserve(j, header.num_entries);
+        j->num_entries = fread(j->entries, sizeof(journal_entry_t), header.num_entries, in);
+        ok = j->num_entries == header.num_entries;
+    }
+
+    fclose(in);
+    if (!ok)
+        journal_free(j);
+    return ok;
+}
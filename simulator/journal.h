@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdint.h>
+
+
+// A record of everything the virtual car fed into the KLR, so that a run can
+// be replayed exactly, without the physics model. See vc_start_recording()
+// and vc_start_replay().
+//
+// Replaying a journal into a KLR with a patched ROM shows how the patch
+// changes the KLR's outputs for exactly the same inputs.
+
+typedef enum {
+    JOURNAL_THROTTLE,       // val is the throttle position * 65535. For display only.
+    JOURNAL_RESET,
+    JOURNAL_DWELL_START,
+    JOURNAL_DWELL_END,
+    JOURNAL_ADC_INPUT,      // arg is the ADC channel, val the value it now converts to
+    NUM_JOURNAL_TYPES
+} journal_type_t;
+
+typedef struct {
+    uint32_t clk;           // master_clk when the input changed
+    u8 type;
+    u8 arg;
+    uint16_t val;
+} journal_entry_t;
+
+typedef struct {
+    journal_entry_t *entries;   // In the order they happened
+    unsigned num_entries;
+    unsigned max_entries;
+} journal_t;
+
+
+void journal_init(journal_t *j);
+void journal_free(journal_t *j);
+void journal_add(journal_t *j, unsigned clk, journal_type_t type, u8 arg, uint16_t val);
+
+// Return false if the file couldn't be written, or read, or isn't a journal.
+bool journal_save(journal_t const *j, char const *path);
+bool journal_load(journal_t *j, char const *path);
@@ -0,0 +1,155 @@
+// Own header
+#include "lod.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+static int get_shift(int level) {
+    return LOD_LEVEL0_SHIFT + level * LOD_LEVEL_SHIFT;
+}
+
+static lod_bucket_t *get_bucket(lod_t const *lod, int level, uint64_t bucket) {
+    return &lod->rings[level][bucket & (LOD_RING_SIZE - 1)];
+}
+
+static void set_bucket(lod_bucket_t *b, u8 val) {
+    b->min = val;
+    b->max = val;
+}
+
+static void merge_into_bucket(lod_bucket_t *b, u8 val) {
+    if (val < b->min) b->min = val;
+    if (val > b->max) b->max = val;
+}
+
+// The oldest bucket of the level that still holds data
+static uint64_t get_oldest_bucket(lod_t const *lod, int level) {
+    uint64_t newest = lod->newest_buckets[level];
+    uint64_t oldest = newest >= LOD_RING_SIZE ? newest - LOD_RING_SIZE + 1 : 0;
+    if (oldest < lod->first_buckets[level])
+        oldest = lod->first_buckets[level];
+    return oldest;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void lod_init(lod_t *lod) {
+    memset(lod, 0, sizeof(*lod));
+    for (int level = 0; level < LOD_NUM_LEVELS; level++)
+        lod->rings[level] = (lod_bucket_t *)malloc(LOD_RING_SIZE * sizeof(lod_bucket_t));
+}
+
+void lod_free(lod_t *lod) {
+    for (int level = 0; level < LOD_NUM_LEVELS; level++)
+        free(lod->rings[level]);
+    memset(lod, 0, sizeof(*lod));
+}
+
+void lod_clear(lod_t *lod) {
+    lod->has_points = false;
+}
+
+void lod_add(lod_t *lod, uint64_t time, u8 val) {
+    for (int level = 0; level < LOD_NUM_LEVELS; level++) {
+        uint64_t bucket = time >> get_shift(level);
+        if (!lod->has_points) {
+            lod->first_buckets[level] = bucket;
+            lod->newest_buckets[level] = bucket;
+            set_bucket(get_bucket(lod, level, bucket), val);
+        }
+        else if (bucket != lod->last_buckets[level]) {
+            // Every bucket after the last point's held the last point's value throughout
+            uint64_t num_held = bucket - lod->last_buckets[level];
+            if (num_held > LOD_RING_SIZE)
+                num_held = LOD_RING_SIZE;
+            for (uint64_t b = bucket - num_held + 1; b <= bucket; b++)
+                set_bucket(get_bucket(lod, level, b), lod->last_val);
+            merge_into_bucket(get_bucket(lod, level, bucket), val);
+        }
+        else {
+            merge_into_bucket(get_bucket(lod, level, bucket), val);
+        }
+
+        lod->last_buckets[level] = bucket;
+        if (bucket > lod->newest_buckets[level])
+            lod->newest_buckets[level] = bucket;
+    }
+
+    lod->has_points = true;
+    lod->last_val = val;
+}
+
+void lod_rewind(lod_t *lod, uint64_t time, u8 val) {
+    for (int level = 0; level < LOD_NUM_LEVELS; level++) {
+        uint64_t bucket = time >> get_shift(level);
+        if (!lod->has_points || bucket < lod->first_buckets[level])
+            lod->first_buckets[level] = bucket;
+        if (!lod->has_points || bucket > lod->newest_buckets[level])
+            lod->newest_buckets[level] = bucket;
+        lod->last_buckets[level] = bucket;
+        set_bucket(get_bucket(lod, level, bucket), val);
+    }
+
+    lod->has_points = true;
+    lod->last_val = val;
+}
+
+uint64_t lod_get_rewind_time(uint64_t time) {
+    int shift = get_shift(LOD_NUM_LEVELS - 1);
+    return (time >> shift) << shift;
+}
+
+int lod_choose_level(lod_t const *lod, uint64_t start_time, double cycles_per_pixel) {
+    if (cycles_per_pixel < (double)(1 << LOD_LEVEL0_SHIFT))
+        return -1;
+
+    int level = 0;
+    while (level + 1 < LOD_NUM_LEVELS && (double)((uint64_t)1 << get_shift(level + 1)) <= cycles_per_pixel)
+        level++;
+
+    // Go coarser if this level's history has been overwritten
+    while (level + 1 < LOD_NUM_LEVELS && lod->has_points &&
+            (start_time >> get_shift(level)) < get_oldest_bucket(lod, level))
+        level++;
+
+    return level;
+}
+
+bool lod_get_range(lod_t const *lod, int level, uint64_t start_time, uint64_t end_time, u8 *min, u8 *max) {
+    if (!lod->has_points || end_time <= start_time)
+        return false;
+
+    int shift = get_shift(level);
+    uint64_t first = start_time >> shift;
+    uint64_t last = (end_time - 1) >> shift;
+    uint64_t oldest = get_oldest_bucket(lod, level);
+    if (last < oldest)
+        return false;
+    if (first < oldest)
+        first = oldest;
+
+    // After the last point, the signal holds its value
+    lod_bucket_t range;
+    set_bucket(&range, lod->last_val);
+    if (first <= lod->last_buckets[level]) {
+        range = *get_bucket(lod, level, first);
+        if (last > lod->last_buckets[level]) {
+            last = lod->last_buckets[level];
+            merge_into_bucket(&range, lod->last_val);
+        }
+        for (uint64_t b = first + 1; b <= last; b++) {
+            lod_bucket_t const *bucket = get_bucket(lod, level, b);
+            merge_into_bucket(&range, bucket->min);
+            merge_into_bucket(&range, bucket->max);
+        }
+    }
+
+    *min = range.min;
+    *max = range.max;
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdint.h>
+
+
+// A min/max summary of a signal at several levels of detail, so that a chart
+// of any time range can be drawn in time proportional to its width in pixels,
+// however many points fall in the range.
+//
+// Each level splits time into buckets and records the lowest and highest
+// value the signal held during each one. Level 0's buckets are
+// 2^LOD_LEVEL0_SHIFT cycles long, and each level's are 2^LOD_LEVEL_SHIFT times
+// longer than the one below's. Each level is a ring of its most recent
+// LOD_RING_SIZE buckets, so the coarser levels go back further. Level 0 covers
+// about 90 seconds and level 5 about a day.
+//
+// Times are on the 64-bit clock of capture_t.
+
+enum {
+    LOD_NUM_LEVELS = 6,
+    LOD_LEVEL0_SHIFT = 10,
+    LOD_LEVEL_SHIFT = 2,
+    LOD_RING_SIZE = 65536
+};
+
+typedef struct {
+    u8 min;
+    u8 max;
+} lod_bucket_t;
+
+typedef struct {
+    lod_bucket_t *rings[LOD_NUM_LEVELS];
+    uint64_t first_buckets[LOD_NUM_LEVELS];     // Number of the bucket the first point is in
+    uint64_t last_buckets[LOD_NUM_LEVELS];      // Number of the bucket the last point is in
+    uint64_t newest_buckets[LOD_NUM_LEVELS];    // Highest bucket number written. Not lowered by
+                                                // lod_rewind(), because the buckets that were
+                                                // written since have overwritten older ones.
+    bool has_points;
+    u8 last_val;
+} lod_t;
+
+
+void lod_init(lod_t *lod);
+void lod_free(lod_t *lod);
+void lod_clear(lod_t *lod);
+
+// Points must be added in time order.
+void lod_add(lod_t *lod, uint64_t time, u8 val);
+
+// Discards everything from time on, leaving the signal holding val from time.
+// The points after time must then be added again. time must be on a bucket
+// boundary of every level. See lod_get_rewind_time().
+void lod_rewind(lod_t *lod, uint64_t time, u8 val);
+
+// Returns the start of the coarsest level's bucket that time is in. Rewinding
+// to there, and adding the points since, rebuilds every bucket that the points
+// after time could have affected.
+uint64_t lod_get_rewind_time(uint64_t time);
+
+// Chooses the level to draw time ranges starting at start_time with, when
+// each pixel is cycles_per_pixel wide. This is the coarsest level whose
+// buckets are no wider than a pixel, unless it no longer goes back to
+// start_time. Returns -1 if the pixels are narrower than level 0's buckets, in
+// which case the points themselves should be drawn.
+int lod_choose_level(lod_t const *lod, uint64_t start_time, double cycles_per_pixel);
+
+// Gets the lowest and highest values held from start_time up to, but not
+// including, end_time, to the resolution of the level's buckets. Returns false
+// if the level has no data for any of that time.
+bool lod_get_range(lod_t const *lod, int level, uint64_t start_time, uint64_t end_time, u8 *min, u8 *max);
@@ -1,6 +1,10 @@
 // This project's headers
 #include "cpu.h"
+#include "dirty_rows.h"
 #include "graph.h"
+#include "journal.h"
+#include "mcs48_asm.h"
+#include "sim_thread.h"
 #include "virtual_car.h"
 
 // Deadfrog headers
@@ -12,6 +16,34 @@
 
 // Standard headers
 #include <stdio.h>
+#include <string.h>
+
+
+// Multiplies the time range that the signal graphs show
+static double g_graph_zoom = 1.0;
+static double const MIN_GRAPH_ZOOM = 1.0 / 1024.0;
+static double const MAX_GRAPH_ZOOM = 8192.0;
+
+// The time range that each signal graph shows, in seconds, at zoom 1
+static double const GRAPH_SECONDS[NUM_GRAPHS] = { 50e-3, 50e-3, 0.1, 0.1, 0.1, 0.1 };
+
+// The car runs on the sim thread. This is the copy of it that is drawn.
+static sim_view_t const *g_view;
+
+// Every session's inputs to the KLR are saved here on exit, so that the
+// session can be replayed exactly with "headless --replay"
+static char const *SESSION_JOURNAL_PATH = "session.journal";
+
+// Shown before quitting if the sim thread can't be started, at startup or
+// after a ROM reload
+static char const *SIM_THREAD_ERROR = "Couldn't start the simulation thread.";
+
+// The listing that R reassembles and patches into the running KLR. The first
+// successful assembly only sets what later ones are compared with, because
+// rom.bin, not the listing, is what was loaded.
+static char const *ROM_SOURCE_PATH = "Annotated_Stock1987_951KLR.asm";
+static mcs48_asm_t g_rom_source;
+static bool g_have_rom_source;
 
 
 static void show_help_dialog(void) {
@@ -19,83 +51,342 @@ static void show_help_dialog(void) {
         "Keyboard shortcuts:\n\n"
         "  Esc - Quit\n"
         "  -/+ keys (next to backspace) - Slow down/speed up the simulation\n"
-        "  1-9 - Set throttle position. 1=idle 9=wide open",
+        "  0 - Run the simulation as fast as possible, or back at the set speed\n"
+        "  1-9 - Set throttle position. 1=idle 9=wide open\n"
+        "  [/] - Zoom the signal graphs out/in\n"
+        "  R - Reassemble Annotated_Stock1987_951KLR.asm and patch the changes into the ROM\n\n"
+        "The session is recorded to session.journal when you quit.",
         MsgDlgTypeOk);
 }
 
-static int draw_signals_from_dme(int y) {
-    cpu_t *cpu = cpu_get();
+#define DRAW_TEXT(x, y, msg, ...) \
+    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, msg, ##__VA_ARGS__)
+
+
+// ****************************************************************************
+// ROM hot reload
+// ****************************************************************************
+
+// Reassembles ROM_SOURCE_PATH and copies the bytes that changed since the last
+// time into the running KLR, leaving the rest of its state as it was. The sim
+// thread is stopped while the ROM is patched, and restarted with controls.
+// Returns false if it couldn't be restarted.
+static bool reload_rom_source(sim_thread_t *sim, sim_controls_t const *controls) {
+    if (!mcs48_asm_assemble_file(&g_rom_source, ROM_SOURCE_PATH)) {
+        char msg[256];
+        if (g_rom_source.num_errors == 0)
+            snprintf(msg, sizeof(msg), "Couldn't read %s", ROM_SOURCE_PATH);
+        else
+            snprintf(msg, sizeof(msg), "%s:%u: %s\n\n%u errors. The ROM is unchanged.",
+                ROM_SOURCE_PATH, g_rom_source.errors[0].line_num,
+                g_rom_source.errors[0].message, g_rom_source.num_errors);
+        MessageDialog("Reassemble ROM", msg, MsgDlgTypeOk);
+        return true;
+    }
+
+    if (!g_have_rom_source) {
+        g_have_rom_source = true;
+        return true;
+    }
+    if (g_rom_source.num_changes == 0)
+        return true;
+
+    sim_thread_stop(sim);
+    g_view = NULL;
+    for (unsigned i = 0; i < g_rom_source.num_changes; i++) {
+        mcs48_asm_range_t const *range = &g_rom_source.changes[i];
+        cpu_patch_rom(g_virtual_car.cpu, range->start,
+            g_rom_source.image + range->start, range->num_bytes);
+    }
+    return sim_thread_start(sim, &g_virtual_car, controls);
+}
+
+
+// ****************************************************************************
+// Drawing
+// ****************************************************************************
+
+// Only the parts of the window whose contents have changed are redrawn and
+// sent to the screen. g_drawn is what each part showed when it was last drawn.
+// Drawing adds the rows it touched to g_dirty_rows.
+static struct {
+    char header[512];
+    char cpu_fields[128];
+    u8 ram[128];
+    unsigned view_serial;
+    int bmp_width;
+    int bmp_height;
+} g_drawn;
+
+static dirty_rows_t g_dirty_rows;
+
+static void draw_vc_state(int _x, int _y, bool redraw_all) {
+    char line1[128];
+    char line2[128];
+    char speed[64];
+    char zoom[64];
+    snprintf(line1, sizeof(line1), "Engine RPM:%.0f  Throttle Pos:%d%%  Turbo KRPM:%.0f  Crank angle:%.2f  ",
+        g_view->engine_rpm, (int)(g_view->throttle_pos*100.0),
+        g_view->turbo_rpm / 1e3, g_view->crank_angle);
+    snprintf(line2, sizeof(line2), "Manifold pressure:%.2f bar  Engine power:%.0f BHP  RealTime:%4.1fms  ",
+        g_view->manifold_pressure, g_view->engine_power,
+        g_view->master_clk * CPU_CLOCK_PERIOD * 1e3);
+    if (g_view->controls.sim_speed > 0.0)
+        snprintf(speed, sizeof(speed), "Sim Speed:%.5f ", g_view->controls.sim_speed);
+    else
+        snprintf(speed, sizeof(speed), "Sim Speed:max (%.2f) ", g_view->measured_speed);
+    snprintf(zoom, sizeof(zoom), "Graph Zoom:%g ", g_graph_zoom);
+
+    int x = _x + g_defaultFont->maxCharWidth;
+    int y = _y + g_defaultFont->charHeight / 2;
+    int line1_y = y + g_defaultFont->charHeight * 1.2;
+    int line2_y = line1_y + g_defaultFont->charHeight * 1.2;
+    int hline_y = line2_y + g_defaultFont->charHeight * 1.7;
+
+    // The speed and zoom labels overlap the parameters, so the whole band is
+    // redrawn if any of them change
+    char header[sizeof(g_drawn.header)];
+    snprintf(header, sizeof(header), "%s%s%s%s", line1, line2, speed, zoom);
+    if (redraw_all || strcmp(header, g_drawn.header) != 0) {
+        RectFill(g_window->bmp, 0, _y, g_window->bmp->width, hline_y - _y, g_colourWhite);
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp,
+            g_window->bmp->width, g_defaultFont->charHeight * 1.65, "%s", speed);
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp,
+            g_window->bmp->width, g_defaultFont->charHeight * 0.45, "%s", zoom);
+        DRAW_TEXT(x, y, "Virtual Car Simulation Parameters");
+        DRAW_TEXT(x+1, y, "Virtual Car Simulation Parameters");
+        DRAW_TEXT(x + g_defaultFont->maxCharWidth, line1_y, "%s", line1);
+        DRAW_TEXT(_x + g_defaultFont->maxCharWidth * 2, line2_y, "%s", line2);
+        dirty_rows_add(&g_dirty_rows, _y, hline_y - _y);
+        strcpy(g_drawn.header, header);
+    }
+
+    if (redraw_all)
+        HLine(g_window->bmp, 0, hline_y, g_window->bmp->width, g_colourBlack);
+}
+
+static void draw_cpu_state(int _x, int _y, bool redraw_all) {
+    int x = _x + g_defaultFont->maxCharWidth;
+    int y = _y + g_defaultFont->charHeight;
+    if (redraw_all) {
+        DRAW_TEXT(x, y, "KLR Microcontroller state");
+        DRAW_TEXT(x + 1, y, "KLR Microcontroller state");
+    }
+    x += g_defaultFont->maxCharWidth;
+    y += g_defaultFont->charHeight * 1.2;
+
+    char fields[128];
+    snprintf(fields, sizeof(fields), "PC:%03x  MasterClk:%u  T:%d  MemBank:%d  ",
+        g_view->pc, g_view->master_clk, g_view->timer_counter, !!g_view->a11);
+    if (redraw_all || strcmp(fields, g_drawn.cpu_fields) != 0) {
+        RectFill(g_window->bmp, 0, y, g_window->bmp->width, g_defaultFont->charHeight, g_colourWhite);
+        DRAW_TEXT(x, y, "%s", fields);
+        dirty_rows_add(&g_dirty_rows, y, g_defaultFont->charHeight);
+        strcpy(g_drawn.cpu_fields, fields);
+    }
+
+    x = g_defaultFont->maxCharWidth * 2;
+    y += g_defaultFont->charHeight * 2;
+    if (redraw_all) {
+        int header_x = x;
+        header_x += DRAW_TEXT(header_x, y, "RAM:    ");
+        for (unsigned a = 0; a < 16; a++) {
+            header_x += DRAW_TEXT(header_x, y, " %x ", a);
+        }
+    }
+
+    // Only the bytes that have changed are redrawn
+    int cells_x = x + GetTextWidth(g_defaultFont, "     00 ");
+    int cell_w = GetTextWidth(g_defaultFont, "00 ");
+    for (unsigned a = 0; a < 128; a++) {
+        int row_y = y + g_defaultFont->charHeight * (1 + (a >> 4));
+        if (redraw_all && (a & 0xf) == 0)
+            DRAW_TEXT(x, row_y, "     %x0 ", a >> 4);
+        if (!redraw_all && g_view->ram[a] == g_drawn.ram[a])
+            continue;
+
+        int cell_x = cells_x + cell_w * (a & 0xf);
+        RectFill(g_window->bmp, cell_x, row_y, cell_w, g_defaultFont->charHeight, g_colourWhite);
+        DRAW_TEXT(cell_x, row_y, "%02x ", g_view->ram[a]);
+        dirty_rows_add(&g_dirty_rows, row_y, g_defaultFont->charHeight);
+        g_drawn.ram[a] = g_view->ram[a];
+    }
+
+    y += g_defaultFont->charHeight * 8;
+    y += g_defaultFont->charHeight * 1.7;
+    if (redraw_all)
+        HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
+}
+
+// The width of the graphs, and so the number of columns the sim thread gets
+static int get_graph_width(void) {
+    return g_window->bmp->width * 0.8;
+}
+
+// graph_draw_columns() fills the whole of the graph's rectangle, so nothing
+// needs clearing first
+static void draw_graph(graph_id_t id, int x, int y, int w, int h) {
+    if (w > g_view->controls.graph_columns)
+        w = g_view->controls.graph_columns;
+    graph_draw_columns(g_view->graph_mins[id], g_view->graph_maxs[id], x, y, w, h);
+    dirty_rows_add(&g_dirty_rows, y, h);
+}
+
+static int draw_signals_from_dme(int y, bool redraw_all, bool redraw_graphs) {
     int x = g_defaultFont->maxCharWidth;
-    int w = g_window->bmp->width * 0.8;
+    int w = get_graph_width();
     int h = g_defaultFont->charHeight * 2;
     int text_y_offset = g_defaultFont->charHeight * 0.6;
-    double time_range_to_display = CPU_CLOCK_RATE_HZ * 50e-3;
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, "Signals from DME to KLR");
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x + 1, y, "Signals from DME to KLR");
+    if (redraw_all) {
+        DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, "Signals from DME to KLR");
+        DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x + 1, y, "Signals from DME to KLR");
+    }
     x = g_window->bmp->width * 0.15;
     y += g_defaultFont->charHeight * 1.2;
     int text_x = x - g_defaultFont->maxCharWidth;
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Reset");
-    graph_draw(TO_KLR_RESET, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Reset");
+    if (redraw_graphs)
+        draw_graph(TO_KLR_RESET, x, y, w, h);
     y += h + 10;
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Ignition");
-    graph_draw(TO_KLR_IGNTION, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Ignition");
+    if (redraw_graphs)
+        draw_graph(TO_KLR_IGNTION, x, y, w, h);
     y += h + g_defaultFont->charHeight;
-    HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
+    if (redraw_all)
+        HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
     return y;
 }
 
-static int draw_signals_from_klr(int y) {
-    cpu_t *cpu = cpu_get();
+static int draw_signals_from_klr(int y, bool redraw_all, bool redraw_graphs) {
     int x = g_defaultFont->maxCharWidth;
-    int w = g_window->bmp->width * 0.8;
+    int w = get_graph_width();
     int h = g_defaultFont->charHeight * 2;
     int text_y_offset = g_defaultFont->charHeight * 0.6;
-    double time_range_to_display = CPU_CLOCK_RATE_HZ * 0.1;
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, "Signals from KLR to DME");
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x + 1, y, "Signals from KLR to DME");
+    if (redraw_all) {
+        DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, "Signals from KLR to DME");
+        DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x + 1, y, "Signals from KLR to DME");
+    }
     x = g_window->bmp->width * 0.15;
     y += g_defaultFont->charHeight * 1.2;
     int text_x = x - g_defaultFont->maxCharWidth;
 
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Ignition");
-    graph_draw(FROM_KLR_IGNITION, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Ignition");
+    if (redraw_graphs)
+        draw_graph(FROM_KLR_IGNITION, x, y, w, h);
     y += h + 10;
 
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Cyc valve");
-    graph_draw(FROM_KLR_CYCLING_VALVE_PWM, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Cyc valve");
+    if (redraw_graphs)
+        draw_graph(FROM_KLR_CYCLING_VALVE_PWM, x, y, w, h);
     y += h + 10;
 
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Full load");
-    graph_draw(FROM_KLR_FULL_LOAD_SIGNAL, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Full load");
+    if (redraw_graphs)
+        draw_graph(FROM_KLR_FULL_LOAD_SIGNAL, x, y, w, h);
     y += h + g_defaultFont->charHeight;
 
 //    time_range_to_display = CPU_CLOCK_RATE_HZ * 0.5;
-    DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Blink code");
-    graph_draw(FROM_KLR_BLINK_CODE, cpu->master_clk, time_range_to_display, x, y, w, h);
+    if (redraw_all)
+        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp, text_x, y + text_y_offset, "Blink code");
+    if (redraw_graphs)
+        draw_graph(FROM_KLR_BLINK_CODE, x, y, w, h);
     y += h + g_defaultFont->charHeight;
 
-    HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
+    if (redraw_all)
+        HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
     return y;
 }
 
+// With redraw_all, clears the window and draws everything. Otherwise draws
+// only what has changed since the last call.
+static void draw_window(bool redraw_all) {
+    // The window's bitmap is recreated, blank, when the window is resized
+    if (g_window->bmp->width != g_drawn.bmp_width || g_window->bmp->height != g_drawn.bmp_height)
+        redraw_all = true;
+
+    if (redraw_all) {
+        BitmapClear(g_window->bmp, g_colourWhite);
+        dirty_rows_add(&g_dirty_rows, 0, g_window->bmp->height);
+    }
+
+    bool redraw_graphs = redraw_all || g_view->serial != g_drawn.view_serial;
+
+    int y = 0;
+    draw_vc_state(0, y, redraw_all);
+    y += g_defaultFont->charHeight * 4.5;
+
+    draw_cpu_state(0, y, redraw_all);
+    y += g_defaultFont->charHeight * 15.0;
+
+    y = draw_signals_from_dme(y, redraw_all, redraw_graphs) + g_defaultFont->charHeight;
+    y = draw_signals_from_klr(y, redraw_all, redraw_graphs);
+
+    if (redraw_all) {
+        DrawTextCentre(g_defaultFont, g_colourBlack,
+            g_window->bmp, g_window->bmp->width / 2, g_window->bmp->height - g_defaultFont->charHeight,
+            "For help press 'h'");
+    }
+
+    g_drawn.view_serial = g_view->serial;
+    g_drawn.bmp_width = g_window->bmp->width;
+    g_drawn.bmp_height = g_window->bmp->height;
+}
+
+
+// ****************************************************************************
+// Main
+// ****************************************************************************
+
+static void set_graph_controls(sim_controls_t *controls) {
+    controls->graph_columns = get_graph_width();
+    for (int i = 0; i < NUM_GRAPHS; i++)
+        controls->graph_time_ranges[i] = CPU_CLOCK_RATE_HZ * GRAPH_SECONDS[i] * g_graph_zoom;
+}
+
 int main() {
 //void __stdcall WinMain(void *instance, void *prev_instance, char *cmd_line, int show_cmd) {
     g_window = CreateWin(700, 800, WT_WINDOWED_FIXED, "951 KLR Simulator");
     g_defaultFont = LoadFontFromMemory(df_mono_8x15, sizeof(df_mono_8x15));
 
-    vc_init();
-    cpu_reset();
+    vc_init(&g_virtual_car);
+    g_virtual_car.record_graphs = true;
+    cpu_reset(g_virtual_car.cpu);
 
     FILE *rom_file = fopen("rom.bin", "rb");
     if (!rom_file) 
         rom_file = fopen("C:/Coding/951_klr_playground/rom.bin", "rb");
     if (!rom_file) return 0;
-    cpu_t *cpu = cpu_get();
-    fread(cpu->rom, 1, sizeof(cpu->rom), rom_file);
+    u8 rom[4096];
+    unsigned rom_size = fread(rom, 1, sizeof(rom), rom_file);
+    cpu_load_rom(g_virtual_car.cpu, rom, rom_size);
+
+    mcs48_asm_init(&g_rom_source);
+    g_have_rom_source = mcs48_asm_assemble_file(&g_rom_source, ROM_SOURCE_PATH);
+
+    journal_t journal;
+    journal_init(&journal);
+    vc_start_recording(&g_virtual_car, &journal);
 
-    double prev_now = GetRealTime();
     double sim_speed = 0.004;
+    bool run_flat_out = false;
+    sim_controls_t controls;
+    memset(&controls, 0, sizeof(controls));
+    controls.throttle_pos = g_virtual_car.throttle_pos;
+    controls.sim_speed = sim_speed;
+    set_graph_controls(&controls);
+    sim_thread_t sim;
+    if (!sim_thread_start(&sim, &g_virtual_car, &controls)) {
+        MessageDialog("Error", SIM_THREAD_ERROR, MsgDlgTypeOk);
+        return 0;
+    }
+
+    bool redraw_all = true;
+    double next_full_update_time = 0.0;
     while (!g_window->windowClosed && !g_window->input.keys[KEY_ESC]) {
         InputPoll(g_window);
         for (int i = 0; i < g_window->input.numKeysTyped; i++) {
@@ -105,41 +396,61 @@ int main() {
             if (g_window->input.keysTyped[i] == '-') {
                 sim_speed /= 2.0;
             }
+            if (g_window->input.keysTyped[i] == '0') {
+                run_flat_out = !run_flat_out;
+            }
+            if (g_window->input.keysTyped[i] == '[' && g_graph_zoom < MAX_GRAPH_ZOOM) {
+                g_graph_zoom *= 2.0;
+            }
+            if (g_window->input.keysTyped[i] == ']' && g_graph_zoom > MIN_GRAPH_ZOOM) {
+                g_graph_zoom /= 2.0;
+            }
+            char key = g_window->input.keysTyped[i];
+            if (key >= KEY_1 && key <= KEY_9) {
+                controls.throttle_pos = (key - KEY_1) / 8.0f;
+            }
         }
-        if (g_window->input.keyDowns[KEY_H])
+        if (g_window->input.keyDowns[KEY_R]) {
+            if (!reload_rom_source(&sim, &controls)) {
+                MessageDialog("Error", SIM_THREAD_ERROR, MsgDlgTypeOk);
+                break;
+            }
+            redraw_all = true;
+            next_full_update_time = 0.0;
+        }
+        if (g_window->input.keyDowns[KEY_H]) {
             show_help_dialog();
+            next_full_update_time = 0.0;
+        }
 
-        double now = GetRealTime();
-        double advance_time = now - prev_now;
-        prev_now = now;
-        if (advance_time > 0.03)
-            advance_time = 0.03;
-        advance_time = 0.016; // Temporary hack to force the system to be deterministic for the
-							  // interrupt timings not to be effected by the application's frame 
-							  // rate.
-        advance_time *= sim_speed;
-
-        vc_advance(advance_time);
-        
-        BitmapClear(g_window->bmp, g_colourWhite);
-        DrawTextRight(g_defaultFont, g_colourBlack, g_window->bmp,
-            g_window->bmp->width, g_defaultFont->charHeight * 1.65, "Sim Speed:%.5f ", sim_speed);
-
-        int y = 0;
-        vc_draw_state(0, y);
-        y += g_defaultFont->charHeight * 4.5;
-
-        cpu_draw_state(0, y);
-        y += g_defaultFont->charHeight * 15.0;
+        controls.sim_speed = run_flat_out ? 0.0 : sim_speed;
+        set_graph_controls(&controls);
+        g_view = sim_thread_get_view(&sim, &controls);
+        if (!g_view) {
+            WaitVsync();
+            continue;
+        }
 
-        y = draw_signals_from_dme(y) + g_defaultFont->charHeight;
-        y = draw_signals_from_klr(y);
+        draw_window(redraw_all);
+        redraw_all = false;
 
-        DrawTextCentre(g_defaultFont, g_colourBlack,
-            g_window->bmp, g_window->bmp->width / 2, g_window->bmp->height - g_defaultFont->charHeight,
-            "For help press 'h'");
-
-        UpdateWin(g_window);
+        double now = GetRealTime();
+        // Deadfrog doesn't say when part of the window has been uncovered, so
+        // the whole of it is sent to the screen every second anyway
+        if (now >= next_full_update_time) {
+            UpdateWin(g_window);
+            next_full_update_time = now + 1.0;
+        }
+        else {
+            UpdateWinRows(g_window, g_dirty_rows.num_bands, g_dirty_rows.first_rows, g_dirty_rows.num_rows);
+        }
+        dirty_rows_clear(&g_dirty_rows);
         WaitVsync();
     }
+
+    sim_thread_stop(&sim);
+    g_virtual_car.journal = NULL;
+    journal_save(&journal, SESSION_JOURNAL_PATH);
+    journal_free(&journal);
+    mcs48_asm_free(&g_rom_source);
 }
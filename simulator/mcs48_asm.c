@@ -0,0 +1,1016 @@
+// Own header
+#include "mcs48_asm.h"
+
+// This project's headers
+#include "mcs48_isa.h"
+
+// Standard headers
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef enum {
+    LINE_EMPTY,
+    LINE_BAD,           // Couldn't be parsed. error says why.
+    LINE_INSN,
+    LINE_DB,
+    LINE_ORG,
+    LINE_EQU
+} line_kind_t;
+
+// A parsed line, in the cache. Lines with the same text, ignoring case and
+// comments, share an entry.
+struct mcs48_asm_line_t {
+    uint64_t hash;
+    char *key;              // The text, lower case, without the comment
+    unsigned key_len;
+    char *work;             // A copy of key, cut up by the parser into the strings below
+    unsigned generation;    // Of the last assembly that used it
+
+    line_kind_t kind;
+    char error[100];        // For LINE_BAD
+    char *addr_expr;        // The line's address, or NULL
+    char *label;            // Or NULL
+    unsigned label_len;
+    char *name;             // Defined by LINE_EQU
+    unsigned name_len;
+    char *expr;             // Of LINE_ORG or LINE_EQU
+
+    unsigned opcode;        // For LINE_INSN
+    unsigned length;        // In bytes
+    char *values;           // The "#n" or "addr" value, or the .db values, without the '#' or spaces
+    unsigned num_values;    // Each is NUL-terminated, one after the other
+
+    // The symbols that the values use, as pointers into values
+    char **refs;
+    unsigned *ref_lens;
+    unsigned num_refs;
+
+    // The line's bytes, as last encoded. They stand while the line is at the
+    // same address and the symbols it uses have the same values. If the same
+    // text is at more than one address, the bytes are only kept for one.
+    u8 *bytes;
+    bool is_encoded;
+    unsigned encoded_addr;
+    uint64_t encoded_deps;
+};
+
+struct mcs48_asm_symbol_t {
+    char const *name;       // Into a line's work. NULL if the slot is empty.
+    unsigned name_len;
+    unsigned value;
+    unsigned line_num;      // Where it was defined
+};
+
+
+static void error(mcs48_asm_t *a, unsigned line_num, char const *fmt, ...) {
+    if (a->num_errors < MCS48_ASM_MAX_ERRORS) {
+        mcs48_asm_error_t *e = &a->errors[a->num_errors];
+        e->line_num = line_num;
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(e->message, sizeof(e->message), fmt, args);
+        va_end(args);
+    }
+    a->num_errors++;
+}
+
+static unsigned hash_string(char const *s, unsigned len, unsigned seed) {
+    unsigned h = 2166136261u ^ seed;
+    for (unsigned i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static uint64_t hash_u32(uint64_t h, unsigned val) {
+    for (int i = 0; i < 4; i++) {
+        h ^= (val >> (i * 8)) & 0xff;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Only ASCII letters are folded. tolower() goes through the locale, which is
+// slow enough to matter when a whole listing is hashed.
+static char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool is_symbol_start(char c) {
+    return isalpha((unsigned char)c) || c == '_' || c == '.';
+}
+
+static bool is_symbol_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static char *skip_spaces(char *c) {
+    while (isspace((unsigned char)*c)) c++;
+    return c;
+}
+
+static char *skip_word(char *c) {
+    while (*c && !isspace((unsigned char)*c)) c++;
+    return c;
+}
+
+static bool word_is(char const *c, unsigned len, char const *word) {
+    return strlen(word) == len && strncmp(c, word, len) == 0;
+}
+
+
+// ****************************************************************************
+// Mnemonic lookup
+// ****************************************************************************
+
+// Each distinct mnemonic in g_mcs48_isa has a slot in a hash table. The hash
+// is seeded, and the seed is chosen so that no two mnemonics share a slot.
+// That makes it a perfect hash: a lookup is one hash and one string compare.
+// Each mnemonic's opcodes are listed together in s_opcodes_by_mnemonic, so
+// that the operand patterns are only tried against the forms of that
+// mnemonic. The tables are built the first time an assembler is initialized,
+// and only read after that.
+
+enum { MAX_MNEMONICS = 64, MNEMONIC_HASH_SIZE = 1024, MAX_KEYWORDS = 64 };
+
+typedef struct {
+    char const *name;
+    unsigned first_form;        // Index into s_opcodes_by_mnemonic
+    unsigned num_forms;
+} mnemonic_t;
+
+static mnemonic_t s_mnemonics[MAX_MNEMONICS];
+static unsigned s_num_mnemonics;
+static u8 s_opcodes_by_mnemonic[256];
+static unsigned short s_hash_slots[MNEMONIC_HASH_SIZE];  // Index into s_mnemonics + 1, or 0 if empty
+static unsigned s_hash_seed;
+
+// The fixed operands, like a, r0, @r1 and tcnti, which can't be symbols
+static char const *s_keywords[MAX_KEYWORDS];
+static unsigned s_keyword_lens[MAX_KEYWORDS];
+static unsigned s_num_keywords;
+
+// Each operand of each opcode's form, and of each line, is reduced to a
+// code, so that matching a line against a form is comparing a few numbers.
+// A fixed operand's code is its index in s_keywords.
+enum {
+    OPERAND_IMM = -1,       // "#n", or a line's operand that starts with '#'
+    OPERAND_ADDR = -2,      // "addr", or a line's operand that could be one
+    OPERAND_BAD = -3,       // A line's operand that can't be either
+    MAX_FORM_OPERANDS = 2
+};
+
+static signed char s_form_operands[256][MAX_FORM_OPERANDS];
+static u8 s_form_num_operands[256];
+
+static bool try_hash_seed(unsigned seed) {
+    memset(s_hash_slots, 0, sizeof(s_hash_slots));
+    for (unsigned i = 0; i < s_num_mnemonics; i++) {
+        char const *name = s_mnemonics[i].name;
+        unsigned slot = hash_string(name, (unsigned)strlen(name), seed) & (MNEMONIC_HASH_SIZE - 1);
+        if (s_hash_slots[slot]) return false;
+        s_hash_slots[slot] = i + 1;
+    }
+    return true;
+}
+
+// Returns the index of the keyword in s_keywords, or -1
+static int find_keyword(char const *s, unsigned len) {
+    for (unsigned i = 0; i < s_num_keywords; i++) {
+        if (s_keyword_lens[i] == len && strncmp(s_keywords[i], s, len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static bool is_keyword(char const *s, unsigned len) {
+    return find_keyword(s, len) >= 0;
+}
+
+// Adds the opcode's fixed operands to s_keywords, and codes its form
+static void add_form(int opcode) {
+    char const *operands = g_mcs48_isa[opcode].operands;
+    while (*operands) {
+        char const *end = strchr(operands, ',');
+        unsigned len = end ? (unsigned)(end - operands) : (unsigned)strlen(operands);
+        int code;
+        if (len == 2 && operands[0] == '#') {
+            code = OPERAND_IMM;
+        }
+        else if (len == 4 && strncmp(operands, "addr", 4) == 0) {
+            code = OPERAND_ADDR;
+        }
+        else {
+            code = find_keyword(operands, len);
+            if (code < 0 && s_num_keywords < MAX_KEYWORDS) {
+                code = s_num_keywords;
+                s_keywords[s_num_keywords] = operands;
+                s_keyword_lens[s_num_keywords++] = len;
+            }
+        }
+        if (s_form_num_operands[opcode] < MAX_FORM_OPERANDS)
+            s_form_operands[opcode][s_form_num_operands[opcode]++] = (signed char)code;
+        operands += end ? len + 1 : len;
+    }
+}
+
+static void init_mnemonics(void) {
+    if (s_num_mnemonics) return;
+
+    // Group the opcodes by mnemonic, keeping them in opcode order within each
+    unsigned num_forms = 0;
+    for (int op = 0; op < 256; op++) {
+        char const *name = g_mcs48_isa[op].mnemonic;
+        if (!name) continue;
+        add_form(op);
+
+        bool seen = false;
+        for (unsigned i = 0; i < s_num_mnemonics; i++)
+            seen = seen || strcmp(s_mnemonics[i].name, name) == 0;
+        if (seen) continue;
+
+        mnemonic_t *m = &s_mnemonics[s_num_mnemonics++];
+        m->name = name;
+        m->first_form = num_forms;
+        for (int op2 = op; op2 < 256; op2++) {
+            if (g_mcs48_isa[op2].mnemonic && strcmp(g_mcs48_isa[op2].mnemonic, name) == 0)
+                s_opcodes_by_mnemonic[num_forms++] = op2;
+        }
+        m->num_forms = num_forms - m->first_form;
+    }
+
+    s_hash_seed = 0;
+    while (!try_hash_seed(s_hash_seed))
+        s_hash_seed++;
+}
+
+static mnemonic_t const *find_mnemonic(char const *s, unsigned len) {
+    unsigned slot = s_hash_slots[hash_string(s, len, s_hash_seed) & (MNEMONIC_HASH_SIZE - 1)];
+    if (!slot) return NULL;
+    mnemonic_t const *m = &s_mnemonics[slot - 1];
+    if (strlen(m->name) != len || strncmp(m->name, s, len) != 0) return NULL;
+    return m;
+}
+
+
+// ****************************************************************************
+// Symbol table
+// ****************************************************************************
+
+// Open addressing with linear probing, kept at most half full, so a lookup
+// is usually one probe. It is emptied and filled again by each assembly.
+
+static mcs48_asm_symbol_t *find_symbol_slot(mcs48_asm_symbol_t *symbols, unsigned capacity,
+        char const *name, unsigned len) {
+    unsigned i = hash_string(name, len, 0) & (capacity - 1);
+    while (symbols[i].name) {
+        if (symbols[i].name_len == len && memcmp(symbols[i].name, name, len) == 0)
+            break;
+        i = (i + 1) & (capacity - 1);
+    }
+    return &symbols[i];
+}
+
+static mcs48_asm_symbol_t const *find_symbol(mcs48_asm_t *a, char const *name, unsigned len) {
+    mcs48_asm_symbol_t *sym = find_symbol_slot(a->symbols, a->symbol_capacity, name, len);
+    return sym->name ? sym : NULL;
+}
+
+static void grow_symbol_table(mcs48_asm_t *a) {
+    unsigned capacity = a->symbol_capacity * 2;
+    mcs48_asm_symbol_t *symbols = (mcs48_asm_symbol_t *)calloc(capacity, sizeof(mcs48_asm_symbol_t));
+    for (unsigned i = 0; i < a->symbol_capacity; i++) {
+        mcs48_asm_symbol_t const *sym = &a->symbols[i];
+        if (sym->name)
+            *find_symbol_slot(symbols, capacity, sym->name, sym->name_len) = *sym;
+    }
+    free(a->symbols);
+    a->symbols = symbols;
+    a->symbol_capacity = capacity;
+}
+
+static void define_symbol(mcs48_asm_t *a, unsigned line_num, char const *name, unsigned len, unsigned value) {
+    if (is_keyword(name, len) || find_mnemonic(name, len)) {
+        error(a, line_num, "'%.*s' is reserved and can't be a symbol", len, name);
+        return;
+    }
+
+    mcs48_asm_symbol_t const *old = find_symbol(a, name, len);
+    if (old) {
+        error(a, line_num, "'%.*s' is already defined on line %u", len, name, old->line_num);
+        return;
+    }
+
+    if ((a->num_symbols + 1) * 2 > a->symbol_capacity)
+        grow_symbol_table(a);
+    mcs48_asm_symbol_t *sym = find_symbol_slot(a->symbols, a->symbol_capacity, name, len);
+    sym->name = name;
+    sym->name_len = len;
+    sym->value = value;
+    sym->line_num = line_num;
+    a->num_symbols++;
+}
+
+
+// ****************************************************************************
+// Expressions
+// ****************************************************************************
+
+typedef struct {
+    mcs48_asm_t *a;
+    char const *c;
+    unsigned pc;                // The value of $
+    bool undefined;             // Refers to a symbol that isn't defined
+    bool bad;                   // Has a syntax error
+} expr_t;
+
+static unsigned parse_binary(expr_t *e, int min_precedence);
+
+static void skip_expr_spaces(expr_t *e) {
+    while (isspace((unsigned char)*e->c)) e->c++;
+}
+
+static unsigned parse_number(expr_t *e, int base) {
+    char *end;
+    unsigned val = strtoul(e->c, &end, base);
+    if (end == e->c) e->bad = true;
+    e->c = end;
+    return val;
+}
+
+static unsigned parse_unary(expr_t *e) {
+    skip_expr_spaces(e);
+    char c = *e->c;
+    if (c == '-' || c == '~' || c == '+') {
+        e->c++;
+        unsigned val = parse_unary(e);
+        return c == '-' ? 0 - val : c == '~' ? ~val : val;
+    }
+
+    if (c == '(') {
+        e->c++;
+        unsigned val = parse_binary(e, 0);
+        skip_expr_spaces(e);
+        if (*e->c != ')') e->bad = true;
+        else e->c++;
+        return val;
+    }
+
+    if (c == '$') {
+        e->c++;
+        if (isxdigit((unsigned char)*e->c))
+            return parse_number(e, 16);
+        return e->pc;
+    }
+
+    if (c == '0' && e->c[1] == 'x') {
+        e->c += 2;
+        return parse_number(e, 16);
+    }
+
+    if (isdigit((unsigned char)c))
+        return parse_number(e, 10);
+
+    if (is_symbol_start(c)) {
+        char const *name = e->c;
+        while (is_symbol_char(*e->c)) e->c++;
+        mcs48_asm_symbol_t const *sym = find_symbol(e->a, name, (unsigned)(e->c - name));
+        if (sym) return sym->value;
+        e->undefined = true;
+        return 0;
+    }
+
+    e->bad = true;
+    return 0;
+}
+
+// Returns the precedence of the binary operator at c, and its length in len,
+// or -1 if there isn't one
+static int get_binary_op(char const *c, unsigned *len) {
+    *len = 1;
+    switch (c[0]) {
+    case '|': return 1;
+    case '^': return 2;
+    case '&': return 3;
+    case '<': case '>':
+        *len = 2;
+        return c[1] == c[0] ? 4 : -1;
+    case '+': case '-': return 5;
+    case '*': case '/': case '%': return 6;
+    }
+    return -1;
+}
+
+static unsigned parse_binary(expr_t *e, int min_precedence) {
+    unsigned lhs = parse_unary(e);
+    while (!e->bad) {
+        skip_expr_spaces(e);
+        unsigned op_len;
+        int precedence = get_binary_op(e->c, &op_len);
+        if (precedence < 0 || precedence < min_precedence) break;
+        char op = *e->c;
+        e->c += op_len;
+        unsigned rhs = parse_binary(e, precedence + 1);
+        switch (op) {
+        case '|': lhs |= rhs; break;
+        case '^': lhs ^= rhs; break;
+        case '&': lhs &= rhs; break;
+        case '<': lhs <<= rhs; break;
+        case '>': lhs >>= rhs; break;
+        case '+': lhs += rhs; break;
+        case '-': lhs -= rhs; break;
+        case '*': lhs *= rhs; break;
+        case '/': case '%':
+            if (rhs == 0) { e->bad = true; break; }
+            lhs = op == '/' ? lhs / rhs : lhs % rhs;
+            break;
+        }
+    }
+    return lhs;
+}
+
+// Evaluates the whole of text, with $ as pc. Reports an error and returns
+// false if it's bad or refers to a symbol that isn't defined (yet).
+static bool eval(mcs48_asm_t *a, unsigned line_num, char const *text, unsigned pc, unsigned *val) {
+    expr_t e;
+    e.a = a;
+    e.c = text;
+    e.pc = pc;
+    e.undefined = false;
+    e.bad = false;
+    *val = parse_binary(&e, 0);
+    skip_expr_spaces(&e);
+    if (e.bad || *e.c != '\0') {
+        error(a, line_num, "bad expression '%s'", text);
+        return false;
+    }
+    if (e.undefined) {
+        error(a, line_num, "undefined symbol in '%s'", text);
+        return false;
+    }
+    return true;
+}
+
+
+// ****************************************************************************
+// Parsing
+// ****************************************************************************
+
+enum { MAX_OPERANDS = 64, MAX_OPERAND_LEN = 64 };
+
+typedef struct {
+    char text[MAX_OPERANDS][MAX_OPERAND_LEN];   // Without spaces
+    unsigned lens[MAX_OPERANDS];
+    unsigned num;
+} operands_t;
+
+// Splits the comma-separated operands. Returns false if there are too many or
+// they are too long.
+static bool split_operands(char const *c, operands_t *ops) {
+    ops->num = 0;
+    ops->text[0][0] = '\0';
+    unsigned len = 0;
+    for (; *c; c++) {
+        if (isspace((unsigned char)*c)) continue;
+        if (*c == ',') {
+            if (len == 0) return false;
+            ops->lens[ops->num] = len;
+            if (++ops->num == MAX_OPERANDS) return false;
+            len = 0;
+            ops->text[ops->num][0] = '\0';
+            continue;
+        }
+        if (len + 1 >= MAX_OPERAND_LEN) return false;
+        ops->text[ops->num][len++] = *c;
+        ops->text[ops->num][len] = '\0';
+    }
+
+    if (len > 0)
+        ops->lens[ops->num++] = len;
+    else if (ops->num > 0)
+        return false;   // Trailing comma
+    return true;
+}
+
+// Codes the operands of a line, as s_form_operands codes the forms. Values
+// aren't evaluated here, only told apart from the fixed operands, so that a
+// line can be parsed without knowing the symbols. Returns false if there
+// are more than any form takes.
+static bool code_operands(operands_t const *ops, signed char *codes) {
+    if (ops->num > MAX_FORM_OPERANDS) return false;
+    for (unsigned i = 0; i < ops->num; i++) {
+        char const *op = ops->text[i];
+        int keyword = find_keyword(op, ops->lens[i]);
+        if (keyword >= 0) codes[i] = (signed char)keyword;
+        else if (op[0] == '#') codes[i] = OPERAND_IMM;
+        else if (op[0] == '@') codes[i] = OPERAND_BAD;
+        else codes[i] = OPERAND_ADDR;
+    }
+    return true;
+}
+
+// Matches the coded operands against the form of an opcode. Sets
+// value_operand to the index of the "#n" or "addr" operand, or -1.
+static bool match_operands(unsigned opcode, signed char const *codes, unsigned num, int *value_operand) {
+    *value_operand = -1;
+    if (s_form_num_operands[opcode] != num) return false;
+    for (unsigned i = 0; i < num; i++) {
+        if (s_form_operands[opcode][i] != codes[i]) return false;
+        if (codes[i] < 0) *value_operand = i;
+    }
+    return true;
+}
+
+// Copies the values into line->values, and lists the symbols they use
+static void set_values(mcs48_asm_line_t *line, operands_t const *ops, int first, int num, bool skip_hash) {
+    line->num_values = num;
+
+    char *c = line->values;
+    for (int i = first; i < first + num; i++) {
+        char const *text = ops->text[i] + (skip_hash ? 1 : 0);
+        size_t len = strlen(text) + 1;
+        memcpy(c, text, len);
+        c += len;
+    }
+    char const *end = c;
+
+    for (c = line->values; c < end; ) {
+        if (isdigit((unsigned char)*c)) {
+            while (isalnum((unsigned char)*c)) c++;     // A number, like 0x1f
+        }
+        else if (*c == '$') {
+            c++;
+            while (isxdigit((unsigned char)*c)) c++;
+        }
+        else if (is_symbol_start(*c)) {
+            char *name = c;
+            while (is_symbol_char(*c)) c++;
+            line->refs[line->num_refs] = name;
+            line->ref_lens[line->num_refs++] = (unsigned)(c - name);
+        }
+        else {
+            c++;
+        }
+    }
+}
+
+static void set_bad(mcs48_asm_line_t *line, char const *fmt, ...) {
+    line->kind = LINE_BAD;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line->error, sizeof(line->error), fmt, args);
+    va_end(args);
+}
+
+// Splits line->work into its parts, and chooses the opcode
+static void parse_line(mcs48_asm_line_t *line) {
+    char *c = skip_spaces(line->work);
+
+    // Line address
+    if (isdigit((unsigned char)*c) || *c == '$') {
+        line->addr_expr = c;
+        char *end = skip_word(c);
+        bool is_more = *end != '\0';
+        *end = '\0';
+        c = is_more ? skip_spaces(end + 1) : end;
+    }
+
+    // Label
+    char *word = c;
+    while (is_symbol_char(*c)) c++;
+    if (*c == ':' && c > word) {
+        line->label = word;
+        line->label_len = (unsigned)(c - word);
+        word = c = skip_spaces(c + 1);
+        while (is_symbol_char(*c)) c++;
+    }
+
+    unsigned word_len = (unsigned)(c - word);
+    if (word_len == 0) {
+        if (*c) set_bad(line, "syntax error");
+        return;
+    }
+
+    char *after = skip_spaces(c);
+    unsigned after_len = (unsigned)(skip_word(after) - after);
+    if (word_is(after, after_len, "equ")) {
+        line->kind = LINE_EQU;
+        line->name = word;
+        line->name_len = word_len;
+        line->expr = skip_spaces(after + after_len);
+        return;
+    }
+
+    if (word_is(word, word_len, "org")) {
+        line->kind = LINE_ORG;
+        line->expr = after;
+        return;
+    }
+
+    operands_t ops;
+    if (!split_operands(after, &ops)) {
+        set_bad(line, "bad operands");
+        return;
+    }
+
+    if (word_is(word, word_len, ".db")) {
+        line->kind = LINE_DB;
+        line->length = ops.num;
+        set_values(line, &ops, 0, ops.num, false);
+    }
+    else {
+        mnemonic_t const *m = find_mnemonic(word, word_len);
+        if (!m) {
+            set_bad(line, "unknown instruction '%.*s'", word_len, word);
+            return;
+        }
+
+        signed char codes[MAX_FORM_OPERANDS];
+        bool can_match = code_operands(&ops, codes);
+        unsigned i;
+        for (i = 0; can_match && i < m->num_forms; i++) {
+            unsigned opcode = s_opcodes_by_mnemonic[m->first_form + i];
+            int value_operand;
+            if (match_operands(opcode, codes, ops.num, &value_operand)) {
+                line->kind = LINE_INSN;
+                line->opcode = opcode;
+                line->length = g_mcs48_isa[opcode].length;
+                set_values(line, &ops, value_operand < 0 ? 0 : value_operand, value_operand < 0 ? 0 : 1,
+                    g_mcs48_isa[opcode].operand_kind == MCS48_OPND_IMM);
+                break;
+            }
+        }
+        if (!can_match || i == m->num_forms) {
+            set_bad(line, "'%.*s' can't take the operands '%s'", word_len, word, after);
+            return;
+        }
+    }
+}
+
+
+// ****************************************************************************
+// Line cache
+// ****************************************************************************
+
+// Hashes the line up to its comment, and cuts len down to there
+static uint64_t hash_key(char const *text, unsigned *len) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned i = 0; i < *len; i++) {
+        char c = text[i];
+        if (c == ';' || c == '\r' || (c == '/' && i + 1 < *len && text[i + 1] == '/')) {
+            *len = i;
+            break;
+        }
+        h ^= (unsigned char)to_lower(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static bool key_matches(mcs48_asm_line_t const *line, uint64_t hash, char const *text, unsigned len) {
+    if (line->hash != hash || line->key_len != len) return false;
+    for (unsigned i = 0; i < len; i++) {
+        if (line->key[i] != to_lower(text[i])) return false;
+    }
+    return true;
+}
+
+static void free_line(mcs48_asm_line_t *line) {
+    free(line);
+}
+
+static void insert_line(mcs48_asm_line_t **cache, unsigned capacity, mcs48_asm_line_t *line) {
+    unsigned i = (unsigned)line->hash & (capacity - 1);
+    while (cache[i])
+        i = (i + 1) & (capacity - 1);
+    cache[i] = line;
+}
+
+// Rebuilds the cache at the given capacity. Drops the lines that the last
+// assembly didn't use, if drop_unused is set.
+static void rebuild_cache(mcs48_asm_t *a, unsigned capacity, bool drop_unused) {
+    mcs48_asm_line_t **cache = (mcs48_asm_line_t **)calloc(capacity, sizeof(mcs48_asm_line_t *));
+    a->cache_size = 0;
+    for (unsigned i = 0; i < a->cache_capacity; i++) {
+        mcs48_asm_line_t *line = a->cache[i];
+        if (!line) continue;
+        if (drop_unused && line->generation != a->generation) {
+            free_line(line);
+            continue;
+        }
+        insert_line(cache, capacity, line);
+        a->cache_size++;
+    }
+    free(a->cache);
+    a->cache = cache;
+    a->cache_capacity = capacity;
+}
+
+// Returns the cache entry for the text, parsing it if it isn't there
+static mcs48_asm_line_t *get_line(mcs48_asm_t *a, char const *text, unsigned len) {
+    uint64_t hash = hash_key(text, &len);
+    unsigned i = (unsigned)hash & (a->cache_capacity - 1);
+    while (a->cache[i]) {
+        if (key_matches(a->cache[i], hash, text, len))
+            return a->cache[i];
+        i = (i + 1) & (a->cache_capacity - 1);
+    }
+
+    // The line and everything parsed from it are one block, as a cold
+    // assembly is mostly spent making new lines. Each string parsed from the
+    // text, with its NUL, fits in len + 2, as do the bytes, one per value.
+    // There is at most one symbol per two characters.
+    unsigned max_refs = len / 2 + 2;
+    size_t size = sizeof(mcs48_asm_line_t) + max_refs * (sizeof(char *) + sizeof(unsigned)) + 4 * (len + 2);
+    mcs48_asm_line_t *line = (mcs48_asm_line_t *)calloc(1, size);
+    line->refs = (char **)(line + 1);
+    line->ref_lens = (unsigned *)(line->refs + max_refs);
+    line->key = (char *)(line->ref_lens + max_refs);
+    line->work = line->key + len + 2;
+    line->values = line->work + len + 2;
+    line->bytes = (u8 *)(line->values + len + 2);
+
+    line->hash = hash;
+    line->key_len = len;
+    for (unsigned j = 0; j < len; j++)
+        line->key[j] = to_lower(text[j]);
+    line->key[len] = '\0';
+    memcpy(line->work, line->key, len + 1);
+    parse_line(line);
+    a->num_parsed++;
+
+    a->cache[i] = line;
+    a->cache_size++;
+    if (a->cache_size * 2 > a->cache_capacity)
+        rebuild_cache(a, a->cache_capacity * 2, false);
+    return line;
+}
+
+
+// ****************************************************************************
+// Assembly
+// ****************************************************************************
+
+// Gives the line its address, and defines its label or constant. Returns the
+// address of the next line.
+static unsigned first_pass_line(mcs48_asm_t *a, mcs48_asm_line_t *line, unsigned line_num, unsigned pc,
+        unsigned *line_addr) {
+    unsigned addr;
+    if (line->addr_expr) {
+        if (!eval(a, line_num, line->addr_expr, pc, &addr)) return pc;
+        if (addr >= MCS48_ASM_IMAGE_SIZE) {
+            error(a, line_num, "address $%04x is outside the ROM", addr);
+            return pc;
+        }
+        pc = addr;
+    }
+
+    *line_addr = pc;
+    if (line->label)
+        define_symbol(a, line_num, line->label, line->label_len, pc);
+
+    unsigned val;
+    switch (line->kind) {
+    case LINE_EMPTY:
+        break;
+    case LINE_BAD:
+        error(a, line_num, "%s", line->error);
+        break;
+    case LINE_EQU:
+        if (eval(a, line_num, line->expr, pc, &val))
+            define_symbol(a, line_num, line->name, line->name_len, val);
+        break;
+    case LINE_ORG:
+        if (!eval(a, line_num, line->expr, pc, &val)) break;
+        if (val >= MCS48_ASM_IMAGE_SIZE) {
+            error(a, line_num, "address $%04x is outside the ROM", val);
+            break;
+        }
+        pc = val;
+        break;
+    case LINE_INSN:
+    case LINE_DB:
+        if (pc + line->length > MCS48_ASM_IMAGE_SIZE) {
+            error(a, line_num, "goes past the end of the ROM");
+            break;
+        }
+        pc += line->length;
+        break;
+    }
+
+    return pc;
+}
+
+// Works out line->bytes. Returns false if a value is bad.
+static bool encode_line(mcs48_asm_t *a, mcs48_asm_line_t *line, unsigned line_num, unsigned addr) {
+    unsigned num_errors = a->num_errors;
+    char const *text = line->values;
+    unsigned val = 0;
+
+    if (line->kind == LINE_DB) {
+        for (unsigned i = 0; i < line->num_values; i++) {
+            if (eval(a, line_num, text, addr, &val) && val > 0xff && val < 0xffffff80)
+                error(a, line_num, "$%x doesn't fit in a byte", val);
+            line->bytes[i] = val & 0xff;
+            text += strlen(text) + 1;
+        }
+        return a->num_errors == num_errors;
+    }
+
+    unsigned opcode = line->opcode;
+    mcs48_isa_entry_t const *insn = &g_mcs48_isa[opcode];
+    if (line->num_values > 0 && !eval(a, line_num, text, addr, &val))
+        return false;
+
+    switch (insn->operand_kind) {
+    case MCS48_OPND_NONE:
+        break;
+    case MCS48_OPND_IMM:
+        if (val > 0xff && val < 0xffffff80)
+            error(a, line_num, "#$%x doesn't fit in a byte", val);
+        break;
+    case MCS48_OPND_PAGE:
+        // The target is in the page of the second byte, which is the next
+        // page if the instruction starts at the end of one
+        if ((val & ~0xffu) != ((addr + 1) & ~0xffu))
+            error(a, line_num, "$%04x is outside the page ($%04x-$%04x) that %s can reach",
+                val, (addr + 1) & ~0xffu, ((addr + 1) & ~0xffu) + 0xff, insn->mnemonic);
+        break;
+    case MCS48_OPND_LONG:
+        // Only bits 0-10 are encoded. Bit 11 comes from sel mb0/mb1 at run
+        // time, so a call into the other bank is fine.
+        if (val >= MCS48_ASM_IMAGE_SIZE)
+            error(a, line_num, "$%04x is outside the ROM", val);
+        opcode |= ((val >> 8) & 7) << 5;
+        break;
+    }
+
+    line->bytes[0] = opcode;
+    if (insn->length > 1)
+        line->bytes[1] = val & 0xff;
+    return a->num_errors == num_errors;
+}
+
+// Hashes what the line's bytes depend on besides its text: its address and
+// the values of the symbols it uses. Returns false if one isn't defined.
+static bool get_deps(mcs48_asm_t *a, mcs48_asm_line_t const *line, unsigned addr, uint64_t *deps) {
+    uint64_t h = hash_u32(14695981039346656037ull, addr);
+    for (unsigned i = 0; i < line->num_refs; i++) {
+        mcs48_asm_symbol_t const *sym = find_symbol(a, line->refs[i], line->ref_lens[i]);
+        if (!sym) return false;
+        h = hash_u32(h, sym->value);
+    }
+    *deps = h;
+    return true;
+}
+
+// Writes the line's bytes into new_image, encoding them if they aren't
+// cached. Lines may share a byte if they agree on it: the stock ROM's jmp at
+// $3ff takes its target from the first entry of the table at $400.
+static void second_pass_line(mcs48_asm_t *a, mcs48_asm_line_t *line, unsigned line_num, unsigned addr) {
+    if (line->kind != LINE_INSN && line->kind != LINE_DB) return;
+
+    uint64_t deps = 0;
+    bool has_deps = get_deps(a, line, addr, &deps);
+    if (!has_deps || !line->is_encoded || line->encoded_addr != addr || line->encoded_deps != deps) {
+        a->num_encoded++;
+        bool ok = encode_line(a, line, line_num, addr);
+        line->is_encoded = ok && has_deps;
+        line->encoded_addr = addr;
+        line->encoded_deps = deps;
+        if (!ok) return;
+    }
+
+    for (unsigned i = 0; i < line->length; i++) {
+        unsigned other = a->written[addr + i];
+        if (other && a->new_image[addr + i] != line->bytes[i]) {
+            error(a, line_num, "overlaps line %u at $%04x", other, addr + i);
+            return;
+        }
+        a->written[addr + i] = line_num;
+        a->new_image[addr + i] = line->bytes[i];
+    }
+}
+
+// Copies new_image into image, and lists the ranges that differed
+static void apply_changes(mcs48_asm_t *a) {
+    a->num_changes = 0;
+    unsigned i = 0;
+    while (i < MCS48_ASM_IMAGE_SIZE) {
+        if (a->image[i] == a->new_image[i]) {
+            i++;
+            continue;
+        }
+
+        unsigned start = i;
+        while (i < MCS48_ASM_IMAGE_SIZE && a->image[i] != a->new_image[i]) {
+            a->image[i] = a->new_image[i];
+            i++;
+        }
+        mcs48_asm_range_t *range = &a->changes[a->num_changes++];
+        range->start = start;
+        range->num_bytes = i - start;
+    }
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void mcs48_asm_init(mcs48_asm_t *a) {
+    init_mnemonics();
+    memset(a, 0, sizeof(*a));
+    a->cache_capacity = 4096;   // Holds a listing the size of the stock one without growing
+    a->cache = (mcs48_asm_line_t **)calloc(a->cache_capacity, sizeof(mcs48_asm_line_t *));
+    a->symbol_capacity = 1024;
+    a->symbols = (mcs48_asm_symbol_t *)calloc(a->symbol_capacity, sizeof(mcs48_asm_symbol_t));
+}
+
+void mcs48_asm_free(mcs48_asm_t *a) {
+    for (unsigned i = 0; i < a->cache_capacity; i++) {
+        if (a->cache[i])
+            free_line(a->cache[i]);
+    }
+    free(a->cache);
+    free(a->lines);
+    free(a->line_addrs);
+    free(a->symbols);
+    memset(a, 0, sizeof(*a));
+}
+
+bool mcs48_asm_assemble(mcs48_asm_t *a, char const *source, size_t num_bytes) {
+    a->generation++;
+    a->num_changes = 0;
+    a->num_errors = 0;
+    a->num_lines = 0;
+    a->num_parsed = 0;
+    a->num_encoded = 0;
+    a->num_symbols = 0;
+    a->num_bytes = 0;
+    memset(a->symbols, 0, a->symbol_capacity * sizeof(mcs48_asm_symbol_t));
+
+    // Look each line up in the cache
+    char const *c = source;
+    char const *end = source + num_bytes;
+    while (c < end) {
+        char const *eol = (char const *)memchr(c, '\n', end - c);
+        char const *line_end = eol ? eol : end;
+        if (a->num_lines == a->max_lines) {
+            a->max_lines = a->max_lines ? a->max_lines * 2 : 4096;
+            a->lines = (mcs48_asm_line_t **)realloc(a->lines, a->max_lines * sizeof(mcs48_asm_line_t *));
+            a->line_addrs = (unsigned *)realloc(a->line_addrs, a->max_lines * sizeof(unsigned));
+        }
+        mcs48_asm_line_t *line = get_line(a, c, (unsigned)(line_end - c));
+        line->generation = a->generation;
+        a->lines[a->num_lines++] = line;
+        c = eol ? eol + 1 : end;
+    }
+
+    unsigned pc = 0;
+    for (unsigned i = 0; i < a->num_lines; i++)
+        pc = first_pass_line(a, a->lines[i], i + 1, pc, &a->line_addrs[i]);
+
+    // Don't encode with labels that may have been misplaced
+    if (a->num_errors == 0) {
+        memset(a->new_image, 0, sizeof(a->new_image));
+        memset(a->written, 0, sizeof(a->written));
+        for (unsigned i = 0; i < a->num_lines; i++)
+            second_pass_line(a, a->lines[i], i + 1, a->line_addrs[i]);
+    }
+
+    // Keep the cache from filling up with old versions of lines
+    if (a->cache_size > a->num_lines * 2 + 1024)
+        rebuild_cache(a, a->cache_capacity, true);
+
+    if (a->num_errors)
+        return false;
+
+    for (unsigned i = 0; i < MCS48_ASM_IMAGE_SIZE; i++)
+        a->num_bytes += a->written[i] != 0;
+    apply_changes(a);
+    return true;
+}
+
+bool mcs48_asm_assemble_file(mcs48_asm_t *a, char const *path) {
+    a->num_errors = 0;
+    a->num_changes = 0;
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return false;
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char *source = (char *)malloc(size > 0 ? size : 1);
+    size_t num_bytes = fread(source, 1, size > 0 ? size : 0, in);
+    fclose(in);
+
+    bool ok = mcs48_asm_assemble(a, source, num_bytes);
+    free(source);
+    return ok;
+}
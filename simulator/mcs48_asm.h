@@ -0,0 +1,85 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Assembles an MCS-48 listing, in the style of Annotated_Stock1987_951KLR.asm,
+// into a 4 KB ROM image. See assembler/asm.cpp for the syntax.
+//
+// It is made for reassembling the same listing over and over as it is edited,
+// for example to hot-reload a patch into a running simulator. Each line is
+// parsed once, and cached by the hash of its text. It is only encoded again
+// if its text, its address or the value of a symbol it uses has changed. The
+// image is then patched in place, and the ranges of bytes that changed are
+// listed, so that only those need to be copied into the CPU's ROM. See
+// cpu_patch_rom().
+
+enum {
+    MCS48_ASM_IMAGE_SIZE = 4096,
+    MCS48_ASM_MAX_ERRORS = 32,                          // Kept. The rest are only counted.
+    MCS48_ASM_MAX_CHANGES = MCS48_ASM_IMAGE_SIZE / 2    // Enough for every other byte
+};
+
+typedef struct {
+    u16 start;
+    u16 num_bytes;
+} mcs48_asm_range_t;
+
+typedef struct {
+    unsigned line_num;      // From 1
+    char message[120];
+} mcs48_asm_error_t;
+
+typedef struct mcs48_asm_line_t mcs48_asm_line_t;
+typedef struct mcs48_asm_symbol_t mcs48_asm_symbol_t;
+
+typedef struct {
+    // Bytes that no line writes are 0
+    u8 image[MCS48_ASM_IMAGE_SIZE];
+
+    // From the last call to mcs48_asm_assemble(). The changes are in address
+    // order and don't touch.
+    mcs48_asm_range_t changes[MCS48_ASM_MAX_CHANGES];
+    unsigned num_changes;
+    mcs48_asm_error_t errors[MCS48_ASM_MAX_ERRORS];
+    unsigned num_errors;
+    unsigned num_lines;
+    unsigned num_parsed;    // Lines that weren't in the cache
+    unsigned num_encoded;   // Lines whose bytes weren't in the cache
+    unsigned num_symbols;
+    unsigned num_bytes;     // Written by the listing
+
+    // The cache of parsed lines, by text
+    mcs48_asm_line_t **cache;
+    unsigned cache_capacity;    // A power of two
+    unsigned cache_size;
+    unsigned generation;        // Counts the calls to mcs48_asm_assemble()
+
+    // The listing, as entries in the cache
+    mcs48_asm_line_t **lines;
+    unsigned *line_addrs;
+    unsigned max_lines;
+
+    mcs48_asm_symbol_t *symbols;
+    unsigned symbol_capacity;   // A power of two
+
+    u8 new_image[MCS48_ASM_IMAGE_SIZE];
+    unsigned written[MCS48_ASM_IMAGE_SIZE];     // The line number that wrote each byte, or 0
+} mcs48_asm_t;
+
+
+void mcs48_asm_init(mcs48_asm_t *a);
+void mcs48_asm_free(mcs48_asm_t *a);
+
+// Assembles the whole listing. If there are no errors, patches image to match
+// it, lists the ranges that changed and returns true. Otherwise leaves image
+// as it was, with no changes, and returns false. The source needn't be
+// NUL-terminated.
+bool mcs48_asm_assemble(mcs48_asm_t *a, char const *source, size_t num_bytes);
+
+// Reads and assembles a file. Returns false, with no errors, if it couldn't
+// be read.
+bool mcs48_asm_assemble_file(mcs48_asm_t *a, char const *path);
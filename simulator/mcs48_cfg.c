@@ -0,0 +1,760 @@
+// Own header
+#include "mcs48_cfg.h"
+
+// This project's headers
+#include "mcs48_isa.h"
+
+// Standard headers
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+    OP_INC_R0 = 0x18,
+    OP_XCH_A_R0 = 0x28,
+    OP_RET = 0x83,
+    OP_RETR = 0x93,
+    OP_MOV_R0_A = 0xA8,
+    OP_JMPP = 0xB3,
+    OP_MOV_R0_N = 0xB8,
+    OP_SEL_RB0 = 0xC5,
+    OP_DEC_R0 = 0xC8,
+    OP_SEL_RB1 = 0xD5,
+    OP_DJNZ_R0 = 0xE8
+};
+
+// The states of a block in wcet_state
+enum {
+    WCET_NOT_DONE,
+    WCET_IN_PROGRESS,
+    WCET_DONE
+};
+
+enum { NO_PATH = UINT_MAX };
+
+// The PC only counts through the bottom 11 bits
+static unsigned add_to_pc(unsigned pc, unsigned n) {
+    return ((pc + n) & 0x7ff) | (pc & 0x800);
+}
+
+static unsigned next_insn(mcs48_cfg_t const *cfg, unsigned addr) {
+    return add_to_pc(addr, g_mcs48_isa[cfg->d->rom[addr]].length);
+}
+
+static bool is_jmp(unsigned opcode) { return (opcode & 0x1f) == 0x04; }
+static bool is_call(unsigned opcode) { return (opcode & 0x1f) == 0x14; }
+static bool is_djnz(unsigned opcode) { return (opcode & 0xf8) == OP_DJNZ_R0; }
+
+static bool ends_block(unsigned opcode) {
+    return g_mcs48_isa[opcode].operand_kind == MCS48_OPND_PAGE ||
+        g_mcs48_isa[opcode].operand_kind == MCS48_OPND_LONG ||
+        opcode == OP_RET || opcode == OP_RETR || opcode == OP_JMPP;
+}
+
+static bool has_extra_edge(mcs48_cfg_t const *cfg, unsigned from) {
+    for (unsigned i = 0; i < cfg->num_extra_edges; i++) {
+        if (cfg->extra_edges[i].from == from)
+            return true;
+    }
+    return false;
+}
+
+
+// ****************************************************************************
+// Building
+// ****************************************************************************
+
+static void add_succ(mcs48_cfg_t *cfg, mcs48_block_t *b, unsigned addr) {
+    unsigned idx = cfg->block_at[addr & 0xfff];
+    if (idx == MCS48_CFG_NO_BLOCK || cfg->num_succs >= MCS48_CFG_MAX_SUCCS)
+        return;
+    for (unsigned i = 0; i < b->num_succs; i++) {
+        if (cfg->succs[b->first_succ + i] == idx)
+            return;
+    }
+    cfg->succs[cfg->num_succs++] = (u16)idx;
+    b->num_succs++;
+}
+
+static mcs48_jump_table_t const *find_table(mcs48_disasm_t const *d, unsigned jmpp_addr) {
+    for (unsigned i = 0; i < d->num_tables; i++) {
+        if (d->tables[i].num_entries && d->tables[i].jmpp_addr == jmpp_addr)
+            return &d->tables[i];
+    }
+    return NULL;
+}
+
+// Leaders are the instructions that start a block
+static void find_leaders(mcs48_cfg_t const *cfg, bool *leader) {
+    mcs48_disasm_t const *d = cfg->d;
+    for (unsigned addr = 0; addr < MCS48_DISASM_IMAGE_SIZE; addr++) {
+        if (!(d->flags[addr] & MCS48_DISASM_INSN))
+            continue;
+        if (d->flags[addr] & (MCS48_DISASM_ENTRY | MCS48_DISASM_CALLED))
+            leader[addr] = true;
+        int target = mcs48_disasm_branch_target(d, addr);
+        if (target >= 0)
+            leader[target] = true;
+        if (ends_block(d->rom[addr]))
+            leader[next_insn(cfg, addr)] = true;
+    }
+
+    for (unsigned i = 0; i < d->num_tables; i++) {
+        mcs48_jump_table_t const *table = &d->tables[i];
+        for (unsigned j = 0; j < table->num_entries; j++) {
+            if ((j & table->mask) == j)
+                leader[table->first | d->rom[table->first | j]] = true;
+        }
+    }
+
+    for (unsigned i = 0; i < cfg->num_extra_edges; i++) {
+        leader[cfg->extra_edges[i].to] = true;
+        leader[next_insn(cfg, cfg->extra_edges[i].from)] = true;
+    }
+}
+
+static void make_block(mcs48_cfg_t *cfg, unsigned addr, bool const *leader) {
+    mcs48_disasm_t const *d = cfg->d;
+    mcs48_block_t *b = &cfg->blocks[cfg->num_blocks];
+    memset(b, 0, sizeof(*b));
+    b->start = (u16)addr;
+    b->callee = MCS48_CFG_NO_BLOCK;
+    cfg->block_at[addr] = (u16)cfg->num_blocks++;
+
+    while (true) {
+        unsigned opcode = d->rom[addr];
+        b->last = (u16)addr;
+        b->num_insns++;
+        b->cycles += g_mcs48_isa[opcode].cycles;
+        if (ends_block(opcode) || has_extra_edge(cfg, addr))
+            return;
+
+        addr = next_insn(cfg, addr);
+        if (!(d->flags[addr] & MCS48_DISASM_INSN)) {
+            // The trace ran into an unused opcode or the end of the bank
+            b->unknown_end = true;
+            return;
+        }
+        if (leader[addr])
+            return;
+    }
+}
+
+static void link_block(mcs48_cfg_t *cfg, mcs48_block_t *b) {
+    mcs48_disasm_t const *d = cfg->d;
+    unsigned opcode = d->rom[b->last];
+    int target = mcs48_disasm_branch_target(d, b->last);
+    b->first_succ = (u16)cfg->num_succs;
+
+    bool extra = false;
+    for (unsigned i = 0; i < cfg->num_extra_edges; i++) {
+        if (cfg->extra_edges[i].from == b->last) {
+            add_succ(cfg, b, cfg->extra_edges[i].to);
+            extra = true;
+        }
+    }
+
+    if (opcode == OP_RET || opcode == OP_RETR) {
+        b->returns = !extra;
+    }
+    else if (opcode == OP_JMPP) {
+        mcs48_jump_table_t const *table = find_table(d, b->last);
+        for (unsigned i = 0; table && i < table->num_entries; i++) {
+            if ((i & table->mask) == i)
+                add_succ(cfg, b, table->first | d->rom[table->first | i]);
+        }
+        if (!table && !extra)
+            b->unknown_end = true;
+    }
+    else if (is_jmp(opcode)) {
+        add_succ(cfg, b, target);
+    }
+    else {
+        if (is_call(opcode))
+            b->callee = cfg->block_at[target];
+        else if (target >= 0)
+            add_succ(cfg, b, target);
+        if (!b->unknown_end)
+            add_succ(cfg, b, next_insn(cfg, b->last));
+    }
+}
+
+
+// ****************************************************************************
+// WCET
+// ****************************************************************************
+
+// The blocks reachable from the entry of a subroutine without going into its
+// calls. They are numbered in the order that the depth first search reaches
+// them, so the ones under a block in the search tree are the numbers from it
+// to its last_desc.
+typedef struct {
+    unsigned num;
+    u16 *blocks;            // Of each local number
+    unsigned *local;        // Of each block, or UINT_MAX if it isn't in the region
+    unsigned *post_order;   // Local numbers, each after the ones it goes to, but for back edges
+    unsigned *last_desc;
+    u8 *colour;             // 0 not reached, 1 on the search stack, 2 done
+    u8 *is_back;            // Of each entry in cfg->succs
+    bool *follow;           // Whether the path goes on to the block's successors
+    bool *is_end;           // Whether the path can end at it
+    unsigned *weight;       // Cycles, with the callee's and the extra iterations of the loop it heads
+    unsigned *pred_start;   // Predecessors of local number i are preds[pred_start[i]] to preds[pred_start[i + 1]]
+    unsigned *preds;
+    unsigned *len;          // Of the longest path from each
+    unsigned *next;         // On that path, or UINT_MAX
+    u8 *mark;               // MARK_ bits, while a loop is worked on
+    unsigned *work;
+} region_t;
+
+enum {
+    MARK_BODY = 1,
+    MARK_LATCH = 2,
+    MARK_FROM_HEADER = 4,
+    MARK_TO_HEADER = 8
+};
+
+typedef struct {
+    unsigned header;        // Local number
+    unsigned size;          // In blocks
+    bool endless;
+} loop_ref_t;
+
+static mcs48_wcet_t analyse(mcs48_cfg_t *cfg, unsigned entry, bool record);
+
+static void alloc_region(region_t *r, unsigned num_blocks, unsigned num_succs) {
+    r->num = 0;
+    r->blocks = (u16 *)malloc(sizeof(u16) * num_blocks);
+    r->local = (unsigned *)malloc(sizeof(unsigned) * num_blocks);
+    r->post_order = (unsigned *)malloc(sizeof(unsigned) * num_blocks);
+    r->last_desc = (unsigned *)malloc(sizeof(unsigned) * num_blocks);
+    r->colour = (u8 *)calloc(num_blocks, 1);
+    r->is_back = (u8 *)calloc(num_succs + 1, 1);
+    r->follow = (bool *)calloc(num_blocks, sizeof(bool));
+    r->is_end = (bool *)calloc(num_blocks, sizeof(bool));
+    r->weight = (unsigned *)calloc(num_blocks, sizeof(unsigned));
+    r->pred_start = (unsigned *)calloc(num_blocks + 1, sizeof(unsigned));
+    r->preds = (unsigned *)malloc(sizeof(unsigned) * (num_succs + 1));
+    r->len = (unsigned *)malloc(sizeof(unsigned) * num_blocks);
+    r->next = (unsigned *)malloc(sizeof(unsigned) * num_blocks);
+    r->mark = (u8 *)calloc(num_blocks, 1);
+    r->work = (unsigned *)malloc(sizeof(unsigned) * num_blocks * 2);
+    for (unsigned i = 0; i < num_blocks; i++)
+        r->local[i] = UINT_MAX;
+}
+
+static void free_region(region_t *r) {
+    free(r->blocks);
+    free(r->local);
+    free(r->post_order);
+    free(r->last_desc);
+    free(r->colour);
+    free(r->is_back);
+    free(r->follow);
+    free(r->is_end);
+    free(r->weight);
+    free(r->pred_start);
+    free(r->preds);
+    free(r->len);
+    free(r->next);
+    free(r->mark);
+    free(r->work);
+}
+
+static mcs48_block_t const *local_block(mcs48_cfg_t const *cfg, region_t const *r, unsigned u) {
+    return &cfg->blocks[r->blocks[u]];
+}
+
+// Adds the callee's WCET to the block that calls it
+static void weigh_call(mcs48_cfg_t *cfg, region_t *r, unsigned u, mcs48_wcet_t *result) {
+    unsigned callee = local_block(cfg, r, u)->callee;
+    if (cfg->wcet_state[callee] == WCET_IN_PROGRESS) {
+        result->recursive = true;
+        return;
+    }
+    if (cfg->wcet_state[callee] == WCET_NOT_DONE)
+        analyse(cfg, callee, false);
+
+    mcs48_wcet_t const *w = &cfg->wcet[callee];
+    r->weight[u] += w->cycles;
+    result->num_unbounded += w->num_unbounded;
+    result->recursive |= w->recursive;
+    result->unknown_end |= w->unknown_end;
+    if (!w->returns) {
+        r->follow[u] = false;
+        r->is_end[u] = true;
+    }
+}
+
+static unsigned add_to_region(region_t *r, unsigned block) {
+    r->local[block] = r->num;
+    r->blocks[r->num] = (u16)block;
+    r->colour[r->num] = 1;
+    return r->num++;
+}
+
+// Finds and weighs the blocks of the region, and marks the back edges
+static void find_region(mcs48_cfg_t *cfg, region_t *r, unsigned entry, mcs48_wcet_t *result) {
+    unsigned *stack = r->work;      // Pairs of a local number and how many of its successors are done
+    unsigned stack_size = 0;
+    unsigned num_done = 0;
+
+    stack[0] = add_to_region(r, entry);
+    stack[1] = 0;
+    stack_size = 1;
+    while (stack_size) {
+        unsigned *top = &stack[(stack_size - 1) * 2];
+        unsigned u = top[0];
+        mcs48_block_t const *b = local_block(cfg, r, u);
+
+        if (top[1] == 0) {
+            r->weight[u] = b->cycles;
+            r->follow[u] = true;
+            r->is_end[u] = b->returns || b->unknown_end;
+            result->returns |= b->returns;
+            result->unknown_end |= b->unknown_end;
+            if (b->callee != MCS48_CFG_NO_BLOCK)
+                weigh_call(cfg, r, u, result);
+        }
+
+        if (!r->follow[u] || top[1] >= b->num_succs) {
+            r->last_desc[u] = r->num - 1;
+            r->colour[u] = 2;
+            r->post_order[num_done++] = u;
+            stack_size--;
+            continue;
+        }
+
+        unsigned succ = b->first_succ + top[1]++;
+        unsigned v = cfg->succs[succ];
+        if (r->local[v] == UINT_MAX) {
+            stack[stack_size * 2] = add_to_region(r, v);
+            stack[stack_size * 2 + 1] = 0;
+            stack_size++;
+        }
+        else if (r->colour[r->local[v]] == 1) {
+            r->is_back[succ] = 1;
+        }
+    }
+
+    // Predecessors, for finding the bodies of loops
+    for (unsigned u = 0; u < r->num; u++) {
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned i = 0; r->follow[u] && i < b->num_succs; i++)
+            r->pred_start[r->local[cfg->succs[b->first_succ + i]] + 1]++;
+    }
+    for (unsigned u = 0; u < r->num; u++)
+        r->pred_start[u + 1] += r->pred_start[u];
+    unsigned *fill = r->work;
+    memcpy(fill, r->pred_start, sizeof(unsigned) * r->num);
+    for (unsigned u = 0; u < r->num; u++) {
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned i = 0; r->follow[u] && i < b->num_succs; i++)
+            r->preds[fill[r->local[cfg->succs[b->first_succ + i]]]++] = u;
+    }
+}
+
+static bool is_under(region_t const *r, unsigned u, unsigned ancestor) {
+    return u >= ancestor && u <= r->last_desc[ancestor];
+}
+
+// Marks the body of the loop headed by h, and its latches, the blocks that
+// branch back to h. The body is the blocks under h in the search tree that
+// can reach a latch without going through h. Returns its size.
+static unsigned mark_loop(mcs48_cfg_t const *cfg, region_t *r, unsigned h) {
+    memset(r->mark, 0, r->num);
+    unsigned *stack = r->work;
+    unsigned stack_size = 0;
+    r->mark[h] = MARK_BODY;
+    unsigned size = 1;
+
+    for (unsigned i = r->pred_start[h]; i < r->pred_start[h + 1]; i++) {
+        unsigned u = r->preds[i];
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        bool is_latch = false;
+        for (unsigned j = 0; j < b->num_succs; j++)
+            is_latch |= r->is_back[b->first_succ + j] && r->local[cfg->succs[b->first_succ + j]] == h;
+        if (!is_latch)
+            continue;
+        if (!r->mark[u]) {
+            stack[stack_size++] = u;
+            size++;
+        }
+        r->mark[u] |= MARK_BODY | MARK_LATCH;
+    }
+
+    while (stack_size) {
+        unsigned u = stack[--stack_size];
+        for (unsigned i = r->pred_start[u]; i < r->pred_start[u + 1]; i++) {
+            unsigned p = r->preds[i];
+            if (r->mark[p] || !is_under(r, p, h))
+                continue;
+            r->mark[p] = MARK_BODY;
+            stack[stack_size++] = p;
+            size++;
+        }
+    }
+    return size;
+}
+
+// Whether the loop headed by h can't be left. That is when nothing in the
+// blocks that h can reach and be reached from, with its inner and outer
+// loops, goes anywhere else or ends the path.
+static bool is_endless(mcs48_cfg_t const *cfg, region_t *r, unsigned h) {
+    memset(r->mark, 0, r->num);
+    unsigned *stack = r->work;
+    unsigned stack_size = 0;
+    r->mark[h] = MARK_FROM_HEADER | MARK_TO_HEADER;
+    stack[stack_size++] = h;
+    while (stack_size) {
+        unsigned u = stack[--stack_size];
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned i = 0; r->follow[u] && i < b->num_succs; i++) {
+            unsigned v = r->local[cfg->succs[b->first_succ + i]];
+            if (!(r->mark[v] & MARK_FROM_HEADER)) {
+                r->mark[v] |= MARK_FROM_HEADER;
+                stack[stack_size++] = v;
+            }
+        }
+    }
+    stack[stack_size++] = h;
+    while (stack_size) {
+        unsigned u = stack[--stack_size];
+        for (unsigned i = r->pred_start[u]; i < r->pred_start[u + 1]; i++) {
+            unsigned p = r->preds[i];
+            if (!(r->mark[p] & MARK_TO_HEADER)) {
+                r->mark[p] |= MARK_TO_HEADER;
+                stack[stack_size++] = p;
+            }
+        }
+    }
+
+    u8 const in_cycle = MARK_FROM_HEADER | MARK_TO_HEADER;
+    for (unsigned u = 0; u < r->num; u++) {
+        if ((r->mark[u] & in_cycle) != in_cycle)
+            continue;
+        if (r->is_end[u])
+            return false;
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned i = 0; r->follow[u] && i < b->num_succs; i++) {
+            if ((r->mark[r->local[cfg->succs[b->first_succ + i]]] & in_cycle) != in_cycle)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Longest path from the local block from, through the blocks that have all
+// of the mark bits in within (or all blocks, if within is 0), to one that
+// has the mark bits in end or, if end is 0, is_end. Back edges aren't taken.
+static unsigned longest_path(mcs48_cfg_t const *cfg, region_t *r, unsigned from, u8 within, u8 end) {
+    for (unsigned i = 0; i < r->num; i++) {
+        unsigned u = r->post_order[i];
+        r->len[u] = NO_PATH;
+        r->next[u] = UINT_MAX;
+        if ((r->mark[u] & within) != within)
+            continue;
+
+        bool can_end = end ? (r->mark[u] & end) != 0 : r->is_end[u];
+        unsigned best = can_end ? 0 : (unsigned)NO_PATH;
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned j = 0; r->follow[u] && j < b->num_succs; j++) {
+            unsigned v = r->local[cfg->succs[b->first_succ + j]];
+            if (r->is_back[b->first_succ + j] || r->len[v] == NO_PATH)
+                continue;
+            if (best == NO_PATH || r->len[v] > best) {
+                best = r->len[v];
+                r->next[u] = v;
+            }
+        }
+        if (best != NO_PATH)
+            r->len[u] = best + r->weight[u];
+        if (u == from)
+            break;
+    }
+    return r->len[from];
+}
+
+static bool writes_reg(unsigned opcode, unsigned reg) {
+    return opcode == OP_MOV_R0_N + reg || opcode == OP_MOV_R0_A + reg ||
+        opcode == OP_XCH_A_R0 + reg || opcode == OP_INC_R0 + reg ||
+        opcode == OP_DEC_R0 + reg || opcode == OP_DJNZ_R0 + reg ||
+        opcode == OP_SEL_RB0 || opcode == OP_SEL_RB1;
+}
+
+enum { WRITE_NONE = -1, WRITE_UNKNOWN = -2 };
+
+// The value that the block leaves in register reg: the n of a mov rN,#n,
+// WRITE_UNKNOWN if something else writes it last, or WRITE_NONE if nothing
+// does
+static int last_write(mcs48_cfg_t const *cfg, mcs48_block_t const *b, unsigned reg) {
+    mcs48_disasm_t const *d = cfg->d;
+    int value = WRITE_NONE;
+    unsigned addr = b->start;
+    for (unsigned i = 0; i < b->num_insns; i++) {
+        unsigned opcode = d->rom[addr];
+        if (writes_reg(opcode, reg))
+            value = (opcode == OP_MOV_R0_N + reg) ? (int)d->rom[add_to_pc(addr, 1)] : (int)WRITE_UNKNOWN;
+        addr = next_insn(cfg, addr);
+    }
+    return value;
+}
+
+// The count of the djnz loop headed by h, or 0 if it isn't one or something
+// else in it writes the register. It is the biggest n of the mov rN,#n
+// instructions that can set the register for the loop, or 256, the most that
+// a djnz can count, if anything else can. mark_loop() must have marked it.
+static unsigned infer_count(mcs48_cfg_t const *cfg, region_t *r, unsigned h) {
+    mcs48_disasm_t const *d = cfg->d;
+    unsigned header_addr = local_block(cfg, r, h)->start;
+    int reg = -1;
+    for (unsigned u = 0; u < r->num; u++) {
+        if (!(r->mark[u] & MARK_LATCH))
+            continue;
+        unsigned last = local_block(cfg, r, u)->last;
+        unsigned opcode = d->rom[last];
+        if (!is_djnz(opcode) || mcs48_disasm_branch_target(d, last) != (int)header_addr)
+            return 0;
+        if (reg >= 0 && (unsigned)reg != (opcode & 7))
+            return 0;
+        reg = opcode & 7;
+    }
+    if (reg < 0)
+        return 0;
+
+    // Nothing in the body but the djnz may write the register
+    for (unsigned u = 0; u < r->num; u++) {
+        if (!(r->mark[u] & MARK_BODY))
+            continue;
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        unsigned addr = b->start;
+        for (unsigned i = 0; i < b->num_insns; i++) {
+            bool is_the_djnz = (r->mark[u] & MARK_LATCH) && addr == b->last;
+            if (writes_reg(d->rom[addr], reg) && !is_the_djnz)
+                return 0;
+            addr = next_insn(cfg, addr);
+        }
+    }
+
+    // Search back from the loop for the writes that can reach it. Getting
+    // back into the loop means that the register can be what the last time
+    // round left, so the loop can run 256 times.
+    unsigned *stack = r->work;
+    unsigned stack_size = 0;
+    unsigned count = 0;
+    for (unsigned i = r->pred_start[h]; i < r->pred_start[h + 1]; i++) {
+        unsigned p = r->preds[i];
+        if (!r->mark[p]) {
+            r->mark[p] = MARK_FROM_HEADER;
+            stack[stack_size++] = p;
+        }
+    }
+    while (stack_size && count < 256) {
+        unsigned p = stack[--stack_size];
+        int value = last_write(cfg, local_block(cfg, r, p), (unsigned)reg);
+        if (value == WRITE_NONE && p != 0) {
+            for (unsigned i = r->pred_start[p]; i < r->pred_start[p + 1]; i++) {
+                unsigned q = r->preds[i];
+                if (r->mark[q] & MARK_BODY)
+                    count = 256;
+                else if (!r->mark[q]) {
+                    r->mark[q] = MARK_FROM_HEADER;
+                    stack[stack_size++] = q;
+                }
+            }
+        }
+        else {
+            // Set by something other than a mov rN,#n, or before the subroutine
+            unsigned n = (value < 0 || value == 0) ? 256 : (unsigned)value;
+            if (n > count)
+                count = n;
+        }
+    }
+
+    for (unsigned u = 0; u < r->num; u++)
+        r->mark[u] &= (u8)~MARK_FROM_HEADER;
+    return count ? count : 256;
+}
+
+static unsigned given_count(mcs48_cfg_t const *cfg, unsigned header_addr) {
+    for (unsigned i = 0; i < cfg->num_loop_bounds; i++) {
+        if (cfg->loop_bounds[i].header == header_addr)
+            return cfg->loop_bounds[i].count;
+    }
+    return 0;
+}
+
+static int compare_loops(void const *a, void const *b) {
+    loop_ref_t const *la = (loop_ref_t const *)a;
+    loop_ref_t const *lb = (loop_ref_t const *)b;
+    if (la->size != lb->size)
+        return la->size < lb->size ? -1 : 1;
+    return la->header < lb->header ? 1 : -1;
+}
+
+// Weighs each loop header with the extra iterations of its loop, from the
+// innermost loops out, so that an outer loop's iterations count the inner
+// loops in full
+static void weigh_loops(mcs48_cfg_t *cfg, region_t *r, mcs48_wcet_t *result, bool record) {
+    loop_ref_t *loops = (loop_ref_t *)malloc(sizeof(loop_ref_t) * r->num);
+    unsigned num_loops = 0;
+    for (unsigned u = 0; u < r->num; u++) {
+        mcs48_block_t const *b = local_block(cfg, r, u);
+        for (unsigned i = 0; r->follow[u] && i < b->num_succs; i++) {
+            if (!r->is_back[b->first_succ + i])
+                continue;
+            unsigned h = r->local[cfg->succs[b->first_succ + i]];
+            bool known = false;
+            for (unsigned j = 0; j < num_loops; j++)
+                known |= loops[j].header == h;
+            if (!known) {
+                loops[num_loops].header = h;
+                loops[num_loops].size = 0;
+                num_loops++;
+            }
+        }
+    }
+    // Before any latches are made ends
+    for (unsigned i = 0; i < num_loops; i++) {
+        loops[i].endless = is_endless(cfg, r, loops[i].header);
+        loops[i].size = mark_loop(cfg, r, loops[i].header);
+    }
+    qsort(loops, num_loops, sizeof(loop_ref_t), compare_loops);
+
+    for (unsigned i = 0; i < num_loops; i++) {
+        unsigned h = loops[i].header;
+        mark_loop(cfg, r, h);
+
+        mcs48_loop_t loop;
+        memset(&loop, 0, sizeof(loop));
+        loop.header = local_block(cfg, r, h)->start;
+        loop.endless = loops[i].endless;
+        for (unsigned u = 0; u < r->num; u++) {
+            if (r->mark[u] & MARK_LATCH)
+                loop.latch = local_block(cfg, r, u)->last;
+        }
+
+        loop.iteration_cycles = longest_path(cfg, r, h, MARK_BODY, MARK_LATCH);
+        if (loop.iteration_cycles == NO_PATH)
+            loop.iteration_cycles = 0;
+        if (loop.endless) {
+            // The path goes round once and stops
+            for (unsigned u = 0; u < r->num; u++) {
+                if (r->mark[u] & MARK_LATCH)
+                    r->is_end[u] = true;
+            }
+        }
+        else {
+            loop.count = given_count(cfg, loop.header);
+            if (!loop.count) {
+                loop.count = infer_count(cfg, r, h);
+                loop.inferred = loop.count != 0;
+            }
+            if (loop.count)
+                r->weight[h] += (loop.count - 1) * loop.iteration_cycles;
+            else
+                result->num_unbounded++;
+        }
+
+        result->num_loops++;
+        if (record && cfg->num_loops < MCS48_CFG_MAX_BLOCKS)
+            cfg->loops[cfg->num_loops++] = loop;
+    }
+    memset(r->mark, 0, r->num);
+    free(loops);
+}
+
+static mcs48_wcet_t analyse(mcs48_cfg_t *cfg, unsigned entry, bool record) {
+    mcs48_wcet_t result;
+    memset(&result, 0, sizeof(result));
+    cfg->wcet_state[entry] = WCET_IN_PROGRESS;
+    if (record) {
+        cfg->num_loops = 0;
+        memset(cfg->on_worst_path, 0, sizeof(cfg->on_worst_path));
+    }
+
+    region_t r;
+    alloc_region(&r, cfg->num_blocks, cfg->num_succs);
+    find_region(cfg, &r, entry, &result);
+    weigh_loops(cfg, &r, &result, record);
+
+    result.cycles = longest_path(cfg, &r, 0, 0, 0);
+    if (result.cycles == NO_PATH) {
+        result.cycles = 0;
+        result.unknown_end = true;
+    }
+    if (record) {
+        for (unsigned u = 0; u != UINT_MAX && result.cycles; u = r.next[u])
+            cfg->on_worst_path[r.blocks[u]] = true;
+    }
+    free_region(&r);
+
+    cfg->wcet[entry] = result;
+    cfg->wcet_state[entry] = WCET_DONE;
+    return result;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void mcs48_cfg_init(mcs48_cfg_t *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    memset(cfg->block_at, 0xff, sizeof(cfg->block_at));
+}
+
+bool mcs48_cfg_add_edge(mcs48_cfg_t *cfg, unsigned from, unsigned to) {
+    if (cfg->num_extra_edges >= MCS48_CFG_MAX_EXTRA_EDGES)
+        return false;
+    mcs48_cfg_edge_t *edge = &cfg->extra_edges[cfg->num_extra_edges++];
+    edge->from = (u16)(from & 0xfff);
+    edge->to = (u16)(to & 0xfff);
+    return true;
+}
+
+bool mcs48_cfg_set_loop_bound(mcs48_cfg_t *cfg, unsigned header, unsigned count) {
+    if (cfg->num_loop_bounds >= MCS48_CFG_MAX_LOOP_BOUNDS)
+        return false;
+    mcs48_loop_bound_t *bound = &cfg->loop_bounds[cfg->num_loop_bounds++];
+    bound->header = (u16)(header & 0xfff);
+    bound->count = (u16)count;
+    // The WCETs so far didn't know about it
+    memset(cfg->wcet_state, WCET_NOT_DONE, sizeof(cfg->wcet_state));
+    return true;
+}
+
+void mcs48_cfg_build(mcs48_cfg_t *cfg, mcs48_disasm_t const *d) {
+    cfg->d = d;
+    cfg->num_blocks = 0;
+    cfg->num_succs = 0;
+    memset(cfg->block_at, 0xff, sizeof(cfg->block_at));
+    memset(cfg->wcet_state, WCET_NOT_DONE, sizeof(cfg->wcet_state));
+
+    bool *leader = (bool *)calloc(MCS48_DISASM_IMAGE_SIZE, sizeof(bool));
+    find_leaders(cfg, leader);
+    for (unsigned addr = 0; addr < MCS48_DISASM_IMAGE_SIZE; addr++) {
+        if ((d->flags[addr] & MCS48_DISASM_INSN) && leader[addr])
+            make_block(cfg, addr, leader);
+    }
+    free(leader);
+
+    for (unsigned i = 0; i < cfg->num_blocks; i++)
+        link_block(cfg, &cfg->blocks[i]);
+}
+
+unsigned mcs48_cfg_block_at(mcs48_cfg_t const *cfg, unsigned addr) {
+    return cfg->block_at[addr & 0xfff];
+}
+
+mcs48_wcet_t mcs48_cfg_wcet(mcs48_cfg_t *cfg, unsigned addr) {
+    unsigned block = mcs48_cfg_block_at(cfg, addr);
+    if (block == MCS48_CFG_NO_BLOCK) {
+        mcs48_wcet_t none;
+        memset(&none, 0, sizeof(none));
+        none.unknown_end = true;
+        return none;
+    }
+    return analyse(cfg, block, true);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "mcs48_disasm.h"
+#include "types.h"
+
+
+// The control flow graph of the code that mcs48_disasm found, and the worst
+// case execution time (WCET) of the subroutines and handlers in it, in
+// machine cycles. Each instruction costs what g_mcs48_isa says it does,
+// which is what cpu.c burns for it.
+//
+// A basic block ends at a branch, jump, call, ret, retr or jmpp @a, or just
+// before an instruction that something branches to. Each call is the last
+// instruction of its block, and the block costs the callee's WCET on top of
+// its own cycles. A jmpp @a goes to every entry of its jump table.
+//
+// The WCET of a subroutine is the longest path from its entry to a ret or
+// retr. Loops are found from the back edges of a depth first search. Each
+// one costs its longest iteration times its bound, less the one iteration
+// that the path already counts. A djnz loop runs at most 256 times, or n
+// times if a mov rN,#n comes just before it, as long as nothing else in the
+// loop writes rN. Calls in the loop are taken not to. Other bounds have to be
+// given with mcs48_cfg_set_loop_bound(), and loops without one are counted
+// as running once. A loop that can't get to a ret or retr, like the idle
+// loop, ends the path.
+//
+// A ret can also be used as a jump to an address pushed by hand. Its targets
+// can be given with mcs48_cfg_add_edge(), which makes it a jump.
+
+enum {
+    MCS48_CFG_MAX_BLOCKS = MCS48_DISASM_IMAGE_SIZE,
+    MCS48_CFG_MAX_SUCCS = 4 * MCS48_DISASM_IMAGE_SIZE,
+    MCS48_CFG_MAX_EXTRA_EDGES = 64,
+    MCS48_CFG_MAX_LOOP_BOUNDS = 64,
+    MCS48_CFG_NO_BLOCK = 0xffff
+};
+
+typedef struct {
+    u16 start;              // Address of the first instruction
+    u16 last;               // Address of the last instruction
+    u16 num_insns;
+    u16 cycles;             // Of its own instructions, without the callee's
+    u16 callee;             // Block that the call at the end goes to, or MCS48_CFG_NO_BLOCK
+    u16 first_succ;         // Index into succs
+    u16 num_succs;
+    bool returns;           // Ends with a ret or retr that has no extra edges
+    bool unknown_end;       // Ends with a jmpp @a whose table wasn't found, or an unused opcode
+} mcs48_block_t;
+
+typedef struct {
+    u16 from;               // Address of the instruction
+    u16 to;
+} mcs48_cfg_edge_t;
+
+typedef struct {
+    u16 header;             // Address of the first instruction of the loop
+    u16 count;              // How many times the body runs each time the loop is entered
+} mcs48_loop_bound_t;
+
+// A loop that mcs48_cfg_wcet() found
+typedef struct {
+    u16 header;             // Address
+    u16 latch;              // Address of the last instruction of the branch back
+    unsigned count;         // Bound that was used, 0 if there wasn't one
+    unsigned iteration_cycles;  // Longest pass through the body, with inner loops
+    bool inferred;          // The count came from the djnz that closes the loop
+    bool endless;           // No way out, so it ends the path
+} mcs48_loop_t;
+
+typedef struct {
+    unsigned cycles;
+    unsigned num_loops;
+    unsigned num_unbounded; // Loops counted as running once, as they had no bound
+    bool returns;           // Some path reaches a ret or retr. If none does, a call to it ends the path.
+    bool recursive;         // Calls itself, directly or not. The inner call is counted as free.
+    bool unknown_end;       // Can reach a block with unknown_end
+} mcs48_wcet_t;
+
+typedef struct {
+    mcs48_disasm_t const *d;
+
+    mcs48_block_t blocks[MCS48_CFG_MAX_BLOCKS];
+    unsigned num_blocks;
+    u16 block_at[MCS48_DISASM_IMAGE_SIZE];  // Of each block start, else MCS48_CFG_NO_BLOCK
+    u16 succs[MCS48_CFG_MAX_SUCCS];
+    unsigned num_succs;
+
+    mcs48_cfg_edge_t extra_edges[MCS48_CFG_MAX_EXTRA_EDGES];
+    unsigned num_extra_edges;
+    mcs48_loop_bound_t loop_bounds[MCS48_CFG_MAX_LOOP_BOUNDS];
+    unsigned num_loop_bounds;
+
+    // Of each block, as the entry of a subroutine or handler
+    mcs48_wcet_t wcet[MCS48_CFG_MAX_BLOCKS];
+    u8 wcet_state[MCS48_CFG_MAX_BLOCKS];
+
+    // Of the last mcs48_cfg_wcet() at the top level. Each block on the worst
+    // path has on_worst_path set.
+    mcs48_loop_t loops[MCS48_CFG_MAX_BLOCKS];
+    unsigned num_loops;
+    bool on_worst_path[MCS48_CFG_MAX_BLOCKS];
+} mcs48_cfg_t;
+
+
+void mcs48_cfg_init(mcs48_cfg_t *cfg);
+
+// Makes the instruction at from go to to. Must come before mcs48_cfg_build().
+// Returns false if there are too many.
+bool mcs48_cfg_add_edge(mcs48_cfg_t *cfg, unsigned from, unsigned to);
+
+// Says how many times the loop that starts at header runs its body each time
+// it is entered. Must come before mcs48_cfg_wcet(). Returns false if there
+// are too many.
+bool mcs48_cfg_set_loop_bound(mcs48_cfg_t *cfg, unsigned header, unsigned count);
+
+// Splits the code that d found into blocks. d must outlive cfg.
+void mcs48_cfg_build(mcs48_cfg_t *cfg, mcs48_disasm_t const *d);
+
+// Returns the block that starts at addr, or MCS48_CFG_NO_BLOCK
+unsigned mcs48_cfg_block_at(mcs48_cfg_t const *cfg, unsigned addr);
+
+// Works out the WCET of the code from addr to a ret or retr, or into an
+// endless loop, in cycles. addr must be the start of a block. Fills in loops
+// and on_worst_path for it.
+mcs48_wcet_t mcs48_cfg_wcet(mcs48_cfg_t *cfg, unsigned addr);
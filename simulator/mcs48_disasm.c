@@ -0,0 +1,395 @@
+// Own header
+#include "mcs48_disasm.h"
+
+// This project's headers
+#include "mcs48_isa.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+// The states that code is traced in. Each address is traced at most once in
+// each, as a bit in visited.
+enum {
+    STATE_BANK0,
+    STATE_BANK1,
+    STATE_INTERRUPT,
+    NUM_STATES
+};
+
+enum {
+    OP_ANL_A_N = 0x53,
+    OP_RET = 0x83,
+    OP_RETR = 0x93,
+    OP_JMPP = 0xB3,
+    OP_SEL_MB0 = 0xE5,
+    OP_SEL_MB1 = 0xF5
+};
+
+// The PC only counts through the bottom 11 bits
+static unsigned add_to_pc(unsigned pc, unsigned n) {
+    return ((pc + n) & 0x7ff) | (pc & 0x800);
+}
+
+static bool is_jmp(unsigned opcode) { return (opcode & 0x1f) == 0x04; }
+static bool is_call(unsigned opcode) { return (opcode & 0x1f) == 0x14; }
+
+// Where the instruction at addr branches to, in the given state, or -1
+static int get_target(u8 const *rom, unsigned addr, int state) {
+    unsigned opcode = rom[addr];
+    unsigned next_pc = add_to_pc(addr, 1);
+    unsigned operand = rom[next_pc];
+    switch (g_mcs48_isa[opcode].operand_kind) {
+    case MCS48_OPND_PAGE:
+        return (next_pc & 0xf00) | operand;
+    case MCS48_OPND_LONG:
+        return ((opcode & 0xe0) << 3) | operand | (state == STATE_BANK1 ? 0x800 : 0);
+    }
+    return -1;
+}
+
+
+// ****************************************************************************
+// Tracing
+// ****************************************************************************
+
+typedef struct {
+    mcs48_disasm_t *d;
+    u16 *stack;             // Each is an address, with the state in the top bits
+    unsigned stack_size;
+} tracer_t;
+
+static void push(tracer_t *t, unsigned addr, int state) {
+    u8 bit = (u8)(1 << state);
+    if (t->d->visited[addr] & bit)
+        return;
+    t->d->visited[addr] |= bit;
+    t->stack[t->stack_size++] = (u16)(addr | (state << 12));
+}
+
+// Reads the jump table of the jmpp @a at addr, and traces each of its targets
+static void trace_jump_table(tracer_t *t, unsigned addr, int state) {
+    mcs48_disasm_t *d = t->d;
+    mcs48_jump_table_t table;
+    memset(&table, 0, sizeof(table));
+    table.jmpp_addr = (u16)addr;
+    table.first = (u16)(add_to_pc(addr, 1) & 0xf00);
+
+    unsigned anl_addr = (addr - 2) & 0xfff;
+    if ((d->flags[anl_addr] & MCS48_DISASM_INSN) && d->rom[anl_addr] == OP_ANL_A_N) {
+        table.mask = d->rom[anl_addr + 1];
+        table.num_entries = table.mask + 1;
+        for (unsigned i = 0; i <= table.mask; i++) {
+            if ((i & table.mask) != i)
+                continue;
+            unsigned entry = table.first | i;
+            d->flags[entry] |= MCS48_DISASM_TABLE;
+            push(t, table.first | d->rom[entry], state);
+        }
+    }
+
+    for (unsigned i = 0; i < d->num_tables; i++) {
+        if (d->tables[i].jmpp_addr == addr)
+            return;
+    }
+    if (d->num_tables < MCS48_DISASM_MAX_TABLES)
+        d->tables[d->num_tables++] = table;
+}
+
+// Follows the code from addr until it ends or reaches code already traced in
+// the same state. Pushes the branches it passes.
+static void trace_flow(tracer_t *t, unsigned addr, int state) {
+    mcs48_disasm_t *d = t->d;
+    while (true) {
+        unsigned opcode = d->rom[addr];
+        mcs48_isa_entry_t const *entry = &g_mcs48_isa[opcode];
+        // An instruction can't run on past the end of its bank
+        if (!entry->mnemonic || (addr & 0x7ff) + entry->length > 0x800) {
+            d->num_illegal++;
+            return;
+        }
+
+        if (!(d->flags[addr] & MCS48_DISASM_INSN))
+            d->num_insns++;
+        d->flags[addr] |= MCS48_DISASM_INSN | (state == STATE_BANK1 ? MCS48_DISASM_IN_BANK1 : MCS48_DISASM_IN_BANK0);
+        for (unsigned i = 0; i < entry->length; i++)
+            d->flags[add_to_pc(addr, i)] |= MCS48_DISASM_CODE;
+
+        int target = get_target(d->rom, addr, state);
+        if (target >= 0) {
+            if (is_call(opcode))
+                d->flags[target] |= MCS48_DISASM_CALLED;
+            push(t, target, state);
+        }
+
+        if (is_jmp(opcode) || opcode == OP_RET || opcode == OP_RETR || opcode == OP_JMPP) {
+            d->flags[addr] |= MCS48_DISASM_FLOW_ENDS;
+            if (opcode == OP_JMPP)
+                trace_jump_table(t, addr, state);
+            return;
+        }
+
+        if (state != STATE_INTERRUPT) {
+            if (opcode == OP_SEL_MB0) state = STATE_BANK0;
+            if (opcode == OP_SEL_MB1) state = STATE_BANK1;
+        }
+
+        addr = add_to_pc(addr, entry->length);
+        u8 bit = (u8)(1 << state);
+        if (d->visited[addr] & bit)
+            return;
+        d->visited[addr] |= bit;
+    }
+}
+
+
+// ****************************************************************************
+// Listing
+// ****************************************************************************
+
+enum { MAX_DB_PER_LINE = 8, MIN_SKIPPED_ZEROS = 16 };
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;             // Of the whole listing, even the part that didn't fit
+    unsigned num_newlines;  // At the end of it
+} writer_t;
+
+// The listing is made on every round trip check, so it is formatted by hand.
+// printf would be most of the time that the check takes.
+static void append_char(writer_t *w, char c) {
+    if (w->len + 1 < w->size)
+        w->buf[w->len] = c;
+    w->len++;
+    w->num_newlines = (c == '\n') ? w->num_newlines + 1 : 0;
+}
+
+// Ends the line, and leaves a blank one, unless there is one already
+static void append_blank_line(writer_t *w) {
+    while (w->num_newlines < 2)
+        append_char(w, '\n');
+}
+
+static void append(writer_t *w, char const *s) {
+    while (*s)
+        append_char(w, *s++);
+}
+
+// Line addresses and .db values are in lower case, like the annotated
+// listing, and operands in upper case
+static void append_hex(writer_t *w, unsigned val, int num_digits, bool upper_case) {
+    char const *digits = upper_case ? "0123456789ABCDEF" : "0123456789abcdef";
+    for (int i = num_digits - 1; i >= 0; i--)
+        append_char(w, digits[(val >> (i * 4)) & 0xf]);
+}
+
+static void append_line_addr(writer_t *w, unsigned addr) {
+    append(w, "0x");
+    append_hex(w, addr, 3, false);
+    append_char(w, ' ');
+}
+
+static void append_db(writer_t *w, u8 val) {
+    append(w, "0x");
+    append_hex(w, val, 2, false);
+}
+
+static void terminate(writer_t *w) {
+    if (w->size)
+        w->buf[w->len < w->size ? w->len : w->size - 1] = '\0';
+}
+
+static unsigned count_zeros(mcs48_disasm_t const *d, unsigned addr, unsigned end) {
+    unsigned n = 0;
+    while (addr + n < end && d->rom[addr + n] == 0)
+        n++;
+    return n;
+}
+
+// Lists the bytes from addr to end as .db lines. Long runs of zeros are left
+// out, as the assembler fills the gaps between lines with zeros.
+static void write_data(writer_t *w, mcs48_disasm_t const *d, unsigned addr, unsigned end) {
+    while (addr < end) {
+        unsigned zeros = count_zeros(d, addr, end);
+        if (zeros >= MIN_SKIPPED_ZEROS) {
+            addr += zeros;
+            continue;
+        }
+
+        append_line_addr(w, addr);
+        append(w, ".db  ");
+        append_db(w, d->rom[addr]);
+        unsigned line_end = addr + 1;
+        while (line_end < end && line_end - addr < MAX_DB_PER_LINE &&
+               count_zeros(d, line_end, end) < MIN_SKIPPED_ZEROS) {
+            append(w, ", ");
+            append_db(w, d->rom[line_end]);
+            line_end++;
+        }
+        append(w, "\n");
+        addr = line_end;
+    }
+}
+
+static mcs48_jump_table_t const *find_table(mcs48_disasm_t const *d, unsigned first_entry) {
+    for (unsigned i = 0; i < d->num_tables; i++) {
+        if (d->tables[i].num_entries && d->tables[i].first == first_entry)
+            return &d->tables[i];
+    }
+    return NULL;
+}
+
+static void write_entry_comment(writer_t *w, mcs48_disasm_t const *d, unsigned addr) {
+    u8 flags = d->flags[addr];
+    char const *what = NULL;
+    if (addr == 0x000) what = "Reset";
+    else if (addr == 0x003 && (flags & MCS48_DISASM_ENTRY)) what = "External interrupt";
+    else if (addr == 0x007 && (flags & MCS48_DISASM_ENTRY)) what = "Timer interrupt";
+    else if (flags & MCS48_DISASM_CALLED) what = "Subroutine";
+    else if (flags & MCS48_DISASM_ENTRY) what = "Entry point";
+    if (what) {
+        append_blank_line(w);
+        append(w, "// ");
+        append(w, what);
+        append(w, "\n");
+    }
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void mcs48_disasm_init(mcs48_disasm_t *d, u8 const *rom, unsigned num_bytes) {
+    memset(d, 0, sizeof(*d));
+    if (num_bytes > MCS48_DISASM_IMAGE_SIZE)
+        num_bytes = MCS48_DISASM_IMAGE_SIZE;
+    memcpy(d->rom, rom, num_bytes);
+}
+
+void mcs48_disasm_trace(mcs48_disasm_t *d, unsigned addr, bool in_interrupt) {
+    addr &= MCS48_DISASM_IMAGE_SIZE - 1;
+    d->flags[addr] |= MCS48_DISASM_ENTRY;
+
+    tracer_t t;
+    t.d = d;
+    t.stack = (u16 *)malloc(sizeof(u16) * MCS48_DISASM_IMAGE_SIZE * NUM_STATES);
+    t.stack_size = 0;
+
+    push(&t, addr, in_interrupt ? STATE_INTERRUPT : (addr & 0x800) ? STATE_BANK1 : STATE_BANK0);
+    while (t.stack_size) {
+        u16 item = t.stack[--t.stack_size];
+        trace_flow(&t, item & 0xfff, item >> 12);
+    }
+
+    free(t.stack);
+}
+
+void mcs48_disasm_trace_vectors(mcs48_disasm_t *d) {
+    mcs48_disasm_trace(d, 0x000, false);
+    mcs48_disasm_trace(d, 0x003, true);
+    mcs48_disasm_trace(d, 0x007, true);
+}
+
+int mcs48_disasm_branch_target(mcs48_disasm_t const *d, unsigned addr) {
+    u8 flags = d->flags[addr];
+    bool bank1 = (flags & MCS48_DISASM_IN_BANK1) &&
+        (!(flags & MCS48_DISASM_IN_BANK0) || (addr & 0x800));
+    return get_target(d->rom, addr, bank1 ? STATE_BANK1 : STATE_BANK0);
+}
+
+void mcs48_disasm_format_insn(mcs48_disasm_t const *d, unsigned addr, char *buf, size_t buf_size) {
+    mcs48_isa_entry_t const *entry = &g_mcs48_isa[d->rom[addr]];
+    writer_t w = { buf, buf_size, 0, 0 };
+    if (!entry->mnemonic) {
+        append(&w, ".db  ");
+        append_db(&w, d->rom[addr]);
+        terminate(&w);
+        return;
+    }
+
+    append(&w, entry->mnemonic);
+    if (entry->operands[0]) {
+        // Operands line up after the mnemonic, as in the annotated listing
+        for (size_t i = strlen(entry->mnemonic); i < 4; i++)
+            append_char(&w, ' ');
+        append_char(&w, ' ');
+    }
+    for (char const *c = entry->operands; *c; ) {
+        if (strncmp(c, "#n", 2) == 0) {
+            append(&w, "#$");
+            append_hex(&w, d->rom[add_to_pc(addr, 1)], 2, true);
+            c += 2;
+        }
+        else if (strncmp(c, "addr", 4) == 0) {
+            append(&w, "$");
+            append_hex(&w, mcs48_disasm_branch_target(d, addr), 4, true);
+            c += 4;
+        }
+        else {
+            append_char(&w, *c);
+            c++;
+        }
+    }
+    terminate(&w);
+}
+
+size_t mcs48_disasm_listing(mcs48_disasm_t const *d, char *buf, size_t buf_size) {
+    writer_t w = { buf, buf_size, 0, 2 };   // No blank line at the top
+
+    unsigned covered_until = 0;     // The end of the last instruction listed
+    unsigned addr = 0;
+    while (addr < MCS48_DISASM_IMAGE_SIZE) {
+        u8 flags = d->flags[addr];
+
+        if (flags & MCS48_DISASM_INSN) {
+            char insn[32];
+            mcs48_disasm_format_insn(d, addr, insn, sizeof(insn));
+            write_entry_comment(&w, d, addr);
+            append_line_addr(&w, addr);
+            append(&w, insn);
+            append(&w, "\n");
+            if (flags & MCS48_DISASM_FLOW_ENDS)
+                append_blank_line(&w);
+            unsigned end = addr + g_mcs48_isa[d->rom[addr]].length;
+            if (end > covered_until)
+                covered_until = end;
+            addr++;
+            continue;
+        }
+
+        // Table entries are listed even where they are also the operand of
+        // an instruction. The assembler allows that, as the bytes agree.
+        if (flags & MCS48_DISASM_TABLE) {
+            mcs48_jump_table_t const *table = find_table(d, addr);
+            if (table) {
+                append(&w, "// Jump table of the jmpp @a at $");
+                append_hex(&w, table->jmpp_addr, 4, true);
+                append(&w, "\n");
+            }
+            append_line_addr(&w, addr);
+            append(&w, ".db  ");
+            append_db(&w, d->rom[addr]);
+            append(&w, "\n");
+            addr++;
+            continue;
+        }
+
+        if (addr < covered_until) {
+            addr++;
+            continue;
+        }
+
+        unsigned end = addr + 1;
+        while (end < MCS48_DISASM_IMAGE_SIZE &&
+               !(d->flags[end] & (MCS48_DISASM_INSN | MCS48_DISASM_TABLE)))
+            end++;
+        write_data(&w, d, addr, end);
+        addr = end;
+    }
+
+    terminate(&w);
+    return w.len;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+
+
+// Disassembles a 4 KB MCS-48 ROM image into a listing, in the style of
+// Annotated_Stock1987_951KLR.asm, that mcs48_asm assembles back into the same
+// bytes. It is built from g_mcs48_isa, like the assembler.
+//
+// Code is told from data by recursive descent: each entry point is followed
+// through jumps, calls and conditional branches until it returns or jumps
+// away. The bank that long jumps and calls go to is tracked through sel mb0
+// and sel mb1, and is bank 0 in the interrupt handlers, as it is on the chip.
+// A jmpp @a reads its target from a table in its own page. When the jmpp
+// comes straight after an anl a,#n, the table is the entries that the mask n
+// lets through, and each is followed. Other tables can't be found.
+//
+// Code that is only reached in ways that can't be followed, like the ret at
+// 0x2b0 to an address pushed by hand, can be given as extra entry points.
+// Everything that isn't reached is listed as .db.
+
+enum {
+    MCS48_DISASM_IMAGE_SIZE = 4096,
+    MCS48_DISASM_MAX_TABLES = 32
+};
+
+// What each byte of the image was found to be. Bytes with none of these are
+// data.
+enum {
+    MCS48_DISASM_CODE = 1,          // Part of an instruction that was reached
+    MCS48_DISASM_INSN = 2,          // The first byte of one
+    MCS48_DISASM_ENTRY = 4,         // An entry point given to mcs48_disasm_trace()
+    MCS48_DISASM_CALLED = 8,        // The target of a call
+    MCS48_DISASM_TABLE = 16,        // Read by a jmpp @a, as a jump table
+    MCS48_DISASM_IN_BANK1 = 32,     // An INSN reached with sel mb1 in force
+    MCS48_DISASM_IN_BANK0 = 64,     // An INSN reached with sel mb0 in force, or in an interrupt handler
+    MCS48_DISASM_FLOW_ENDS = 128    // An INSN that doesn't fall through to the next: jmp, ret, retr or jmpp
+};
+
+typedef struct {
+    u16 jmpp_addr;
+    u16 first;              // Address of entry 0
+    u16 num_entries;        // Counting from first, with gaps where the mask clears bits. 0 if not found.
+    u8 mask;                // Of the anl a,#n before the jmpp
+} mcs48_jump_table_t;
+
+typedef struct {
+    u8 rom[MCS48_DISASM_IMAGE_SIZE];
+    u8 flags[MCS48_DISASM_IMAGE_SIZE];
+    u8 visited[MCS48_DISASM_IMAGE_SIZE];    // Which of the trace states each address has been reached in
+
+    mcs48_jump_table_t tables[MCS48_DISASM_MAX_TABLES];
+    unsigned num_tables;    // Including the ones that weren't found
+
+    unsigned num_insns;
+    unsigned num_illegal;   // Unused opcodes that a trace ran into. They end the trace.
+} mcs48_disasm_t;
+
+
+// Copies the ROM. Shorter ROMs are padded with zeros.
+void mcs48_disasm_init(mcs48_disasm_t *d, u8 const *rom, unsigned num_bytes);
+
+// Follows the code from addr. in_interrupt says whether it runs as an
+// interrupt handler. Outside of one, long jumps and calls are taken to go to
+// the bank that addr is in until a sel mb says otherwise.
+void mcs48_disasm_trace(mcs48_disasm_t *d, unsigned addr, bool in_interrupt);
+
+// Traces from the reset, external interrupt and timer interrupt vectors: 0x000,
+// 0x003 and 0x007.
+void mcs48_disasm_trace_vectors(mcs48_disasm_t *d);
+
+// Returns the address that the instruction at addr branches to. Long jumps
+// and calls are given the bank they were traced in. Returns -1 if it isn't a
+// jump, call or conditional branch.
+int mcs48_disasm_branch_target(mcs48_disasm_t const *d, unsigned addr);
+
+// Writes the instruction at addr, such as "jnz $0A14", to buf.
+void mcs48_disasm_format_insn(mcs48_disasm_t const *d, unsigned addr, char *buf, size_t buf_size);
+
+// Writes the listing of the whole image to buf, NUL-terminated, and returns
+// its length. If buf_size is too small, the listing is cut short, and the
+// return value is the length that it would have had.
+size_t mcs48_disasm_listing(mcs48_disasm_t const *d, char *buf, size_t buf_size);
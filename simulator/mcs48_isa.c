@@ -0,0 +1,13 @@
+// Own header
+#include "mcs48_isa.h"
+
+// Standard headers
+#include <stddef.h>
+
+
+#define ISA_ENTRY(_n, _len, _cycles, _kind, _mnemonic, _operands, _handler) \
+    { _len, _cycles, MCS48_OPND_##_kind, _mnemonic, _operands },
+
+mcs48_isa_entry_t const g_mcs48_isa[256] = {
+    MCS48_ISA_TABLE(ISA_ENTRY)
+};
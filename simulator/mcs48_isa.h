@@ -0,0 +1,299 @@
+#pragma once
+
+#include "types.h"
+
+
+// The MCS-48 instruction set, one entry per opcode, in the same layout as
+// s_mcs48_opcodes in cpu.c. The assembler is built from it, and so are cpu.c's
+// handler, length and cycle tables, so the two can't disagree. The opcodes
+// the simulator doesn't implement (the BUS, port input and expander
+// instructions, and ent0 clk) have the illegal handler, and are listed with
+// their real timings.
+//
+// The operands are written as they are in the annotated listing: lower case,
+// separated by commas. "#n" stands for an immediate byte, "#$xx" in the
+// source, and "addr" for a branch target, "$xxxx". The operand kind says how
+// the value is encoded:
+//   NONE - the instruction is just its opcode
+//   IMM  - the second byte is the immediate value
+//   PAGE - the second byte is the low 8 bits of a target in the same 256-byte
+//          page as itself
+//   LONG - the second byte is the low 8 bits of an 11-bit target, and bits
+//          8 to 10 go in bits 5 to 7 of the opcode
+// Opcodes with a NULL mnemonic aren't instructions.
+
+typedef enum {
+    MCS48_OPND_NONE,
+    MCS48_OPND_IMM,
+    MCS48_OPND_PAGE,
+    MCS48_OPND_LONG
+} mcs48_operand_kind_t;
+
+typedef struct {
+    u8 length;                  // In bytes, including the opcode
+    u8 cycles;
+    u8 operand_kind;            // An mcs48_operand_kind_t
+    char const *mnemonic;
+    char const *operands;
+} mcs48_isa_entry_t;
+
+// X(opcode, length, cycles, operand kind, mnemonic, operands, cpu.c handler)
+#define MCS48_ISA_TABLE(X) \
+    X(0x00, 1, 1, NONE, "nop",   "",        nop)        \
+    X(0x01, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x02, 1, 2, NONE, "outl",  "bus,a",   illegal)    \
+    X(0x03, 2, 2, IMM,  "add",   "a,#n",    add_a_n)    \
+    X(0x04, 2, 2, LONG, "jmp",   "addr",    jmp_0)      \
+    X(0x05, 1, 1, NONE, "en",    "i",       en_i)       \
+    X(0x06, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x07, 1, 1, NONE, "dec",   "a",       dec_a)      \
+    X(0x08, 1, 2, NONE, "ins",   "a,bus",   illegal)    \
+    X(0x09, 1, 2, NONE, "in",    "a,p1",    illegal)    \
+    X(0x0A, 1, 2, NONE, "in",    "a,p2",    illegal)    \
+    X(0x0B, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x0C, 1, 2, NONE, "movd",  "a,p4",    illegal)    \
+    X(0x0D, 1, 2, NONE, "movd",  "a,p5",    illegal)    \
+    X(0x0E, 1, 2, NONE, "movd",  "a,p6",    illegal)    \
+    X(0x0F, 1, 2, NONE, "movd",  "a,p7",    illegal)    \
+    X(0x10, 1, 1, NONE, "inc",   "@r0",     inc_xr0)    \
+    X(0x11, 1, 1, NONE, "inc",   "@r1",     inc_xr1)    \
+    X(0x12, 2, 2, PAGE, "jb0",   "addr",    jb_0)       \
+    X(0x13, 2, 2, IMM,  "addc",  "a,#n",    adc_a_n)    \
+    X(0x14, 2, 2, LONG, "call",  "addr",    call_0)     \
+    X(0x15, 1, 1, NONE, "dis",   "i",       dis_i)      \
+    X(0x16, 2, 2, PAGE, "jtf",   "addr",    jtf)        \
+    X(0x17, 1, 1, NONE, "inc",   "a",       inc_a)      \
+    X(0x18, 1, 1, NONE, "inc",   "r0",      inc_r0)     \
+    X(0x19, 1, 1, NONE, "inc",   "r1",      inc_r1)     \
+    X(0x1A, 1, 1, NONE, "inc",   "r2",      inc_r2)     \
+    X(0x1B, 1, 1, NONE, "inc",   "r3",      inc_r3)     \
+    X(0x1C, 1, 1, NONE, "inc",   "r4",      inc_r4)     \
+    X(0x1D, 1, 1, NONE, "inc",   "r5",      inc_r5)     \
+    X(0x1E, 1, 1, NONE, "inc",   "r6",      inc_r6)     \
+    X(0x1F, 1, 1, NONE, "inc",   "r7",      inc_r7)     \
+    X(0x20, 1, 1, NONE, "xch",   "a,@r0",   xch_a_xr0)  \
+    X(0x21, 1, 1, NONE, "xch",   "a,@r1",   xch_a_xr1)  \
+    X(0x22, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x23, 2, 2, IMM,  "mov",   "a,#n",    mov_a_n)    \
+    X(0x24, 2, 2, LONG, "jmp",   "addr",    jmp_1)      \
+    X(0x25, 1, 1, NONE, "en",    "tcnti",   en_tcnti)   \
+    X(0x26, 2, 2, PAGE, "jnt0",  "addr",    jnt_0)      \
+    X(0x27, 1, 1, NONE, "clr",   "a",       clr_a)      \
+    X(0x28, 1, 1, NONE, "xch",   "a,r0",    xch_a_r0)   \
+    X(0x29, 1, 1, NONE, "xch",   "a,r1",    xch_a_r1)   \
+    X(0x2A, 1, 1, NONE, "xch",   "a,r2",    xch_a_r2)   \
+    X(0x2B, 1, 1, NONE, "xch",   "a,r3",    xch_a_r3)   \
+    X(0x2C, 1, 1, NONE, "xch",   "a,r4",    xch_a_r4)   \
+    X(0x2D, 1, 1, NONE, "xch",   "a,r5",    xch_a_r5)   \
+    X(0x2E, 1, 1, NONE, "xch",   "a,r6",    xch_a_r6)   \
+    X(0x2F, 1, 1, NONE, "xch",   "a,r7",    xch_a_r7)   \
+    X(0x30, 1, 1, NONE, "xchd",  "a,@r0",   xchd_a_xr0) \
+    X(0x31, 1, 1, NONE, "xchd",  "a,@r1",   xchd_a_xr1) \
+    X(0x32, 2, 2, PAGE, "jb1",   "addr",    jb_1)       \
+    X(0x33, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x34, 2, 2, LONG, "call",  "addr",    call_1)     \
+    X(0x35, 1, 1, NONE, "dis",   "tcnti",   dis_tcnti)  \
+    X(0x36, 2, 2, PAGE, "jt0",   "addr",    jt_0)       \
+    X(0x37, 1, 1, NONE, "cpl",   "a",       cpl_a)      \
+    X(0x38, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x39, 1, 2, NONE, "outl",  "p1,a",    illegal)    \
+    X(0x3A, 1, 2, NONE, "outl",  "p2,a",    illegal)    \
+    X(0x3B, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x3C, 1, 2, NONE, "movd",  "p4,a",    illegal)    \
+    X(0x3D, 1, 2, NONE, "movd",  "p5,a",    illegal)    \
+    X(0x3E, 1, 2, NONE, "movd",  "p6,a",    illegal)    \
+    X(0x3F, 1, 2, NONE, "movd",  "p7,a",    illegal)    \
+    X(0x40, 1, 1, NONE, "orl",   "a,@r0",   orl_a_xr0)  \
+    X(0x41, 1, 1, NONE, "orl",   "a,@r1",   orl_a_xr1)  \
+    X(0x42, 1, 1, NONE, "mov",   "a,t",     mov_a_t)    \
+    X(0x43, 2, 2, IMM,  "orl",   "a,#n",    orl_a_n)    \
+    X(0x44, 2, 2, LONG, "jmp",   "addr",    jmp_2)      \
+    X(0x45, 1, 1, NONE, "strt",  "cnt",     strt_cnt)   \
+    X(0x46, 2, 2, PAGE, "jnt1",  "addr",    jnt_1)      \
+    X(0x47, 1, 1, NONE, "swap",  "a",       swap_a)     \
+    X(0x48, 1, 1, NONE, "orl",   "a,r0",    orl_a_r0)   \
+    X(0x49, 1, 1, NONE, "orl",   "a,r1",    orl_a_r1)   \
+    X(0x4A, 1, 1, NONE, "orl",   "a,r2",    orl_a_r2)   \
+    X(0x4B, 1, 1, NONE, "orl",   "a,r3",    orl_a_r3)   \
+    X(0x4C, 1, 1, NONE, "orl",   "a,r4",    orl_a_r4)   \
+    X(0x4D, 1, 1, NONE, "orl",   "a,r5",    orl_a_r5)   \
+    X(0x4E, 1, 1, NONE, "orl",   "a,r6",    orl_a_r6)   \
+    X(0x4F, 1, 1, NONE, "orl",   "a,r7",    orl_a_r7)   \
+    X(0x50, 1, 1, NONE, "anl",   "a,@r0",   anl_a_xr0)  \
+    X(0x51, 1, 1, NONE, "anl",   "a,@r1",   anl_a_xr1)  \
+    X(0x52, 2, 2, PAGE, "jb2",   "addr",    jb_2)       \
+    X(0x53, 2, 2, IMM,  "anl",   "a,#n",    anl_a_n)    \
+    X(0x54, 2, 2, LONG, "call",  "addr",    call_2)     \
+    X(0x55, 1, 1, NONE, "strt",  "t",       strt_t)     \
+    X(0x56, 2, 2, PAGE, "jt1",   "addr",    jt_1)       \
+    X(0x57, 1, 1, NONE, "da",    "a",       da_a)       \
+    X(0x58, 1, 1, NONE, "anl",   "a,r0",    anl_a_r0)   \
+    X(0x59, 1, 1, NONE, "anl",   "a,r1",    anl_a_r1)   \
+    X(0x5A, 1, 1, NONE, "anl",   "a,r2",    anl_a_r2)   \
+    X(0x5B, 1, 1, NONE, "anl",   "a,r3",    anl_a_r3)   \
+    X(0x5C, 1, 1, NONE, "anl",   "a,r4",    anl_a_r4)   \
+    X(0x5D, 1, 1, NONE, "anl",   "a,r5",    anl_a_r5)   \
+    X(0x5E, 1, 1, NONE, "anl",   "a,r6",    anl_a_r6)   \
+    X(0x5F, 1, 1, NONE, "anl",   "a,r7",    anl_a_r7)   \
+    X(0x60, 1, 1, NONE, "add",   "a,@r0",   add_a_xr0)  \
+    X(0x61, 1, 1, NONE, "add",   "a,@r1",   add_a_xr1)  \
+    X(0x62, 1, 1, NONE, "mov",   "t,a",     mov_t_a)    \
+    X(0x63, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x64, 2, 2, LONG, "jmp",   "addr",    jmp_3)      \
+    X(0x65, 1, 1, NONE, "stop",  "tcnt",    stop_tcnt)  \
+    X(0x66, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x67, 1, 1, NONE, "rrc",   "a",       rrc_a)      \
+    X(0x68, 1, 1, NONE, "add",   "a,r0",    add_a_r0)   \
+    X(0x69, 1, 1, NONE, "add",   "a,r1",    add_a_r1)   \
+    X(0x6A, 1, 1, NONE, "add",   "a,r2",    add_a_r2)   \
+    X(0x6B, 1, 1, NONE, "add",   "a,r3",    add_a_r3)   \
+    X(0x6C, 1, 1, NONE, "add",   "a,r4",    add_a_r4)   \
+    X(0x6D, 1, 1, NONE, "add",   "a,r5",    add_a_r5)   \
+    X(0x6E, 1, 1, NONE, "add",   "a,r6",    add_a_r6)   \
+    X(0x6F, 1, 1, NONE, "add",   "a,r7",    add_a_r7)   \
+    X(0x70, 1, 1, NONE, "addc",  "a,@r0",   adc_a_xr0)  \
+    X(0x71, 1, 1, NONE, "addc",  "a,@r1",   adc_a_xr1)  \
+    X(0x72, 2, 2, PAGE, "jb3",   "addr",    jb_3)       \
+    X(0x73, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x74, 2, 2, LONG, "call",  "addr",    call_3)     \
+    X(0x75, 1, 1, NONE, "ent0",  "clk",     illegal)    \
+    X(0x76, 2, 2, PAGE, "jf1",   "addr",    jf1)        \
+    X(0x77, 1, 1, NONE, "rr",    "a",       rr_a)       \
+    X(0x78, 1, 1, NONE, "addc",  "a,r0",    adc_a_r0)   \
+    X(0x79, 1, 1, NONE, "addc",  "a,r1",    adc_a_r1)   \
+    X(0x7A, 1, 1, NONE, "addc",  "a,r2",    adc_a_r2)   \
+    X(0x7B, 1, 1, NONE, "addc",  "a,r3",    adc_a_r3)   \
+    X(0x7C, 1, 1, NONE, "addc",  "a,r4",    adc_a_r4)   \
+    X(0x7D, 1, 1, NONE, "addc",  "a,r5",    adc_a_r5)   \
+    X(0x7E, 1, 1, NONE, "addc",  "a,r6",    adc_a_r6)   \
+    X(0x7F, 1, 1, NONE, "addc",  "a,r7",    adc_a_r7)   \
+    X(0x80, 1, 2, NONE, "movx",  "a,@r0",   movx_a_xr0) \
+    X(0x81, 1, 2, NONE, "movx",  "a,@r1",   movx_a_xr1) \
+    X(0x82, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x83, 1, 2, NONE, "ret",   "",        ret)        \
+    X(0x84, 2, 2, LONG, "jmp",   "addr",    jmp_4)      \
+    X(0x85, 1, 1, NONE, "clr",   "f0",      clr_f0)     \
+    X(0x86, 2, 2, PAGE, "jni",   "addr",    jni)        \
+    X(0x87, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x88, 2, 2, IMM,  "orl",   "bus,#n",  illegal)    \
+    X(0x89, 2, 2, IMM,  "orl",   "p1,#n",   orl_p1_n)   \
+    X(0x8A, 2, 2, IMM,  "orl",   "p2,#n",   orl_p2_n)   \
+    X(0x8B, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x8C, 1, 2, NONE, "orld",  "p4,a",    illegal)    \
+    X(0x8D, 1, 2, NONE, "orld",  "p5,a",    illegal)    \
+    X(0x8E, 1, 2, NONE, "orld",  "p6,a",    illegal)    \
+    X(0x8F, 1, 2, NONE, "orld",  "p7,a",    illegal)    \
+    X(0x90, 1, 2, NONE, "movx",  "@r0,a",   movx_xr0_a) \
+    X(0x91, 1, 2, NONE, "movx",  "@r1,a",   movx_xr1_a) \
+    X(0x92, 2, 2, PAGE, "jb4",   "addr",    jb_4)       \
+    X(0x93, 1, 2, NONE, "retr",  "",        retr)       \
+    X(0x94, 2, 2, LONG, "call",  "addr",    call_4)     \
+    X(0x95, 1, 1, NONE, "cpl",   "f0",      cpl_f0)     \
+    X(0x96, 2, 2, PAGE, "jnz",   "addr",    jnz)        \
+    X(0x97, 1, 1, NONE, "clr",   "c",       clr_c)      \
+    X(0x98, 2, 2, IMM,  "anl",   "bus,#n",  illegal)    \
+    X(0x99, 2, 2, IMM,  "anl",   "p1,#n",   anl_p1_n)   \
+    X(0x9A, 2, 2, IMM,  "anl",   "p2,#n",   anl_p2_n)   \
+    X(0x9B, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0x9C, 1, 2, NONE, "anld",  "p4,a",    illegal)    \
+    X(0x9D, 1, 2, NONE, "anld",  "p5,a",    illegal)    \
+    X(0x9E, 1, 2, NONE, "anld",  "p6,a",    illegal)    \
+    X(0x9F, 1, 2, NONE, "anld",  "p7,a",    illegal)    \
+    X(0xA0, 1, 1, NONE, "mov",   "@r0,a",   mov_xr0_a)  \
+    X(0xA1, 1, 1, NONE, "mov",   "@r1,a",   mov_xr1_a)  \
+    X(0xA2, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xA3, 1, 2, NONE, "movp",  "a,@a",    movp_a_xa)  \
+    X(0xA4, 2, 2, LONG, "jmp",   "addr",    jmp_5)      \
+    X(0xA5, 1, 1, NONE, "clr",   "f1",      clr_f1)     \
+    X(0xA6, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xA7, 1, 1, NONE, "cpl",   "c",       cpl_c)      \
+    X(0xA8, 1, 1, NONE, "mov",   "r0,a",    mov_r0_a)   \
+    X(0xA9, 1, 1, NONE, "mov",   "r1,a",    mov_r1_a)   \
+    X(0xAA, 1, 1, NONE, "mov",   "r2,a",    mov_r2_a)   \
+    X(0xAB, 1, 1, NONE, "mov",   "r3,a",    mov_r3_a)   \
+    X(0xAC, 1, 1, NONE, "mov",   "r4,a",    mov_r4_a)   \
+    X(0xAD, 1, 1, NONE, "mov",   "r5,a",    mov_r5_a)   \
+    X(0xAE, 1, 1, NONE, "mov",   "r6,a",    mov_r6_a)   \
+    X(0xAF, 1, 1, NONE, "mov",   "r7,a",    mov_r7_a)   \
+    X(0xB0, 2, 2, IMM,  "mov",   "@r0,#n",  mov_xr0_n)  \
+    X(0xB1, 2, 2, IMM,  "mov",   "@r1,#n",  mov_xr1_n)  \
+    X(0xB2, 2, 2, PAGE, "jb5",   "addr",    jb_5)       \
+    X(0xB3, 1, 2, NONE, "jmpp",  "@a",      jmpp_xa)    \
+    X(0xB4, 2, 2, LONG, "call",  "addr",    call_5)     \
+    X(0xB5, 1, 1, NONE, "cpl",   "f1",      cpl_f1)     \
+    X(0xB6, 2, 2, PAGE, "jf0",   "addr",    jf0)        \
+    X(0xB7, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xB8, 2, 2, IMM,  "mov",   "r0,#n",   mov_r0_n)   \
+    X(0xB9, 2, 2, IMM,  "mov",   "r1,#n",   mov_r1_n)   \
+    X(0xBA, 2, 2, IMM,  "mov",   "r2,#n",   mov_r2_n)   \
+    X(0xBB, 2, 2, IMM,  "mov",   "r3,#n",   mov_r3_n)   \
+    X(0xBC, 2, 2, IMM,  "mov",   "r4,#n",   mov_r4_n)   \
+    X(0xBD, 2, 2, IMM,  "mov",   "r5,#n",   mov_r5_n)   \
+    X(0xBE, 2, 2, IMM,  "mov",   "r6,#n",   mov_r6_n)   \
+    X(0xBF, 2, 2, IMM,  "mov",   "r7,#n",   mov_r7_n)   \
+    X(0xC0, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xC1, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xC2, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xC3, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xC4, 2, 2, LONG, "jmp",   "addr",    jmp_6)      \
+    X(0xC5, 1, 1, NONE, "sel",   "rb0",     sel_rb0)    \
+    X(0xC6, 2, 2, PAGE, "jz",    "addr",    jz)         \
+    X(0xC7, 1, 1, NONE, "mov",   "a,psw",   mov_a_psw)  \
+    X(0xC8, 1, 1, NONE, "dec",   "r0",      dec_r0)     \
+    X(0xC9, 1, 1, NONE, "dec",   "r1",      dec_r1)     \
+    X(0xCA, 1, 1, NONE, "dec",   "r2",      dec_r2)     \
+    X(0xCB, 1, 1, NONE, "dec",   "r3",      dec_r3)     \
+    X(0xCC, 1, 1, NONE, "dec",   "r4",      dec_r4)     \
+    X(0xCD, 1, 1, NONE, "dec",   "r5",      dec_r5)     \
+    X(0xCE, 1, 1, NONE, "dec",   "r6",      dec_r6)     \
+    X(0xCF, 1, 1, NONE, "dec",   "r7",      dec_r7)     \
+    X(0xD0, 1, 1, NONE, "xrl",   "a,@r0",   xrl_a_xr0)  \
+    X(0xD1, 1, 1, NONE, "xrl",   "a,@r1",   xrl_a_xr1)  \
+    X(0xD2, 2, 2, PAGE, "jb6",   "addr",    jb_6)       \
+    X(0xD3, 2, 2, IMM,  "xrl",   "a,#n",    xrl_a_n)    \
+    X(0xD4, 2, 2, LONG, "call",  "addr",    call_6)     \
+    X(0xD5, 1, 1, NONE, "sel",   "rb1",     sel_rb1)    \
+    X(0xD6, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xD7, 1, 1, NONE, "mov",   "psw,a",   mov_psw_a)  \
+    X(0xD8, 1, 1, NONE, "xrl",   "a,r0",    xrl_a_r0)   \
+    X(0xD9, 1, 1, NONE, "xrl",   "a,r1",    xrl_a_r1)   \
+    X(0xDA, 1, 1, NONE, "xrl",   "a,r2",    xrl_a_r2)   \
+    X(0xDB, 1, 1, NONE, "xrl",   "a,r3",    xrl_a_r3)   \
+    X(0xDC, 1, 1, NONE, "xrl",   "a,r4",    xrl_a_r4)   \
+    X(0xDD, 1, 1, NONE, "xrl",   "a,r5",    xrl_a_r5)   \
+    X(0xDE, 1, 1, NONE, "xrl",   "a,r6",    xrl_a_r6)   \
+    X(0xDF, 1, 1, NONE, "xrl",   "a,r7",    xrl_a_r7)   \
+    X(0xE0, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xE1, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xE2, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xE3, 1, 2, NONE, "movp3", "a,@a",    movp3_a_xa) \
+    X(0xE4, 2, 2, LONG, "jmp",   "addr",    jmp_7)      \
+    X(0xE5, 1, 1, NONE, "sel",   "mb0",     sel_mb0)    \
+    X(0xE6, 2, 2, PAGE, "jnc",   "addr",    jnc)        \
+    X(0xE7, 1, 1, NONE, "rl",    "a",       rl_a)       \
+    X(0xE8, 2, 2, PAGE, "djnz",  "r0,addr", djnz_r0)    \
+    X(0xE9, 2, 2, PAGE, "djnz",  "r1,addr", djnz_r1)    \
+    X(0xEA, 2, 2, PAGE, "djnz",  "r2,addr", djnz_r2)    \
+    X(0xEB, 2, 2, PAGE, "djnz",  "r3,addr", djnz_r3)    \
+    X(0xEC, 2, 2, PAGE, "djnz",  "r4,addr", djnz_r4)    \
+    X(0xED, 2, 2, PAGE, "djnz",  "r5,addr", djnz_r5)    \
+    X(0xEE, 2, 2, PAGE, "djnz",  "r6,addr", djnz_r6)    \
+    X(0xEF, 2, 2, PAGE, "djnz",  "r7,addr", djnz_r7)    \
+    X(0xF0, 1, 1, NONE, "mov",   "a,@r0",   mov_a_xr0)  \
+    X(0xF1, 1, 1, NONE, "mov",   "a,@r1",   mov_a_xr1)  \
+    X(0xF2, 2, 2, PAGE, "jb7",   "addr",    jb_7)       \
+    X(0xF3, 1, 1, NONE, NULL,    NULL,      illegal)    \
+    X(0xF4, 2, 2, LONG, "call",  "addr",    call_7)     \
+    X(0xF5, 1, 1, NONE, "sel",   "mb1",     sel_mb1)    \
+    X(0xF6, 2, 2, PAGE, "jc",    "addr",    jc)         \
+    X(0xF7, 1, 1, NONE, "rlc",   "a",       rlc_a)      \
+    X(0xF8, 1, 1, NONE, "mov",   "a,r0",    mov_a_r0)   \
+    X(0xF9, 1, 1, NONE, "mov",   "a,r1",    mov_a_r1)   \
+    X(0xFA, 1, 1, NONE, "mov",   "a,r2",    mov_a_r2)   \
+    X(0xFB, 1, 1, NONE, "mov",   "a,r3",    mov_a_r3)   \
+    X(0xFC, 1, 1, NONE, "mov",   "a,r4",    mov_a_r4)   \
+    X(0xFD, 1, 1, NONE, "mov",   "a,r5",    mov_a_r5)   \
+    X(0xFE, 1, 1, NONE, "mov",   "a,r6",    mov_a_r6)   \
+    X(0xFF, 1, 1, NONE, "mov",   "a,r7",    mov_a_r7)
+
+extern mcs48_isa_entry_t const g_mcs48_isa[256];
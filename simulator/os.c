@@ -0,0 +1,197 @@
+// Own header
+#include "os.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+#if _WIN32
+
+
+// ****************************************************************************
+// Windows
+// ****************************************************************************
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#pragma comment(lib, "winmm.lib")
+
+struct os_thread_t {
+    HANDLE handle;
+    os_thread_func_t func;
+    void *arg;
+};
+
+static DWORD WINAPI thread_main(LPVOID param) {
+    os_thread_t *thread = (os_thread_t *)param;
+    thread->func(thread->arg);
+    return 0;
+}
+
+os_thread_t *os_thread_create(os_thread_func_t func, void *arg) {
+    os_thread_t *thread = (os_thread_t *)malloc(sizeof(os_thread_t));
+    thread->func = func;
+    thread->arg = arg;
+    thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+    if (!thread->handle) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void os_thread_join(os_thread_t *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+bool os_map_file(os_mapped_file_t *m, char const *path) {
+    memset(m, 0, sizeof(*m));
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && (unsigned long long)size.QuadPart <= (size_t)-1)
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);  // The mapping keeps the file open
+    if (!mapping) return false;
+
+    m->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m->data) {
+        CloseHandle(mapping);
+        return false;
+    }
+    m->num_bytes = (size_t)size.QuadPart;
+    m->handle = mapping;
+    return true;
+}
+
+void os_unmap_file(os_mapped_file_t *m) {
+    if (m->data) {
+        UnmapViewOfFile(m->data);
+        CloseHandle((HANDLE)m->handle);
+    }
+    memset(m, 0, sizeof(*m));
+}
+
+uint64_t os_get_time_ns(void) {
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+
+    // In two parts, so that count * 1e9 doesn't overflow
+    uint64_t seconds = count.QuadPart / frequency.QuadPart;
+    uint64_t remainder = count.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ull + remainder * 1000000000ull / frequency.QuadPart;
+}
+
+void os_sleep_until_ns(uint64_t deadline_ns) {
+    // Sleep() rounds up to the scheduler's tick, which is 15.6 ms by default
+    static bool is_timer_period_set;
+    if (!is_timer_period_set) {
+        timeBeginPeriod(1);
+        is_timer_period_set = true;
+    }
+
+    // Sleep until about 2 ms before the deadline, then spin the rest
+    for (;;) {
+        uint64_t now = os_get_time_ns();
+        if (now >= deadline_ns) break;
+        uint64_t remaining_ms = (deadline_ns - now) / 1000000;
+        if (remaining_ms > 2)
+            Sleep((DWORD)(remaining_ms - 2));
+        else
+            SwitchToThread();
+    }
+}
+
+
+#else
+
+
+// ****************************************************************************
+// POSIX
+// ****************************************************************************
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct os_thread_t {
+    pthread_t handle;
+    os_thread_func_t func;
+    void *arg;
+};
+
+static void *thread_main(void *param) {
+    os_thread_t *thread = (os_thread_t *)param;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+os_thread_t *os_thread_create(os_thread_func_t func, void *arg) {
+    os_thread_t *thread = (os_thread_t *)malloc(sizeof(os_thread_t));
+    thread->func = func;
+    thread->arg = arg;
+    if (pthread_create(&thread->handle, NULL, thread_main, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void os_thread_join(os_thread_t *thread) {
+    pthread_join(thread->handle, NULL);
+    free(thread);
+}
+
+bool os_map_file(os_mapped_file_t *m, char const *path) {
+    memset(m, 0, sizeof(*m));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file open
+    if (data == MAP_FAILED) return false;
+
+    m->data = data;
+    m->num_bytes = st.st_size;
+    return true;
+}
+
+void os_unmap_file(os_mapped_file_t *m) {
+    if (m->data)
+        munmap((void *)m->data, m->num_bytes);
+    memset(m, 0, sizeof(*m));
+}
+
+uint64_t os_get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void os_sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline_ns / 1000000000ull);
+    ts.tv_nsec = (long)(deadline_ns % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+// The few operating system services that the simulator needs beyond the C
+// library and Deadfrog: threads, atomic access to variables shared between
+// them, memory-mapped files and a precise clock.
+
+typedef struct os_thread_t os_thread_t;
+
+typedef void (*os_thread_func_t)(void *arg);
+
+// Starts a thread running func(arg). Returns NULL if it couldn't.
+os_thread_t *os_thread_create(os_thread_func_t func, void *arg);
+
+// Waits for the thread to return, then frees it.
+void os_thread_join(os_thread_t *thread);
+
+
+// Loads and stores of a variable that another thread uses. A load-acquire
+// that sees the value of a store-release also sees everything the storing
+// thread wrote before it. That is enough for a queue with one producer and
+// one consumer.
+#ifdef _MSC_VER
+// On x86, ordinary loads and stores have these semantics. Only the compiler
+// needs stopping from reordering them.
+static inline unsigned os_load_acquire(unsigned const volatile *p) {
+    unsigned val = *p;
+    _ReadWriteBarrier();
+    return val;
+}
+
+static inline void os_store_release(unsigned volatile *p, unsigned val) {
+    _ReadWriteBarrier();
+    *p = val;
+}
+#else
+static inline unsigned os_load_acquire(unsigned const volatile *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void os_store_release(unsigned volatile *p, unsigned val) {
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+#endif
+
+
+// A whole file mapped read-only into memory. On a 32-bit build, the file must
+// fit in the address space that's free.
+typedef struct {
+    void const *data;
+    size_t num_bytes;
+    void *handle;           // The mapping object, on Windows
+} os_mapped_file_t;
+
+// Returns false if the file couldn't be opened or mapped, or is empty.
+bool os_map_file(os_mapped_file_t *m, char const *path);
+void os_unmap_file(os_mapped_file_t *m);
+
+
+// Nanoseconds from a monotonic clock, which isn't affected by changes to the
+// time of day. Only differences between values mean anything.
+uint64_t os_get_time_ns(void);
+
+// Sleeps until os_get_time_ns() reaches deadline_ns. Returns at once if it
+// already has. Because the deadline is absolute, oversleeping on one call
+// doesn't delay the deadlines after it.
+void os_sleep_until_ns(uint64_t deadline_ns);
@@ -0,0 +1,107 @@
+// Own header
+#include "pacer.h"
+
+// This project's headers
+#include "cpu.h"
+#include "os.h"
+
+// Standard headers
+#include <string.h>
+
+
+static uint64_t const HISTOGRAM_BUCKET_NS = 10000;
+
+
+static void add_lateness(pacer_stats_t *stats, uint64_t lateness_ns) {
+    uint64_t bucket = lateness_ns / HISTOGRAM_BUCKET_NS;
+    if (bucket >= PACER_HISTOGRAM_BUCKETS)
+        bucket = PACER_HISTOGRAM_BUCKETS - 1;
+    stats->lateness_histogram[bucket]++;
+    stats->total_lateness_ns += (double)lateness_ns;
+    if (lateness_ns > stats->max_lateness_ns)
+        stats->max_lateness_ns = lateness_ns;
+}
+
+static void restart_schedule(pacer_t *p, uint64_t origin_ns) {
+    p->origin_ns = origin_ns;
+    p->num_ticks = 0;
+    p->cycles_at_origin = p->cycles_issued;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void pacer_init(pacer_t *p, double ratio, double tick_seconds, double max_behind_seconds) {
+    memset(p, 0, sizeof(*p));
+    p->ratio = ratio;
+    p->tick_ns = (uint64_t)(tick_seconds * 1e9);
+    if (p->tick_ns == 0)
+        p->tick_ns = 1;
+    p->max_behind_ns = (uint64_t)(max_behind_seconds * 1e9);
+    restart_schedule(p, os_get_time_ns());
+}
+
+void pacer_set_ratio(pacer_t *p, double ratio) {
+    if (ratio == p->ratio) return;
+    p->ratio = ratio;
+    restart_schedule(p, p->origin_ns + p->num_ticks * p->tick_ns);
+}
+
+unsigned pacer_wait(pacer_t *p) {
+    uint64_t deadline_ns = p->origin_ns + (p->num_ticks + 1) * p->tick_ns;
+    uint64_t now = os_get_time_ns();
+    if (now < deadline_ns) {
+        os_sleep_until_ns(deadline_ns);
+        now = os_get_time_ns();
+    }
+    else if (now - deadline_ns > p->max_behind_ns) {
+        // Too far behind to catch up. Drop the missed time and carry on
+        // from now.
+        p->stats.num_slips++;
+        p->stats.slipped_ns += now - deadline_ns;
+        restart_schedule(p, now - p->tick_ns);
+        deadline_ns = now;
+    }
+    else {
+        p->stats.num_catch_up_ticks++;
+    }
+
+    p->num_ticks++;
+    p->stats.num_ticks++;
+    add_lateness(&p->stats, now > deadline_ns ? now - deadline_ns : 0);
+
+    // Where master_clk should be at the deadline, counted from the origin
+    double seconds = (double)(p->num_ticks * p->tick_ns) * 1e-9;
+    uint64_t target = p->cycles_at_origin + (uint64_t)(seconds * p->ratio * CPU_CLOCK_RATE_HZ);
+    unsigned num_cycles = (unsigned)(target - p->cycles_issued);
+    p->cycles_issued = target;
+    return num_cycles;
+}
+
+uint64_t pacer_lateness_percentile(pacer_stats_t const *stats, double fraction) {
+    uint64_t threshold = (uint64_t)(stats->num_ticks * fraction);
+    uint64_t count = 0;
+    for (int i = 0; i < PACER_HISTOGRAM_BUCKETS; i++) {
+        count += stats->lateness_histogram[i];
+        if (count > threshold)
+            return (i + 1) * HISTOGRAM_BUCKET_NS;
+    }
+    return PACER_HISTOGRAM_BUCKETS * HISTOGRAM_BUCKET_NS;
+}
+
+void pacer_write_stats(pacer_t const *p, FILE *out) {
+    pacer_stats_t const *stats = &p->stats;
+    double mean_lateness_ns = stats->num_ticks ? stats->total_lateness_ns / stats->num_ticks : 0.0;
+    fprintf(out, "realtime_ratio %.6f\n", p->ratio);
+    fprintf(out, "realtime_tick_us %.1f\n", p->tick_ns * 1e-3);
+    fprintf(out, "realtime_ticks %llu\n", (unsigned long long)stats->num_ticks);
+    fprintf(out, "realtime_catch_up_ticks %llu\n", (unsigned long long)stats->num_catch_up_ticks);
+    fprintf(out, "realtime_slips %llu\n", (unsigned long long)stats->num_slips);
+    fprintf(out, "realtime_slipped_ms %.3f\n", stats->slipped_ns * 1e-6);
+    fprintf(out, "realtime_lateness_mean_us %.1f\n", mean_lateness_ns * 1e-3);
+    fprintf(out, "realtime_lateness_p50_us %.0f\n", pacer_lateness_percentile(stats, 0.5) * 1e-3);
+    fprintf(out, "realtime_lateness_p99_us %.0f\n", pacer_lateness_percentile(stats, 0.99) * 1e-3);
+    fprintf(out, "realtime_lateness_max_us %.1f\n", stats->max_lateness_ns * 1e-3);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+// Keeps a simulation locked to wall-clock time, for hardware-in-the-loop
+// style testing. Each call to pacer_wait() sleeps until the next tick, then
+// says how many CPU cycles to run so that master_clk is where it should be at
+// that moment: CPU_CLOCK_RATE_HZ * ratio cycles per real second.
+//
+// Tick n is due at origin + n * tick_ns. The deadlines are absolute and the
+// cycle counts are worked out from the time since the origin, not summed, so
+// neither oversleeping nor rounding builds up into drift.
+//
+// If the simulation falls behind, the ticks it missed are run straight away,
+// without sleeping, to catch up. If it falls more than max_behind_ns behind,
+// the missed time is dropped instead (a slip), and the schedule starts again
+// from now.
+
+enum { PACER_HISTOGRAM_BUCKETS = 1000 };    // Of 10 us each
+
+typedef struct {
+    uint64_t num_ticks;
+    uint64_t num_catch_up_ticks;    // Ticks that were already due, so didn't sleep
+    uint64_t num_slips;
+    uint64_t slipped_ns;            // Total time dropped by slips
+
+    // Lateness is how long after its deadline a tick started. It is the
+    // jitter of the simulation against the wall clock.
+    uint64_t max_lateness_ns;
+    double total_lateness_ns;
+    unsigned lateness_histogram[PACER_HISTOGRAM_BUCKETS];  // The last bucket is everything later
+} pacer_stats_t;
+
+typedef struct {
+    double ratio;               // Simulated seconds per real second
+    uint64_t tick_ns;
+    uint64_t max_behind_ns;
+
+    uint64_t origin_ns;         // When the schedule started
+    uint64_t num_ticks;         // Since the origin
+    uint64_t cycles_at_origin;  // Value of cycles_issued at the origin
+    uint64_t cycles_issued;     // Returned by pacer_wait() since pacer_init()
+
+    pacer_stats_t stats;
+} pacer_t;
+
+
+// Starts the schedule now. The first tick is due one tick_seconds from now.
+void pacer_init(pacer_t *p, double ratio, double tick_seconds, double max_behind_seconds);
+
+// Restarts the schedule at the current tick with a new ratio, so that the
+// cycles already issued stand.
+void pacer_set_ratio(pacer_t *p, double ratio);
+
+// Waits for the next tick. Returns the number of cycles to run for it.
+unsigned pacer_wait(pacer_t *p);
+
+// Lateness at the given percentile, in nanoseconds, to the histogram's 10 us
+// resolution
+uint64_t pacer_lateness_percentile(pacer_stats_t const *stats, double fraction);
+
+// Writes the stats as "name value" lines, in the style of headless's
+// _stats.txt.
+void pacer_write_stats(pacer_t const *p, FILE *out);
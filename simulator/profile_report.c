@@ -0,0 +1,224 @@
+// Own header
+#include "profile_report.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+enum { MAX_ROUTINES = 1024 };
+enum { MAX_TEXT_LEN = 64 };
+enum { NUM_TOP_ENTRIES = 40 };
+
+// What the report needs to know about the annotated disassembly
+typedef struct {
+    int line_nums[4096];                    // 0 if the address isn't in the file
+    char text[4096][MAX_TEXT_LEN];          // The instruction and its comment
+    int routines[4096];                     // Index into routine_names, or -1
+    char routine_names[MAX_ROUTINES][MAX_TEXT_LEN];
+    int routine_line_nums[MAX_ROUTINES];
+    int num_routines;
+} asm_info_t;
+
+
+// ****************************************************************************
+// Annotated disassembly parsing
+// ****************************************************************************
+
+static char const *skip_spaces(char const *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+// Copies the line without leading spaces or the newline, truncating if needed
+static void copy_text(char *dst, char const *src) {
+    src = skip_spaces(src);
+    int i = 0;
+    for (; i < MAX_TEXT_LEN - 1 && src[i] && src[i] != '\r' && src[i] != '\n'; i++)
+        dst[i] = src[i];
+    dst[i] = '\0';
+}
+
+static bool is_label(char const *s) {
+    char const *c = s;
+    while (*c == '_' || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9'))
+        c++;
+    return c != s && *c == ':';
+}
+
+static int add_routine(asm_info_t *info, char const *name, int line_num) {
+    if (info->num_routines == MAX_ROUTINES) return -1;
+    int i = info->num_routines++;
+    copy_text(info->routine_names[i], name);
+    info->routine_line_nums[i] = line_num;
+    return i;
+}
+
+// Each address is given to the routine named by the closest label or comment
+// block before it. "// END ..." comments end a routine.
+static void load_asm_info(asm_info_t *info, char const *path) {
+    for (int i = 0; i < 4096; i++)
+        info->routines[i] = -1;
+
+    FILE *in = path ? fopen(path, "r") : NULL;
+    if (!in) return;
+
+    char line[512];
+    int line_num = 0;
+    int routine = -1;
+    bool prev_was_comment = false;
+    while (fgets(line, sizeof(line), in)) {
+        line_num++;
+        char const *s = skip_spaces(line);
+        bool is_comment = s[0] == '/' && s[1] == '/';
+
+        if (s[0] == '0' && s[1] == 'x') {
+            unsigned addr = strtoul(s, NULL, 16) & 0xfff;
+            info->line_nums[addr] = line_num;
+            copy_text(info->text[addr], s);
+            info->routines[addr] = routine;
+        }
+        else if (is_comment && !prev_was_comment) {
+            if (strncmp(s, "// END", 6) == 0)
+                routine = -1;
+            else
+                routine = add_routine(info, s + 2, line_num);
+        }
+        else if (is_label(s)) {
+            routine = add_routine(info, s, line_num);
+        }
+
+        prev_was_comment = is_comment;
+    }
+
+    fclose(in);
+}
+
+static char const *get_routine_name(asm_info_t const *info, unsigned addr) {
+    int routine = info->routines[addr & 0xfff];
+    return routine < 0 ? "" : info->routine_names[routine];
+}
+
+
+// ****************************************************************************
+// Sorting
+// ****************************************************************************
+
+static unsigned const *s_sort_keys;
+
+static int compare_keys_descending(void const *a, void const *b) {
+    unsigned key_a = s_sort_keys[*(int const *)a];
+    unsigned key_b = s_sort_keys[*(int const *)b];
+    return (key_a < key_b) - (key_a > key_b);
+}
+
+// Fills indices with the indices of the non-zero keys, biggest key first.
+// Returns how many there are.
+static int sort_indices(int *indices, unsigned const *keys, int num_keys) {
+    int num_indices = 0;
+    for (int i = 0; i < num_keys; i++) {
+        if (keys[i])
+            indices[num_indices++] = i;
+    }
+
+    s_sort_keys = keys;
+    qsort(indices, num_indices, sizeof(int), compare_keys_descending);
+    return num_indices;
+}
+
+
+// ****************************************************************************
+// Report sections
+// ****************************************************************************
+
+static void write_interrupts(cpu_profile_t const *p, double total_cycles, FILE *out) {
+    static char const *names[2] = { "external (0x03)", "timer (0x07)" };
+    fprintf(out, "Interrupts, by cycles from entry to retr, including callees\n");
+    fprintf(out, "  %-16s %10s %12s %7s %8s\n", "", "count", "cycles", "%", "avg");
+    for (int i = 0; i < 2; i++) {
+        double avg = p->irqs[i] ? (double)p->irq_cycles[i] / p->irqs[i] : 0.0;
+        fprintf(out, "  %-16s %10u %12u %6.2f%% %8.1f\n", names[i], p->irqs[i], p->irq_cycles[i],
+            100.0 * p->irq_cycles[i] / total_cycles, avg);
+    }
+    fprintf(out, "\n");
+}
+
+static void write_routines(cpu_profile_t const *p, asm_info_t const *info, double total_cycles, FILE *out) {
+    // The last entry is for addresses that aren't in any routine
+    static unsigned cycles[MAX_ROUTINES + 1];
+    static unsigned insns[MAX_ROUTINES + 1];
+    memset(cycles, 0, sizeof(cycles));
+    memset(insns, 0, sizeof(insns));
+    for (int addr = 0; addr < 4096; addr++) {
+        int routine = info->routines[addr] < 0 ? MAX_ROUTINES : info->routines[addr];
+        cycles[routine] += p->cycles[addr];
+        insns[routine] += p->insns[addr];
+    }
+
+    static int indices[MAX_ROUTINES + 1];
+    int num_indices = sort_indices(indices, cycles, MAX_ROUTINES + 1);
+    fprintf(out, "Routines, by cycles spent in their own code\n");
+    fprintf(out, "  %12s %7s %12s %6s  %s\n", "cycles", "%", "insns", "line", "routine");
+    for (int i = 0; i < num_indices && i < NUM_TOP_ENTRIES; i++) {
+        int r = indices[i];
+        bool is_named = r < MAX_ROUTINES;
+        fprintf(out, "  %12u %6.2f%% %12u %6d  %s\n", cycles[r], 100.0 * cycles[r] / total_cycles, insns[r],
+            is_named ? info->routine_line_nums[r] : 0, is_named ? info->routine_names[r] : "(none)");
+    }
+    fprintf(out, "\n");
+}
+
+static void write_instructions(cpu_profile_t const *p, asm_info_t const *info, double total_cycles, FILE *out) {
+    static int indices[4096];
+    int num_indices = sort_indices(indices, p->cycles, 4096);
+    fprintf(out, "Instructions, by cycles\n");
+    fprintf(out, "  %5s %6s %12s %7s %12s  %s\n", "addr", "line", "cycles", "%", "count", "source");
+    for (int i = 0; i < num_indices && i < NUM_TOP_ENTRIES; i++) {
+        int a = indices[i];
+        fprintf(out, "  0x%03x %6d %12u %6.2f%% %12u  %s\n", a, info->line_nums[a], p->cycles[a],
+            100.0 * p->cycles[a] / total_cycles, p->insns[a], info->text[a]);
+    }
+    fprintf(out, "\n");
+}
+
+static void write_calls(cpu_profile_t const *p, asm_info_t const *info, double total_cycles, FILE *out) {
+    static int indices[4096];
+    int num_indices = sort_indices(indices, p->call_cycles, 4096);
+    fprintf(out, "Calls, by cycles from call to ret, including callees\n");
+    fprintf(out, "  %5s %6s %6s %10s %12s %7s %8s  %s\n", "site", "line", "target", "calls", "cycles", "%", "avg", "target routine");
+    for (int i = 0; i < num_indices && i < NUM_TOP_ENTRIES; i++) {
+        int a = indices[i];
+        u16 target = p->call_targets[a];
+        fprintf(out, "  0x%03x %6d  0x%03x %10u %12u %6.2f%% %8.1f  %s\n", a, info->line_nums[a], target,
+            p->calls[a], p->call_cycles[a], 100.0 * p->call_cycles[a] / total_cycles,
+            (double)p->call_cycles[a] / p->calls[a], get_routine_name(info, target));
+    }
+    fprintf(out, "\n");
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+void profile_write_report(cpu_profile_t const *profile, char const *asm_path, FILE *out) {
+    asm_info_t *info = (asm_info_t *)calloc(1, sizeof(asm_info_t));
+    load_asm_info(info, asm_path);
+
+    double total_cycles = 0.0;
+    double total_insns = 0.0;
+    for (int addr = 0; addr < 4096; addr++) {
+        total_cycles += profile->cycles[addr];
+        total_insns += profile->insns[addr];
+    }
+    if (total_cycles == 0.0)
+        total_cycles = 1.0;
+
+    fprintf(out, "Total: %.0f cycles, %.0f instructions\n\n", total_cycles, total_insns);
+    write_interrupts(profile, total_cycles, out);
+    write_routines(profile, info, total_cycles, out);
+    write_instructions(profile, info, total_cycles, out);
+    write_calls(profile, info, total_cycles, out);
+
+    free(info);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "cpu.h"
+
+#include <stdio.h>
+
+
+// Writes a text report of where the cycles in the profile went: the hottest
+// routines, instructions and calls, and the interrupts. Each address is keyed
+// back to its line in asm_path, which is normally
+// Annotated_Stock1987_951KLR.asm. Routines are named after the label or
+// comment block that comes before their code. If asm_path can't be read, only
+// addresses are shown.
+void profile_write_report(cpu_profile_t const *profile, char const *asm_path, FILE *out);
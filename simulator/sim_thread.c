@@ -0,0 +1,156 @@
+// Own header
+#include "sim_thread.h"
+
+// This project's headers
+#include "pacer.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+// When running at a ratio to real time, the car is advanced once per tick of
+// this long. After a stall of more than MAX_BEHIND_SECONDS, the simulation
+// drops the time missed rather than racing to catch up.
+static double const PACER_TICK_SECONDS = 1e-3;
+static double const MAX_BEHIND_SECONDS = 0.03;
+
+// When running as fast as possible, the simulated time per advance
+static double const MAX_SPEED_PERIOD_SECONDS = 0.01;
+
+// How often measured_speed is updated
+static double const SPEED_MEASURE_SECONDS = 0.5;
+
+
+static void fill_view(VirtualCar const *car, sim_controls_t const *controls, sim_view_t *view,
+        unsigned serial, double measured_speed) {
+    cpu_t const *cpu = car->cpu;
+
+    view->serial = serial;
+    view->controls = *controls;
+    view->measured_speed = measured_speed;
+
+    view->throttle_pos = car->throttle_pos;
+    view->engine_rpm = car->engine_rpm;
+    view->crank_angle = car->crank_angle;
+    view->turbo_rpm = car->turbo_rpm;
+    view->manifold_pressure = car->manifold_pressure;
+    view->engine_power = car->engine_power;
+
+    view->pc = cpu->pc;
+    view->master_clk = cpu->master_clk;
+    view->timer_counter = cpu->timer_counter;
+    view->a11 = cpu->a11;
+    memcpy(view->ram, cpu->ram, sizeof(view->ram));
+
+    int num_columns = controls->graph_columns;
+    if (num_columns > MAX_GRAPH_COLUMNS)
+        num_columns = MAX_GRAPH_COLUMNS;
+    for (int i = 0; i < NUM_GRAPHS; i++) {
+        graph_get_columns((graph_id_t)i, cpu->master_clk, controls->graph_time_ranges[i],
+            num_columns, view->graph_mins[i], view->graph_maxs[i]);
+    }
+}
+
+static void sim_thread_main(void *arg) {
+    sim_thread_t *s = (sim_thread_t *)arg;
+    VirtualCar *car = s->car;
+    unsigned served = s->served;
+    sim_controls_t controls = s->controls;
+
+    pacer_t pacer;
+    pacer_init(&pacer, controls.sim_speed, PACER_TICK_SECONDS, MAX_BEHIND_SECONDS);
+    bool was_flat_out = false;
+
+    double measure_start_time = GetRealTime();
+    unsigned measure_start_clk = car->cpu->master_clk;
+    double measured_speed = 0.0;
+
+    while (!os_load_acquire(&s->is_stopping)) {
+        // The UI doesn't touch s->controls between storing request and
+        // seeing served reach it
+        unsigned request = os_load_acquire(&s->request);
+        if (request != served) {
+            controls = s->controls;
+            car->throttle_pos = controls.throttle_pos;
+            fill_view(car, &controls, s->views[request & 1], request, measured_speed);
+            served = request;
+            os_store_release(&s->served, served);
+        }
+
+        if (controls.sim_speed > 0.0) {
+            if (was_flat_out)
+                pacer_init(&pacer, controls.sim_speed, PACER_TICK_SECONDS, MAX_BEHIND_SECONDS);
+            else
+                pacer_set_ratio(&pacer, controls.sim_speed);
+            was_flat_out = false;
+            unsigned num_cycles = pacer_wait(&pacer);
+            vc_advance(car, num_cycles * CPU_CLOCK_PERIOD);
+        }
+        else {
+            was_flat_out = true;
+            vc_advance(car, MAX_SPEED_PERIOD_SECONDS);
+        }
+
+        double now = GetRealTime();
+        if (now - measure_start_time >= SPEED_MEASURE_SECONDS) {
+            unsigned cycles = car->cpu->master_clk - measure_start_clk;
+            measured_speed = cycles * CPU_CLOCK_PERIOD / (now - measure_start_time);
+            measure_start_time = now;
+            measure_start_clk = car->cpu->master_clk;
+        }
+    }
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+bool sim_thread_start(sim_thread_t *s, VirtualCar *car, sim_controls_t const *controls) {
+    memset(s, 0, sizeof(*s));
+    s->car = car;
+    s->controls = *controls;
+    s->views[0] = (sim_view_t *)calloc(1, sizeof(sim_view_t));
+    s->views[1] = (sim_view_t *)calloc(1, sizeof(sim_view_t));
+
+    // Ask for the first view, with the starting controls, so that the UI
+    // doesn't change them while the thread starts up
+    s->request = 1;
+
+    s->thread = os_thread_create(sim_thread_main, s);
+    if (!s->thread) {
+        free(s->views[0]);
+        free(s->views[1]);
+        memset(s, 0, sizeof(*s));
+        return false;
+    }
+
+    return true;
+}
+
+void sim_thread_stop(sim_thread_t *s) {
+    if (!s->thread) return;
+    os_store_release(&s->is_stopping, 1);
+    os_thread_join(s->thread);
+    free(s->views[0]);
+    free(s->views[1]);
+    memset(s, 0, sizeof(*s));
+}
+
+sim_view_t const *sim_thread_get_view(sim_thread_t *s, sim_controls_t const *controls) {
+    // Only this thread stores to request
+    unsigned request = s->request;
+    if (os_load_acquire(&s->served) == request) {
+        // The view asked for last time is ready. Take it and ask for the
+        // next, which goes in the other buffer.
+        s->ui_view = s->views[request & 1];
+        s->controls = *controls;
+        os_store_release(&s->request, request + 1);
+    }
+
+    return s->ui_view;
+}
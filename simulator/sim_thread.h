@@ -0,0 +1,78 @@
+#pragma once
+
+#include "graph.h"
+#include "os.h"
+#include "virtual_car.h"
+
+
+// Runs a car on a thread of its own, so that how fast it is simulated doesn't
+// depend on how fast the UI draws, and a slow frame doesn't stall the KLR.
+//
+// The UI never touches the car while the thread is running. Instead, each
+// frame it gets a sim_view_t: a copy of what it draws, taken by the sim
+// thread between two advances of the car. There are two views. The sim thread
+// fills one while the UI draws the other, and they swap when the UI asks for
+// the next, so neither side ever waits for the other.
+
+// What the UI wants from the sim thread. Sent with each request for a view.
+typedef struct {
+    double throttle_pos;
+    double sim_speed;           // Simulated seconds per real second. 0 runs as fast as possible.
+    int graph_columns;          // Width of the graphs to fetch, up to MAX_GRAPH_COLUMNS
+    unsigned graph_time_ranges[NUM_GRAPHS]; // Time span of each graph, in master_clk cycles
+} sim_controls_t;
+
+typedef struct {
+    unsigned serial;            // Counts the views published. Differs for every view.
+    sim_controls_t controls;    // That this view was made for
+    double measured_speed;      // Simulated seconds per real second, over about the last half second
+
+    // The car
+    double throttle_pos;
+    double engine_rpm;
+    double crank_angle;
+    double turbo_rpm;
+    double manifold_pressure;
+    double engine_power;
+
+    // Its KLR
+    u16 pc;
+    unsigned master_clk;
+    u8 timer_counter;
+    u16 a11;
+    u8 ram[128];
+
+    // Each graph as graph_get_columns() gives it, ending at master_clk
+    uint8_t graph_mins[NUM_GRAPHS][MAX_GRAPH_COLUMNS];
+    uint8_t graph_maxs[NUM_GRAPHS][MAX_GRAPH_COLUMNS];
+} sim_view_t;
+
+typedef struct {
+    VirtualCar *car;
+    os_thread_t *thread;
+
+    // The UI asks for a view by setting controls, then storing request + 1.
+    // The sim thread fills views[request & 1] and stores served = request.
+    // Until then, the UI only reads the other view and doesn't touch controls.
+    sim_view_t *views[2];
+    sim_controls_t controls;
+    unsigned volatile request;  // Number of views asked for. Only stored to by the UI.
+    unsigned volatile served;   // Number of views published. Only stored to by the sim thread.
+    unsigned volatile is_stopping;
+
+    sim_view_t const *ui_view;  // The newest view the UI has got, or NULL
+} sim_thread_t;
+
+
+// Starts advancing car on a new thread. The caller mustn't touch the car
+// again until sim_thread_stop() returns. Returns false if the thread couldn't
+// be started.
+bool sim_thread_start(sim_thread_t *s, VirtualCar *car, sim_controls_t const *controls);
+
+// Waits for the thread to finish its current advance, then stops it.
+void sim_thread_stop(sim_thread_t *s);
+
+// Returns the newest view that the sim thread has published, or NULL if there
+// isn't one yet, and asks for another made with controls. Only call this from
+// one thread. The view stays valid and unchanged until the next call.
+sim_view_t const *sim_thread_get_view(sim_thread_t *s, sim_controls_t const *controls);
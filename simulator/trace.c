@@ -0,0 +1,165 @@
+// Own header
+#include "trace.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+static char const TRACE_MAGIC[8] = { 'K', 'L', 'R', 'T', 'R', 'A', 'C', 'E' };
+
+// The flush thread writes at most this many records at a time, so that
+// trace_add() can reuse the space sooner
+enum { MAX_RECORDS_PER_WRITE = 1 << 16 };
+
+static char const *s_type_names[NUM_TRACE_TYPES] = {
+    "port1_write",
+    "port2_write",
+    "adc_read",
+    "t1",
+    "irq_line",
+    "irq_entry",
+    "reset",
+    "ext_mem_write"
+};
+
+
+char const *trace_type_name(trace_type_t type) {
+    if (type >= NUM_TRACE_TYPES) return "";
+    return s_type_names[type];
+}
+
+
+// ****************************************************************************
+// Writer
+// ****************************************************************************
+
+static void flush_thread_main(void *arg) {
+    trace_writer_t *w = (trace_writer_t *)arg;
+    unsigned tail = w->tail;
+    for (;;) {
+        // Check for closing first, so that records added before close are
+        // seen by the load of head
+        bool is_closing = os_load_acquire(&w->is_closing) != 0;
+        unsigned head = os_load_acquire(&w->head);
+        if (head == tail) {
+            if (is_closing) break;
+            SleepMillisec(1);
+            continue;
+        }
+
+        // Write up to the end of the ring, and no more than one write's worth
+        unsigned start = tail & (TRACE_RING_RECORDS - 1);
+        unsigned num_records = head - tail;
+        if (num_records > TRACE_RING_RECORDS - start)
+            num_records = TRACE_RING_RECORDS - start;
+        if (num_records > MAX_RECORDS_PER_WRITE)
+            num_records = MAX_RECORDS_PER_WRITE;
+        fwrite(w->ring + start, sizeof(trace_record_t), num_records, w->file);
+
+        tail += num_records;
+        os_store_release(&w->tail, tail);
+    }
+}
+
+bool trace_writer_open(trace_writer_t *w, char const *path, unsigned clock_rate_hz) {
+    memset(w, 0, sizeof(*w));
+    w->file = fopen(path, "wb");
+    if (!w->file) return false;
+
+    trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.clock_rate_hz = clock_rate_hz;
+    fwrite(&header, sizeof(header), 1, w->file);
+
+    w->ring = (trace_record_t *)malloc(TRACE_RING_RECORDS * sizeof(trace_record_t));
+    w->thread = os_thread_create(flush_thread_main, w);
+    if (!w->thread) {
+        fclose(w->file);
+        free(w->ring);
+        memset(w, 0, sizeof(*w));
+        return false;
+    }
+
+    return true;
+}
+
+void trace_writer_close(trace_writer_t *w) {
+    if (!w->file) return;
+    os_store_release(&w->is_closing, 1);
+    os_thread_join(w->thread);
+    fclose(w->file);
+    free(w->ring);
+    memset(w, 0, sizeof(*w));
+}
+
+void trace_add(trace_writer_t *w, unsigned clk, trace_type_t type, u8 arg, u8 val) {
+    // Extend clk to 64 bits, taking it to be within 2^31 of the last record's
+    if (!w->has_records) {
+        w->time = clk;
+        w->has_records = true;
+    }
+    else {
+        int delta = (int)(clk - (unsigned)w->time);
+        if (delta > 0)
+            w->time += delta;
+    }
+
+    // Only this thread stores to head
+    unsigned head = w->head;
+    if (head - os_load_acquire(&w->tail) == TRACE_RING_RECORDS) {
+        w->num_stalls++;
+        while (head - os_load_acquire(&w->tail) == TRACE_RING_RECORDS)
+            SleepMillisec(1);
+    }
+
+    w->ring[head & (TRACE_RING_RECORDS - 1)] =
+        (w->time << 24) | ((uint64_t)type << 16) | ((uint64_t)arg << 8) | val;
+    os_store_release(&w->head, head + 1);
+}
+
+
+// ****************************************************************************
+// Reader
+// ****************************************************************************
+
+bool trace_reader_open(trace_reader_t *r, char const *path) {
+    memset(r, 0, sizeof(*r));
+    if (!os_map_file(&r->file, path)) return false;
+
+    trace_header_t const *header = (trace_header_t const *)r->file.data;
+    if (r->file.num_bytes < sizeof(trace_header_t) ||
+            memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != TRACE_VERSION) {
+        os_unmap_file(&r->file);
+        return false;
+    }
+
+    r->header = header;
+    r->records = (trace_record_t const *)(header + 1);
+    r->num_records = (r->file.num_bytes - sizeof(trace_header_t)) / sizeof(trace_record_t);
+    return true;
+}
+
+void trace_reader_close(trace_reader_t *r) {
+    os_unmap_file(&r->file);
+    memset(r, 0, sizeof(*r));
+}
+
+size_t trace_reader_seek(trace_reader_t const *r, uint64_t time) {
+    size_t lo = 0;
+    size_t hi = r->num_records;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (trace_record_time(r->records[mid]) < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
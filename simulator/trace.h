@@ -0,0 +1,106 @@
+#pragma once
+
+#include "os.h"
+#include "types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+// A binary log of the I/O that the KLR's CPU sees: port writes, ADC reads,
+// the T1 and IRQ inputs, interrupts taken and resets.
+//
+// The file is a trace_header_t followed by fixed-size records in time order.
+// Because they are fixed-size, a reader can map the file and index or binary
+// search the records in place, without parsing or copying anything.
+//
+// The writer is called from the simulation. It puts each record in a ring,
+// and a background thread writes the ring out to the file, so the simulation
+// doesn't wait for the disk.
+
+typedef enum {
+    TRACE_PORT1_WRITE,      // val is the new port value. Only writes that change it are
+                            // recorded.
+    TRACE_PORT2_WRITE,
+    TRACE_ADC_READ,         // arg is the ADC channel, val the value read
+    TRACE_T1,               // val is the new level, 0 or 1
+    TRACE_IRQ_LINE,         // val is the new level of the external IRQ line
+    TRACE_IRQ_ENTRY,        // arg is IRQ_EXTERNAL or IRQ_TIMER
+    TRACE_RESET,
+    TRACE_EXT_MEM_WRITE,    // arg is the address, val the value written
+    NUM_TRACE_TYPES
+} trace_type_t;
+
+// A record is a little-endian 64-bit word. The top 40 bits are master_clk,
+// extended to 64 bits so that it doesn't wrap, then truncated to 40. That
+// covers about 17 days at the KLR's clock rate. Below it are 8 bits each of
+// type, arg and val.
+typedef uint64_t trace_record_t;
+
+enum { TRACE_VERSION = 1 };
+
+typedef struct {
+    char magic[8];          // "KLRTRACE"
+    uint32_t version;
+    uint32_t clock_rate_hz;
+} trace_header_t;
+
+static inline uint64_t trace_record_time(trace_record_t r) { return r >> 24; }
+static inline trace_type_t trace_record_type(trace_record_t r) { return (trace_type_t)((r >> 16) & 0xff); }
+static inline u8 trace_record_arg(trace_record_t r) { return (u8)(r >> 8); }
+static inline u8 trace_record_val(trace_record_t r) { return (u8)r; }
+
+char const *trace_type_name(trace_type_t type);
+
+
+// ****************************************************************************
+// Writer
+// ****************************************************************************
+
+enum { TRACE_RING_RECORDS = 1 << 20 };
+
+typedef struct {
+    FILE *file;
+    os_thread_t *thread;
+
+    // A ring with one producer, trace_add(), and one consumer, the flush
+    // thread. head and tail count the records added and written. Each is
+    // only stored to by its own side.
+    trace_record_t *ring;
+    unsigned volatile head;
+    unsigned volatile tail;
+    unsigned volatile is_closing;
+
+    uint64_t time;          // Of the last record, extended to 64 bits
+    bool has_records;
+    unsigned num_stalls;    // Times trace_add() found the ring full and had to wait
+} trace_writer_t;
+
+// Creates the file, writes the header and starts the flush thread.
+bool trace_writer_open(trace_writer_t *w, char const *path, unsigned clock_rate_hz);
+
+// Waits for the flush thread to write everything, then closes the file.
+void trace_writer_close(trace_writer_t *w);
+
+// A clk before the last record's is treated as equal to it.
+void trace_add(trace_writer_t *w, unsigned clk, trace_type_t type, u8 arg, u8 val);
+
+
+// ****************************************************************************
+// Reader
+// ****************************************************************************
+
+typedef struct {
+    os_mapped_file_t file;
+    trace_header_t const *header;
+    trace_record_t const *records;
+    size_t num_records;
+} trace_reader_t;
+
+// Maps the file. Returns false if it couldn't, or it isn't a trace.
+bool trace_reader_open(trace_reader_t *r, char const *path);
+void trace_reader_close(trace_reader_t *r);
+
+// Returns the index of the first record at or after time, or num_records if
+// there isn't one. Binary searches, so only touches O(log n) pages.
+size_t trace_reader_seek(trace_reader_t const *r, uint64_t time);
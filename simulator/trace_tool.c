@@ -0,0 +1,94 @@
+// Reads the binary I/O traces that headless --trace writes.
+//
+// Usage: trace_tool <file.trace> [start_seconds end_seconds]
+//
+// With just the file, scans every record and prints how many there are of
+// each type, and how fast the scan went. With a time range, prints the records
+// in that range as text, one per line.
+//
+// The file is memory mapped, so the scan reads the records in place, and a
+// time range is found by binary search without reading the rest.
+
+// This project's headers
+#include "trace.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static void usage(void) {
+    puts("Usage: trace_tool <file.trace> [start_seconds end_seconds]");
+    exit(1);
+}
+
+static void print_summary(trace_reader_t const *r) {
+    unsigned long long counts[NUM_TRACE_TYPES] = { 0 };
+    unsigned long long adc_reads[8] = { 0 };
+
+    double start_time = GetRealTime();
+    trace_record_t const *records = r->records;
+    for (size_t i = 0; i < r->num_records; i++) {
+        trace_record_t rec = records[i];
+        trace_type_t type = trace_record_type(rec);
+        if (type < NUM_TRACE_TYPES)
+            counts[type]++;
+        if (type == TRACE_ADC_READ)
+            adc_reads[trace_record_arg(rec) & 7]++;
+    }
+    double scan_duration = GetRealTime() - start_time;
+
+    double sim_seconds = 0.0;
+    if (r->num_records > 0) {
+        uint64_t first = trace_record_time(records[0]);
+        uint64_t last = trace_record_time(records[r->num_records - 1]);
+        sim_seconds = (double)(last - first) / r->header->clock_rate_hz;
+    }
+
+    printf("records %llu\n", (unsigned long long)r->num_records);
+    printf("sim_seconds %.6f\n", sim_seconds);
+    for (int i = 0; i < NUM_TRACE_TYPES; i++)
+        printf("%s %llu\n", trace_type_name((trace_type_t)i), counts[i]);
+    for (int i = 0; i < 8; i++)
+        printf("adc_read_channel_%d %llu\n", i, adc_reads[i]);
+
+    double num_bytes = (double)r->num_records * sizeof(trace_record_t);
+    printf("scan_seconds %.6f\n", scan_duration);
+    if (scan_duration > 0.0)
+        printf("scan_gb_per_second %.2f\n", num_bytes / scan_duration / 1e9);
+}
+
+static void print_range(trace_reader_t const *r, double start_seconds, double end_seconds) {
+    double rate = r->header->clock_rate_hz;
+    uint64_t end_time = (uint64_t)(end_seconds * rate);
+    size_t i = trace_reader_seek(r, (uint64_t)(start_seconds * rate));
+    puts("clk,seconds,type,arg,val");
+    for (; i < r->num_records; i++) {
+        trace_record_t rec = r->records[i];
+        uint64_t time = trace_record_time(rec);
+        if (time >= end_time) break;
+        printf("%llu,%.6f,%s,%u,%u\n", (unsigned long long)time, time / rate,
+            trace_type_name(trace_record_type(rec)), trace_record_arg(rec), trace_record_val(rec));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 4) usage();
+
+    trace_reader_t reader;
+    if (!trace_reader_open(&reader, argv[1])) {
+        printf("Couldn't read trace file '%s'\n", argv[1]);
+        return 1;
+    }
+
+    if (argc == 4)
+        print_range(&reader, atof(argv[2]), atof(argv[3]));
+    else
+        print_summary(&reader);
+
+    trace_reader_close(&reader);
+    return 0;
+}
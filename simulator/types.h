@@ -3,7 +3,7 @@
 #ifdef _MSC_VER
 #pragma warning(disable: 4996)
 #else
-typedef unsigned char bool;
+#include <stdbool.h>
 #endif
 
 typedef unsigned char u8;
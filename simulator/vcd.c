@@ -0,0 +1,200 @@
+// Own header
+#include "vcd.h"
+
+// Deadfrog headers
+#include "df_time.h"
+
+// Standard headers
+#include <stdlib.h>
+#include <string.h>
+
+
+// Room for the longest thing written in one go: a time line and a 32-bit
+// vector change
+enum { MAX_WRITE_BYTES = 64 };
+
+
+static void flush_thread_main(void *arg) {
+    vcd_t *vcd = (vcd_t *)arg;
+    unsigned tail = vcd->tail;
+    for (;;) {
+        // Check for closing first, so that buffers handed over before close
+        // are seen by the load of head
+        bool is_closing = os_load_acquire(&vcd->is_closing) != 0;
+        unsigned head = os_load_acquire(&vcd->head);
+        if (head == tail) {
+            if (is_closing) break;
+            SleepMillisec(1);
+            continue;
+        }
+
+        unsigned i = tail & (VCD_NUM_BUFFERS - 1);
+        fwrite(vcd->bufs + i * VCD_BUFFER_BYTES, 1, vcd->buf_used[i], vcd->file);
+        tail++;
+        os_store_release(&vcd->tail, tail);
+    }
+}
+
+// Hands the buffer being filled to the flush thread, and waits for the next
+// one to be free
+static void flush(vcd_t *vcd) {
+    // Only this thread stores to head
+    unsigned head = vcd->head + 1;
+    os_store_release(&vcd->head, head);
+    if (head - os_load_acquire(&vcd->tail) == VCD_NUM_BUFFERS) {
+        vcd->num_stalls++;
+        while (head - os_load_acquire(&vcd->tail) == VCD_NUM_BUFFERS)
+            SleepMillisec(1);
+    }
+
+    unsigned i = head & (VCD_NUM_BUFFERS - 1);
+    vcd->buf = vcd->bufs + i * VCD_BUFFER_BYTES;
+    vcd->buf_used[i] = 0;
+}
+
+static char *reserve(vcd_t *vcd) {
+    int *used = &vcd->buf_used[vcd->head & (VCD_NUM_BUFFERS - 1)];
+    if (*used > VCD_BUFFER_BYTES - MAX_WRITE_BYTES) {
+        flush(vcd);
+        used = &vcd->buf_used[vcd->head & (VCD_NUM_BUFFERS - 1)];
+    }
+    return vcd->buf + *used;
+}
+
+static void commit(vcd_t *vcd, char *end) {
+    vcd->buf_used[vcd->head & (VCD_NUM_BUFFERS - 1)] = (int)(end - vcd->buf);
+}
+
+// Identifier codes are printable characters from '!'
+static char *write_id(char *p, int var) {
+    *p++ = (char)('!' + var);
+    return p;
+}
+
+static char *write_u64(char *p, uint64_t n) {
+    char digits[20];
+    int num_digits = 0;
+    do {
+        digits[num_digits++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (num_digits)
+        *p++ = digits[--num_digits];
+    return p;
+}
+
+static char *write_value(char *p, vcd_var_t const *v, int var) {
+    if (v->width == 1) {
+        *p++ = (char)('0' + (v->val & 1));
+    }
+    else {
+        *p++ = 'b';
+        for (int bit = v->width - 1; bit >= 0; bit--)
+            *p++ = (char)('0' + ((v->val >> bit) & 1));
+        *p++ = ' ';
+    }
+    p = write_id(p, var);
+    *p++ = '\n';
+    return p;
+}
+
+static char *write_time(vcd_t *vcd, char *p) {
+    *p++ = '#';
+    p = write_u64(p, (uint64_t)(vcd->time * vcd->ns_per_tick + 0.5));
+    *p++ = '\n';
+    return p;
+}
+
+
+// ****************************************************************************
+// Public functions
+// ****************************************************************************
+
+bool vcd_init(vcd_t *vcd, FILE *file, double tick_rate_hz) {
+    memset(vcd, 0, sizeof(*vcd));
+    vcd->file = file;
+    vcd->ns_per_tick = 1e9 / tick_rate_hz;
+    vcd->bufs = (char *)malloc(VCD_NUM_BUFFERS * VCD_BUFFER_BYTES);
+    vcd->buf = vcd->bufs;
+    vcd->thread = os_thread_create(flush_thread_main, vcd);
+    if (!vcd->thread) {
+        free(vcd->bufs);
+        memset(vcd, 0, sizeof(*vcd));
+        return false;
+    }
+    return true;
+}
+
+void vcd_free(vcd_t *vcd) {
+    if (!vcd->thread) return;
+    os_store_release(&vcd->head, vcd->head + 1);
+    os_store_release(&vcd->is_closing, 1);
+    os_thread_join(vcd->thread);
+    free(vcd->bufs);
+    memset(vcd, 0, sizeof(*vcd));
+}
+
+int vcd_add_var(vcd_t *vcd, char const *name, int width, unsigned initial_val) {
+    if (vcd->num_vars == VCD_MAX_VARS) return -1;
+    vcd_var_t *v = &vcd->vars[vcd->num_vars];
+    strncpy(v->name, name, VCD_MAX_NAME_LEN - 1);
+    v->name[VCD_MAX_NAME_LEN - 1] = '\0';
+    v->width = width;
+    v->val = initial_val;
+    return vcd->num_vars++;
+}
+
+void vcd_begin(vcd_t *vcd, unsigned tick) {
+    // The flush thread only touches the file once a buffer is handed to it,
+    // and none can be until this has returned
+    fprintf(vcd->file, "$timescale 1 ns $end\n");
+    fprintf(vcd->file, "$scope module klr $end\n");
+    for (int i = 0; i < vcd->num_vars; i++) {
+        vcd_var_t const *v = &vcd->vars[i];
+        if (v->width == 1)
+            fprintf(vcd->file, "$var wire 1 %c %s $end\n", '!' + i, v->name);
+        else
+            fprintf(vcd->file, "$var wire %d %c %s [%d:0] $end\n", v->width, '!' + i, v->name, v->width - 1);
+    }
+    fprintf(vcd->file, "$upscope $end\n");
+    fprintf(vcd->file, "$enddefinitions $end\n");
+
+    vcd->time = tick;
+    char *p = write_time(vcd, reserve(vcd));
+    commit(vcd, p);
+    vcd->is_time_written = true;
+
+    p = reserve(vcd);
+    memcpy(p, "$dumpvars\n", 10);
+    commit(vcd, p + 10);
+    for (int i = 0; i < vcd->num_vars; i++)
+        commit(vcd, write_value(reserve(vcd), &vcd->vars[i], i));
+    p = reserve(vcd);
+    memcpy(p, "$end\n", 5);
+    commit(vcd, p + 5);
+
+    vcd->has_begun = true;
+}
+
+void vcd_change(vcd_t *vcd, int var, unsigned tick, unsigned val) {
+    vcd_var_t *v = &vcd->vars[var];
+    if (v->width < 32)
+        val &= (1u << v->width) - 1;
+    if (val == v->val) return;
+    v->val = val;
+    if (!vcd->has_begun) return;
+
+    // Extend the tick to 64 bits, taking it to be within 2^31 of the last
+    int delta = (int)(tick - (unsigned)vcd->time);
+    if (delta > 0) {
+        vcd->time += delta;
+        vcd->is_time_written = false;
+    }
+
+    char *p = reserve(vcd);
+    if (!vcd->is_time_written) {
+        p = write_time(vcd, p);
+        vcd->is_time_written = true;
+    }
+    commit(vcd, write_value(p, v, var));
+}
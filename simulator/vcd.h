@@ -0,0 +1,79 @@
+#pragma once
+
+#include "os.h"
+#include "types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+// Writes a Value Change Dump file, the waveform format that GTKWave and most
+// logic simulators read.
+//
+// The variables are declared first, then vcd_begin() writes the header and
+// their initial values. After that, each call to vcd_change() adds a change,
+// if the value is different from before. Changes must be added in time order.
+//
+// Output is formatted by hand into a large buffer. Each time it fills, it is
+// handed to a flush thread, which writes it with one fwrite() while the next
+// buffer is filled, so a long run can be traced without the simulation
+// waiting on the disk.
+//
+// Times are in ticks of a clock of the given rate, and are written in
+// nanoseconds. Ticks are 32-bit and are extended to 64 bits internally, so
+// the file can span more than the 2^32 ticks that master_clk wraps in.
+
+enum {
+    VCD_MAX_VARS = 32,
+    VCD_MAX_NAME_LEN = 32,
+    VCD_BUFFER_BYTES = 1 << 20,
+    VCD_NUM_BUFFERS = 4     // A power of two
+};
+
+typedef struct {
+    char name[VCD_MAX_NAME_LEN];
+    int width;              // In bits. 1 to 32.
+    unsigned val;
+} vcd_var_t;
+
+typedef struct {
+    FILE *file;             // Owned by the caller
+    double ns_per_tick;
+    vcd_var_t vars[VCD_MAX_VARS];
+    int num_vars;
+    bool has_begun;
+
+    uint64_t time;          // Of the last change, in ticks
+    bool is_time_written;   // Whether the "#time" line for time has been written
+
+    os_thread_t *thread;
+
+    // A ring of buffers with one producer, vcd_change(), and one consumer, the
+    // flush thread. head and tail count the buffers filled and written. Each
+    // is only stored to by its own side.
+    char *bufs;
+    int buf_used[VCD_NUM_BUFFERS];
+    unsigned volatile head;
+    unsigned volatile tail;
+    unsigned volatile is_closing;
+
+    char *buf;              // The one being filled, bufs[head]
+    unsigned num_stalls;    // Times the ring was full and a change had to wait
+} vcd_t;
+
+
+// Starts the flush thread. Returns false if it couldn't.
+bool vcd_init(vcd_t *vcd, FILE *file, double tick_rate_hz);
+
+// Waits for the flush thread to write everything, but doesn't close the file.
+void vcd_free(vcd_t *vcd);
+
+// Must be called before vcd_begin(). Returns the variable's index, for passing
+// to vcd_change(), or -1 if there are already VCD_MAX_VARS.
+int vcd_add_var(vcd_t *vcd, char const *name, int width, unsigned initial_val);
+
+// Writes the header and the initial values, at the given time.
+void vcd_begin(vcd_t *vcd, unsigned tick);
+
+// A time before the last change's is treated as equal to it.
+void vcd_change(vcd_t *vcd, int var, unsigned tick, unsigned val);
@@ -4,10 +4,9 @@
 // This project's headers
 #include "cpu.h"
 #include "graph.h"
-
-// Deadfrog headers
-#include "df_font.h"
-#include "df_window.h"
+#include "journal.h"
+#include "trace.h"
+#include "vcd.h"
 
 // Standard headers
 #include <math.h>
@@ -17,19 +16,60 @@ static double const MIN_ENGINE_RPM = 850;
 static double const MAX_ENGINE_RPM = 6500;
 static double const MAX_TURBO_RPM = 200000;
 
+enum { ADC_CONVERSION_CYCLES = 10 };    // 14 us, from the datasheet
+
+// Types of event in car->events. They are all crank events, in the order
+// they happen in each cylinder's cycle.
+enum {
+    EVENT_RESET,
+    EVENT_DWELL_START,
+    EVENT_DWELL_END,
+    EVENT_CYLINDER_END,
+    NUM_CRANK_EVENTS
+};
+
+// Crank angle, in degrees, of each crank event:
+// * -80 degrees: Reset the CPU
+// * -33 degrees: Start of ignition dwell period (coil starts charging up)
+// * -30 degrees: End of ignition dwell period (spark fires)
+// * +90 degrees: End of cycle for this cylinder. Move to next cylinder.
+//
+// Notes:
+// 1. The start of the dwell period varies by +/- 10 degrees depending on RPM and load.
+// 2. The dwell period should be 3ms, not a constant amount of crank rotation.
+static double const s_crank_event_angles[NUM_CRANK_EVENTS] = { -80.0, -33.0, -30.0, 90.0 };
+
 
-unsigned g_adc_latched_address;
-unsigned g_adc_latch_cycle;
 VirtualCar g_virtual_car;
-static bool g_t1;
 
 
-u8 cpu_t0_read(void) {
+static void add_graph_point(VirtualCar *car, graph_id_t id, unsigned time, u8 val) {
+    if (car->record_graphs)
+        graph_add_point(id, time, val);
+}
+
+static void add_vcd_change(VirtualCar *car, int var, unsigned time, unsigned val) {
+    if (car->vcd)
+        vcd_change(car->vcd, var, time, val);
+}
+
+static void add_trace_record(VirtualCar *car, trace_type_t type, u8 arg, u8 val) {
+    if (car->trace)
+        trace_add(car->trace, car->cpu->master_clk, type, arg, val);
+}
+
+static void add_journal_entry(VirtualCar *car, unsigned clk, journal_type_t type, u8 arg, uint16_t val) {
+    if (car->journal)
+        journal_add(car->journal, clk, type, arg, val);
+}
+
+static u8 klr_t0_read(cpu_t *cpu) {
     return 0;
 }
 
-u8 cpu_t1_read(void) {
-    return g_t1;
+static u8 klr_t1_read(cpu_t *cpu) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
+    return car->t1;
 }
 
 static u8 get_graph_val_from_bit_n(u8 val, int n) {
@@ -37,141 +77,317 @@ static u8 get_graph_val_from_bit_n(u8 val, int n) {
     return (val & 1) * 255;
 }
 
-void cpu_port1_write(cpu_t *cpu, u8 val) {
+static void klr_port1_write(cpu_t *cpu, u8 val) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
     u8 changes = cpu->p1 ^ val;
+    add_vcd_change(car, VCD_P1, cpu->master_clk, val);
+    if (changes)
+        add_trace_record(car, TRACE_PORT1_WRITE, 0, val);
+    add_vcd_change(car, VCD_ADC_ALE, cpu->master_clk, (val >> 3) & 1);
 
     if ((changes & 0x08) && (val & 0x08)) {
         // ADC ALE
-        g_adc_latched_address = val & 7;
-        g_adc_latch_cycle = cpu->master_clk;
+        car->adc_latched_address = val & 7;
+        car->adc_latch_cycle = cpu->master_clk;
+        add_vcd_change(car, VCD_ADC_MUX, cpu->master_clk, car->adc_latched_address);
     }
     if (changes & 0x10) {
         // Cycling valve changed
-        graph_add_point(FROM_KLR_CYCLING_VALVE_PWM, cpu->master_clk, get_graph_val_from_bit_n(cpu->p1, 4));
-        graph_add_point(FROM_KLR_CYCLING_VALVE_PWM, cpu->master_clk, get_graph_val_from_bit_n(val, 4));
+        add_graph_point(car, FROM_KLR_CYCLING_VALVE_PWM, cpu->master_clk, get_graph_val_from_bit_n(cpu->p1, 4));
+        add_graph_point(car, FROM_KLR_CYCLING_VALVE_PWM, cpu->master_clk, get_graph_val_from_bit_n(val, 4));
     }
     if (changes & 0x20) {
         // Full load signal changed
-        graph_add_point(FROM_KLR_FULL_LOAD_SIGNAL, cpu->master_clk, get_graph_val_from_bit_n(cpu->p1, 5));
-        graph_add_point(FROM_KLR_FULL_LOAD_SIGNAL, cpu->master_clk, get_graph_val_from_bit_n(val, 5));
+        add_graph_point(car, FROM_KLR_FULL_LOAD_SIGNAL, cpu->master_clk, get_graph_val_from_bit_n(cpu->p1, 5));
+        add_graph_point(car, FROM_KLR_FULL_LOAD_SIGNAL, cpu->master_clk, get_graph_val_from_bit_n(val, 5));
     }
 }
 
-void cpu_port2_write(cpu_t *cpu, u8 val) {
+static void klr_port2_write(cpu_t *cpu, u8 val) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
     u8 changes = cpu->p2 ^ val;
+    add_vcd_change(car, VCD_P2, cpu->master_clk, val);
+    if (changes)
+        add_trace_record(car, TRACE_PORT2_WRITE, 0, val);
 
     if (changes & 0x10) {
         // Blink code changed
-        graph_add_point(FROM_KLR_BLINK_CODE, cpu->master_clk, get_graph_val_from_bit_n(cpu->p2, 4));
-        graph_add_point(FROM_KLR_BLINK_CODE, cpu->master_clk, get_graph_val_from_bit_n(val, 4));
+        add_graph_point(car, FROM_KLR_BLINK_CODE, cpu->master_clk, get_graph_val_from_bit_n(cpu->p2, 4));
+        add_graph_point(car, FROM_KLR_BLINK_CODE, cpu->master_clk, get_graph_val_from_bit_n(val, 4));
     }
 }
 
-u8 cpu_external_mem_read(cpu_t *cpu, u8 addr) {
-    if (cpu->pc == 0x44d)
-        cpu->master_clk = cpu->master_clk;
-
-    double conversion_time = 14e-6; // In seconds. From datasheet.
-    unsigned data_ready_time = g_adc_latch_cycle + CPU_CLOCK_RATE_HZ * conversion_time;
-    if ((unsigned)cpu->master_clk < data_ready_time)
-        data_ready_time = data_ready_time; // Error. Output accessed before it was ready.
-
-    switch (g_adc_latched_address) {
-    case 0: // Knock sensor noise level
-        return 0;
-    case 1: // Battery voltage
-        return 200;
-    case 2: // ?
-        return 0;
-    case 3: // Throttle position sensor supply voltage
-        return 40;
-    case 4: // Manifold air pressure
-        return g_virtual_car.manifold_pressure * 127;
-    case 5: // Knock sensor integrator
-        return 0;
-    case 6: // 6 kOhm to ground
-        return 0;
-    case 7: // Throttle position sensor angle
-        return g_virtual_car.throttle_pos * 255;
-    }
+// Works out what the ADC would convert each of its inputs to, from the
+// physics sim's outputs
+static void get_adc_inputs(VirtualCar const *car, u8 *inputs) {
+    inputs[0] = 0;                                  // Knock sensor noise level
+    inputs[1] = 200;                                // Battery voltage
+    inputs[2] = 0;                                  // ?
+    inputs[3] = 40;                                 // Throttle position sensor supply voltage
+    inputs[4] = (u8)(car->manifold_pressure * 127); // Manifold air pressure
+    inputs[5] = 0;                                  // Knock sensor integrator
+    inputs[6] = 0;                                  // 6 kOhm to ground
+    inputs[7] = (u8)(car->throttle_pos * 255);      // Throttle position sensor angle
+}
 
-    return 0;
+static void set_adc_input(VirtualCar *car, int channel, u8 val) {
+    if (val == car->adc_inputs[channel]) return;
+    car->adc_inputs[channel] = val;
+    add_journal_entry(car, car->cpu->master_clk, JOURNAL_ADC_INPUT, (u8)channel, val);
 }
 
-void vc_init() {
-    g_virtual_car.throttle_pos = 0;
+static void add_journal_throttle_pos(VirtualCar *car) {
+    car->journaled_throttle_pos = car->throttle_pos;
+    add_journal_entry(car, car->cpu->master_clk, JOURNAL_THROTTLE, 0, (uint16_t)(car->throttle_pos * 65535.0 + 0.5));
+}
 
-    g_virtual_car.engine_rpm = 2500;
-    g_virtual_car.crank_angle = 0;
-    g_virtual_car.turbo_rpm = 0;
-    g_virtual_car.manifold_pressure = 0;
-    g_virtual_car.engine_power = 0;
+static u8 klr_external_mem_read(cpu_t *cpu, u8 addr) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
+    // The real ADC would still be converting, so the value read could be wrong
+    if (event_time_before(cpu->master_clk, car->adc_latch_cycle + ADC_CONVERSION_CYCLES))
+        car->num_early_adc_reads++;
 
-    g_virtual_car.advance_period_residual = 0;
+    u8 val = car->adc_inputs[car->adc_latched_address & 7];
+    add_vcd_change(car, VCD_ADC_DATA, cpu->master_clk, val);
+    add_trace_record(car, TRACE_ADC_READ, (u8)car->adc_latched_address, val);
+    return val;
 }
 
-#define DRAW_TEXT(x, y, msg, ...) \
-    DrawTextLeft(g_defaultFont, g_colourBlack, g_window->bmp, x, y, msg, ##__VA_ARGS__)
+static void klr_external_mem_write(cpu_t *cpu, u8 addr, u8 val) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
+    car->num_ext_mem_writes++;
+    add_trace_record(car, TRACE_EXT_MEM_WRITE, addr, val);
+}
 
-void vc_draw_state(int _x, int _y) {
-    cpu_t *cpu = cpu_get();
+static void klr_irq_entered(cpu_t *cpu, int source) {
+    VirtualCar *car = (VirtualCar *)cpu->user_data;
+    add_trace_record(car, TRACE_IRQ_ENTRY, (u8)source, 0);
+}
 
-    int x = _x + g_defaultFont->maxCharWidth;
-    int y = _y + g_defaultFont->charHeight / 2;
-    DRAW_TEXT(x, y, "Virtual Car Simulation Parameters");
-    DRAW_TEXT(x+1, y, "Virtual Car Simulation Parameters");
-    x += g_defaultFont->maxCharWidth;
-    y += g_defaultFont->charHeight * 1.2;
-    x += DRAW_TEXT(x, y, "Engine RPM:%.0f  ", g_virtual_car.engine_rpm);
-    x += DRAW_TEXT(x, y, "Throttle Pos:%d%%  ", (int)(g_virtual_car.throttle_pos*100.0));
-    x += DRAW_TEXT(x, y, "Turbo KRPM:%.0f  ", g_virtual_car.turbo_rpm / 1e3);
-    x += DRAW_TEXT(x, y, "Crank angle:%.2f  ", g_virtual_car.crank_angle);
+static cpu_callbacks_t const s_klr_callbacks = {
+    klr_t0_read,
+    klr_t1_read,
+    klr_port1_write,
+    klr_port2_write,
+    klr_external_mem_read,
+    klr_external_mem_write,
+    klr_irq_entered
+};
+
+static double get_crank_degrees_per_second(VirtualCar const *car) {
+    return (car->engine_rpm / 60.0) * 360.0;
+}
 
-    x = _x + g_defaultFont->maxCharWidth * 2;
-    y += g_defaultFont->charHeight * 1.2;
-    x += DRAW_TEXT(x, y, "Manifold pressure:%.2f bar  ", g_virtual_car.manifold_pressure);
-    x += DRAW_TEXT(x, y, "Engine power:%.0f BHP  ", g_virtual_car.engine_power);
-    x += DRAW_TEXT(x, y, "RealTime:%4.1fms  ", cpu->master_clk * CPU_CLOCK_PERIOD * 1e3);
-    y += g_defaultFont->charHeight * 1.7;
-    HLine(g_window->bmp, 0, y, g_window->bmp->width, g_colourBlack);
+// Schedules the crank event of the given type, relative to the previous one.
+// Uses the current engine speed.
+static void schedule_crank_event(VirtualCar *car, int type) {
+    double degrees = s_crank_event_angles[type] - car->last_crank_angle;
+    if (degrees <= 0.0)
+        degrees += 180.0;   // It's in the next cylinder's cycle
+    double cycles = degrees * CPU_CLOCK_RATE_HZ / get_crank_degrees_per_second(car);
+    event_queue_push(&car->events, car->last_crank_event_clk + (unsigned)(cycles + 0.5), type);
 }
 
-void signal_reset() {
-    cpu_t *cpu = cpu_get();
-    cpu_reset();
-    graph_add_point(TO_KLR_RESET, cpu->master_clk, 0);
-    graph_add_point(TO_KLR_RESET, cpu->master_clk, 255);
-    graph_add_point(TO_KLR_RESET, cpu->master_clk + 1, 255);
-    graph_add_point(TO_KLR_RESET, cpu->master_clk + 1, 0);
+void vc_init(VirtualCar *car) {
+    car->throttle_pos = 0;
+
+    car->engine_rpm = 2500;
+    car->crank_angle = 0;
+    car->turbo_rpm = 0;
+    car->manifold_pressure = 0;
+    car->engine_power = 0;
+
+    car->advance_period_residual = 0;
+    car->advance_cycles_residual = 0;
+
+    car->cpu = cpu_create(&s_klr_callbacks, car);
+    car->t1 = false;
+    car->adc_latched_address = 0;
+    car->adc_latch_cycle = 0;
+    car->num_early_adc_reads = 0;
+    car->num_ext_mem_writes = 0;
+    car->record_graphs = false;
+    car->vcd = NULL;
+    car->trace = NULL;
+    car->journal = NULL;
+    car->replay = NULL;
+    car->replay_pos = 0;
+    car->journaled_throttle_pos = car->throttle_pos;
+    get_adc_inputs(car, car->adc_inputs);
+
+    event_queue_init(&car->events);
+    car->end_clk = car->cpu->master_clk;
+    car->last_crank_event_clk = car->cpu->master_clk;
+    car->last_crank_angle = car->crank_angle;
+    schedule_crank_event(car, EVENT_CYLINDER_END);
 }
 
-void signal_dwell_start() {
-    cpu_t *cpu = cpu_get();
-    g_t1 = 1;
-    graph_add_point(TO_KLR_IGNTION, cpu->master_clk, 0);
-    graph_add_point(TO_KLR_IGNTION, cpu->master_clk, 255);
+void vc_destroy(VirtualCar *car) {
+    cpu_destroy(car->cpu);
+    car->cpu = NULL;
 }
 
-void signal_dwell_end() {
-    cpu_t *cpu = cpu_get();
-    g_t1 = 0;
-    cpu->irq_state = 1; // Dodgy. There should be an interface function in the cpu module that we can call to do this.
-    graph_add_point(TO_KLR_IGNTION, cpu->master_clk, 255);
-    graph_add_point(TO_KLR_IGNTION, cpu->master_clk, 0);
+void vc_snapshot(VirtualCar const *car, vc_snapshot_t *snapshot) {
+    snapshot->car = *car;
+    cpu_snapshot(car->cpu, &snapshot->cpu);
+    if (car->record_graphs)
+        graph_snapshot(&snapshot->graphs);
 }
 
-void vc_advance(double advance_period_seconds) {
-    VirtualCar *car = &g_virtual_car;
+void vc_restore(VirtualCar *car, vc_snapshot_t const *snapshot) {
+    cpu_t *cpu = car->cpu;
+    vcd_t *vcd = car->vcd;
+    trace_writer_t *trace = car->trace;
+    journal_t *journal = car->journal;
+    *car = snapshot->car;
+    car->cpu = cpu;
+    car->vcd = vcd;
+    car->trace = trace;
+    car->journal = journal;
+    cpu_restore(cpu, &snapshot->cpu);
+    if (car->record_graphs)
+        graph_restore(&snapshot->graphs);
+}
 
-    // 
-    for (int i = 0; i < g_window->input.numKeysTyped; i++) {
-        char key = g_window->input.keysTyped[i];
-        if (key >= KEY_1 && key <= KEY_9) {
-            car->throttle_pos = (key - KEY_1) / 8.0f;
+void vc_start_vcd(VirtualCar *car, vcd_t *vcd) {
+    cpu_t *cpu = car->cpu;
+    static char const *names[NUM_VCD_VARS] = {
+        "p1", "p2", "t0", "t1", "irq", "reset", "adc_ale", "adc_mux", "adc_data"
+    };
+    static int const widths[NUM_VCD_VARS] = { 8, 8, 1, 1, 1, 1, 1, 3, 8 };
+    unsigned initial_vals[NUM_VCD_VARS] = {
+        cpu->p1, cpu->p2, klr_t0_read(cpu), car->t1, cpu->irq_state, 0,
+        (cpu->p1 >> 3) & 1u, car->adc_latched_address, 0
+    };
+    for (int i = 0; i < NUM_VCD_VARS; i++)
+        vcd_add_var(vcd, names[i], widths[i], initial_vals[i]);
+    vcd_begin(vcd, cpu->master_clk);
+    car->vcd = vcd;
+}
+
+void vc_start_recording(VirtualCar *car, journal_t *journal) {
+    car->journal = journal;
+    add_journal_throttle_pos(car);
+    for (int i = 0; i < 8; i++)
+        journal_add(journal, car->cpu->master_clk, JOURNAL_ADC_INPUT, (u8)i, car->adc_inputs[i]);
+}
+
+// The journal has no engine speed, so while replaying it is worked out from
+// the time from the spark in the entry at spark_pos to the next one. There is
+// a spark every 180 degrees. After the last spark, engine_rpm is left alone.
+static void set_replay_engine_rpm(VirtualCar *car, unsigned spark_pos) {
+    journal_t const *j = car->replay;
+    for (unsigned i = spark_pos + 1; i < j->num_entries; i++) {
+        if (j->entries[i].type != JOURNAL_DWELL_END) continue;
+        unsigned cycles = j->entries[i].clk - j->entries[spark_pos].clk;
+        if (cycles > 0)
+            car->engine_rpm = 30.0 * CPU_CLOCK_RATE_HZ / cycles;
+        return;
+    }
+}
+
+void vc_start_replay(VirtualCar *car, journal_t const *journal) {
+    // The crank events come from the journal instead
+    event_queue_init(&car->events);
+    car->replay = journal;
+    car->replay_pos = 0;
+
+    // Until the first spark, use the speed between the first two
+    for (unsigned i = 0; i < journal->num_entries; i++) {
+        if (journal->entries[i].type == JOURNAL_DWELL_END) {
+            set_replay_engine_rpm(car, i);
+            break;
         }
     }
+}
+
+static void signal_reset(VirtualCar *car) {
+    cpu_t *cpu = car->cpu;
+    add_journal_entry(car, cpu->master_clk, JOURNAL_RESET, 0, 0);
+    add_vcd_change(car, VCD_RESET, cpu->master_clk, 1);
+    add_trace_record(car, TRACE_RESET, 0, 0);
+    cpu_reset(cpu);
+    add_vcd_change(car, VCD_RESET, cpu->master_clk + 1, 0);
+    add_graph_point(car, TO_KLR_RESET, cpu->master_clk, 0);
+    add_graph_point(car, TO_KLR_RESET, cpu->master_clk, 255);
+    add_graph_point(car, TO_KLR_RESET, cpu->master_clk + 1, 255);
+    add_graph_point(car, TO_KLR_RESET, cpu->master_clk + 1, 0);
+}
+
+static void signal_dwell_start(VirtualCar *car) {
+    cpu_t *cpu = car->cpu;
+    car->t1 = 1;
+    add_journal_entry(car, cpu->master_clk, JOURNAL_DWELL_START, 0, 0);
+    add_vcd_change(car, VCD_T1, cpu->master_clk, 1);
+    add_trace_record(car, TRACE_T1, 0, 1);
+    add_graph_point(car, TO_KLR_IGNTION, cpu->master_clk, 0);
+    add_graph_point(car, TO_KLR_IGNTION, cpu->master_clk, 255);
+}
+
+static void signal_dwell_end(VirtualCar *car) {
+    cpu_t *cpu = car->cpu;
+    car->t1 = 0;
+    add_journal_entry(car, cpu->master_clk, JOURNAL_DWELL_END, 0, 0);
+    cpu_raise_irq(cpu);
+    add_vcd_change(car, VCD_T1, cpu->master_clk, 0);
+    add_vcd_change(car, VCD_IRQ, cpu->master_clk, cpu->irq_state);
+    add_trace_record(car, TRACE_T1, 0, 0);
+    add_trace_record(car, TRACE_IRQ_LINE, 0, cpu->irq_state);
+    add_graph_point(car, TO_KLR_IGNTION, cpu->master_clk, 255);
+    add_graph_point(car, TO_KLR_IGNTION, cpu->master_clk, 0);
+}
 
-    // Run car+engine physics
+static void handle_event(VirtualCar *car, event_t const *e) {
+    switch (e->type) {
+    case EVENT_RESET:
+        signal_reset(car);
+        break;
+    case EVENT_DWELL_START:
+        signal_dwell_start(car);
+        break;
+    case EVENT_DWELL_END:
+        signal_dwell_end(car);
+        break;
+    case EVENT_CYLINDER_END:
+        break;
+    }
+
+    // Schedule the next crank event
+    car->last_crank_event_clk = e->time;
+    car->last_crank_angle = s_crank_event_angles[e->type];
+    schedule_crank_event(car, (e->type + 1) % NUM_CRANK_EVENTS);
+}
+
+static void apply_replay_entry(VirtualCar *car, journal_entry_t const *e) {
+    switch (e->type) {
+    case JOURNAL_THROTTLE:
+        car->throttle_pos = e->val / 65535.0;
+        break;
+    case JOURNAL_RESET:
+        signal_reset(car);
+        break;
+    case JOURNAL_DWELL_START:
+        signal_dwell_start(car);
+        break;
+    case JOURNAL_DWELL_END:
+        signal_dwell_end(car);
+        set_replay_engine_rpm(car, (unsigned)(e - car->replay->entries));
+        car->last_crank_event_clk = car->cpu->master_clk;
+        car->last_crank_angle = s_crank_event_angles[EVENT_DWELL_END];
+        break;
+    case JOURNAL_ADC_INPUT:
+        set_adc_input(car, e->arg & 7, (u8)e->val);
+        break;
+    }
+}
+
+static journal_entry_t const *get_next_replay_entry(VirtualCar const *car) {
+    if (!car->replay || car->replay_pos == car->replay->num_entries)
+        return NULL;
+    return &car->replay->entries[car->replay_pos];
+}
+
+static void run_physics(VirtualCar *car, double advance_period_seconds) {
     double advance_period = advance_period_seconds + car->advance_period_residual;
     double step_period = 0.01;
     for (; advance_period > step_period; advance_period -= step_period) {
@@ -199,84 +415,96 @@ void vc_advance(double advance_period_seconds) {
         }
     }
     car->advance_period_residual = advance_period;
+}
 
-    // This function, vc_advance() is passed different values of 
+// Sets the clock that the CPU is to be run up to in this advance period
+static void set_end_clk(VirtualCar *car, double advance_period_seconds) {
+    // vc_advance() is passed different values of 
     // advance_period_seconds, depending on whether the simulation
     // is running in real time, or slowed down. In real time,
     // advance_period_seconds will be about 16ms (assuming the program's
     // window is on a monitor with a 60 Hz refresh rate). If we're
     // running slowed down by a factor of a million, then 
     // advance_period_seconds will be 16ns. In this case, we only
-    // execute a single instruction once every ~50 calls. We need
-    // to cope with this extremes.
-
-    // If a reset or ignition interrupt signal that we generate occurs
-    // during this advance period. If so, we should execute instructions
-    // until it is time to send the signal, send it, then resume executing
-    // instructions. That way the CPU simulation will see our signals at
-    // exactly the right time.
-    // 
+    // execute a single instruction once every ~50 calls. The fraction
+    // of a cycle left over each time is carried into the next call.
+    double period_cycles = advance_period_seconds * CPU_CLOCK_RATE_HZ + car->advance_cycles_residual;
+    unsigned num_cycles = (unsigned)period_cycles;
+    car->advance_cycles_residual = period_cycles - num_cycles;
+    car->end_clk += num_cycles;
+}
+
+// Sets up the KLR's inputs for the period, from the physics sim unless
+// replaying, and the clock that the CPU is to be run up to
+static void start_period(VirtualCar *car, double advance_period_seconds) {
+    if (!car->replay) {
+        run_physics(car, advance_period_seconds);
+        if (car->journal && car->throttle_pos != car->journaled_throttle_pos)
+            add_journal_throttle_pos(car);
+
+        u8 inputs[8];
+        get_adc_inputs(car, inputs);
+        for (int i = 0; i < 8; i++)
+            set_adc_input(car, i, inputs[i]);
+    }
+
+    set_end_clk(car, advance_period_seconds);
+}
+
+// The CPU must stop at the next event, the next replayed input or the end of
+// the period, whichever is first
+static unsigned get_stop_clk(VirtualCar const *car) {
+    unsigned stop_clk = car->end_clk;
+    event_t const *e = event_queue_peek(&car->events);
+    if (e && event_time_before(e->time, stop_clk))
+        stop_clk = e->time;
+    journal_entry_t const *r = get_next_replay_entry(car);
+    if (r && event_time_before(r->clk, stop_clk))
+        stop_clk = r->clk;
+    return stop_clk;
+}
+
+// Handles everything that is now due. Events can schedule further events.
+// Returns true when the CPU has reached end_clk.
+static bool handle_due_events(VirtualCar *car) {
+    event_t const *e;
+    while ((e = event_queue_peek(&car->events)) &&
+           !event_time_before(car->cpu->master_clk, e->time)) {
+        event_t due = event_queue_pop(&car->events);
+        handle_event(car, &due);
+    }
+
+    journal_entry_t const *r;
+    while ((r = get_next_replay_entry(car)) && !event_time_before(car->cpu->master_clk, r->clk)) {
+        car->replay_pos++;
+        apply_replay_entry(car, r);
+    }
+
+    return !event_time_before(car->cpu->master_clk, car->end_clk);
+}
+
+// Works out where the crank has got to, for display
+static void update_crank_angle(VirtualCar *car) {
+    unsigned cycles_since_crank_event = car->cpu->master_clk - car->last_crank_event_clk;
+    car->crank_angle = car->last_crank_angle +
+        cycles_since_crank_event * get_crank_degrees_per_second(car) / CPU_CLOCK_RATE_HZ;
+    if (car->crank_angle > 90.0)
+        car->crank_angle -= 180.0;
+}
+
+void vc_advance(VirtualCar *car, double advance_period_seconds) {
+    start_period(car, advance_period_seconds);
+
+    // The CPU is run up to each event in car->events in turn, so that
+    // the CPU simulation sees our signals at exactly the right time.
+    //
     // At 850 RPM, the time between ignition events is 35ms.
     // At 6500 RPM, the time between ignition events is 4.6ms.
-
-    double engine_speed_degrees_per_second = (car->engine_rpm / 60.0) * 360.0;
-    double advance_period_cycles = advance_period_seconds * CPU_CLOCK_RATE_HZ;
-    double target_crank_angle = car->crank_angle + engine_speed_degrees_per_second * advance_period_seconds;
-    for (int cycle = 0; cycle < advance_period_cycles;) {
-        // There are four crank angles that require us to end a block of CPU execution:
-        // * -80 degrees: Reset the CPU
-        // * -33 degrees: Start of ignition dwell period (coil starts charging up)
-        // * -30 degrees: End of ignition dwell period (spark fires)
-        // * +90 degrees: End of cycle for this cylinder. Move to next cylinder.
-        //
-        // Notes:
-        // 1. The start of the dwell period varies by +/- 10 degrees depending on RPM and load.
-        // 2. The dwell period should be 3ms, not a constant amount of crank rotation.
-        // 3. There's no requirement to end the block of CPU execution when we reach +80
-        //    degrees, but it makes the logic simpler.
-
-        if (car->crank_angle < -80.0 && target_crank_angle > -80.0) {
-            // Need to generate a reset
-            double degrees_until_reset = -80.0 - car->crank_angle;
-            int cycles_until_reset = CPU_CLOCK_RATE_HZ * degrees_until_reset /
-                engine_speed_degrees_per_second;
-            cpu_execute(cycles_until_reset);
-            cycle += cycles_until_reset;
-            car->crank_angle = -80.0;
-            signal_reset();
-        }
-        else if (car->crank_angle < -33.0 && target_crank_angle > -33.0) {
-            // Need to signal start of dwell period
-            double degrees_until_dwell_start = -33.0 - car->crank_angle;
-            int cycles_until_dwell_start = CPU_CLOCK_RATE_HZ * degrees_until_dwell_start /
-                engine_speed_degrees_per_second;
-            cpu_execute(cycles_until_dwell_start);
-            cycle += cycles_until_dwell_start;
-            car->crank_angle = -33.0;
-            signal_dwell_start();
-        }
-        else if (car->crank_angle < -30.0 && target_crank_angle > -30.0) {
-            // Need to signal end of dwell period
-            double degrees_until_dwell_end = -30.0 - car->crank_angle;
-            int cycles_until_dwell_end = CPU_CLOCK_RATE_HZ * degrees_until_dwell_end /
-                engine_speed_degrees_per_second;
-            cpu_execute(cycles_until_dwell_end);
-            cycle += cycles_until_dwell_end;
-            car->crank_angle = -30.0;
-            signal_dwell_end();
-        }
-        else if (car->crank_angle < 90.0 && target_crank_angle > 90.0) {
-            double degrees_until_90 = 90.0 - car->crank_angle;
-            int cycles_until_80 = CPU_CLOCK_RATE_HZ * degrees_until_90 / engine_speed_degrees_per_second;
-            cpu_execute(cycles_until_80);
-            cycle += cycles_until_80;
-            car->crank_angle = -90.0;
-            target_crank_angle -= degrees_until_90 + 180.0;
-        }
-        else {
-            cpu_execute(advance_period_cycles);
-            car->crank_angle = target_crank_angle;
-            break;
-        }
+    bool done = false;
+    while (!done) {
+        cpu_run_until(car->cpu, get_stop_clk(car));
+        done = handle_due_events(car);
     }
+
+    update_crank_angle(car);
 }
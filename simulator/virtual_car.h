@@ -1,21 +1,109 @@
 #pragma once
 
+#include "cpu.h"
+#include "event_queue.h"
+#include "graph.h"
+#include "journal.h"
+#include "trace.h"
+#include "vcd.h"
+
+
 typedef struct {
     // Input to the physics sim
     double throttle_pos;
 
-    // Outputs from the physics sim
+    // Outputs from the physics sim. When replaying, the physics sim doesn't
+    // run, and only engine_rpm is set, from the times of the sparks in the
+    // journal.
     double engine_rpm;
     double crank_angle;         // In degrees after TDC. Range is -90 to 90. Gets reset for every cylinder firing.
+                                // Derived from the crank events. Only updated at the end of vc_advance().
     double turbo_rpm;
     double manifold_pressure;   // In bar
     double engine_power;        // In BHP
 
     double advance_period_residual; // In seconds
+    double advance_cycles_residual; // Fraction of a CPU cycle not yet run
+
+    // Crank angle events, in master_clk order
+    event_queue_t events;
+    unsigned end_clk;               // The CPU has been asked to run up to here
+    unsigned last_crank_event_clk;  // When the most recent crank event was due
+    double last_crank_angle;        // The angle of that event
+
+    // The KLR connected to this car, and the state of the signals between them
+    cpu_t *cpu;
+    bool t1;
+    unsigned adc_latched_address;
+    unsigned adc_latch_cycle;
+    unsigned num_early_adc_reads;   // Reads of the ADC before its conversion was done
+    unsigned num_ext_mem_writes;    // movx writes. Nothing on the KLR's bus takes them.
+    u8 adc_inputs[8];               // What the ADC converts each input to. From the physics sim or a replay.
+
+    // The graph module is global, so only one car at a time should record to
+    // it. Defaults to false. Only g_virtual_car turns it on.
+    bool record_graphs;
+
+    vcd_t *vcd;                 // NULL unless writing a waveform file. See vc_start_vcd().
+    trace_writer_t *trace;      // NULL unless writing a binary trace. Owned by the caller.
+
+    // Recording and replaying of the KLR's inputs
+    journal_t *journal;                 // NULL unless recording. See vc_start_recording().
+    double journaled_throttle_pos;
+    journal_t const *replay;            // NULL unless replaying. See vc_start_replay().
+    unsigned replay_pos;                // Index of the next entry to replay
 } VirtualCar;
 
+// The KLR's signals in the waveform file, in the order they are declared in it
+enum {
+    VCD_P1,
+    VCD_P2,
+    VCD_T0,
+    VCD_T1,
+    VCD_IRQ,
+    VCD_RESET,
+    VCD_ADC_ALE,        // Port 1 bit 3. Rising edge latches adc_mux.
+    VCD_ADC_MUX,        // The ADC input selected
+    VCD_ADC_DATA,       // The last value the KLR read from the ADC
+    NUM_VCD_VARS
+};
+
+// A saved copy of a car, the state of its KLR and, if the car records graphs,
+// the graphs.
+typedef struct {
+    VirtualCar car;             // car.cpu is ignored by vc_restore()
+    cpu_snapshot_t cpu;
+    graph_snapshot_t graphs;
+} vc_snapshot_t;
+
+// The car that the front-end displays. Other instances can be created for
+// running in parallel.
 extern VirtualCar g_virtual_car;
 
-void vc_init();
-void vc_draw_state(int _x, int _y);
-void vc_advance(double advance_period_in_seconds);
+// Creates the car's KLR CPU instance. The caller loads the ROM into car->cpu.
+void vc_init(VirtualCar *car);
+void vc_destroy(VirtualCar *car);
+void vc_advance(VirtualCar *car, double advance_period_in_seconds);
+
+// Declares the KLR's signals in vcd, which must be freshly initialised, writes
+// their current values, and then records every change to them. vcd must
+// outlive the car, or the car's vcd must be set back to NULL first.
+void vc_start_vcd(VirtualCar *car, vcd_t *vcd);
+
+// Records every input to the KLR in journal from now on, starting with the
+// current throttle position and ADC inputs. journal is owned by the caller.
+void vc_start_recording(VirtualCar *car, journal_t *journal);
+
+// Feeds the KLR the inputs from journal, at the master_clk they were recorded
+// at, instead of running the physics sim. The car must not have been advanced
+// since it was initialised, and its KLR must be in the state that the
+// recording started from. Unless the ROM is different, the KLR does exactly
+// what it did when the journal was recorded. journal must outlive the replay.
+void vc_start_replay(VirtualCar *car, journal_t const *journal);
+
+// The snapshot can be restored into the same car, or into any other car whose
+// KLR has the same ROM. Neither allocates memory. The car's vcd, trace and
+// journal are kept, so changes after a restore are written as if time had not
+// gone backwards.
+void vc_snapshot(VirtualCar const *car, vc_snapshot_t *snapshot);
+void vc_restore(VirtualCar *car, vc_snapshot_t const *snapshot);